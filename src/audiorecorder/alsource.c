@@ -0,0 +1,173 @@
+/* alsource.c
+ *
+ * Capture through OpenAL.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <AL/al.h>
+#include <AL/alc.h>
+#include <AL/alext.h>
+
+#include "capturesource.h"
+
+static ALenum get_al_format(int bitdepth, int nchannels);
+static const char *alsource_name(void *ctx);
+static int alsource_start(void *ctx);
+static int alsource_stop(void *ctx);
+static int32_t alsource_available(void *ctx);
+static int alsource_finished(void *ctx);
+static int alsource_read(void *ctx, void *dst, int32_t n);
+static uint64_t alsource_lost(void *ctx);
+static void alsource_close(void *ctx);
+
+int open_alsource(capturesource_t *src,
+    const char *name,
+    int32_t rate,
+    int bitdepth,
+    int channels,
+    int32_t bufframes
+)
+{
+    ALCdevice *dev;
+
+    // check that OpenAL supports the audio recording configuration
+    ALenum al_format = get_al_format(bitdepth, channels);
+    if (al_format == AL_NONE)
+    {
+        fprintf(stderr, "%s: unsupported sample resolution (%d bits) and/or channel count (%d)\n",
+            __func__, bitdepth, channels);
+        return 1;
+    }
+
+    dev = alcCaptureOpenDevice(name, rate, al_format, bufframes);
+    if (!dev)
+    {
+        fprintf(stderr, "%s: failed to open audio capture device '%s'\n", __func__,
+            name ? name : "default");
+        return 1;
+    }
+
+    src->ctx = dev;
+    src->realtime = 1;
+    src->name = alsource_name;
+    src->start = alsource_start;
+    src->stop = alsource_stop;
+    src->available = alsource_available;
+    src->finished = alsource_finished;
+    src->read = alsource_read;
+    src->lost = alsource_lost;
+    src->close = alsource_close;
+
+    return 0;
+}
+
+void list_capture_devices(FILE *fp)
+{
+    // a list of names, each null-terminated, ending with an empty name
+    const ALCchar *name = alcGetString(NULL, ALC_CAPTURE_DEVICE_SPECIFIER);
+
+    while (name && *name)
+    {
+        fprintf(fp, "%s\n", name);
+        name += strlen(name) + 1;
+    }
+}
+
+static const char *alsource_name(void *ctx)
+{
+    return alcGetString((ALCdevice *) ctx, ALC_CAPTURE_DEVICE_SPECIFIER);
+}
+
+static int alsource_start(void *ctx)
+{
+    alcGetError(ctx);
+    alcCaptureStart(ctx);
+    return alcGetError(ctx) != ALC_NO_ERROR;
+}
+
+static int alsource_stop(void *ctx)
+{
+    alcGetError(ctx);
+    alcCaptureStop(ctx);
+    return alcGetError(ctx) != ALC_NO_ERROR;
+}
+
+static int32_t alsource_available(void *ctx)
+{
+    ALCint n = 0;
+
+    alcGetIntegerv(ctx, ALC_CAPTURE_SAMPLES, 1, &n);
+    return n;
+}
+
+/* a device captures until it is stopped */
+static int alsource_finished(void *ctx)
+{
+    return 0;
+}
+
+static int alsource_read(void *ctx, void *dst, int32_t n)
+{
+    // clear the error state before capturing
+    alcGetError(ctx);
+    alcCaptureSamples(ctx, dst, n);
+    return alcGetError(ctx) != ALC_NO_ERROR;
+}
+
+/* OpenAL does not say when its buffer overflowed */
+static uint64_t alsource_lost(void *ctx)
+{
+    return 0;
+}
+
+static void alsource_close(void *ctx)
+{
+    alcCaptureCloseDevice(ctx);
+}
+
+/* returns the appropriate OpenAL enum value for the given recording format.
+ *
+ * parameters
+ *    nchannels: number of channels
+ *    bitdepth: number of bits in each recorded sample
+ */
+static ALenum get_al_format(int bitdepth, int nchannels)
+{
+    /* 8 and 16 bit audio is integer PCM, 32 bit audio is floating point.
+     * The float formats come from the AL_EXT_float32 extension.
+     */
+    if(nchannels == 1)
+    {
+        if(bitdepth == 8)
+        {
+            return AL_FORMAT_MONO8;
+        }
+        else if(bitdepth == 16)
+        {
+            return AL_FORMAT_MONO16;
+        }
+        else if(bitdepth == 32)
+        {
+            return AL_FORMAT_MONO_FLOAT32;
+        }
+    }
+    else if(nchannels == 2)
+    {
+        if(bitdepth == 8)
+        {
+            return AL_FORMAT_STEREO8;
+        }
+        else if(bitdepth == 16)
+        {
+            return AL_FORMAT_STEREO16;
+        }
+        else if(bitdepth == 32)
+        {
+            return AL_FORMAT_STEREO_FLOAT32;
+        }
+    }
+
+    return AL_NONE;
+}
@@ -0,0 +1,83 @@
+/* capturesched.c
+ */
+
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+
+#include "capturesched.h"
+
+#define NSEC_PER_SEC    1000000000L
+#define NSEC_PER_MSEC   1000000L
+
+/* extra time to sleep, so that we wake just after the samples arrive
+ * rather than just before them
+ */
+#define CAPTURESCHED_SLACK_NS   (1 * NSEC_PER_MSEC)
+
+void init_capturesched(capturesched_t *sched, int32_t rate, long report_ms)
+{
+    if (sched)
+    {
+        sched->rate = rate;
+        sched->report_ms = report_ms;
+        sched->reported = 0;
+    }
+}
+
+int capturesched_wait(capturesched_t *sched, int32_t navailable, int32_t nwanted)
+{
+    struct timespec ts;
+    int64_t ns;
+
+    if (!sched || sched->rate <= 0 || navailable >= nwanted)
+    {
+        return 0;
+    }
+
+    // time it will take for the missing samples to be captured
+    ns = (int64_t) (nwanted - navailable) * NSEC_PER_SEC / sched->rate
+        + CAPTURESCHED_SLACK_NS;
+
+    ts.tv_sec = ns / NSEC_PER_SEC;
+    ts.tv_nsec = ns % NSEC_PER_SEC;
+
+    /* a signal (e.g. SIGINT) interrupts the sleep, so that the caller can
+     * stop recording promptly
+     */
+    if (clock_nanosleep(CLOCK_MONOTONIC, 0, &ts, NULL) == EINTR)
+    {
+        return 1;
+    }
+
+    return 0;
+}
+
+int capturesched_report_due(capturesched_t *sched)
+{
+    struct timespec now;
+    int64_t elapsed_ms;
+
+    if (!sched)
+    {
+        return 0;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    if (sched->reported)
+    {
+        elapsed_ms = (int64_t) (now.tv_sec - sched->last_report.tv_sec) * 1000
+            + (now.tv_nsec - sched->last_report.tv_nsec) / NSEC_PER_MSEC;
+
+        if (elapsed_ms < sched->report_ms)
+        {
+            return 0;
+        }
+    }
+
+    sched->last_report = now;
+    sched->reported = 1;
+
+    return 1;
+}
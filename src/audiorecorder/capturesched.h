@@ -0,0 +1,50 @@
+/* capturesched.h
+ */
+
+#ifndef CAPTURESCHED_H
+#define CAPTURESCHED_H
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <time.h>
+
+/* minimum interval between progress reports, in milliseconds */
+#define CAPTURESCHED_REPORT_MS  250
+
+/* Paces the capture loop by the sample rate, so that it sleeps while the
+ * device fills its buffer instead of polling it.
+ */
+typedef struct capturesched
+{
+    int32_t         rate;           // samples captured per second
+
+    long            report_ms;      // minimum interval between reports
+    struct timespec last_report;    // when progress was last reported
+    int             reported;       // set once progress has been reported
+} capturesched_t;
+
+void init_capturesched(capturesched_t *sched, int32_t rate, long report_ms);
+
+/* Sleeps until roughly nwanted samples should be available, given that
+ * navailable samples are available now. Returns immediately if enough
+ * samples are already available.
+ *
+ * returns:
+ *   0: slept for the full duration, or did not need to sleep
+ *   1: woken early by a signal
+ */
+int capturesched_wait(capturesched_t *sched, int32_t navailable, int32_t nwanted);
+
+/* returns 1 if at least report_ms milliseconds have passed since it last
+ * returned 1, and 0 otherwise.
+ */
+int capturesched_report_due(capturesched_t *sched);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
@@ -0,0 +1,25 @@
+/* capturesource.c
+ */
+
+#include <string.h>
+
+#include "capturesource.h"
+#include "stringutils.h"
+
+int open_capturesource(capturesource_t *src,
+    const char *name,
+    int32_t rate,
+    int bitdepth,
+    int channels,
+    int32_t bufframes,
+    int fast
+)
+{
+    if (name && startswith(name, CAPTURESOURCE_SYNTH_PREFIX))
+    {
+        return open_synthsource(src, name + strlen(CAPTURESOURCE_SYNTH_PREFIX),
+            rate, bitdepth, channels, bufframes, !fast);
+    }
+
+    return open_alsource(src, name, rate, bitdepth, channels, bufframes);
+}
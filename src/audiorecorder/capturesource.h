@@ -0,0 +1,114 @@
+/* capturesource.h
+ *
+ * Where the recorder gets its audio from. An OpenAL capture device is used
+ * normally; a synthetic device, which replays a WAV file or generates a
+ * signal, lets the rest of the recorder be run and measured on machines
+ * without any audio hardware.
+ */
+
+#ifndef CAPTURESOURCE_H
+#define CAPTURESOURCE_H
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// device names starting with this are synthetic devices
+#define CAPTURESOURCE_SYNTH_PREFIX  "synth:"
+
+/* A capture device. Samples are read in host byte order, as a whole number
+ * of sample frames at a time.
+ */
+typedef struct capturesource
+{
+    void        *ctx;           // passed to each function below
+
+    /* whether samples arrive at the sample rate whether they are read or
+     * not, so that a slow reader loses some. Otherwise samples are produced
+     * only as fast as they are read.
+     */
+    int         realtime;
+
+    // returns a name to show for the device
+    const char *(*name)(void *ctx);
+
+    // start and stop producing samples. return 0 on success, 1 otherwise
+    int         (*start)(void *ctx);
+    int         (*stop)(void *ctx);
+
+    // returns the number of sample frames ready to read
+    int32_t     (*available)(void *ctx);
+
+    // returns 1 once the device will produce no more samples than those
+    // available, which may be less than the block size. 0 otherwise.
+    int         (*finished)(void *ctx);
+
+    // reads n sample frames into dst. returns 0 on success, 1 otherwise
+    int         (*read)(void *ctx, void *dst, int32_t n);
+
+    // returns the number of sample frames lost for not being read in time
+    uint64_t    (*lost)(void *ctx);
+
+    void        (*close)(void *ctx);
+} capturesource_t;
+
+/* Opens a capture device by name: an OpenAL device, the default OpenAL
+ * device if name is NULL, or a synthetic device if name starts with
+ * CAPTURESOURCE_SYNTH_PREFIX.
+ *
+ * parameters:
+ *   bufframes: sample frames the device should be able to hold while
+ *              waiting to be read
+ *   fast:    if set, a synthetic device produces samples as fast as they
+ *            are read, rather than in real time
+ *
+ * returns 0 on success, 1 otherwise
+ */
+int open_capturesource(capturesource_t *src,
+    const char *name,
+    int32_t rate,
+    int bitdepth,
+    int channels,
+    int32_t bufframes,
+    int fast
+);
+
+/* opens an OpenAL capture device, or the default device if name is NULL */
+int open_alsource(capturesource_t *src,
+    const char *name,
+    int32_t rate,
+    int bitdepth,
+    int channels,
+    int32_t bufframes
+);
+
+/* Opens a synthetic capture device. spec is one of:
+ *   sine[:HZ]  a sine wave at half of full scale (default: 440 Hz)
+ *   noise      white noise at half of full scale
+ *   silence    nothing but zeroes
+ *   FILE       the samples of a WAV file, which must be in the same format
+ *              as the recording. The device runs out at the end of the file.
+ *
+ * returns 0 on success, 1 otherwise
+ */
+int open_synthsource(capturesource_t *src,
+    const char *spec,
+    int32_t rate,
+    int bitdepth,
+    int channels,
+    int32_t bufframes,
+    int realtime
+);
+
+/* prints the name of each OpenAL capture device, one per line */
+void list_capture_devices(FILE *fp);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
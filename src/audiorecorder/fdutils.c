@@ -0,0 +1,31 @@
+/* fdutils.c
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "fdutils.h"
+
+int write_all(int fd, const unsigned char *buf, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0)
+    {
+        n = write(fd, buf, len);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            perror(__func__);
+            return 1;
+        }
+        buf += n;
+        len -= n;
+    }
+
+    return 0;
+}
@@ -0,0 +1,24 @@
+/* fdutils.h
+ */
+
+#ifndef FDUTILS_H
+#define FDUTILS_H
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+/* Writes all len bytes of buf to fd, retrying after partial writes and
+ * after writes interrupted by a signal before they wrote anything, such as
+ * the SIGINT that stops a recording while a pipe is full.
+ * returns 0 on success, 1 otherwise
+ */
+int write_all(int fd, const unsigned char *buf, size_t len);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
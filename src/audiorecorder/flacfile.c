@@ -0,0 +1,764 @@
+/* flacfile.c
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include "crc.h"
+#include "flacfile.h"
+#include "fdutils.h"
+
+#define MAX_FIXED_ORDER     4
+#define MAX_PARTITION_ORDER 8       // the most the FLAC subset allows
+#define MAX_RICE4_PARAM     14      // with 4 bit parameters (15 is an escape)
+#define MAX_RICE5_PARAM     30      // with 5 bit parameters (31 is an escape)
+
+// subframe type codes
+#define SUBFRAME_CONSTANT   0x00
+#define SUBFRAME_VERBATIM   0x01
+#define SUBFRAME_FIXED      0x08    // plus the predictor order
+
+// frame header block size codes
+#define BLOCKSIZE_CODE_4096 12
+#define BLOCKSIZE_CODE_16   7       // block size - 1 follows in 16 bits
+
+// the longest frame header: sync to bits per sample, a 6 byte frame
+// number, block size, sample rate and CRC-8
+#define MAX_FRAME_HEADER_LEN 16
+
+/* bits being packed into a buffer, most significant first */
+typedef struct bitwriter
+{
+    unsigned char   *buf;
+    size_t          len;        // whole bytes in buf
+    uint64_t        acc;        // bits not yet in buf, in the low nbits
+    unsigned int    nbits;
+} bitwriter_t;
+
+/* how the prediction errors of a subframe are divided and coded */
+typedef struct rice_config
+{
+    unsigned int    order;      // log2 of the number of partitions
+    unsigned int    param_bits; // width of each Rice parameter (4 or 5)
+    unsigned int    k[1 << MAX_PARTITION_ORDER]; // Rice parameter of each
+} rice_config_t;
+
+static int encode_frame(flacfile_t *ff);
+static void encode_subframe(bitwriter_t *bw, const int32_t *x, size_t n,
+    int bitdepth, int32_t *res);
+static uint64_t choose_rice(const int32_t *res, size_t n, unsigned int order,
+    rice_config_t *rc);
+static void put_residual(bitwriter_t *bw, const int32_t *res, size_t n,
+    unsigned int order, const rice_config_t *rc);
+static void put_bits(bitwriter_t *bw, uint32_t val, unsigned int nbits);
+static void put_unary(bitwriter_t *bw, uint32_t q);
+static void put_utf8(bitwriter_t *bw, uint32_t val);
+static void put_align(bitwriter_t *bw);
+static unsigned int samplerate_code(uint32_t rate, uint32_t *extra,
+    unsigned int *extra_bits);
+static int flacfile_flush(flacfile_t *ff);
+static int header_due(const flacfile_t *ff);
+
+int open_flacfile(flacfile_t *ff,
+    const char *fname,
+    const wavheader_t *hdr,
+    long hdr_interval_ms
+)
+{
+    size_t max_frame;
+
+    if (!ff || !fname || !hdr)
+    {
+        return 1;
+    }
+
+    // FLAC holds integers only, so float recordings stay WAV
+    if (hdr->audioformat != WAVE_FORMAT_PCM ||
+        (hdr->bitdepth != 8 && hdr->bitdepth != 16 && hdr->bitdepth != 24) ||
+        hdr->nchannels < 1 || hdr->nchannels > FLACFILE_MAX_CHANNELS ||
+        hdr->srate <= 0)
+    {
+        return 1;
+    }
+
+    memset(ff, 0, sizeof(*ff));
+    ff->samplerate = hdr->srate;
+    ff->channels = hdr->nchannels;
+    ff->bitdepth = hdr->bitdepth;
+    ff->hdr_interval_ms = hdr_interval_ms;
+
+    // no frame is stored in more bits than it would take verbatim
+    max_frame = MAX_FRAME_HEADER_LEN
+        + ff->channels * (1 + FLACFILE_BLOCKSIZE * ff->bitdepth / 8)
+        + 1 + 2;
+    ff->outsize = FLACFILE_WRITESIZE + max_frame;
+
+    ff->block = malloc(sizeof(*ff->block) * FLACFILE_BLOCKSIZE * ff->channels);
+    ff->residual = malloc(sizeof(*ff->residual) * FLACFILE_BLOCKSIZE);
+    ff->out = malloc(ff->outsize);
+    if (!ff->block || !ff->residual || !ff->out)
+    {
+        goto fail;
+    }
+
+    ff->fd = open(fname, O_WRONLY | O_CREAT | O_TRUNC, 0664);
+    if (ff->fd < 0)
+    {
+        goto fail;
+    }
+
+    // an empty stream of unknown length, until the first update
+    if (flacfile_update_header(ff) != 0 ||
+        lseek(ff->fd, FLACFILE_HEADER_LEN, SEEK_SET) < 0)
+    {
+        close(ff->fd);
+        goto fail;
+    }
+
+    return 0;
+
+fail:
+    free(ff->block);
+    free(ff->residual);
+    free(ff->out);
+    ff->block = ff->residual = NULL;
+    ff->out = NULL;
+    return 1;
+}
+
+int flacfile_write(flacfile_t *ff, const unsigned char *samples, size_t len)
+{
+    size_t bytes_per_sample, blockalign, nframes, n;
+    int32_t *dst;
+
+    if (!ff || (!samples && len > 0))
+    {
+        return 1;
+    }
+
+    bytes_per_sample = ff->bitdepth / 8;
+    blockalign = bytes_per_sample * ff->channels;
+
+    // a partial frame would put every sample after it in the wrong channel
+    if (len % blockalign != 0)
+    {
+        return 1;
+    }
+    nframes = len / blockalign;
+
+    while (nframes > 0)
+    {
+        n = FLACFILE_BLOCKSIZE - ff->blocklen;
+        if (n > nframes)
+        {
+            n = nframes;
+        }
+
+        // split the interleaved channels into the block
+        for (int c = 0; c < ff->channels; c++)
+        {
+            const unsigned char *p = samples + c * bytes_per_sample;
+            dst = ff->block + c * FLACFILE_BLOCKSIZE + ff->blocklen;
+
+            switch (ff->bitdepth)
+            {
+                case 8:
+                    // 8 bit WAV samples are unsigned
+                    for (size_t i = 0; i < n; i++, p += blockalign)
+                    {
+                        dst[i] = p[0] - 128;
+                    }
+                    break;
+                case 16:
+                    for (size_t i = 0; i < n; i++, p += blockalign)
+                    {
+                        dst[i] = (int16_t) (p[0] | p[1] << 8);
+                    }
+                    break;
+                default:
+                    // shift into the top of 32 bits to sign extend
+                    for (size_t i = 0; i < n; i++, p += blockalign)
+                    {
+                        dst[i] = (int32_t) ((uint32_t) p[0] << 8
+                            | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 24) >> 8;
+                    }
+                    break;
+            }
+        }
+
+        ff->blocklen += n;
+        samples += n * blockalign;
+        nframes -= n;
+
+        if (ff->blocklen == FLACFILE_BLOCKSIZE && encode_frame(ff) != 0)
+        {
+            return 1;
+        }
+    }
+
+    /* at low data rates the encoded frames can take many seconds to fill a
+     * write, so once the header is due, those there are go out with it. The
+     * block being gathered waits, as only the last frame may be short.
+     */
+    if (ff->outlen > 0 && header_due(ff) && flacfile_flush(ff) != 0)
+    {
+        return 1;
+    }
+
+    return 0;
+}
+
+int flacfile_update_header(flacfile_t *ff)
+{
+    unsigned char buf[FLACFILE_HEADER_LEN] = { 'f', 'L', 'a', 'C' };
+    unsigned char *p = buf + 4;
+    uint64_t packed;
+
+    if (!ff)
+    {
+        return 1;
+    }
+
+    // the only metadata block: STREAMINFO, 34 bytes long
+    *p++ = 0x80;
+    *p++ = 0;
+    *p++ = 0;
+    *p++ = 34;
+
+    *p++ = FLACFILE_BLOCKSIZE >> 8;
+    *p++ = FLACFILE_BLOCKSIZE & 0xff;
+    *p++ = FLACFILE_BLOCKSIZE >> 8;
+    *p++ = FLACFILE_BLOCKSIZE & 0xff;
+
+    for (int i = 16; i >= 0; i -= 8)
+    {
+        *p++ = ff->min_framesize >> i;
+    }
+    for (int i = 16; i >= 0; i -= 8)
+    {
+        *p++ = ff->max_framesize >> i;
+    }
+
+    /* sample rate, channels and bits per sample, then the total number of
+     * sample frames on disk (0 meaning unknown)
+     */
+    packed = (uint64_t) ff->samplerate << 44
+        | (uint64_t) (ff->channels - 1) << 41
+        | (uint64_t) (ff->bitdepth - 1) << 36
+        | (ff->written & 0xfffffffffULL);
+    for (int i = 56; i >= 0; i -= 8)
+    {
+        *p++ = packed >> i;
+    }
+
+    // the MD5 signature is left as zero, which means it was not computed
+
+    if (pwrite(ff->fd, buf, sizeof(buf), 0) != sizeof(buf))
+    {
+        return 1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &ff->last_hdr);
+
+    return 0;
+}
+
+int close_flacfile(flacfile_t *ff)
+{
+    int ret = 0;
+
+    if (!ff)
+    {
+        return 1;
+    }
+
+    if (ff->blocklen > 0 && encode_frame(ff) != 0)
+    {
+        ret = 1;
+    }
+
+    if (ff->outlen > 0 && flacfile_flush(ff) != 0)
+    {
+        ret = 1;
+    }
+
+    if (flacfile_update_header(ff) != 0)
+    {
+        ret = 1;
+    }
+
+    if (close(ff->fd) != 0)
+    {
+        ret = 1;
+    }
+
+    free(ff->block);
+    free(ff->residual);
+    free(ff->out);
+    ff->block = ff->residual = NULL;
+    ff->out = NULL;
+
+    return ret;
+}
+
+/* encodes the samples in the block as one FLAC frame, and writes the
+ * encoded frames to disk once enough have gathered.
+ */
+static int encode_frame(flacfile_t *ff)
+{
+    bitwriter_t bw = { ff->out + ff->outlen, 0, 0, 0 };
+    const size_t n = ff->blocklen;
+    uint32_t rate_extra;
+    unsigned int rate_bits, bps_code;
+
+    // sync code, for a stream of fixed size blocks
+    put_bits(&bw, 0xfff8, 16);
+
+    put_bits(&bw, n == FLACFILE_BLOCKSIZE ? BLOCKSIZE_CODE_4096 : BLOCKSIZE_CODE_16, 4);
+    put_bits(&bw, samplerate_code(ff->samplerate, &rate_extra, &rate_bits), 4);
+    put_bits(&bw, ff->channels - 1, 4);     // independent channels
+
+    bps_code = ff->bitdepth == 8 ? 1 : ff->bitdepth == 16 ? 4 : 6;
+    put_bits(&bw, bps_code, 3);
+    put_bits(&bw, 0, 1);
+
+    put_utf8(&bw, ff->frameno);
+    if (n != FLACFILE_BLOCKSIZE)
+    {
+        put_bits(&bw, n - 1, 16);
+    }
+    put_bits(&bw, rate_extra, rate_bits);
+
+    put_bits(&bw, crc8(0, bw.buf, bw.len), 8);
+
+    for (int c = 0; c < ff->channels; c++)
+    {
+        encode_subframe(&bw, ff->block + c * FLACFILE_BLOCKSIZE, n,
+            ff->bitdepth, ff->residual);
+    }
+
+    put_align(&bw);
+    put_bits(&bw, crc16(0, bw.buf, bw.len), 16);
+
+    if (ff->min_framesize == 0 || bw.len < ff->min_framesize)
+    {
+        ff->min_framesize = bw.len;
+    }
+    if (bw.len > ff->max_framesize)
+    {
+        ff->max_framesize = bw.len;
+    }
+
+    ff->outlen += bw.len;
+    ff->nframes += n;
+    ff->frameno++;
+    ff->blocklen = 0;
+
+    if (ff->outlen >= FLACFILE_WRITESIZE)
+    {
+        return flacfile_flush(ff);
+    }
+
+    return 0;
+}
+
+/* writes one channel of a frame as whichever of a constant, fixed predictor
+ * or verbatim subframe is smallest.
+ */
+static void encode_subframe(bitwriter_t *bw, const int32_t *x, size_t n,
+    int bitdepth, int32_t *res)
+{
+    uint64_t err[MAX_FIXED_ORDER + 1] = { 0 };
+    uint64_t bits, best_bits;
+    unsigned int order = 0;
+    rice_config_t rc;
+    size_t i;
+    int32_t e0, e1, e2, e3, e4;
+
+    for (i = 1; i < n && x[i] == x[0]; i++);
+    if (i == n)
+    {
+        put_bits(bw, SUBFRAME_CONSTANT << 1, 8);
+        put_bits(bw, x[0], bitdepth);
+        return;
+    }
+
+    best_bits = (uint64_t) n * bitdepth;
+
+    if (n > MAX_FIXED_ORDER)
+    {
+        // the error of every predictor order, summed over the block
+        for (i = MAX_FIXED_ORDER; i < n; i++)
+        {
+            e0 = x[i];
+            e1 = e0 - x[i - 1];
+            e2 = e1 - (x[i - 1] - x[i - 2]);
+            e3 = e2 - (x[i - 1] - 2 * x[i - 2] + x[i - 3]);
+            e4 = e3 - (x[i - 1] - 3 * x[i - 2] + 3 * x[i - 3] - x[i - 4]);
+
+            err[0] += e0 < 0 ? -(int64_t) e0 : e0;
+            err[1] += e1 < 0 ? -(int64_t) e1 : e1;
+            err[2] += e2 < 0 ? -(int64_t) e2 : e2;
+            err[3] += e3 < 0 ? -(int64_t) e3 : e3;
+            err[4] += e4 < 0 ? -(int64_t) e4 : e4;
+        }
+
+        for (unsigned int o = 1; o <= MAX_FIXED_ORDER; o++)
+        {
+            if (err[o] < err[order])
+            {
+                order = o;
+            }
+        }
+
+        for (i = order; i < n; i++)
+        {
+            switch (order)
+            {
+                case 0:
+                    res[i] = x[i];
+                    break;
+                case 1:
+                    res[i] = x[i] - x[i - 1];
+                    break;
+                case 2:
+                    res[i] = x[i] - 2 * x[i - 1] + x[i - 2];
+                    break;
+                case 3:
+                    res[i] = x[i] - 3 * x[i - 1] + 3 * x[i - 2] - x[i - 3];
+                    break;
+                default:
+                    res[i] = x[i] - 4 * x[i - 1] + 6 * x[i - 2] - 4 * x[i - 3] + x[i - 4];
+                    break;
+            }
+        }
+
+        bits = (uint64_t) order * bitdepth + choose_rice(res, n, order, &rc);
+
+        if (bits < best_bits)
+        {
+            put_bits(bw, (SUBFRAME_FIXED + order) << 1, 8);
+            for (i = 0; i < order; i++)
+            {
+                put_bits(bw, x[i], bitdepth);
+            }
+            put_residual(bw, res, n, order, &rc);
+            return;
+        }
+    }
+
+    put_bits(bw, SUBFRAME_VERBATIM << 1, 8);
+    for (i = 0; i < n; i++)
+    {
+        put_bits(bw, x[i], bitdepth);
+    }
+}
+
+/* maps a prediction error to an unsigned value: 0, -1, 1, -2, 2... */
+static inline uint32_t fold(int32_t r)
+{
+    return r < 0 ? ((uint32_t) -(r + 1) << 1) | 1 : (uint32_t) r << 1;
+}
+
+/* the Rice parameter that about suits values with the given sum */
+static unsigned int rice_param(uint64_t sum, uint64_t count, unsigned int max)
+{
+    unsigned int k = 0;
+
+    while (k < max && count << (k + 1) <= sum)
+    {
+        k++;
+    }
+
+    return k;
+}
+
+/* Picks the number of partitions and their Rice parameters for the
+ * prediction errors res[order] to res[n - 1].
+ * returns the exact number of bits the coded errors take
+ */
+static uint64_t choose_rice(const int32_t *res, size_t n, unsigned int order,
+    rice_config_t *rc)
+{
+    uint64_t sums[1 << MAX_PARTITION_ORDER];
+    uint64_t bits, best_bits = UINT64_MAX, count;
+    unsigned int max_order = MAX_PARTITION_ORDER;
+    unsigned int k, param_bits, nparts;
+    size_t start, end;
+
+    rc->order = 0;
+
+    // partitions must divide the block evenly, and the first must hold
+    // more than the warm up samples
+    while (max_order > 0 &&
+        ((n & ((1u << max_order) - 1)) != 0 || (n >> max_order) <= order))
+    {
+        max_order--;
+    }
+
+    nparts = 1u << max_order;
+    for (unsigned int j = 0; j < nparts; j++)
+    {
+        start = j == 0 ? order : j * (n >> max_order);
+        end = (j + 1) * (n >> max_order);
+        sums[j] = 0;
+        for (size_t i = start; i < end; i++)
+        {
+            sums[j] += fold(res[i]);
+        }
+    }
+
+    // estimate each partition order, merging pairs of partitions each time
+    for (int p = max_order; p >= 0; p--)
+    {
+        nparts = 1u << p;
+        bits = 0;
+        param_bits = 4;
+
+        for (unsigned int j = 0; j < nparts; j++)
+        {
+            count = (n >> p) - (j == 0 ? order : 0);
+            k = rice_param(sums[j], count, MAX_RICE5_PARAM);
+            if (k > MAX_RICE4_PARAM)
+            {
+                param_bits = 5;
+            }
+            bits += count * (k + 1) + (sums[j] >> k);
+        }
+        bits += nparts * param_bits;
+
+        if (bits < best_bits)
+        {
+            best_bits = bits;
+            rc->order = p;
+        }
+
+        for (unsigned int j = 0; j < nparts / 2; j++)
+        {
+            sums[j] = sums[2 * j] + sums[2 * j + 1];
+        }
+    }
+
+    // work out the parameters of the chosen order, and its exact size
+    nparts = 1u << rc->order;
+    rc->param_bits = 4;
+    bits = 2 + 4;
+
+    for (unsigned int j = 0; j < nparts; j++)
+    {
+        start = j == 0 ? order : j * (n >> rc->order);
+        end = (j + 1) * (n >> rc->order);
+
+        count = 0;
+        for (size_t i = start; i < end; i++)
+        {
+            count += fold(res[i]);
+        }
+
+        k = rice_param(count, end - start, MAX_RICE5_PARAM);
+        if (k > MAX_RICE4_PARAM)
+        {
+            rc->param_bits = 5;
+        }
+        rc->k[j] = k;
+
+        bits += (end - start) * (k + 1);
+        for (size_t i = start; i < end; i++)
+        {
+            bits += fold(res[i]) >> k;
+        }
+    }
+
+    return bits + nparts * rc->param_bits;
+}
+
+static void put_residual(bitwriter_t *bw, const int32_t *res, size_t n,
+    unsigned int order, const rice_config_t *rc)
+{
+    const unsigned int nparts = 1u << rc->order;
+    unsigned int k;
+    size_t start, end;
+    uint32_t u, q;
+
+    // coding method 0 has 4 bit Rice parameters, method 1 has 5
+    put_bits(bw, rc->param_bits == 5, 2);
+    put_bits(bw, rc->order, 4);
+
+    for (unsigned int j = 0; j < nparts; j++)
+    {
+        start = j == 0 ? order : j * (n >> rc->order);
+        end = (j + 1) * (n >> rc->order);
+        k = rc->k[j];
+
+        put_bits(bw, k, rc->param_bits);
+
+        for (size_t i = start; i < end; i++)
+        {
+            u = fold(res[i]);
+            q = u >> k;
+
+            // the quotient in unary, ended by a 1, then the low k bits
+            if (q + 1 + k <= 32)
+            {
+                put_bits(bw, (1u << k) | (u & ((1u << k) - 1)), q + 1 + k);
+            }
+            else
+            {
+                put_unary(bw, q);
+                put_bits(bw, u, k);
+            }
+        }
+    }
+}
+
+/* appends the low nbits (up to 32) of val */
+static void put_bits(bitwriter_t *bw, uint32_t val, unsigned int nbits)
+{
+    if (nbits == 0)
+    {
+        return;
+    }
+
+    bw->acc = bw->acc << nbits | (val & (0xffffffffu >> (32 - nbits)));
+    bw->nbits += nbits;
+
+    while (bw->nbits >= 8)
+    {
+        bw->nbits -= 8;
+        bw->buf[bw->len++] = bw->acc >> bw->nbits;
+    }
+}
+
+/* appends q zero bits, then a one */
+static void put_unary(bitwriter_t *bw, uint32_t q)
+{
+    while (q >= 32)
+    {
+        put_bits(bw, 0, 32);
+        q -= 32;
+    }
+    put_bits(bw, 1, q + 1);
+}
+
+/* appends a frame number in the UTF-8 style coding FLAC uses */
+static void put_utf8(bitwriter_t *bw, uint32_t val)
+{
+    unsigned int len = 2;
+
+    if (val < 0x80)
+    {
+        put_bits(bw, val, 8);
+        return;
+    }
+
+    // each byte after the first carries 6 bits
+    while (len < 6 && val >= 1u << (5 * len + 1))
+    {
+        len++;
+    }
+
+    put_bits(bw, (0xff00 >> len & 0xff) | val >> (6 * (len - 1)), 8);
+    for (int i = len - 2; i >= 0; i--)
+    {
+        put_bits(bw, 0x80 | (val >> (6 * i) & 0x3f), 8);
+    }
+}
+
+/* pads with zero bits to the next byte boundary */
+static void put_align(bitwriter_t *bw)
+{
+    if (bw->nbits > 0)
+    {
+        put_bits(bw, 0, 8 - bw->nbits);
+    }
+}
+
+/* returns the frame header code for a sample rate, and any value that has
+ * to follow the header to give it
+ */
+static unsigned int samplerate_code(uint32_t rate, uint32_t *extra,
+    unsigned int *extra_bits)
+{
+    static const uint32_t rates[] = {
+        0, 88200, 176400, 192000, 8000, 16000, 22050, 24000,
+        32000, 44100, 48000, 96000
+    };
+
+    *extra = 0;
+    *extra_bits = 0;
+
+    for (unsigned int i = 1; i < sizeof(rates) / sizeof(*rates); i++)
+    {
+        if (rates[i] == rate)
+        {
+            return i;
+        }
+    }
+
+    if (rate % 1000 == 0 && rate / 1000 <= 0xff)
+    {
+        *extra = rate / 1000;
+        *extra_bits = 8;
+        return 12;
+    }
+
+    if (rate <= 0xffff)
+    {
+        *extra = rate;
+        *extra_bits = 16;
+        return 13;
+    }
+
+    if (rate % 10 == 0 && rate / 10 <= 0xffff)
+    {
+        *extra = rate / 10;
+        *extra_bits = 16;
+        return 14;
+    }
+
+    // only in STREAMINFO
+    return 0;
+}
+
+/* writes the encoded frames to disk, and updates the header if it is due */
+static int flacfile_flush(flacfile_t *ff)
+{
+    if (write_all(ff->fd, ff->out, ff->outlen) != 0)
+    {
+        return 1;
+    }
+
+    ff->datalen += ff->outlen;
+    ff->outlen = 0;
+    ff->written = ff->nframes;
+
+    if (header_due(ff))
+    {
+        return flacfile_update_header(ff);
+    }
+
+    return 0;
+}
+
+/* returns whether the header was last written hdr_interval_ms or more ago */
+static int header_due(const flacfile_t *ff)
+{
+    struct timespec now;
+    long elapsed_ms;
+
+    if (ff->hdr_interval_ms <= 0)
+    {
+        return 0;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    elapsed_ms = (now.tv_sec - ff->last_hdr.tv_sec) * 1000
+        + (now.tv_nsec - ff->last_hdr.tv_nsec) / 1000000;
+
+    return elapsed_ms >= ff->hdr_interval_ms;
+}
@@ -0,0 +1,98 @@
+/* flacfile.h
+ *
+ * FLAC encoder for recordings. Each block of audio is predicted with
+ * whichever of the fixed polynomial predictors (orders 0 to 4) fits it
+ * best, and the prediction error is stored with partitioned Rice codes.
+ * Blocks that would not shrink are stored verbatim.
+ */
+
+#ifndef FLACFILE_H
+#define FLACFILE_H
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "wav.h"
+
+#define FLACFILE_BLOCKSIZE      4096            // sample frames per FLAC frame
+#define FLACFILE_WRITESIZE      (256 * 1024)    // bytes per write to disk
+#define FLACFILE_MAX_CHANNELS   8
+
+// "fLaC", then the STREAMINFO metadata block
+#define FLACFILE_HEADER_LEN     (4 + 4 + 34)
+
+/* A FLAC file being written. Samples are gathered into blocks, encoded as
+ * each block fills, and written to disk in large pieces. The STREAMINFO
+ * header is rewritten in place periodically, along with the frames encoded
+ * since the last piece, so the file stays readable even if the program dies.
+ */
+typedef struct flacfile
+{
+    int             fd;             // destination file descriptor
+
+    uint32_t        samplerate;
+    int             channels;
+    int             bitdepth;       // 8, 16 or 24
+
+    int32_t         *block;         // samples of each channel in turn
+    size_t          blocklen;       // sample frames in block
+    int32_t         *residual;      // scratch space for prediction errors
+
+    unsigned char   *out;           // encoded frames not yet written to disk
+    size_t          outlen;         // number of bytes in out
+    size_t          outsize;        // bytes out can hold
+
+    uint64_t        nframes;        // sample frames encoded
+    uint32_t        frameno;        // number of the next FLAC frame
+    uint32_t        min_framesize;  // smallest FLAC frame so far, in bytes
+    uint32_t        max_framesize;  // largest FLAC frame so far, in bytes
+    uint64_t        written;        // sample frames written to disk
+    uint64_t        datalen;        // bytes of frames written to disk
+
+    long            hdr_interval_ms; // time between header updates, 0 for none
+    struct timespec last_hdr;       // when the header was last written
+} flacfile_t;
+
+/* Creates the file at fname and writes a header for an empty recording.
+ *
+ * parameters:
+ *   hdr:             header describing the audio format, which must be
+ *                    integer PCM of 8, 16 or 24 bits
+ *   hdr_interval_ms: how often to update the header with the amount of
+ *                    audio written so far. 0 to only do so when closing.
+ *
+ * returns 0 on success, 1 otherwise
+ */
+int open_flacfile(flacfile_t *ff,
+    const char *fname,
+    const wavheader_t *hdr,
+    long hdr_interval_ms
+);
+
+/* Appends len bytes of little-endian samples, as they would be stored in a
+ * WAV file, to the file. len must be a whole number of sample frames.
+ * returns 0 on success, 1 otherwise, writing nothing if len is not
+ */
+int flacfile_write(flacfile_t *ff, const unsigned char *samples, size_t len);
+
+/* Writes the header, with the totals of the frames written to disk so far.
+ * returns 0 on success, 1 otherwise
+ */
+int flacfile_update_header(flacfile_t *ff);
+
+/* Encodes and writes any remaining samples and the final header, then
+ * closes the file.
+ * returns 0 on success, 1 otherwise
+ */
+int close_flacfile(flacfile_t *ff);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
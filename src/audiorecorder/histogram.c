@@ -0,0 +1,162 @@
+/* histogram.c
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "histogram.h"
+
+/* the bucket which holds value: the power of two below it, then the next
+ * HISTOGRAM_SUBBITS bits of it
+ */
+static int bucket_of(uint64_t value)
+{
+    int top = 0;
+
+    if (value < HISTOGRAM_SUB)
+    {
+        return (int) value;
+    }
+
+    while (value >> top >> 1)
+    {
+        top++;
+    }
+
+    return HISTOGRAM_SUB * (top - HISTOGRAM_SUBBITS + 1)
+        + (int) ((value >> (top - HISTOGRAM_SUBBITS)) & (HISTOGRAM_SUB - 1));
+}
+
+/* the largest value which bucket b holds */
+static uint64_t bucket_max(int b)
+{
+    int shift;
+
+    if (b < HISTOGRAM_SUB)
+    {
+        return b;
+    }
+
+    shift = b / HISTOGRAM_SUB - 1;
+    return ((uint64_t) (HISTOGRAM_SUB + b % HISTOGRAM_SUB) << shift)
+        + (((uint64_t) 1 << shift) - 1);
+}
+
+void init_histogram(histogram_t *h)
+{
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        atomic_init(&h->counts[i], 0);
+    }
+
+    atomic_init(&h->count, 0);
+    atomic_init(&h->sum, 0);
+    atomic_init(&h->max, 0);
+}
+
+void histogram_add(histogram_t *h, uint64_t value)
+{
+    // the only writer, so a load and a store are enough, and cheaper than
+    // a read-modify-write
+    _Atomic uint64_t *c = &h->counts[bucket_of(value)];
+
+    atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + 1,
+        memory_order_relaxed);
+    atomic_store_explicit(&h->sum,
+        atomic_load_explicit(&h->sum, memory_order_relaxed) + value,
+        memory_order_relaxed);
+    if (value > atomic_load_explicit(&h->max, memory_order_relaxed))
+    {
+        atomic_store_explicit(&h->max, value, memory_order_relaxed);
+    }
+    atomic_store_explicit(&h->count,
+        atomic_load_explicit(&h->count, memory_order_relaxed) + 1,
+        memory_order_relaxed);
+}
+
+uint64_t histogram_percentile(histogram_t *h, double p)
+{
+    uint64_t counts[HISTOGRAM_BUCKETS];
+    uint64_t total = 0, seen = 0, rank, max;
+    int b;
+
+    // take a copy, so the total matches the buckets while values are added
+    for (b = 0; b < HISTOGRAM_BUCKETS; b++)
+    {
+        counts[b] = atomic_load_explicit(&h->counts[b], memory_order_relaxed);
+        total += counts[b];
+    }
+
+    if (total == 0)
+    {
+        return 0;
+    }
+
+    if (p < 0)
+    {
+        p = 0;
+    }
+    else if (p > 1)
+    {
+        p = 1;
+    }
+
+    rank = (uint64_t) (p * total + 0.5);
+    if (rank < 1)
+    {
+        rank = 1;
+    }
+
+    for (b = 0; b < HISTOGRAM_BUCKETS - 1; b++)
+    {
+        seen += counts[b];
+        if (seen >= rank)
+        {
+            break;
+        }
+    }
+
+    max = atomic_load_explicit(&h->max, memory_order_relaxed);
+    return bucket_max(b) < max ? bucket_max(b) : max;
+}
+
+double histogram_mean(histogram_t *h)
+{
+    uint64_t count = atomic_load_explicit(&h->count, memory_order_relaxed);
+
+    if (count == 0)
+    {
+        return 0;
+    }
+
+    return (double) atomic_load_explicit(&h->sum, memory_order_relaxed) / count;
+}
+
+void histogram_print_json(FILE *fp, histogram_t *h, double scale)
+{
+    uint64_t n;
+    int first = 1;
+
+    fprintf(fp, "{\"count\": %llu, \"mean\": %.3f, \"p50\": %.3f, \"p90\": %.3f, "
+        "\"p99\": %.3f, \"max\": %.3f, \"buckets\": [",
+        (unsigned long long) atomic_load_explicit(&h->count, memory_order_relaxed),
+        histogram_mean(h) / scale,
+        histogram_percentile(h, 0.5) / scale,
+        histogram_percentile(h, 0.9) / scale,
+        histogram_percentile(h, 0.99) / scale,
+        atomic_load_explicit(&h->max, memory_order_relaxed) / scale);
+
+    for (int b = 0; b < HISTOGRAM_BUCKETS; b++)
+    {
+        n = atomic_load_explicit(&h->counts[b], memory_order_relaxed);
+        if (n > 0)
+        {
+            fprintf(fp, "%s[%.3f, %llu]", first ? "" : ", ",
+                bucket_max(b) / scale, (unsigned long long) n);
+            first = 0;
+        }
+    }
+
+    fprintf(fp, "]}");
+}
@@ -0,0 +1,56 @@
+/* histogram.h
+ */
+
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#define HISTOGRAM_SUBBITS   3   // each power of two is split into 2^3 buckets
+#define HISTOGRAM_SUB       (1 << HISTOGRAM_SUBBITS)
+#define HISTOGRAM_BUCKETS   (HISTOGRAM_SUB * (64 - HISTOGRAM_SUBBITS + 1))
+
+/* Counts of values in buckets which are no wider than an eighth of the
+ * values they hold, so any value is known to within 12.5% however large it
+ * is. Values below 8 have a bucket each. One thread may add values while
+ * others read the counts, so percentiles can be reported as it fills.
+ */
+typedef struct histogram
+{
+    _Atomic uint64_t counts[HISTOGRAM_BUCKETS];
+    _Atomic uint64_t count;     // number of values added
+    _Atomic uint64_t sum;       // sum of the values added
+    _Atomic uint64_t max;       // largest value added
+} histogram_t;
+
+void init_histogram(histogram_t *h);
+
+/* adds a value; only one thread may add to a histogram */
+void histogram_add(histogram_t *h, uint64_t value);
+
+/* Returns the upper bound of the bucket holding the value below which the
+ * fraction p (0 to 1) of the values added fall, no more than the maximum.
+ * Returns 0 if nothing was added.
+ */
+uint64_t histogram_percentile(histogram_t *h, double p);
+
+/* returns the mean of the values added, or 0 if nothing was added */
+double histogram_mean(histogram_t *h);
+
+/* Writes the histogram as a JSON object, dividing values by scale:
+ * count, mean, p50, p90, p99, max, and the non-empty buckets as pairs
+ * of [upper bound, count].
+ */
+void histogram_print_json(FILE *fp, histogram_t *h, double scale);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
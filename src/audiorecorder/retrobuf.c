@@ -0,0 +1,138 @@
+/* retrobuf.c
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "retrobuf.h"
+
+int init_retrobuf(retrobuf_t *rb, size_t size)
+{
+    if (!rb || size == 0)
+    {
+        return 1;
+    }
+
+    rb->data = malloc(size);
+    if (!rb->data)
+    {
+        return 1;
+    }
+
+    // fault every page in now, rather than while capturing
+    memset(rb->data, 0, size);
+
+    rb->size = size;
+    rb->head = 0;
+    rb->len = 0;
+    rb->saving = 0;
+    rb->save_off = 0;
+    rb->save_left = 0;
+
+    return 0;
+}
+
+void free_retrobuf(retrobuf_t *rb)
+{
+    if (rb != NULL)
+    {
+        free(rb->data);
+        rb->data = NULL;
+    }
+}
+
+void retrobuf_push(retrobuf_t *rb, const unsigned char *samples, size_t len)
+{
+    size_t ahead, n;
+
+    // only the end of a block larger than the whole buffer matters
+    if (len > rb->size)
+    {
+        samples += len - rb->size;
+        len = rb->size;
+    }
+
+    /* anything of a save that is about to be overwritten is lost to it.
+     * The save starts ahead bytes on from the head.
+     */
+    if (rb->saving)
+    {
+        ahead = (rb->save_off + rb->size - rb->head) % rb->size;
+        if (len > ahead)
+        {
+            n = len - ahead < rb->save_left ? len - ahead : rb->save_left;
+            rb->save_off = (rb->save_off + n) % rb->size;
+            rb->save_left -= n;
+        }
+    }
+
+    while (len > 0)
+    {
+        n = rb->size - rb->head;
+        if (n > len)
+        {
+            n = len;
+        }
+
+        memcpy(rb->data + rb->head, samples, n);
+        rb->head = (rb->head + n) % rb->size;
+        samples += n;
+        len -= n;
+
+        rb->len += n;
+        if (rb->len > rb->size)
+        {
+            rb->len = rb->size;
+        }
+    }
+}
+
+void retrobuf_save_start(retrobuf_t *rb)
+{
+    // the oldest byte is len behind the head
+    rb->save_off = (rb->head + rb->size - rb->len) % rb->size;
+    rb->save_left = rb->len;
+    rb->saving = 1;
+}
+
+int retrobuf_save_step(retrobuf_t *rb,
+    size_t max,
+    int (*write)(void *ctx, unsigned char *samples, size_t len),
+    void *ctx
+)
+{
+    size_t n;
+    int ret;
+
+    while (rb->saving && rb->save_left > 0 && max > 0)
+    {
+        // up to the end of the buffer, then from its start
+        n = rb->size - rb->save_off;
+        if (n > rb->save_left)
+        {
+            n = rb->save_left;
+        }
+        if (n > max)
+        {
+            n = max;
+        }
+
+        ret = write(ctx, rb->data + rb->save_off, n);
+        if (ret != 0)
+        {
+            rb->saving = 0;
+            return ret;
+        }
+
+        rb->save_off = (rb->save_off + n) % rb->size;
+        rb->save_left -= n;
+        max -= n;
+    }
+
+    if (rb->save_left == 0)
+    {
+        rb->saving = 0;
+    }
+
+    return 0;
+}
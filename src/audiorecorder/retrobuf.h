@@ -0,0 +1,62 @@
+/* retrobuf.h
+ */
+
+#ifndef RETROBUF_H
+#define RETROBUF_H
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+#define RETROBUF_STEP   (1024 * 1024)   // bytes of a save written between blocks
+
+/* Retroactive recording. The latest audio is kept in a circular buffer of
+ * fixed size, allocated up front, so recording can run indefinitely in
+ * constant memory. A save writes out everything the buffer holds at that
+ * moment, oldest first, a step at a time, while newer audio keeps being
+ * added. Steps are much larger than blocks of audio, so a save keeps ahead
+ * of the audio which overwrites what it has yet to write.
+ */
+typedef struct retrobuf
+{
+    unsigned char   *data;      // the latest samples, wrapping around
+    size_t          size;       // bytes data can hold
+    size_t          head;       // offset at which the next byte goes
+    size_t          len;        // bytes of samples in data
+
+    int             saving;     // whether a save is in progress
+    size_t          save_off;   // offset of the next byte to save
+    size_t          save_left;  // bytes still to save
+} retrobuf_t;
+
+/* Allocates a buffer of size bytes, touching all of it so that the memory
+ * is really there before recording starts.
+ * returns 0 on success, 1 otherwise
+ */
+int init_retrobuf(retrobuf_t *rb, size_t size);
+
+void free_retrobuf(retrobuf_t *rb);
+
+/* adds len bytes of samples, overwriting the oldest once full */
+void retrobuf_push(retrobuf_t *rb, const unsigned char *samples, size_t len);
+
+/* starts a save of everything the buffer holds now */
+void retrobuf_save_start(retrobuf_t *rb);
+
+/* Passes up to max bytes of the save in progress to write, in one or two
+ * pieces, and clears rb->saving once the whole save has been written.
+ * returns 0 on success, or the first non-zero return of write
+ */
+int retrobuf_save_step(retrobuf_t *rb,
+    size_t max,
+    int (*write)(void *ctx, unsigned char *samples, size_t len),
+    void *ctx
+);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
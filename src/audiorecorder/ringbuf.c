@@ -0,0 +1,115 @@
+/* ringbuf.c
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+
+#include "ringbuf.h"
+
+int init_ringbuf(ringbuf_t *rb, size_t blocksize, size_t nblocks)
+{
+    if (!rb || blocksize == 0 || nblocks == 0)
+    {
+        return 1;
+    }
+
+    rb->data = malloc(blocksize * nblocks);
+    rb->lens = malloc(sizeof(size_t) * nblocks);
+    if (!rb->data || !rb->lens)
+    {
+        free(rb->data);
+        free(rb->lens);
+        return 1;
+    }
+
+    rb->blocksize = blocksize;
+    rb->nblocks = nblocks;
+
+    atomic_init(&rb->head, 0);
+    atomic_init(&rb->tail, 0);
+    atomic_init(&rb->overruns, 0);
+    atomic_init(&rb->empty_polls, 0);
+    atomic_init(&rb->closed, 0);
+
+    return 0;
+}
+
+void free_ringbuf(ringbuf_t *rb)
+{
+    if (rb != NULL)
+    {
+        free(rb->data);
+        free(rb->lens);
+        rb->data = NULL;
+        rb->lens = NULL;
+    }
+}
+
+unsigned char *ringbuf_acquire(ringbuf_t *rb)
+{
+    // only the producer changes head
+    const uint64_t head = atomic_load_explicit(&rb->head, memory_order_relaxed);
+    // acquire, so that the consumer has finished with the block we reuse
+    const uint64_t tail = atomic_load_explicit(&rb->tail, memory_order_acquire);
+
+    if (head - tail == rb->nblocks)
+    {
+        atomic_fetch_add_explicit(&rb->overruns, 1, memory_order_relaxed);
+        return NULL;
+    }
+
+    return rb->data + (head % rb->nblocks) * rb->blocksize;
+}
+
+void ringbuf_commit(ringbuf_t *rb, size_t len)
+{
+    const uint64_t head = atomic_load_explicit(&rb->head, memory_order_relaxed);
+
+    rb->lens[head % rb->nblocks] = len;
+
+    // release, so that the block's contents are visible before its index
+    atomic_store_explicit(&rb->head, head + 1, memory_order_release);
+}
+
+void ringbuf_close(ringbuf_t *rb)
+{
+    atomic_store_explicit(&rb->closed, 1, memory_order_release);
+}
+
+unsigned char *ringbuf_peek(ringbuf_t *rb, size_t *len)
+{
+    // only the consumer changes tail
+    const uint64_t tail = atomic_load_explicit(&rb->tail, memory_order_relaxed);
+    const uint64_t head = atomic_load_explicit(&rb->head, memory_order_acquire);
+
+    if (head == tail)
+    {
+        if (!ringbuf_closed(rb))
+        {
+            atomic_fetch_add_explicit(&rb->empty_polls, 1, memory_order_relaxed);
+        }
+        return NULL;
+    }
+
+    *len = rb->lens[tail % rb->nblocks];
+    return rb->data + (tail % rb->nblocks) * rb->blocksize;
+}
+
+void ringbuf_release(ringbuf_t *rb)
+{
+    const uint64_t tail = atomic_load_explicit(&rb->tail, memory_order_relaxed);
+
+    atomic_store_explicit(&rb->tail, tail + 1, memory_order_release);
+}
+
+int ringbuf_closed(ringbuf_t *rb)
+{
+    return atomic_load_explicit(&rb->closed, memory_order_acquire);
+}
+
+size_t ringbuf_used(ringbuf_t *rb)
+{
+    return atomic_load_explicit(&rb->head, memory_order_acquire)
+        - atomic_load_explicit(&rb->tail, memory_order_acquire);
+}
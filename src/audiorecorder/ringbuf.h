@@ -0,0 +1,75 @@
+/* ringbuf.h
+ */
+
+#ifndef RINGBUF_H
+#define RINGBUF_H
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+/* A lock-free ring of fixed-size blocks, for passing audio from exactly one
+ * producer thread to exactly one consumer thread.
+ *
+ * The producer acquires a free block, fills it in place and commits it. The
+ * consumer peeks at the oldest committed block, uses it in place and
+ * releases it. Neither side ever waits for the other.
+ */
+typedef struct ringbuf
+{
+    unsigned char   *data;          // nblocks blocks of blocksize bytes
+    size_t          *lens;          // bytes committed to each block
+    size_t          blocksize;
+    size_t          nblocks;
+
+    _Atomic uint64_t head;          // number of blocks ever committed
+    _Atomic uint64_t tail;          // number of blocks ever released
+
+    _Atomic uint64_t overruns;      // blocks the producer found no room for
+    _Atomic uint64_t empty_polls;   // times the consumer found nothing to read
+    _Atomic int     closed;         // set once the producer has finished
+} ringbuf_t;
+
+/* returns 0 on success, 1 if memory could not be allocated */
+int init_ringbuf(ringbuf_t *rb, size_t blocksize, size_t nblocks);
+
+void free_ringbuf(ringbuf_t *rb);
+
+/* Producer: returns the next free block, or NULL if the ring is full, in
+ * which case an overrun is counted.
+ */
+unsigned char *ringbuf_acquire(ringbuf_t *rb);
+
+/* Producer: publishes the block returned by ringbuf_acquire, of which the
+ * first len bytes are valid.
+ */
+void ringbuf_commit(ringbuf_t *rb, size_t len);
+
+/* Producer: marks that no more blocks will be committed. */
+void ringbuf_close(ringbuf_t *rb);
+
+/* Consumer: returns the oldest committed block and sets *len to its length,
+ * or returns NULL if the ring is empty, in which case an empty poll is
+ * counted unless the ring has been closed. A consumer that keeps up polls
+ * an empty ring often, so these measure how idle it is, not data lost.
+ */
+unsigned char *ringbuf_peek(ringbuf_t *rb, size_t *len);
+
+/* Consumer: frees the block returned by ringbuf_peek. */
+void ringbuf_release(ringbuf_t *rb);
+
+/* returns 1 if the producer has closed the ring */
+int ringbuf_closed(ringbuf_t *rb);
+
+/* returns the number of committed blocks not yet released */
+size_t ringbuf_used(ringbuf_t *rb);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
@@ -18,6 +18,13 @@ int startswith(const char *a, const char *b)
     return strstr(a, b) == a;
 }
 
+int endswith(const char *a, const char *b)
+{
+    size_t alen = strlen(a), blen = strlen(b);
+
+    return alen >= blen && strcmp(a + alen - blen, b) == 0;
+}
+
 /* parses the int16_t number in/following a command-line argument.
  * returns 0 on success, 1 otherwise
  *
@@ -101,3 +108,42 @@ int parse_int32_t_opt(int argc, char **argv, int *current_arg_index,  int32_t *d
 
 	return 0;	
 }
+
+/* parses the string in/following a command-line argument.
+ * returns 0 on success, 1 otherwise
+ *
+ * see common.h for more info
+ */
+int parse_str_opt(int argc, char **argv, int *current_arg_index, char **dst)
+{
+	char *str;
+
+	if (current_arg_index == NULL)
+	{
+		return 1;
+	}
+
+	if ((str = strchr(argv[*current_arg_index], '=')) != NULL)
+	{
+		str++;
+	}
+	else
+	{
+		if (++(*current_arg_index) < argc)
+		{
+			str = argv[*current_arg_index];
+		}
+		else
+		{
+			return 1;
+		}
+	}
+
+	if (*str == '\0')
+	{
+		return 1;
+	}
+
+	*dst = str;
+	return 0;
+}
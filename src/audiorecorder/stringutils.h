@@ -22,6 +22,16 @@ extern "C" {
  */
 int startswith(const char *a, const char *b);
 
+/* returns:
+ *   1: a ends with b
+ *   0: a doesn't end with b
+ *
+ * example:
+ *   endswith("take.flac", ".flac"): returns 1
+ *   endswith("flac", ".flac"): returns 0
+ */
+int endswith(const char *a, const char *b);
+
 /* parses the number in/following a command-line argument.
  *
  * the string at argv[*current_arg_index] must match one of the following patterns:
@@ -38,6 +48,9 @@ int startswith(const char *a, const char *b);
 int parse_int16_t_opt(int argc, char **argv, int *current_arg_index,  int16_t *dst);
 int parse_int32_t_opt(int argc, char **argv, int *current_arg_index,  int32_t *dst);
 
+/* as above, but for a string, which is pointed to rather than copied */
+int parse_str_opt(int argc, char **argv, int *current_arg_index, char **dst);
+
 #if defined(__cplusplus)
 }
 #endif
@@ -0,0 +1,365 @@
+/* synthsource.c
+ *
+ * Synthetic capture devices, for testing and benchmarking the recorder
+ * without audio hardware.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "capturesource.h"
+#include "endianness.h"
+#include "stringutils.h"
+#include "wavreader.h"
+#include "wav.h"
+
+#define SYNTH_SINE          0
+#define SYNTH_NOISE         1
+#define SYNTH_SILENCE       2
+#define SYNTH_FILE          3
+
+#define SYNTH_DEFAULT_HZ    440
+#define SYNTH_LEVEL         0.5     // fraction of full scale
+
+/* state of a synthetic device */
+typedef struct synthsource
+{
+    char            *spec;          // what was asked for, as the device name
+    int             kind;           // one of the SYNTH_ values above
+
+    int32_t         rate;
+    int             bitdepth;
+    int             channels;
+    int             blockalign;     // bytes per sample frame
+
+    double          step;           // phase advance of the sine per sample
+    double          step_re, step_im; // the cosine and sine of step
+    double          re, im;         // the sine and cosine of the phase
+    uint32_t        seed;           // noise generator state
+
+    wavreader_t     wav;            // file being replayed
+
+    int             realtime;
+    struct timespec started;        // when the device was started
+    uint64_t        capacity;       // sample frames it holds before losing some
+    uint64_t        pos;            // sample frames produced, read or lost
+    uint64_t        lost;           // sample frames lost for not being read
+} synthsource_t;
+
+static const char *synthsource_name(void *ctx);
+static int synthsource_start(void *ctx);
+static int synthsource_stop(void *ctx);
+static int32_t synthsource_available(void *ctx);
+static int synthsource_finished(void *ctx);
+static int synthsource_read(void *ctx, void *dst, int32_t n);
+static uint64_t synthsource_lost(void *ctx);
+static void synthsource_close(void *ctx);
+static void synthsource_seek(synthsource_t *s, uint64_t pos);
+static void put_sample(unsigned char *dst, double x, int bitdepth);
+
+int open_synthsource(capturesource_t *src,
+    const char *spec,
+    int32_t rate,
+    int bitdepth,
+    int channels,
+    int32_t bufframes,
+    int realtime
+)
+{
+    synthsource_t *s;
+    double hz = SYNTH_DEFAULT_HZ;
+
+    if (!src || !spec || rate <= 0 || channels <= 0 || bufframes <= 0 ||
+        (bitdepth != 8 && bitdepth != 16 && bitdepth != 24 && bitdepth != 32))
+    {
+        return 1;
+    }
+
+    s = calloc(1, sizeof(*s));
+    if (!s || !(s->spec = strdup(spec)))
+    {
+        free(s);
+        return 1;
+    }
+
+    s->rate = rate;
+    s->bitdepth = bitdepth;
+    s->channels = channels;
+    s->blockalign = channels * bitdepth / 8;
+    s->realtime = realtime;
+    s->capacity = bufframes;
+    s->seed = 1;
+    s->wav.fd = -1;
+
+    if (startswith(spec, "sine"))
+    {
+        s->kind = SYNTH_SINE;
+        if (spec[4] == ':')
+        {
+            hz = atof(spec + 5);
+        }
+        else if (spec[4] != '\0')
+        {
+            hz = 0;
+        }
+    }
+    else if (strcmp(spec, "noise") == 0)
+    {
+        s->kind = SYNTH_NOISE;
+    }
+    else if (strcmp(spec, "silence") == 0)
+    {
+        s->kind = SYNTH_SILENCE;
+    }
+    else if (open_wavreader(&s->wav, spec) == 0)
+    {
+        s->kind = SYNTH_FILE;
+
+        // samples are copied as they are, so the formats must agree
+        if ((int32_t) s->wav.samplerate != rate || s->wav.channels != channels ||
+            s->wav.bitdepth != bitdepth || s->wav.format != get_wav_format(bitdepth))
+        {
+            fprintf(stderr, "%s: '%s' is %u Hz, %u channel, %u bit audio, "
+                            "which does not match the recording\n", __func__,
+                spec, s->wav.samplerate, s->wav.channels, s->wav.bitdepth);
+            synthsource_close(s);
+            return 1;
+        }
+    }
+    else
+    {
+        fprintf(stderr, "%s: '%s' is not a signal or a readable WAV file\n",
+            __func__, spec);
+        synthsource_close(s);
+        return 1;
+    }
+
+    if (hz <= 0 || hz >= rate / 2.0)
+    {
+        fprintf(stderr, "%s: invalid frequency in '%s'\n", __func__, spec);
+        synthsource_close(s);
+        return 1;
+    }
+
+    s->step = 2 * M_PI * hz / rate;
+    s->step_re = cos(s->step);
+    s->step_im = sin(s->step);
+    synthsource_seek(s, 0);
+
+    src->ctx = s;
+    src->realtime = realtime;
+    src->name = synthsource_name;
+    src->start = synthsource_start;
+    src->stop = synthsource_stop;
+    src->available = synthsource_available;
+    src->finished = synthsource_finished;
+    src->read = synthsource_read;
+    src->lost = synthsource_lost;
+    src->close = synthsource_close;
+
+    return 0;
+}
+
+static const char *synthsource_name(void *ctx)
+{
+    return ((synthsource_t *) ctx)->spec;
+}
+
+static int synthsource_start(void *ctx)
+{
+    synthsource_t *s = ctx;
+
+    clock_gettime(CLOCK_MONOTONIC, &s->started);
+    return 0;
+}
+
+static int synthsource_stop(void *ctx)
+{
+    return 0;
+}
+
+static int32_t synthsource_available(void *ctx)
+{
+    synthsource_t *s = ctx;
+    struct timespec now;
+    uint64_t due, end = UINT64_MAX;
+
+    if (s->kind == SYNTH_FILE)
+    {
+        end = s->wav.nframes;
+    }
+
+    if (!s->realtime)
+    {
+        due = s->pos + s->capacity;
+    }
+    else
+    {
+        // everything a real device would have captured by now
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        due = ((uint64_t) (now.tv_sec - s->started.tv_sec) * 1000000000
+            + now.tv_nsec - s->started.tv_nsec) * s->rate / 1000000000;
+
+        // a full device drops its oldest samples
+        if (due > s->pos + s->capacity)
+        {
+            s->lost += due - s->capacity - s->pos;
+            synthsource_seek(s, due - s->capacity);
+        }
+    }
+
+    if (due > end)
+    {
+        due = end;
+    }
+
+    return due > s->pos ? (int32_t) (due - s->pos) : 0;
+}
+
+/* a replayed file is finished once all that is left of it is available */
+static int synthsource_finished(void *ctx)
+{
+    synthsource_t *s = ctx;
+
+    return s->kind == SYNTH_FILE &&
+        (uint64_t) synthsource_available(ctx) == s->wav.nframes - s->pos;
+}
+
+static int synthsource_read(void *ctx, void *dst, int32_t n)
+{
+    synthsource_t *s = ctx;
+    unsigned char *p = dst;
+    const int bytes = s->bitdepth / 8;
+    double x, re;
+
+    if (n < 0 || (s->kind == SYNTH_FILE && s->pos + n > s->wav.nframes))
+    {
+        return 1;
+    }
+
+    switch (s->kind)
+    {
+        case SYNTH_SINE:
+            for (int32_t i = 0; i < n; i++)
+            {
+                x = SYNTH_LEVEL * s->im;
+                for (int c = 0; c < s->channels; c++, p += bytes)
+                {
+                    put_sample(p, x, s->bitdepth);
+                }
+
+                // rotate the phase by one sample
+                re = s->re * s->step_re - s->im * s->step_im;
+                s->im = s->re * s->step_im + s->im * s->step_re;
+                s->re = re;
+            }
+
+            // keep rounding errors from changing the level
+            x = sqrt(s->re * s->re + s->im * s->im);
+            s->re /= x;
+            s->im /= x;
+            break;
+        case SYNTH_NOISE:
+            for (int32_t i = 0; i < n; i++)
+            {
+                for (int c = 0; c < s->channels; c++, p += bytes)
+                {
+                    s->seed = s->seed * 1103515245 + 12345;
+                    put_sample(p, SYNTH_LEVEL * ((double) s->seed / 2147483648.0 - 1), s->bitdepth);
+                }
+            }
+            break;
+        case SYNTH_SILENCE:
+            for (int32_t i = 0; i < n; i++)
+            {
+                for (int c = 0; c < s->channels; c++, p += bytes)
+                {
+                    put_sample(p, 0, s->bitdepth);
+                }
+            }
+            break;
+        default:
+            // WAV files are little-endian
+            memcpy(dst, s->wav.samples + s->pos * s->blockalign, (size_t) n * s->blockalign);
+            switch (s->bitdepth)
+            {
+                case 16:
+                    le16_buf(dst, (size_t) n * s->channels);
+                    break;
+                case 24:
+                    le24_buf(dst, (size_t) n * s->channels);
+                    break;
+                case 32:
+                    le32_buf(dst, (size_t) n * s->channels);
+                    break;
+            }
+            break;
+    }
+
+    s->pos += n;
+
+    return 0;
+}
+
+static uint64_t synthsource_lost(void *ctx)
+{
+    return ((synthsource_t *) ctx)->lost;
+}
+
+static void synthsource_close(void *ctx)
+{
+    synthsource_t *s = ctx;
+
+    close_wavreader(&s->wav);
+    free(s->spec);
+    free(s);
+}
+
+/* moves to the sample frame at pos, as if those before had been read */
+static void synthsource_seek(synthsource_t *s, uint64_t pos)
+{
+    s->pos = pos;
+    s->re = cos(s->step * (double) pos);
+    s->im = sin(s->step * (double) pos);
+}
+
+/* stores x, from -1 to 1, as one sample in host byte order */
+static void put_sample(unsigned char *dst, double x, int bitdepth)
+{
+    int16_t s16;
+    int32_t s32;
+    float f;
+
+    switch (bitdepth)
+    {
+        case 8:
+            // 8 bit samples alone are unsigned
+            dst[0] = (unsigned char) lrint(x * 127 + 128);
+            break;
+        case 16:
+            s16 = lrint(x * 32767);
+            memcpy(dst, &s16, sizeof(s16));
+            break;
+        case 24:
+            s32 = lrint(x * 8388607);
+#if (IS_BIG_ENDIAN == 1)
+            dst[0] = s32 >> 16;
+            dst[1] = s32 >> 8;
+            dst[2] = s32;
+#else
+            dst[0] = s32;
+            dst[1] = s32 >> 8;
+            dst[2] = s32 >> 16;
+#endif
+            break;
+        default:
+            // 32 bit audio is captured as floats
+            f = x;
+            memcpy(dst, &f, sizeof(f));
+            break;
+    }
+}
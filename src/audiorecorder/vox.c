@@ -0,0 +1,211 @@
+/* vox.c
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "endianness.h"
+#include "dsp.h"
+#include "vox.h"
+
+int init_vox(vox_t *v,
+    int threshold_db,
+    int preroll_ms,
+    int hangover_ms,
+    int rate,
+    int bitdepth,
+    int channels
+)
+{
+    if (!v || threshold_db >= 0 || preroll_ms < 0 || hangover_ms < 0 ||
+        rate <= 0 || channels <= 0)
+    {
+        return 1;
+    }
+
+    // dBFS to a fraction of full scale
+    v->threshold = pow(10.0, threshold_db / 20.0);
+    v->hangover = (uint64_t) hangover_ms * rate / 1000;
+    v->quiet = 0;
+    v->active = 0;
+
+    v->bitdepth = bitdepth;
+    v->blockalign = channels * bitdepth / 8;
+
+    v->preroll_size = (size_t) ((uint64_t) preroll_ms * rate / 1000) * v->blockalign;
+    v->preroll_len = 0;
+    v->preroll_head = 0;
+    v->preroll = NULL;
+
+    if (v->preroll_size > 0)
+    {
+        v->preroll = malloc(v->preroll_size);
+        if (!v->preroll)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+void free_vox(vox_t *v)
+{
+    if (v != NULL)
+    {
+        free(v->preroll);
+        v->preroll = NULL;
+    }
+}
+
+int vox_update(vox_t *v, const unsigned char *samples, size_t len)
+{
+    const size_t nframes = len / v->blockalign;
+    const int loud = pcm_rms(samples, len / (v->bitdepth / 8), v->bitdepth)
+        >= v->threshold;
+
+    if (!v->active)
+    {
+        if (!loud)
+        {
+            return VOX_IDLE;
+        }
+
+        v->active = 1;
+        v->quiet = 0;
+        return VOX_START;
+    }
+
+    if (loud)
+    {
+        v->quiet = 0;
+        return VOX_CONTINUE;
+    }
+
+    v->quiet += nframes;
+    if (v->quiet < v->hangover)
+    {
+        return VOX_CONTINUE;
+    }
+
+    v->active = 0;
+    return VOX_STOP;
+}
+
+void vox_preroll_push(vox_t *v, const unsigned char *samples, size_t len)
+{
+    size_t n;
+
+    if (v->preroll_size == 0)
+    {
+        return;
+    }
+
+    // only the end of a block larger than the whole pre-roll matters
+    if (len > v->preroll_size)
+    {
+        samples += len - v->preroll_size;
+        len = v->preroll_size;
+    }
+
+    while (len > 0)
+    {
+        n = v->preroll_size - v->preroll_head;
+        if (n > len)
+        {
+            n = len;
+        }
+
+        memcpy(v->preroll + v->preroll_head, samples, n);
+        v->preroll_head = (v->preroll_head + n) % v->preroll_size;
+        samples += n;
+        len -= n;
+
+        v->preroll_len += n;
+        if (v->preroll_len > v->preroll_size)
+        {
+            v->preroll_len = v->preroll_size;
+        }
+    }
+}
+
+int vox_preroll_flush(vox_t *v,
+    int (*write)(void *ctx, unsigned char *samples, size_t len),
+    void *ctx
+)
+{
+    size_t start, first;
+    int ret = 0;
+
+    if (v->preroll_len > 0)
+    {
+        // the oldest byte is preroll_len behind the head
+        start = (v->preroll_head + v->preroll_size - v->preroll_len) % v->preroll_size;
+        first = v->preroll_size - start;
+        if (first > v->preroll_len)
+        {
+            first = v->preroll_len;
+        }
+
+        ret = write(ctx, v->preroll + start, first);
+        if (ret == 0 && first < v->preroll_len)
+        {
+            ret = write(ctx, v->preroll, v->preroll_len - first);
+        }
+    }
+
+    v->preroll_len = 0;
+    v->preroll_head = 0;
+
+    return ret;
+}
+
+double pcm_rms(const unsigned char *samples, size_t nsamples, int bitdepth)
+{
+    // 32 bit audio is captured as floats
+    const int format = bitdepth == 32 ? DSP_FORMAT_FLOAT : DSP_FORMAT_PCM;
+    const size_t bytes = bitdepth / 8;
+    float x[VOX_CHUNK];
+#if (IS_BIG_ENDIAN == 1)
+    unsigned char le[VOX_CHUNK * 4];
+#endif
+    double sum = 0;
+    float peak = 0;
+    size_t n;
+
+    if (nsamples == 0 ||
+        (bitdepth != 8 && bitdepth != 16 && bitdepth != 24 && bitdepth != 32))
+    {
+        return 0;
+    }
+
+    for (size_t i = 0; i < nsamples; i += n, samples += n * bytes)
+    {
+        n = nsamples - i < VOX_CHUNK ? nsamples - i : VOX_CHUNK;
+
+#if (IS_BIG_ENDIAN == 1)
+        // the kernels take samples in little-endian order, as WAV files hold them
+        memcpy(le, samples, n * bytes);
+        switch (bitdepth)
+        {
+            case 16:
+                le16_buf(le, n);
+                break;
+            case 24:
+                le24_buf(le, n);
+                break;
+            case 32:
+                le32_buf(le, n);
+                break;
+        }
+        dsp_to_float(x, le, format, bitdepth, n);
+#else
+        dsp_to_float(x, samples, format, bitdepth, n);
+#endif
+        dsp_level(x, n, &sum, &peak);
+    }
+
+    return sqrt(sum / nsamples);
+}
@@ -0,0 +1,87 @@
+/* vox.h
+ */
+
+#ifndef VOX_H
+#define VOX_H
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* what vox_update decided about a block of samples */
+#define VOX_IDLE        0   // silence: keep the block as pre-roll
+#define VOX_START       1   // sound has begun: write the pre-roll, then the block
+#define VOX_CONTINUE    2   // sound, or silence within the hangover time
+#define VOX_STOP        3   // the hangover has run out: write the block, then stop
+
+#define VOX_CHUNK       1024    // samples measured at a time
+
+/* Level-triggered (voice operated) recording. Each block of samples is
+ * measured as it arrives. Recording starts when the RMS level of a block
+ * reaches the threshold, and stops once the level has stayed below it for
+ * the hangover time. While idle, the most recent audio is kept as pre-roll,
+ * so the start of a sound is not lost to the block that detected it.
+ */
+typedef struct vox
+{
+    double          threshold;      // RMS level, as a fraction of full scale
+    uint64_t        hangover;       // sample frames of silence before stopping
+    uint64_t        quiet;          // sample frames of silence so far
+    int             active;         // whether a recording is in progress
+
+    unsigned char   *preroll;       // circular buffer of the latest samples
+    size_t          preroll_size;   // bytes preroll can hold
+    size_t          preroll_len;    // bytes of samples in preroll
+    size_t          preroll_head;   // offset at which the next byte goes
+
+    int             bitdepth;
+    int             blockalign;     // bytes per sample frame
+} vox_t;
+
+/* parameters:
+ *   threshold_db: level at which to start recording, in dBFS (below 0)
+ *   preroll_ms:   audio kept from before the level was reached
+ *   hangover_ms:  silence after which to stop recording
+ *
+ * returns 0 on success, 1 otherwise
+ */
+int init_vox(vox_t *v,
+    int threshold_db,
+    int preroll_ms,
+    int hangover_ms,
+    int rate,
+    int bitdepth,
+    int channels
+);
+
+void free_vox(vox_t *v);
+
+/* Measures a block of len bytes of samples (in host byte order), and returns
+ * one of the VOX_ values above. Blocks are not stored by this function.
+ */
+int vox_update(vox_t *v, const unsigned char *samples, size_t len);
+
+/* adds a block of samples to the pre-roll, dropping the oldest if full */
+void vox_preroll_push(vox_t *v, const unsigned char *samples, size_t len);
+
+/* Passes the pre-roll, oldest first, to write in one or two pieces, then
+ * empties it. Stops at the first non-zero return of write, and returns it.
+ */
+int vox_preroll_flush(vox_t *v,
+    int (*write)(void *ctx, unsigned char *samples, size_t len),
+    void *ctx
+);
+
+/* Returns the RMS level of nsamples samples (in host byte order), as a
+ * fraction of full scale.
+ */
+double pcm_rms(const unsigned char *samples, size_t nsamples, int bitdepth);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
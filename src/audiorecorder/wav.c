@@ -17,6 +17,7 @@ int16_t get_wav_format(const int16_t bitdepth)
     {
         case 8:
         case 16:
+        case 24:
             return WAVE_FORMAT_PCM;
         case 32:
             return WAVE_FORMAT_IEEE_FLOAT;
@@ -112,7 +113,9 @@ void bufferwrite(unsigned char **dst, void *src, size_t nbytes)
     *dst += nbytes;
 }
 
-/* converts the samples in buf to little-endian if needed,
+/* converts the samples in buf to little-endian if needed.
+ * nsamples is the number of sample frames, each holding nchannels samples.
+ * 32 bit samples may be integers or floats.
  * returns:
  * zero: success
  * non-zero: samplesbuffer is NULL or channels/bitdepth is unsupported
@@ -123,34 +126,30 @@ int wav_prepare_pcm(
     const int nchannels,
     const int nsamples)
 {
-    if (!samplesbuffer)
+    const size_t n = (size_t) nchannels * nsamples;
+
+    if (!samplesbuffer || nchannels < 0 || nsamples < 0)
     {
         return 1;
     }
 
-    if (bitdepth == 8)
-    {
-        // each sample is only 1 byte, so byte order can't be swapped.
-        return 0;
-    }
-    else if (bitdepth == 16)
-    {
-        for (size_t i = 0; i < nchannels * nsamples; i += 2)
-        {
-            samplesbuffer[i] = le16(samplesbuffer[i]);
-        }
-        return 0;
-    }
-    else if (bitdepth == 32)
+    switch (bitdepth)
     {
-        for (size_t i = 0; i < nchannels * nsamples; i += 4)
-        {
-            samplesbuffer[i] = le32(samplesbuffer[i]);
-        }
-        return 0;
+        case 8:
+            // each sample is only 1 byte, so byte order can't be swapped.
+            return 0;
+        case 16:
+            le16_buf(samplesbuffer, n);
+            return 0;
+        case 24:
+            le24_buf(samplesbuffer, n);
+            return 0;
+        case 32:
+            le32_buf(samplesbuffer, n);
+            return 0;
+        default:
+            return 1;
     }
-
-    return 1;
 }
 
 int write_wavheader(const wavheader_t *hdr, FILE *fp)
@@ -162,6 +161,23 @@ int write_wavheader(const wavheader_t *hdr, FILE *fp)
 
     const int hdr_len = get_wavheader_len();
     unsigned char buf[hdr_len];
+
+    pack_wavheader(hdr, buf);
+
+    fwrite(buf, sizeof(buf), 1, fp);
+    if (ferror(fp))
+    {
+        return 1;
+    }
+
+    return 0;
+}
+
+/* stores the header in buf as it is laid out on disk.
+ * buf must hold at least get_wavheader_len() bytes.
+ */
+void pack_wavheader(const wavheader_t *hdr, unsigned char *buf)
+{
     unsigned char *bufptr = buf;
 
     /* I will use this to represent the WAVE header in little endian form.
@@ -189,10 +205,9 @@ int write_wavheader(const wavheader_t *hdr, FILE *fp)
     memcpy(&hdr_le.subchunk2id, hdr->subchunk2id, sizeof(hdr_le.subchunk2id));
     hdr_le.subchunk2size = le32(hdr->subchunk2size);
 
-    /* create an intermediate buffer for little-endian representation.
+    /* copy each member individually to the byte array.
      * We do not supply wavheader_t struct directly to fwrite,
      * because the struct potentially contains padding.
-     * Therefore we copy each member individually to a byte array.
      */
     bufferwrite(&bufptr, &hdr_le.chunkid,       sizeof(hdr_le.chunkid));
     bufferwrite(&bufptr, &hdr_le.chunksize,     sizeof(hdr_le.chunksize));
@@ -207,14 +222,77 @@ int write_wavheader(const wavheader_t *hdr, FILE *fp)
     bufferwrite(&bufptr, &hdr_le.bitdepth,      sizeof(hdr_le.bitdepth));
     bufferwrite(&bufptr, &hdr_le.subchunk2id,   sizeof(hdr_le.subchunk2id));
     bufferwrite(&bufptr, &hdr_le.subchunk2size, sizeof(hdr_le.subchunk2size));
+}
 
-    fwrite(buf, sizeof(buf), 1, fp);
-    if (ferror(fp))
+size_t get_wavheader64_len()
+{
+    return get_wavheader_len() + WAV_DS64_LEN;
+}
+
+int pack_wavheader64(const wavheader_t *hdr, uint64_t datalen, unsigned char *buf)
+{
+    // offset of the ds64 chunk, which follows "RIFF", its size and "WAVE"
+    const size_t ds64_off = sizeof(hdr->chunkid) + sizeof(hdr->chunksize)
+        + sizeof(hdr->format);
+    const uint64_t riffsize = get_wavheader64_len()
+        - (sizeof(hdr->chunkid) + sizeof(hdr->chunksize)) + datalen;
+    const int rf64 = riffsize > UINT32_MAX;
+
+    unsigned char *bufptr;
+    wavheader_t tmp = *hdr;
+    uint32_t val32;
+    uint64_t val64;
+
+    if (rf64)
     {
-        return 1;
+        memcpy(tmp.chunkid, "RF64", sizeof(tmp.chunkid));
+        tmp.chunksize = WAV_RF64_SIZE;
+        tmp.subchunk2size = WAV_RF64_SIZE;
+    }
+    else
+    {
+        tmp.chunksize = riffsize;
+        tmp.subchunk2size = datalen;
     }
 
-    return 0;
+    // the 32 bit header goes either side of the ds64 chunk
+    pack_wavheader(&tmp, buf + WAV_DS64_LEN);
+    memmove(buf, buf + WAV_DS64_LEN, ds64_off);
+
+    bufptr = buf + ds64_off;
+    bufferwrite(&bufptr, (void *) (rf64 ? "ds64" : "JUNK"), 4);
+    val32 = le32(WAV_DS64_LEN - 8);
+    bufferwrite(&bufptr, &val32, sizeof(val32));
+
+    if (!rf64)
+    {
+        memset(bufptr, 0, WAV_DS64_LEN - 8);
+        return 0;
+    }
+
+    // RIFF size, data size and number of sample frames, then no table
+    val64 = riffsize;
+    val32 = le32(val64 & 0xffffffff);
+    bufferwrite(&bufptr, &val32, sizeof(val32));
+    val32 = le32(val64 >> 32);
+    bufferwrite(&bufptr, &val32, sizeof(val32));
+
+    val64 = datalen;
+    val32 = le32(val64 & 0xffffffff);
+    bufferwrite(&bufptr, &val32, sizeof(val32));
+    val32 = le32(val64 >> 32);
+    bufferwrite(&bufptr, &val32, sizeof(val32));
+
+    val64 = hdr->blockalign > 0 ? datalen / hdr->blockalign : 0;
+    val32 = le32(val64 & 0xffffffff);
+    bufferwrite(&bufptr, &val32, sizeof(val32));
+    val32 = le32(val64 >> 32);
+    bufferwrite(&bufptr, &val32, sizeof(val32));
+
+    val32 = 0;
+    bufferwrite(&bufptr, &val32, sizeof(val32));
+
+    return 1;
 }
 
 void print_wavheader(FILE *fp, wavheader_t *hdr)
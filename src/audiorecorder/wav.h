@@ -10,6 +10,20 @@ extern "C" {
 #define WAVE_FORMAT_IEEE_FLOAT  0x0003 /* IEEE Float */
 #define WAVE_FORMAT_UNKNOWN     0x0000 /* unknown */
 
+/* A file whose RIFF size would not fit in 32 bits is written as RF64
+ * (EBU Tech 3306). Its 64 bit sizes live in a "ds64" chunk placed straight
+ * after the RIFF header. Files start out as plain RIFF with a "JUNK" chunk
+ * of the same size there, so they can be promoted in place.
+ */
+#define WAV_DS64_LEN        36          // ds64 (or JUNK) chunk, including its ID and size
+#define WAV_RF64_SIZE       0xffffffff  // 32 bit size fields of an RF64 file
+
+/* A stream written to a pipe cannot go back to fill in its sizes, so they
+ * are given as the largest possible, which readers take to mean that the
+ * samples run on until the end of the stream.
+ */
+#define WAV_STREAM_SIZE     0xffffffff
+
 /* header structure of a WAVE audio file */
 typedef struct wavheader
 {
@@ -46,6 +60,18 @@ void finalise_wavheader(wavheader_t *hdr, const long fsize);
 
 int write_wavheader(const wavheader_t *hdr, FILE *fp);
 
+void pack_wavheader(const wavheader_t *hdr, unsigned char *buf);
+
+/* Returns the length of the header written by pack_wavheader64. */
+size_t get_wavheader64_len();
+
+/* Stores the header for datalen bytes of samples in buf, as RIFF with a
+ * reserved JUNK chunk, or as RF64 if the sizes no longer fit in 32 bits.
+ * buf must hold at least get_wavheader64_len() bytes.
+ * returns 1 if the header is RF64, 0 otherwise
+ */
+int pack_wavheader64(const wavheader_t *hdr, uint64_t datalen, unsigned char *buf);
+
 void print_wavheader(FILE *fp, wavheader_t *hdr);
 
 int wav_prepare_pcm(unsigned char *samples, int bitdepth, int nchannels, int nsamples);
@@ -0,0 +1,264 @@
+/* wavfile.c
+ */
+
+// for fallocate
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include "wavfile.h"
+#include "fdutils.h"
+
+static int wavfile_flush(wavfile_t *wf, size_t len);
+static int header_due(const wavfile_t *wf);
+
+int open_wavfile(wavfile_t *wf,
+    const char *fname,
+    const wavheader_t *hdr,
+    uint64_t prealloc,
+    long hdr_interval_ms
+)
+{
+    void *buf;
+
+    if (!wf || !fname || !hdr)
+    {
+        return 1;
+    }
+
+    if (posix_memalign(&buf, WAVFILE_ALIGN, WAVFILE_BLOCKSIZE) != 0)
+    {
+        return 1;
+    }
+
+    wf->fd = open(fname, O_WRONLY | O_CREAT | O_TRUNC, 0664);
+    if (wf->fd < 0)
+    {
+        free(buf);
+        return 1;
+    }
+
+    wf->hdr = *hdr;
+    wf->buf = buf;
+    wf->buflen = 0;
+    wf->datalen = 0;
+    wf->hdr_interval_ms = hdr_interval_ms;
+    wf->stream = 0;
+
+    /* reserve the disk space for the whole recording in one go, which
+     * avoids fragmentation. The file size is left alone, so a reader never
+     * sees the unwritten space. Not every file system supports this.
+     */
+    if (prealloc > 0)
+    {
+        fallocate(wf->fd, FALLOC_FL_KEEP_SIZE, 0, get_wavheader64_len() + prealloc);
+    }
+
+    // an empty but valid file, until the first update
+    if (wavfile_update_header(wf) != 0 ||
+        lseek(wf->fd, get_wavheader64_len(), SEEK_SET) < 0)
+    {
+        close(wf->fd);
+        free(wf->buf);
+        return 1;
+    }
+
+    return 0;
+}
+
+int open_wavstream(wavfile_t *wf, int fd, const wavheader_t *hdr, int raw)
+{
+    unsigned char buf[get_wavheader_len()];
+    wavheader_t tmp;
+
+    if (!wf || fd < 0 || !hdr)
+    {
+        return 1;
+    }
+
+    wf->fd = fd;
+    wf->hdr = *hdr;
+    wf->buf = NULL;
+    wf->buflen = 0;
+    wf->datalen = 0;
+    wf->hdr_interval_ms = 0;
+    wf->stream = 1;
+
+    if (raw)
+    {
+        return 0;
+    }
+
+    // a plain RIFF header, as there is no going back to promote it to RF64
+    tmp = *hdr;
+    tmp.chunksize = WAV_STREAM_SIZE;
+    tmp.subchunk2size = WAV_STREAM_SIZE;
+    pack_wavheader(&tmp, buf);
+
+    return write_all(fd, buf, sizeof(buf));
+}
+
+int wavfile_write(wavfile_t *wf, const unsigned char *samples, size_t len)
+{
+    size_t n;
+
+    if (!wf || (!samples && len > 0))
+    {
+        return 1;
+    }
+
+    // nothing is held back from a stream
+    if (wf->stream)
+    {
+        if (write_all(wf->fd, samples, len) != 0)
+        {
+            return 1;
+        }
+        wf->datalen += len;
+        return 0;
+    }
+
+    while (len > 0)
+    {
+        n = WAVFILE_BLOCKSIZE - wf->buflen;
+        if (n > len)
+        {
+            n = len;
+        }
+
+        memcpy(wf->buf + wf->buflen, samples, n);
+        wf->buflen += n;
+        samples += n;
+        len -= n;
+
+        // whole blocks are written as they fill
+        if (wf->buflen == WAVFILE_BLOCKSIZE && wavfile_flush(wf, wf->buflen) != 0)
+        {
+            return 1;
+        }
+    }
+
+    /* at low data rates a block can take many seconds to fill, so once the
+     * header is due, whatever has been gathered is written out with it
+     */
+    if (wf->buflen > 0 && header_due(wf) && wavfile_flush(wf, wf->buflen) != 0)
+    {
+        return 1;
+    }
+
+    return 0;
+}
+
+int wavfile_update_header(wavfile_t *wf)
+{
+    const size_t hdr_len = get_wavheader64_len();
+    unsigned char buf[hdr_len];
+
+    if (!wf)
+    {
+        return 1;
+    }
+
+    // a stream's header is never revisited
+    if (wf->stream)
+    {
+        return 0;
+    }
+
+    // becomes RF64 once the data no longer fits in a 32 bit RIFF file
+    pack_wavheader64(&wf->hdr, wf->datalen, buf);
+
+    // the header is rewritten in place, without moving the file offset
+    if (pwrite(wf->fd, buf, hdr_len, 0) != hdr_len)
+    {
+        return 1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &wf->last_hdr);
+
+    return 0;
+}
+
+int close_wavfile(wavfile_t *wf)
+{
+    int ret = 0;
+
+    if (!wf)
+    {
+        return 1;
+    }
+
+    if (!wf->stream)
+    {
+        if (wavfile_flush(wf, wf->buflen) != 0)
+        {
+            ret = 1;
+        }
+
+        // release any preallocated space that went unused
+        if (ftruncate(wf->fd, get_wavheader64_len() + wf->datalen) != 0)
+        {
+            ret = 1;
+        }
+
+        if (wavfile_update_header(wf) != 0)
+        {
+            ret = 1;
+        }
+    }
+
+    if (close(wf->fd) != 0)
+    {
+        ret = 1;
+    }
+
+    free(wf->buf);
+    wf->buf = NULL;
+
+    return ret;
+}
+
+/* writes the first len bytes of the buffer to disk, and updates the header
+ * if it is due.
+ */
+static int wavfile_flush(wavfile_t *wf, size_t len)
+{
+    if (write_all(wf->fd, wf->buf, len) != 0)
+    {
+        return 1;
+    }
+
+    wf->datalen += len;
+    wf->buflen -= len;
+
+    if (header_due(wf))
+    {
+        return wavfile_update_header(wf);
+    }
+
+    return 0;
+}
+
+/* returns whether the header was last written hdr_interval_ms or more ago */
+static int header_due(const wavfile_t *wf)
+{
+    struct timespec now;
+    long elapsed_ms;
+
+    if (wf->hdr_interval_ms <= 0)
+    {
+        return 0;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    elapsed_ms = (now.tv_sec - wf->last_hdr.tv_sec) * 1000
+        + (now.tv_nsec - wf->last_hdr.tv_nsec) / 1000000;
+
+    return elapsed_ms >= wf->hdr_interval_ms;
+}
@@ -0,0 +1,90 @@
+/* wavfile.h
+ */
+
+#ifndef WAVFILE_H
+#define WAVFILE_H
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include <time.h>
+
+#include "wav.h"
+
+#define WAVFILE_BLOCKSIZE   (256 * 1024)    // bytes per write to disk
+#define WAVFILE_ALIGN       4096            // alignment of the write buffer
+
+/* A WAV file being written. Sample data is gathered into large aligned
+ * blocks before being written, and the header is rewritten in place
+ * periodically, along with whatever part of a block has been gathered, so
+ * the file stays readable even if the program dies.
+ * Recordings too long for a RIFF file are turned into RF64 as they grow.
+ */
+typedef struct wavfile
+{
+    int             fd;             // destination file descriptor
+    wavheader_t     hdr;            // header, in host byte order
+
+    unsigned char   *buf;           // samples not yet written to disk
+    size_t          buflen;         // number of bytes in buf
+
+    uint64_t        datalen;        // bytes of samples written to disk
+
+    long            hdr_interval_ms; // time between header updates, 0 for none
+    struct timespec last_hdr;       // when the header was last written
+
+    int             stream;         // whether samples are written as they arrive
+} wavfile_t;
+
+/* Creates the file at fname and writes a header for an empty recording.
+ *
+ * parameters:
+ *   hdr:             header describing the audio format
+ *   prealloc:        expected number of bytes of samples, for which disk
+ *                    space is reserved up front. 0 if unknown.
+ *   hdr_interval_ms: how often to update the header with the amount of
+ *                    audio written so far. 0 to only do so when closing.
+ *
+ * returns 0 on success, 1 otherwise
+ */
+int open_wavfile(wavfile_t *wf,
+    const char *fname,
+    const wavheader_t *hdr,
+    uint64_t prealloc,
+    long hdr_interval_ms
+);
+
+/* Starts a stream of samples on fd, which need not be seekable, such as a
+ * pipe or FIFO. The header, unless raw, has sizes meaning unknown, and is
+ * never rewritten. Every block of samples is written as soon as it
+ * arrives, so a reader at the other end can keep up in real time.
+ *
+ * parameters:
+ *   fd:  destination, which is closed by close_wavfile
+ *   raw: if set, no header is written, only the samples
+ *
+ * returns 0 on success, 1 otherwise
+ */
+int open_wavstream(wavfile_t *wf, int fd, const wavheader_t *hdr, int raw);
+
+/* Appends len bytes of (little-endian) samples to the file.
+ * returns 0 on success, 1 otherwise
+ */
+int wavfile_write(wavfile_t *wf, const unsigned char *samples, size_t len);
+
+/* Writes the header, with sizes covering the samples written to disk so far.
+ * returns 0 on success, 1 otherwise
+ */
+int wavfile_update_header(wavfile_t *wf);
+
+/* Writes any remaining samples and the final header, then closes the file.
+ * returns 0 on success, 1 otherwise
+ */
+int close_wavfile(wavfile_t *wf);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
@@ -3,21 +3,80 @@
  */
 
 #include <stdint.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <signal.h>
-
-#include <AL/al.h>
-#include <AL/alc.h>
-#include <AL/alext.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
 
 #include "wavrecorder.h"
+#include "capturesched.h"
+#include "capturesource.h"
+#include "ringbuf.h"
+#include "wavfile.h"
+#include "flacfile.h"
 #include "stringutils.h"
+#include "histogram.h"
 #include "wav.h"
 
-// must be global so that signal handler can access it
-static int wavrec_stop = 0;
+/* must be global so that signal handler can access it. It is read on the
+ * capture and writer threads, so it is atomic, and lock-free atomics are
+ * safe to store to from a signal handler.
+ */
+static _Atomic int wavrec_stop = 0;
+
+// number of times SIGUSR1 has asked for retroactive recordings to be saved
+static volatile sig_atomic_t wavrec_saves = 0;
+
+static int open_capturedev(wavrecorder_t *rec,
+    capturedev_t *d,
+    const char *name,
+    const options_t *opts
+);
+static void close_capturedev(capturedev_t *d);
+static void *capturedev_thread(void *dev);
+static void *wavwriter(void *dev);
+static void *mergewriter(void *rec);
+static int write_samples(void *dev, unsigned char *samples, size_t len);
+static int write_prepared(void *dev, unsigned char *samples, size_t len);
+static int publish(wavrecorder_t *rec, const unsigned char *samples, size_t len);
+static int retro_service(capturedev_t *d);
+static int open_outfile(wavrecorder_t *rec,
+    outfile_t *of,
+    const char *fname,
+    const wavheader_t *hdr,
+    uint64_t prealloc
+);
+static int outfile_write(outfile_t *of, const unsigned char *samples, size_t len);
+static int timed_write(histogram_t *h,
+    outfile_t *of,
+    const unsigned char *samples,
+    size_t len
+);
+static int close_outfile(outfile_t *of);
+static int open_next_file(capturedev_t *d);
+static char *suffixed_fname(const char *fname, const char *suffix);
+static int is_stream(const char *fname);
+static double capturedev_drift(wavrecorder_t *rec, unsigned int i);
+static void print_progress(FILE *fp, wavrecorder_t *rec);
+static void print_stats(FILE *fp, wavrecorder_t *rec);
+static int write_stats_json(const char *fname,
+    wavrecorder_t *rec,
+    double wall,
+    double cpu
+);
+static void print_json_string(FILE *fp, const char *s);
+static int64_t ns_since(const struct timespec *t);
+static void ring_wait(capturesched_t *sched, int realtime, int32_t nframes);
+static double cpu_seconds(void);
 
 int main(int argc, char **argv)
 {
@@ -38,6 +97,13 @@ int main(int argc, char **argv)
     sig_handler.sa_flags = 0;
     sigaction(SIGINT, &sig_handler, NULL);
 
+    // SIGUSR1 saves a retroactive recording, without interrupting anything
+    sig_handler.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &sig_handler, NULL);
+
+    // a reader of a stream that goes away is a write error, not a reason to die
+    signal(SIGPIPE, SIG_IGN);
+
     options_t opts;
     init_options(&opts);
 
@@ -57,6 +123,12 @@ int main(int argc, char **argv)
         return 0;
     }
 
+    if (opts.list)
+    {
+        list_capture_devices(stdout);
+        return 0;
+    }
+
     if (argi == argc)
     {
         fprintf(stderr, "%s: no destination file specified\n"
@@ -72,260 +144,1449 @@ int main(int argc, char **argv)
         return 1;
     }
 
-    return wavrecorder(argv[argi], opts);
+    return wavrecorder(argv[argi], opts);
+}
+
+int wavrecorder(char *fname, options_t opts)
+{
+    /* I will use this to represent the WAVE audio file header.
+     */
+    wavheader_t wavhdr;
+
+    wavrecorder_t rec;
+    capturedev_t *d;
+    unsigned int i;
+    int ret = 0;
+
+    // for measuring how much work a second of audio takes
+    struct timespec wall_start, wall_end;
+    double cpu_start, cpu, wall, audio = 0;
+
+    memset(&rec, 0, sizeof(rec));
+    rec.fname = fname;
+    rec.ndevs = opts.ndevices > 0 ? opts.ndevices : 1;
+    rec.merge = opts.merge && rec.ndevs > 1;
+    rec.header_ms = opts.header_ms;
+    rec.flac = opts.flac || endswith(fname, ".flac");
+    rec.raw = opts.raw;
+    rec.index = opts.index;
+    rec.silent = opts.quiet;
+
+    // the audio itself may be going to stdout
+    rec.msg = strcmp(fname, "-") == 0 ? stderr : stdout;
+
+    rec.bitdepth = opts.bitdepth;
+    rec.channels = opts.channels;
+    rec.rate = opts.rate;
+    rec.blockalign = opts.channels * opts.bitdepth / 8;
+
+    // 64 bit, so that recordings can run for days at any rate
+    rec.maxsamples = (uint64_t) opts.duration * opts.rate;
+
+    // set our buffer size to that of the internal buffer used by fwrite
+    rec.bufsize = BUFSIZ;
+
+    // if required, increase the buffer size to align with our audio sample sizes
+    rec.bufsize += (rec.bufsize % rec.blockalign); 
+
+    // number of samples that buffer can hold
+    rec.bufnmemb = rec.bufsize / rec.blockalign;
+
+    atomic_init(&rec.write_err, 0);
+    atomic_init(&rec.running, 0);
+
+    if (rec.merge && (opts.vox_db != 0 || opts.retro_s > 0))
+    {
+        fprintf(stderr, "%s: level-triggered or retroactive recording cannot be merged\n", __func__);
+        return 1;
+    }
+
+    if (opts.vox_db != 0 && opts.retro_s > 0)
+    {
+        fprintf(stderr, "%s: recording cannot be both level-triggered and retroactive\n", __func__);
+        return 1;
+    }
+
+    if (rec.flac && get_wav_format(opts.bitdepth) != WAVE_FORMAT_PCM)
+    {
+        fprintf(stderr, "%s: FLAC cannot hold %d bit samples\n", __func__, opts.bitdepth);
+        return 1;
+    }
+
+    if (rec.flac && (rec.raw || is_stream(fname)))
+    {
+        fprintf(stderr, "%s: FLAC cannot be streamed or written raw\n", __func__);
+        return 1;
+    }
+
+    // a ring carries one stream, continuously
+    if (opts.publish &&
+        (opts.vox_db != 0 || opts.retro_s > 0 || (rec.ndevs > 1 && !rec.merge)))
+    {
+        fprintf(stderr, "%s: only one continuous stream can be published\n", __func__);
+        return 1;
+    }
+
+    // numbered files have no meaning for standard output
+    if (strcmp(fname, "-") == 0 &&
+        (opts.vox_db != 0 || opts.retro_s > 0 || (rec.ndevs > 1 && !rec.merge)))
+    {
+        fprintf(stderr, "%s: only one stream can be written to standard output\n", __func__);
+        return 1;
+    }
+
+    if (opts.json && strcmp(opts.json, "-") == 0 && strcmp(fname, "-") == 0)
+    {
+        fprintf(stderr, "%s: statistics cannot be written to standard output along with the audio\n",
+            __func__);
+        return 1;
+    }
+
+    for (i = 0; i < rec.ndevs && ret == 0; i++)
+    {
+        ret = open_capturedev(&rec, &rec.devs[i],
+            opts.ndevices > 0 ? opts.devices[i] : NULL, &opts);
+    }
+
+    /* a merged file holds the channels of the first device, then those of
+     * the second, and so on
+     */
+    if (ret == 0 && rec.merge)
+    {
+        init_wavheader(&wavhdr, opts.bitdepth, opts.channels * rec.ndevs, opts.rate);
+        if (open_outfile(&rec, &rec.out, rec.fname, &wavhdr,
+            rec.maxsamples * rec.blockalign * rec.ndevs) != 0)
+        {
+            fprintf(stderr, "%s: failed to open file '%s'\n", __func__, rec.fname);
+            ret = 1;
+        }
+        else
+        {
+            rec.out_open = 1;
+        }
+    }
+
+    /* blocks are published as they are written, in the same format, so
+     * the ring holds as much audio as the rings of the devices do
+     */
+    if (ret == 0 && opts.publish)
+    {
+        size_t nblocks = ((int64_t) opts.ring_ms * opts.rate / 1000 + rec.bufnmemb - 1)
+            / rec.bufnmemb;
+
+        if (create_shmring(&rec.shm, opts.publish,
+            (size_t) rec.bufnmemb * rec.blockalign * (rec.merge ? rec.ndevs : 1),
+            nblocks < 2 ? 2 : nblocks, opts.rate, opts.bitdepth,
+            opts.channels * (rec.merge ? rec.ndevs : 1),
+            opts.overwrite ? SHMRING_DROP : SHMRING_BACKPRESSURE) != 0)
+        {
+            fprintf(stderr, "%s: failed to create shared memory ring '%s'\n",
+                __func__, opts.publish);
+            ret = 1;
+        }
+        else
+        {
+            rec.publishing = 1;
+        }
+    }
+
+    if (ret != 0)
+    {
+        for (i = 0; i < rec.ndevs; i++)
+        {
+            close_capturedev(&rec.devs[i]);
+        }
+        if (rec.out_open)
+        {
+            close_outfile(&rec.out);
+        }
+        return 1;
+    }
+
+    if (!opts.quiet)
+    {
+        fprintf(rec.msg, "recording with the following parameters:\n"
+                        "  maximum duration  = %d seconds\n"
+                        "  sample rate       = %dHz\n"
+                        "  channels          = %d\n"
+                        "  sample resolution = %d bits\n",
+                        opts.duration, opts.rate, opts.channels, opts.bitdepth
+        );
+
+        for (i = 0; i < rec.ndevs; i++)
+        {
+            fprintf(rec.msg, "  destination file  = '%s'\n"
+                            "  recording device  = '%s'\n",
+                            rec.merge ? rec.fname : rec.devs[i].fname,
+                            rec.devs[i].src.name(rec.devs[i].src.ctx)
+            );
+        }
+
+        if (rec.publishing)
+        {
+            fprintf(rec.msg, "  published as      = '" SHMRING_PREFIX "%s'\n", opts.publish);
+        }
+    }
+
+    /* start every device at as nearly the same moment as possible. Whatever
+     * a device captures before the last one started is then discarded, so
+     * that the first sample kept from each device was captured at the same
+     * time.
+     */
+    cpu_start = cpu_seconds();
+    clock_gettime(CLOCK_MONOTONIC, &wall_start);
+
+    for (i = 0; i < rec.ndevs; i++)
+    {
+        if (rec.devs[i].src.start(rec.devs[i].src.ctx) != 0)
+        {
+            fprintf(stderr, "%s: failed to start capture device %u\n", __func__, i + 1);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &rec.devs[i].started);
+    }
+
+    for (i = 0; i < rec.ndevs; i++)
+    {
+        d = &rec.devs[i];
+        d->skip = (((int64_t) rec.devs[rec.ndevs - 1].started.tv_sec - d->started.tv_sec) * 1000000000
+            + (rec.devs[rec.ndevs - 1].started.tv_nsec - d->started.tv_nsec))
+            * rec.rate / 1000000000;
+    }
+
+    /* samples are passed to separate threads to be written to disk, so that
+     * a slow disk cannot stop us from draining the capture devices in time
+     */
+    if (rec.merge)
+    {
+        rec.devs[0].writing = pthread_create(&rec.devs[0].writer, NULL,
+            mergewriter, &rec) == 0;
+        ret = !rec.devs[0].writing;
+    }
+    else
+    {
+        for (i = 0; i < rec.ndevs && ret == 0; i++)
+        {
+            rec.devs[i].writing = pthread_create(&rec.devs[i].writer, NULL,
+                wavwriter, &rec.devs[i]) == 0;
+            ret = !rec.devs[i].writing;
+        }
+    }
+
+    // each device is drained by its own thread
+    for (i = 0; i < rec.ndevs && ret == 0; i++)
+    {
+        atomic_fetch_add(&rec.running, 1);
+        rec.devs[i].capturing = pthread_create(&rec.devs[i].capturer, NULL,
+            capturedev_thread, &rec.devs[i]) == 0;
+        if (!rec.devs[i].capturing)
+        {
+            atomic_fetch_sub(&rec.running, 1);
+            ret = 1;
+        }
+    }
+
+    if (ret != 0)
+    {
+        // stops any threads that did start
+        fprintf(stderr, "%s: failed to start recording threads\n", __func__);
+        atomic_store(&rec.write_err, 1);
+    }
+
+    // report progress until every device has finished
+    capturesched_t sched, stats_sched;
+    init_capturesched(&sched, opts.rate, CAPTURESCHED_REPORT_MS);
+    init_capturesched(&stats_sched, opts.rate, opts.stats_ms);
+
+    // the first report would be of nothing
+    capturesched_report_due(&stats_sched);
+
+    while (atomic_load(&rec.running) > 0)
+    {
+        capturesched_wait(&sched, 0, rec.bufnmemb);
+
+        if (opts.stats_ms > 0 && capturesched_report_due(&stats_sched))
+        {
+            // statistics start a line of their own after the progress
+            if (!opts.quiet)
+            {
+                fprintf(rec.msg, "\n");
+                fflush(rec.msg);
+            }
+            print_stats(stderr, &rec);
+        }
+
+        if (!opts.quiet && capturesched_report_due(&sched))
+        {
+            print_progress(rec.msg, &rec);
+            fflush(rec.msg);
+        }
+    }
+
+    for (i = 0; i < rec.ndevs; i++)
+    {
+        if (rec.devs[i].capturing)
+        {
+            pthread_join(rec.devs[i].capturer, NULL);
+        }
+    }
+
+    if (!opts.quiet)
+    {
+        // final sample count, then a newline after it
+        print_progress(rec.msg, &rec);
+        fprintf(rec.msg, "\n");
+    }
+
+    // let the writers finish what is left in the rings
+    for (i = 0; i < rec.ndevs; i++)
+    {
+        ringbuf_close(&rec.devs[i].ring);
+    }
+
+    for (i = 0; i < rec.ndevs; i++)
+    {
+        if (rec.devs[i].writing)
+        {
+            pthread_join(rec.devs[i].writer, NULL);
+        }
+    }
+
+    // transcribers finish whatever is left in the ring, then see it closed
+    if (rec.publishing)
+    {
+        destroy_shmring(&rec.shm);
+
+        if (!opts.quiet)
+        {
+            fprintf(rec.msg, "blocks held up by transcribers: %" PRIu64 "\n", rec.shm_waits);
+        }
+        if (rec.shm_lost > 0)
+        {
+            fprintf(stderr, "%s: %" PRIu64 " blocks were not published, as a transcriber "
+                            "had stopped reading\n", __func__, rec.shm_lost);
+        }
+    }
+
+    cpu = cpu_seconds() - cpu_start;
+    clock_gettime(CLOCK_MONOTONIC, &wall_end);
+    wall = (wall_end.tv_sec - wall_start.tv_sec)
+        + (wall_end.tv_nsec - wall_start.tv_nsec) / 1e9;
+
+    if (opts.json && write_stats_json(opts.json, &rec, wall, cpu) != 0)
+    {
+        fprintf(stderr, "%s: failed to write statistics to '%s'\n", __func__, opts.json);
+    }
+
+    for (i = 0; i < rec.ndevs; i++)
+    {
+        d = &rec.devs[i];
+
+        audio += (double) atomic_load(&d->nsamples) / rec.rate;
+
+        if (d->lost > 0)
+        {
+            fprintf(stderr, "%s: capture fell behind, %" PRIu64 " samples were lost "
+                            "by device %u\n", __func__, d->lost, i + 1);
+        }
+
+        if (atomic_load(&d->ring.overruns) > 0)
+        {
+            fprintf(stderr, "%s: disk writes fell behind, %" PRIu64 " samples were dropped "
+                            "(%" PRIu64 " overruns)\n",
+                __func__, (uint64_t) atomic_load(&d->dropped),
+                (uint64_t) atomic_load(&d->ring.overruns));
+        }
+
+        if (atomic_load(&d->errors) > 0)
+        {
+            fprintf(stderr, "%s: %" PRIu64 " reads from device %u failed\n",
+                __func__, (uint64_t) atomic_load(&d->errors), i + 1);
+        }
+
+        if (!opts.quiet)
+        {
+            fprintf(rec.msg, "writer empty polls: %" PRIu64 "\n",
+                (uint64_t) atomic_load(&d->ring.empty_polls));
+
+            if (d->use_vox)
+            {
+                fprintf(rec.msg, "level was reached %u times\n", d->nfiles);
+            }
+
+            if (d->use_retro)
+            {
+                fprintf(rec.msg, "the last %d s were saved %u times\n", opts.retro_s, d->nfiles);
+            }
+
+            /* how far each device has run ahead of or behind the first. A
+             * device that is not real time has no clock to drift.
+             */
+            if (i > 0 && d->src.realtime && rec.devs[0].src.realtime)
+            {
+                fprintf(rec.msg, "device %u: started %.3f ms before the last, "
+                                "drift %+.1f ppm relative to device 1\n",
+                    i + 1, d->skip * 1000.0 / rec.rate, capturedev_drift(&rec, i));
+            }
+        }
+
+        close_capturedev(d);
+    }
+
+    // the cost of recording, which synthetic devices allow to be measured
+    if (!opts.quiet && audio > 0 && wall > 0)
+    {
+        fprintf(rec.msg, "recorded %.1f s of audio in %.2f s (%.1fx real time), "
+                        "using %.2f ms of CPU time per second of audio\n",
+            audio, wall, audio / rec.ndevs / wall, cpu * 1000 / audio);
+    }
+
+    /* write any remaining samples, and the final sizes to the header */
+    if (rec.out_open && close_outfile(&rec.out) != 0)
+    {
+        fprintf(stderr, "%s: error finalising output file\n", __func__);
+    }
+
+    //print_wavheader(stdout, &wavhdr);
+
+    return ret;
+}
+
+/* Opens a capture device, and unless devices are merged, its output file.
+ * returns 0 on success, 1 otherwise
+ */
+static int open_capturedev(wavrecorder_t *rec,
+    capturedev_t *d,
+    const char *name,
+    const options_t *opts
+)
+{
+    wavheader_t wavhdr;
+    char suffix[16];
+
+    d->rec = rec;
+    d->name = name;
+    atomic_init(&d->nsamples, 0);
+    atomic_init(&d->rate_mhz, 0);
+    atomic_init(&d->dropped, 0);
+    atomic_init(&d->errors, 0);
+    init_histogram(&d->backlog);
+    init_histogram(&d->loop_ns);
+    init_histogram(&d->write_ns);
+
+    // each device of several records to its own numbered file
+    if (rec->ndevs > 1)
+    {
+        snprintf(suffix, sizeof(suffix), "-dev%u", (unsigned int) (d - rec->devs) + 1);
+        d->fname = suffixed_fname(rec->fname, suffix);
+    }
+    else
+    {
+        d->fname = suffixed_fname(rec->fname, "");
+    }
+
+    d->buf = malloc(rec->bufsize);
+    if (!d->fname || !d->buf)
+    {
+        perror(__func__);
+        return 1;
+    }
+
+    // open microphone, or a synthetic device
+    d->bufframes = 2 * rec->bufsize;
+    if (open_capturesource(&d->src, name, opts->rate, opts->bitdepth, opts->channels,
+        d->bufframes, opts->fast) != 0)
+    {
+        fprintf(stderr, "%s: failed to open audio capture device '%s'\n", __func__,
+            name ? name : "default");
+        return 1;
+    }
+    d->src_open = 1;
+
+    if (!rec->merge)
+    {
+        if (opts->vox_db != 0)
+        {
+            // the writer thread opens a file each time the level is reached
+            if (init_vox(&d->vox, opts->vox_db, opts->preroll_ms, opts->hangover_ms,
+                opts->rate, opts->bitdepth, opts->channels) != 0)
+            {
+                fprintf(stderr, "%s: invalid level-triggered recording settings\n", __func__);
+                return 1;
+            }
+            d->use_vox = 1;
+        }
+        else if (opts->retro_s > 0)
+        {
+            // whole sample frames, so every save starts on one
+            uint64_t size = (uint64_t) opts->retro_s * opts->rate * rec->blockalign;
+
+            if (size > SIZE_MAX || init_retrobuf(&d->retro, size) != 0)
+            {
+                fprintf(stderr, "%s: cannot keep the last %d seconds in memory\n",
+                    __func__, opts->retro_s);
+                return 1;
+            }
+            d->use_retro = 1;
+        }
+        else
+        {
+            /* open output file. If the duration is known, the disk space for
+             * the whole recording is reserved now.
+             */
+            init_wavheader(&wavhdr, opts->bitdepth, opts->channels, opts->rate);
+            if (open_outfile(rec, &d->out, d->fname, &wavhdr,
+                rec->maxsamples * rec->blockalign) != 0)
+            {
+                fprintf(stderr, "%s: failed to open file '%s'\n", __func__, d->fname);
+                return 1;
+            }
+            d->out_open = 1;
+        }
+    }
+
+    size_t nblocks = ((int64_t) opts->ring_ms * opts->rate / 1000 + rec->bufnmemb - 1)
+        / rec->bufnmemb;
+    if (nblocks < 2)
+    {
+        nblocks = 2;
+    }
+
+    if (init_ringbuf(&d->ring, rec->bufnmemb * rec->blockalign, nblocks) != 0)
+    {
+        perror(__func__);
+        return 1;
+    }
+
+    return 0;
+}
+
+/* closes whatever open_capturedev managed to open */
+static void close_capturedev(capturedev_t *d)
+{
+    if (d->src_open)
+    {
+        d->src.close(d->src.ctx);
+        d->src_open = 0;
+    }
+
+    if (d->out_open && close_outfile(&d->out) != 0)
+    {
+        fprintf(stderr, "%s: error finalising output file\n", __func__);
+    }
+    d->out_open = 0;
+
+    if (d->use_vox)
+    {
+        free_vox(&d->vox);
+        d->use_vox = 0;
+    }
+
+    if (d->use_retro)
+    {
+        free_retrobuf(&d->retro);
+        d->use_retro = 0;
+    }
+
+    if (d->ring.data)
+    {
+        free_ringbuf(&d->ring);
+        d->ring.data = NULL;
+    }
+
+    free(d->buf);
+    d->buf = NULL;
+    free(d->fname);
+    d->fname = NULL;
+}
+
+/* Capture thread, one per device. Drains the device into its ring until
+ * the time limit is reached or recording is stopped.
+ */
+static void *capturedev_thread(void *p)
+{
+    capturedev_t *d = p;
+    wavrecorder_t *rec = d->rec;
+
+    int32_t samplesavailable = 0, sampleswanted, n;
+    uint64_t totalsamples = 0, skip = d->skip;
+    unsigned char *dst;
+    struct timespec now;
+    int64_t elapsed_ns;
+    int ended = 0;
+
+    // paces the loop below by the sample rate, rather than busy polling
+    capturesched_t sched;
+    init_capturesched(&sched, rec->rate, CAPTURESCHED_REPORT_MS);
+
+    /* Audio sample retrieval. */
+
+    /* while there is no limit to maxsamples,
+     * OR while we have not yet captured the maximum amount of samples
+     */
+    while (!ended && (rec->maxsamples == 0 || totalsamples < rec->maxsamples))
+    {
+        /* a synthetic device may run out, with its last block a short one.
+         * Checked first, so that no samples arrive in between.
+         */
+        ended = d->src.finished(d->src.ctx);
+
+        // check how many captured samples are available
+        samplesavailable = d->src.available(d->src.ctx);
+        histogram_add(&d->backlog, samplesavailable > 0 ? samplesavailable : 0);
+
+        /* everything the device has produced since it started, over how long
+         * that took, is its real sample rate
+         */
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        elapsed_ns = (int64_t) (now.tv_sec - d->started.tv_sec) * 1000000000
+            + (now.tv_nsec - d->started.tv_nsec);
+        if (elapsed_ns > 0)
+        {
+            atomic_store(&d->rate_mhz, (uint64_t)
+                ((double) (d->skip - skip + totalsamples + samplesavailable)
+                * 1e12 / elapsed_ns));
+        }
+
+        // throw away what was captured before the last device started
+        while (skip > 0 && samplesavailable > 0)
+        {
+            n = samplesavailable < rec->bufnmemb ? samplesavailable : rec->bufnmemb;
+            if ((uint64_t) n > skip)
+            {
+                n = skip;
+            }
+
+            d->src.read(d->src.ctx, d->buf, n);
+            skip -= n;
+            samplesavailable -= n;
+        }
+
+        /* while there are enough samples to fill the buffer,
+         * or we have captured the maximum number of samples
+         */
+        while ( samplesavailable                >=  rec->bufnmemb   ||
+                (ended                                              &&
+                samplesavailable                >   0)              ||
+                (rec->maxsamples                >   0               &&
+                samplesavailable                >   0               &&
+                totalsamples + samplesavailable >=  rec->maxsamples)
+        )
+        {
+            /* copy the samples to local buffer,
+             * but no more than the time limit allows
+             */
+            n = samplesavailable < rec->bufnmemb ? samplesavailable : rec->bufnmemb;
+            if (rec->maxsamples > 0 && (uint64_t) n > rec->maxsamples - totalsamples)
+            {
+                n = rec->maxsamples - totalsamples;
+            }
+            if (n == 0)
+            {
+                break;
+            }
+
+            /* capture straight into the ring. If the writer has fallen so far
+             * behind that the ring is full, a real time device must still be
+             * drained, so the samples are captured into our own buffer and
+             * dropped. Any other device just waits for the writer.
+             */
+            while (!d->src.realtime && ringbuf_used(&d->ring) == d->ring.nblocks &&
+                !atomic_load(&rec->write_err) && !atomic_load(&wavrec_stop))
+            {
+                ring_wait(&sched, 0, rec->bufnmemb);
+            }
+
+            dst = ringbuf_acquire(&d->ring);
+            if (!dst)
+            {
+                dst = d->buf;
+                atomic_fetch_add(&d->dropped, n);
+            }
+
+            if (d->src.read(d->src.ctx, dst, n) != 0)
+            {
+                fprintf(stderr, "%s: error capturing samples\n", __func__);
+                atomic_fetch_add(&d->errors, 1);
+            }
+
+            if (dst != d->buf)
+            {
+                ringbuf_commit(&d->ring, n * rec->blockalign);
+            }
+
+            totalsamples += n;
+            samplesavailable -= n;
+        }
+
+        atomic_store(&d->nsamples, totalsamples);
+
+        // from the poll of the device to here, which must stay well short of
+        // the time the device takes to fill
+        histogram_add(&d->loop_ns, ns_since(&now));
+
+        if (atomic_load(&rec->write_err) || atomic_load(&wavrec_stop))
+        {
+            break;
+        }
+
+        // a device that is not real time never needs waiting for
+        if (!d->src.realtime)
+        {
+            continue;
+        }
+
+        /* sleep until the device should have filled our buffer,
+         * or captured the last of the samples we need
+         */
+        sampleswanted = rec->bufnmemb;
+        if (rec->maxsamples > 0 && rec->maxsamples - totalsamples < (uint64_t) sampleswanted)
+        {
+            sampleswanted = rec->maxsamples - totalsamples;
+        }
+        capturesched_wait(&sched, samplesavailable, sampleswanted);
+    }
+
+    if (d->src.stop(d->src.ctx) != 0)
+    {
+        fprintf(stderr, "%s: error stopping capture\n", __func__);
+    }
+    d->lost = d->src.lost(d->src.ctx);
+
+    atomic_fetch_sub(&rec->running, 1);
+
+    return NULL;
+}
+
+/* Writer thread, one per device unless merging. Takes blocks of samples
+ * from the ring, converts them to little-endian if needed, and writes them
+ * to the device's output file, until the ring is closed and empty.
+ */
+static void *wavwriter(void *p)
+{
+    capturedev_t *d = p;
+    wavrecorder_t *rec = d->rec;
+    unsigned char *block;
+    size_t len;
+    int closed, state, err;
+
+    // sleeps for a block's worth of audio whenever the ring is empty
+    capturesched_t sched;
+    init_capturesched(&sched, rec->rate, CAPTURESCHED_REPORT_MS);
+
+    for (;;)
+    {
+        // check before peeking, so that no block committed before closing is missed
+        closed = ringbuf_closed(&d->ring);
+
+        block = ringbuf_peek(&d->ring, &len);
+
+        // a save is written a step at a time, between blocks
+        if (d->use_retro && retro_service(d) != 0)
+        {
+            fprintf(stderr, "%s: error saving samples\n", __func__);
+            atomic_store(&rec->write_err, 1);
+            break;
+        }
+
+        if (!block)
+        {
+            if (closed)
+            {
+                break;
+            }
+
+            // there is no waiting while a save is still to be written
+            if (!d->retro.saving)
+            {
+                ring_wait(&sched, d->src.realtime, rec->bufnmemb);
+            }
+            continue;
+        }
+
+        // in retroactive mode, blocks are only kept until they are saved
+        if (d->use_retro)
+        {
+            wav_prepare_pcm(block, rec->bitdepth, rec->channels, len / rec->blockalign);
+            retrobuf_push(&d->retro, block, len);
+            ringbuf_release(&d->ring);
+            continue;
+        }
+
+        /* in level-triggered mode, blocks are measured before anything else
+         * is done with them, and quiet blocks only go to the pre-roll
+         */
+        state = d->use_vox ? vox_update(&d->vox, block, len) : VOX_CONTINUE;
+        if (state == VOX_IDLE)
+        {
+            vox_preroll_push(&d->vox, block, len);
+            ringbuf_release(&d->ring);
+            continue;
+        }
+
+        err = 0;
+        if (state == VOX_START)
+        {
+            err = open_next_file(d) != 0 ||
+                vox_preroll_flush(&d->vox, write_samples, d) != 0;
+        }
+
+        if (!err)
+        {
+            err = write_samples(d, block, len) != 0;
+        }
+        ringbuf_release(&d->ring);
+
+        // the level has stayed low for the whole hangover time
+        if (!err && state == VOX_STOP)
+        {
+            d->out_open = 0;
+            err = close_outfile(&d->out) != 0;
+        }
+
+        if (err)
+        {
+            fprintf(stderr, "%s: error writing samples\n", __func__);
+            atomic_store(&rec->write_err, 1);
+            break;
+        }
+    }
+
+    // a save that was started is finished, even once recording has stopped
+    while (d->use_retro && d->retro.saving && !atomic_load(&rec->write_err))
+    {
+        if (retro_service(d) != 0)
+        {
+            fprintf(stderr, "%s: error saving samples\n", __func__);
+            atomic_store(&rec->write_err, 1);
+        }
+    }
+
+    return NULL;
+}
+
+/* Writer thread when merging. Interleaves the samples of every device into
+ * one file, sample by sample. A device that stops early is padded with
+ * silence until the others have finished.
+ */
+static void *mergewriter(void *p)
+{
+    wavrecorder_t *rec = p;
+    const size_t ba = rec->blockalign;
+    const size_t outframe = ba * rec->ndevs;
+    unsigned char *block[WAVRECORDER_MAX_DEVICES] = { NULL };
+    size_t len[WAVRECORDER_MAX_DEVICES], off[WAVRECORDER_MAX_DEVICES];
+    unsigned char *out, *dst;
+    size_t n, avail;
+    unsigned int i, nactive;
+    int closed, waiting;
+
+    capturesched_t sched;
+    init_capturesched(&sched, rec->rate, CAPTURESCHED_REPORT_MS);
+
+    out = malloc(rec->bufnmemb * outframe);
+    if (!out)
+    {
+        perror(__func__);
+        atomic_store(&rec->write_err, 1);
+        return NULL;
+    }
+
+    for (;;)
+    {
+        n = rec->bufnmemb;
+        nactive = 0;
+        waiting = 0;
+
+        for (i = 0; i < rec->ndevs; i++)
+        {
+            if (!block[i])
+            {
+                closed = ringbuf_closed(&rec->devs[i].ring);
+                block[i] = ringbuf_peek(&rec->devs[i].ring, &len[i]);
+                off[i] = 0;
+
+                if (!block[i])
+                {
+                    // a device that is still running holds everything up
+                    waiting |= !closed;
+                    continue;
+                }
+
+                wav_prepare_pcm(block[i], rec->bitdepth, rec->channels, len[i] / ba);
+            }
+
+            avail = (len[i] - off[i]) / ba;
+            if (avail < n)
+            {
+                n = avail;
+            }
+            nactive++;
+        }
+
+        if (waiting)
+        {
+            ring_wait(&sched, rec->devs[0].src.realtime, rec->bufnmemb);
+            continue;
+        }
+        if (nactive == 0)
+        {
+            break;
+        }
+
+        dst = out;
+        for (size_t f = 0; f < n; f++)
+        {
+            for (i = 0; i < rec->ndevs; i++, dst += ba)
+            {
+                if (block[i])
+                {
+                    memcpy(dst, block[i] + off[i] + f * ba, ba);
+                }
+                else
+                {
+                    // silence: 8 bit samples alone are unsigned
+                    memset(dst, rec->bitdepth == 8 ? 0x80 : 0, ba);
+                }
+            }
+        }
+
+        for (i = 0; i < rec->ndevs; i++)
+        {
+            if (block[i])
+            {
+                off[i] += n * ba;
+                if (off[i] >= len[i])
+                {
+                    ringbuf_release(&rec->devs[i].ring);
+                    block[i] = NULL;
+                }
+            }
+        }
+
+        if ((rec->publishing && publish(rec, out, n * outframe) != 0) ||
+            timed_write(&rec->devs[0].write_ns, &rec->out, out, n * outframe) != 0)
+        {
+            fprintf(stderr, "%s: error writing samples\n", __func__);
+            atomic_store(&rec->write_err, 1);
+            break;
+        }
+    }
+
+    free(out);
+    return NULL;
+}
+
+/* converts samples to little-endian, and appends them to a device's file.
+ * returns 0 on success, 1 otherwise
+ */
+static int write_samples(void *p, unsigned char *samples, size_t len)
+{
+    capturedev_t *d = p;
+    wavrecorder_t *rec = d->rec;
+
+    /* Convert the byte order of the PCM data
+     * to little endian if not already so.
+     */
+    if (wav_prepare_pcm(samples, rec->bitdepth, rec->channels, len / rec->blockalign) != 0)
+    {
+        fprintf(stderr, "%s: error processing samples\n", __func__);
+    }
+
+    return write_prepared(d, samples, len);
+}
+
+/* appends samples which are already little-endian to a device's file.
+ * returns 0 on success, 1 otherwise
+ */
+static int write_prepared(void *p, unsigned char *samples, size_t len)
+{
+    capturedev_t *d = p;
+
+    if (d->rec->publishing && publish(d->rec, samples, len) != 0)
+    {
+        return 1;
+    }
+
+    return timed_write(&d->write_ns, &d->out, samples, len);
+}
+
+/* Publishes samples which are already little-endian to transcribers. A
+ * transcriber that is behind holds up the writer, not capture, which goes
+ * on into the ring of the device. Once recording has been stopped, one
+ * that holds it up is no longer waited for.
+ * returns 0 on success, 1 otherwise
+ */
+static int publish(wavrecorder_t *rec, const unsigned char *samples, size_t len)
+{
+    const struct timespec brief = { 0, 200000 };
+    int waited = 0;
+
+    while (shmring_publish(&rec->shm, samples, len) != 0)
+    {
+        if (len > rec->shm.hdr->blocksize)
+        {
+            return 1;
+        }
+
+        if (atomic_load(&wavrec_stop))
+        {
+            rec->shm_lost++;
+            return 0;
+        }
+
+        if (!waited)
+        {
+            rec->shm_waits++;
+            waited = 1;
+        }
+        nanosleep(&brief, NULL);
+    }
+
+    return 0;
+}
+
+/* Starts saving the latest audio of a device to its next numbered file if
+ * SIGUSR1 has been received since the last save began, then writes the
+ * next step of any save in progress, closing the file when it is done.
+ * returns 0 on success, 1 otherwise
+ */
+static int retro_service(capturedev_t *d)
+{
+    wavrecorder_t *rec = d->rec;
+    const unsigned int requested = wavrec_saves;
+
+    if (!d->retro.saving && requested != d->saves)
+    {
+        d->saves = requested;
+        if (open_next_file(d) != 0)
+        {
+            return 1;
+        }
+        retrobuf_save_start(&d->retro);
+
+        if (!rec->silent)
+        {
+            fprintf(rec->msg, "\nsaving the last %.1f s of device %u as file %u\n",
+                (double) d->retro.save_left / rec->blockalign / rec->rate,
+                (unsigned int) (d - rec->devs) + 1, d->nfiles);
+        }
+    }
+
+    if (!d->retro.saving)
+    {
+        return 0;
+    }
+
+    // whole sample frames at a time, as a FLAC encoder needs
+    if (retrobuf_save_step(&d->retro, RETROBUF_STEP - RETROBUF_STEP % rec->blockalign,
+        write_prepared, d) != 0)
+    {
+        return 1;
+    }
+
+    if (!d->retro.saving)
+    {
+        d->out_open = 0;
+        return close_outfile(&d->out);
+    }
+
+    return 0;
+}
+
+/* Creates an output file in the recording's format. FLAC frames are
+ * encoded by the writer thread as it drains the ring, so compression never
+ * holds up capture.
+ * returns 0 on success, 1 otherwise
+ */
+static int open_outfile(wavrecorder_t *rec,
+    outfile_t *of,
+    const char *fname,
+    const wavheader_t *hdr,
+    uint64_t prealloc
+)
+{
+    char *idxname;
+    int fd;
+
+    of->is_flac = rec->flac;
+    of->has_index = 0;
+
+    /* there is no seeking back to the header of standard output or a FIFO,
+     * and raw samples have no header to go back to
+     */
+    if (!of->is_flac && (rec->raw || is_stream(fname)))
+    {
+        if (strcmp(fname, "-") == 0)
+        {
+            fd = dup(STDOUT_FILENO);
+        }
+        else
+        {
+            fd = open(fname, O_WRONLY | O_CREAT | O_TRUNC, 0664);
+        }
+
+        if (fd < 0 || open_wavstream(&of->wav, fd, hdr, rec->raw) != 0)
+        {
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+            return 1;
+        }
+
+        return 0;
+    }
+
+    /* the index of a file is computed as the samples are written, so that
+     * a transcriber can skip silence without reading it
+     */
+    if (rec->index)
+    {
+        idxname = malloc(strlen(fname) + sizeof(ONSETINDEX_EXT));
+        if (!idxname)
+        {
+            return 1;
+        }
+
+        sprintf(idxname, "%s" ONSETINDEX_EXT, fname);
+        of->has_index = open_onsetindex_writer(&of->index, idxname, hdr->srate,
+            hdr->bitdepth, hdr->nchannels) == 0;
+        if (!of->has_index)
+        {
+            fprintf(stderr, "%s: failed to open index '%s'\n", __func__, idxname);
+        }
+        free(idxname);
+
+        if (!of->has_index)
+        {
+            return 1;
+        }
+    }
+
+    // the size of a FLAC file is not known in advance
+    if (of->is_flac ?
+        open_flacfile(&of->flac, fname, hdr, rec->header_ms) != 0 :
+        open_wavfile(&of->wav, fname, hdr, prealloc, rec->header_ms) != 0)
+    {
+        if (of->has_index)
+        {
+            close_onsetindex_writer(&of->index);
+            of->has_index = 0;
+        }
+        return 1;
+    }
+
+    return 0;
+}
+
+/* appends len bytes of little-endian samples to an output file */
+static int outfile_write(outfile_t *of, const unsigned char *samples, size_t len)
+{
+    if (of->has_index && onsetindex_write(&of->index, samples, len) != 0)
+    {
+        return 1;
+    }
+
+    if (of->is_flac)
+    {
+        return flacfile_write(&of->flac, samples, len);
+    }
+
+    return wavfile_write(&of->wav, samples, len);
 }
 
-int wavrecorder(char *fname, options_t opts)
+/* outfile_write, adding the time it took to h */
+static int timed_write(histogram_t *h,
+    outfile_t *of,
+    const unsigned char *samples,
+    size_t len
+)
 {
-    /* I will use this to represent the WAVE audio file header.
-     */
-    wavheader_t wavhdr;
+    struct timespec start;
+    int ret;
 
-    wavrecorder_t rec;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    ret = outfile_write(of, samples, len);
+    histogram_add(h, ns_since(&start));
 
-    rec.fname = fname;
+    return ret;
+}
 
-    rec.blockalign = opts.channels * opts.bitdepth / 8;
+static int close_outfile(outfile_t *of)
+{
+    int ret = 0;
 
-    // set our buffer size to that of the internal buffer used by fwrite
-    rec.bufsize = BUFSIZ;
+    if (of->has_index)
+    {
+        ret = close_onsetindex_writer(&of->index);
+        of->has_index = 0;
+    }
 
-    // if required, increase the buffer size to align with our audio sample sizes
-    rec.bufsize += (rec.bufsize % rec.blockalign); 
+    if (of->is_flac)
+    {
+        return close_flacfile(&of->flac) | ret;
+    }
 
-    // number of samples that buffer can hold
-    rec.bufnmemb = rec.bufsize / rec.blockalign;
+    return close_wavfile(&of->wav) | ret;
+}
 
-    rec.buf = malloc(rec.bufsize);
-    if (!rec.buf)
+/* Opens the next of the numbered files of a level-triggered recording.
+ * "take.wav" is recorded as "take-001.wav", "take-002.wav" and so on.
+ * returns 0 on success, 1 otherwise
+ */
+static int open_next_file(capturedev_t *d)
+{
+    wavrecorder_t *rec = d->rec;
+    wavheader_t hdr;
+    char suffix[16];
+    char *fname;
+    int ret = 0;
+
+    snprintf(suffix, sizeof(suffix), "-%03u", ++d->nfiles);
+    fname = suffixed_fname(d->fname, suffix);
+    if (!fname)
     {
-        perror(__func__);
         return 1;
     }
 
-    // check that OpenAL supports the audio recording configuration
-    ALenum al_format = get_al_format(opts.bitdepth, opts.channels);
-    if (al_format == AL_NONE)
+    init_wavheader(&hdr, rec->bitdepth, rec->channels, rec->rate);
+    if (open_outfile(rec, &d->out, fname, &hdr, 0) != 0)
     {
-        fprintf(stderr, "%s: unsupported sample resolution (%d bits) and/or channel count (%d)\n",
-            __func__, opts.bitdepth, opts.channels);
-        free(rec.buf);
-        return 1;
+        fprintf(stderr, "%s: failed to open file '%s'\n", __func__, fname);
+        ret = 1;
     }
-
-    // open microphone
-    rec.dev = alcCaptureOpenDevice(NULL, opts.rate, al_format, 2 * rec.bufsize);
-    if (!rec.dev)
+    else
     {
-        fprintf(stderr, "%s: failed to open audio capture device\n", __func__);
-        free(rec.buf);
-        return 1;
+        d->out_open = 1;
     }
 
-    if (!opts.quiet)
+    free(fname);
+    return ret;
+}
+
+/* Returns a copy of fname with suffix inserted before its extension, if it
+ * has one. The copy must be freed by the caller.
+ */
+static char *suffixed_fname(const char *fname, const char *suffix)
+{
+    const char *slash = strrchr(fname, '/');
+    const char *dot = strrchr(fname, '.');
+    size_t stemlen = strlen(fname);
+    size_t size;
+    char *dst;
+
+    // only an extension in the last path component counts
+    if (dot && (!slash || dot > slash + 1))
     {
-        fprintf(stdout, "recording with the following parameters:\n"
-                        "  maximum duration  = %d seconds\n"
-                        "  sample rate       = %dHz\n"
-                        "  channels          = %d\n"
-                        "  sample resolution = %d bits\n"
-                        "  destination file  = '%s'\n"
-                        "  recording device  = '%s'\n",
-                        opts.duration, opts.rate, opts.channels, opts.bitdepth,
-                        rec.fname,
-                        alcGetString(rec.dev, ALC_CAPTURE_DEVICE_SPECIFIER)
-        );
+        stemlen = dot - fname;
+    }
+    else
+    {
+        dot = "";
     }
 
-    // open output file
-    rec.outfp = fopen(rec.fname, "wb");
-    if (!rec.outfp)
+    size = strlen(fname) + strlen(suffix) + 1;
+    dst = malloc(size);
+    if (dst)
     {
-        fprintf(stderr, "%s: failed to open file '%s'\n", __func__, rec.fname);
-        alcCaptureCloseDevice(rec.dev);
-        free(rec.buf);
-        return 1;
+        snprintf(dst, size, "%.*s%s%s", (int) stemlen, fname, suffix, dot);
     }
 
-    init_wavheader(&wavhdr, opts.bitdepth, opts.channels, opts.rate);
-    /* seek forward to reserve space in the file for the header,
-     * which we will write later
-     */
-    fseek(rec.outfp, get_wavheader_len(), SEEK_SET);
+    return dst;
+}
 
-    alcCaptureStart(rec.dev);
+/* returns whether fname is "-", for standard output, or something other
+ * than a regular file that already exists, such as a FIFO
+ */
+static int is_stream(const char *fname)
+{
+    struct stat st;
 
-    const uint32_t maxsamples = opts.duration * opts.rate;
-    int32_t samplesavailable = 0;
-    uint32_t samplesinbuffer = 0, totalsamples = 0;
+    return strcmp(fname, "-") == 0 ||
+        (stat(fname, &st) == 0 && !S_ISREG(st.st_mode));
+}
 
-    /* Audio sample retrieval. */
+/* Returns how much faster the clock of device i runs than that of the
+ * first, in parts per million. Devices whose clocks drift apart slowly fall
+ * out of line over a long recording.
+ */
+static double capturedev_drift(wavrecorder_t *rec, unsigned int i)
+{
+    const uint64_t ref = atomic_load(&rec->devs[0].rate_mhz);
+    const uint64_t rate = atomic_load(&rec->devs[i].rate_mhz);
 
-    /* while there is no limit to maxsamples,
-     * OR while we have not yet written to file the maximum amount of samples
-     */
-    while (maxsamples == 0 || totalsamples < maxsamples)
+    if (ref == 0 || rate == 0)
     {
-        // check how many captured samples are available
-        alcGetIntegerv(rec.dev, ALC_CAPTURE_SAMPLES,
-            sizeof(samplesavailable), &samplesavailable);
+        return 0;
+    }
 
-        if (!opts.quiet)
-        {
-            fprintf(stdout, "\rSamples written: %10u", totalsamples);
-        }
+    return ((double) rate - (double) ref) * 1e6 / ref;
+}
 
-        /* while there are enough samples to fill the buffer,
-         * or we have captured the maximum number of samples
-         */
-        while ( samplesavailable                >=  rec.bufnmemb    ||
-                (maxsamples                     >   0               &&
-                samplesavailable                >   0               &&
-                totalsamples + samplesavailable >=  maxsamples)
-        )
-        {
-            /* copy the samples to local buffer */
-            if (samplesavailable < rec.bufnmemb)
-            {
-                samplesinbuffer += samplesavailable;
-            }
-            else
-            {
-                samplesinbuffer +=  rec.bufnmemb;
-            }
+/* prints the number of samples captured, and with several devices, the
+ * greatest drift between them
+ */
+static void print_progress(FILE *fp, wavrecorder_t *rec)
+{
+    double drift, worst = 0;
 
-            /* clear the error state,
-             * before calling openal capture samples function
-             */
-            alcGetError(rec.dev);
-            alcCaptureSamples(rec.dev, rec.buf, samplesinbuffer);
-            if (alcGetError(rec.dev) != ALC_NO_ERROR)
-            {
-                fprintf(stderr, "%s: error capturing samples\n", __func__);
-            }
+    fprintf(fp, "\rSamples captured: %10" PRIu64,
+        (uint64_t) atomic_load(&rec->devs[0].nsamples));
 
-            /* Convert the byte order of the PCM data
-             * to little endian if not already so.
-             */
-            if (wav_prepare_pcm(rec.buf, opts.bitdepth, opts.channels, samplesinbuffer) != 0)
+    if (rec->ndevs > 1 && rec->devs[0].src.realtime)
+    {
+        for (unsigned int i = 1; i < rec->ndevs; i++)
+        {
+            if (!rec->devs[i].src.realtime)
             {
-                fprintf(stderr, "%s: error processing samples\n", __func__);
+                continue;
             }
 
-            /* write the buffered samples to file */
-            fwrite(rec.buf, rec.blockalign, samplesinbuffer, rec.outfp);
-            if (ferror(rec.outfp))
-            {   
-                fprintf(stderr, "%s: error writing samples\n", __func__);
-                break;
+            drift = capturedev_drift(rec, i);
+            if (fabs(drift) > fabs(worst))
+            {
+                worst = drift;
             }
-
-            totalsamples += samplesinbuffer;
-            samplesavailable -= samplesinbuffer;
-            samplesinbuffer = 0;
-        }
-
-        if (ferror(rec.outfp) || wavrec_stop)
-        {
-            break;
         }
+        fprintf(fp, "  drift: %+10.1f ppm", worst);
     }
+}
 
-    if (!opts.quiet)
+/* Prints a line for each device of how close it has come to losing audio
+ * so far: how long the device's backlog grew, against how much it can
+ * hold, how long the capture loop and writes took, and what was lost.
+ */
+static void print_stats(FILE *fp, wavrecorder_t *rec)
+{
+    const double frame_ms = 1000.0 / rec->rate;
+    capturedev_t *d;
+
+    for (unsigned int i = 0; i < rec->ndevs; i++)
     {
-        // newline after sample count was printed
-        fprintf(stdout, "\n");
+        d = &rec->devs[i];
+
+        fprintf(fp, "dev%u: backlog p50 %.1f p99 %.1f max %.1f ms (%.0f%% of device), "
+                    "loop p99 %.0f max %.0f us, write p99 %.0f max %.0f us, "
+                    "ring %zu/%zu, dropped %" PRIu64 ", errors %" PRIu64 "\n",
+            i + 1,
+            histogram_percentile(&d->backlog, 0.5) * frame_ms,
+            histogram_percentile(&d->backlog, 0.99) * frame_ms,
+            atomic_load(&d->backlog.max) * frame_ms,
+            atomic_load(&d->backlog.max) * 100.0 / d->bufframes,
+            histogram_percentile(&d->loop_ns, 0.99) / 1e3,
+            atomic_load(&d->loop_ns.max) / 1e3,
+            histogram_percentile(&d->write_ns, 0.99) / 1e3,
+            atomic_load(&d->write_ns.max) / 1e3,
+            ringbuf_used(&d->ring), d->ring.nblocks,
+            (uint64_t) atomic_load(&d->dropped),
+            (uint64_t) atomic_load(&d->errors));
     }
+}
+
+/* Writes the statistics of a finished recording as a JSON object to fname,
+ * or to stdout if fname is "-". Backlogs are in sample frames, times in
+ * microseconds.
+ * returns 0 on success, 1 otherwise
+ */
+static int write_stats_json(const char *fname,
+    wavrecorder_t *rec,
+    double wall,
+    double cpu
+)
+{
+    FILE *fp = strcmp(fname, "-") == 0 ? stdout : fopen(fname, "w");
+    capturedev_t *d;
+    double audio = 0;
+    int ret;
 
-    alcGetError(rec.dev);
-    alcCaptureStop(rec.dev);
-    if (alcGetError(rec.dev) != ALC_NO_ERROR)
+    if (!fp)
     {
-        fprintf(stderr, "%s: error stopping capture\n", __func__);
+        return 1;
     }
 
-    alcCaptureCloseDevice(rec.dev);
-    if (alcGetError(rec.dev) != ALC_NO_ERROR)
+    for (unsigned int i = 0; i < rec->ndevs; i++)
     {
-        fprintf(stderr, "%s: error closing capture device\n", __func__);
+        audio += (double) atomic_load(&rec->devs[i].nsamples) / rec->rate;
     }
 
-    if (rec.buf)
+    fprintf(fp, "{\n  \"sample_rate\": %d,\n  \"channels\": %d,\n"
+                "  \"bits_per_sample\": %d,\n  \"block_frames\": %d,\n"
+                "  \"audio_seconds\": %.3f,\n  \"wall_seconds\": %.3f,\n"
+                "  \"cpu_seconds\": %.3f,\n  \"devices\": [",
+        rec->rate, rec->channels, rec->bitdepth, rec->bufnmemb, audio, wall, cpu);
+
+    for (unsigned int i = 0; i < rec->ndevs; i++)
     {
-        free(rec.buf);
-    }
+        d = &rec->devs[i];
 
-    /* update destination file headers */
-    // size of recording file
-	const long fsize = ftell(rec.outfp);
+        fprintf(fp, "%s\n    {\"name\": ", i > 0 ? "," : "");
+        print_json_string(fp, d->src.name(d->src.ctx));
+        fprintf(fp, ", \"samples\": %" PRIu64 ", \"device_frames\": %d, "
+                    "\"ring_blocks\": %zu, \"lost\": %" PRIu64 ", "
+                    "\"dropped\": %" PRIu64 ", \"ring_overruns\": %" PRIu64 ", "
+                    "\"writer_empty_polls\": %" PRIu64 ", \"read_errors\": %" PRIu64 ",",
+            (uint64_t) atomic_load(&d->nsamples), d->bufframes, d->ring.nblocks,
+            d->lost, (uint64_t) atomic_load(&d->dropped),
+            (uint64_t) atomic_load(&d->ring.overruns),
+            (uint64_t) atomic_load(&d->ring.empty_polls),
+            (uint64_t) atomic_load(&d->errors));
+
+        fprintf(fp, "\n     \"backlog_frames\": ");
+        histogram_print_json(fp, &d->backlog, 1);
+        fprintf(fp, ",\n     \"loop_us\": ");
+        histogram_print_json(fp, &d->loop_ns, 1e3);
+        fprintf(fp, ",\n     \"write_us\": ");
+        histogram_print_json(fp, &d->write_ns, 1e3);
+        fprintf(fp, "}");
+    }
 
-    finalise_wavheader(&wavhdr, fsize);
+    fprintf(fp, "\n  ]\n}\n");
 
-    rewind(rec.outfp);
-    if (write_wavheader(&wavhdr, rec.outfp) != 0)
+    ret = ferror(fp) != 0;
+    if (fp == stdout)
     {
-        fprintf(stderr, "%s: error finalising WAV file\n", __func__);
+        ret |= fflush(fp) != 0;
+    }
+    else
+    {
+        ret |= fclose(fp) != 0;
     }
-    fclose(rec.outfp);
-
-    //print_wavheader(stdout, &wavhdr);
 
-    return 0;
+    return ret;
 }
 
-/* returns the appropriate OpenAL enum value for the given recording format.
- *
- * parameters
- *    nchannels: number of channels
- *    bitdepth: number of bits in each recorded sample
- */
-ALenum get_al_format(int bitdepth, int nchannels)
+/* prints s as a quoted JSON string */
+static void print_json_string(FILE *fp, const char *s)
 {
-    /* For now, this program shall only support integer PCM audio.
-     */
-    if(nchannels == 1)
+    fputc('"', fp);
+    for (; *s; s++)
     {
-        if(bitdepth == 8)
-        {
-            return AL_FORMAT_MONO8;
-        }
-        else if(bitdepth == 16)
+        if (*s == '"' || *s == '\\')
         {
-            return AL_FORMAT_MONO16;
+            fprintf(fp, "\\%c", *s);
         }
-        /*else if(bitdepth == 32)
-        {
-            return AL_FORMAT_MONO_FLOAT32;
-        }*/
-    }
-    else if(nchannels == 2)
-    {
-        if(bitdepth == 8)
+        else if ((unsigned char) *s < 0x20)
         {
-            return AL_FORMAT_STEREO8;
+            fprintf(fp, "\\u%04x", (unsigned char) *s);
         }
-        else if(bitdepth == 16)
+        else
         {
-            return AL_FORMAT_STEREO16;
+            fputc(*s, fp);
         }
-        /*else if(bitdepth == 32)
-        {
-            return AL_FORMAT_STEREO_FLOAT32;
-        }*/
     }
-
-    return AL_NONE;
+    fputc('"', fp);
 }
 
-
-
 /*signal handler to allow for graceful shutdown of the recording operation */
 void on_signal(int s)
 {
     switch (s)
     {
         case SIGINT:
-            wavrec_stop = 1;
+            atomic_store(&wavrec_stop, 1);
+            break;
+        case SIGUSR1:
+            wavrec_saves++;
             break;
     }
 }
@@ -337,12 +1598,30 @@ void print_usage(FILE *fp, const char *prog_name)
 
 	fprintf(fp,
 	    "Usage: %s [OPTION]... <FILE>\n"
-	    "Records audio, storing output in <FILE> in WAV file format. \n"
+	    "Records audio, storing output in <FILE> in WAV or FLAC file format. \n"
+	    "<FILE> may be - for standard output, or a FIFO, to which WAV is streamed as it is recorded.\n"
 		"Options:\n"
 		"%*s, %-*s "OPT_CHANNELS_EXPLAIN"\n"
 		"%*s, %-*s "OPT_BITS_EXPLAIN"\n"
 		"%*s, %-*s "OPT_RATE_EXPLAIN"\n"
 		"%*s, %-*s "OPT_DURATION_EXPLAIN"\n"
+		"%*s, %-*s "OPT_RING_EXPLAIN"\n"
+		"%*s, %-*s "OPT_HEADER_EXPLAIN"\n"
+		"%*s, %-*s "OPT_DEVICE_EXPLAIN"\n"
+		"%*s, %-*s "OPT_MERGE_EXPLAIN"\n"
+		"%*s, %-*s "OPT_FAST_EXPLAIN"\n"
+		"%*s, %-*s "OPT_LIST_EXPLAIN"\n"
+		"%*s, %-*s "OPT_FLAC_EXPLAIN"\n"
+		"%*s, %-*s "OPT_RAW_EXPLAIN"\n"
+		"%*s, %-*s "OPT_INDEX_EXPLAIN"\n"
+		"%*s, %-*s "OPT_VOX_EXPLAIN"\n"
+		"%*s, %-*s "OPT_PREROLL_EXPLAIN"\n"
+		"%*s, %-*s "OPT_HANGOVER_EXPLAIN"\n"
+		"%*s, %-*s "OPT_RETRO_EXPLAIN"\n"
+		"%*s, %-*s "OPT_PUBLISH_EXPLAIN"\n"
+		"%*s, %-*s "OPT_OVERWRITE_EXPLAIN"\n"
+		"%*s, %-*s "OPT_STATS_EXPLAIN"\n"
+		"%*s, %-*s "OPT_JSON_EXPLAIN"\n"
 		"%*s, %-*s "OPT_QUIET_EXPLAIN"\n"
 		"%*s, %-*s "OPT_HELP_EXPLAIN"\n"
 		"Example:\n"
@@ -354,6 +1633,23 @@ void print_usage(FILE *fp, const char *prog_name)
         s_opt_width, OPT_BITS_SHORT" NUM", 	    l_opt_width, OPT_BITS_LONG"NUM",
         s_opt_width, OPT_RATE_SHORT" NUM", 	    l_opt_width, OPT_RATE_LONG"NUM",
         s_opt_width, OPT_DURATION_SHORT" NUM", 	l_opt_width, OPT_DURATION_LONG"NUM",
+        s_opt_width, OPT_RING_SHORT" NUM",      l_opt_width, OPT_RING_LONG"NUM",
+        s_opt_width, OPT_HEADER_SHORT" NUM",    l_opt_width, OPT_HEADER_LONG"NUM",
+        s_opt_width, OPT_DEVICE_SHORT" NAME",   l_opt_width, OPT_DEVICE_LONG"NAME",
+        s_opt_width, OPT_MERGE_SHORT,           l_opt_width, OPT_MERGE_LONG,
+        s_opt_width, OPT_FAST_SHORT,            l_opt_width, OPT_FAST_LONG,
+        s_opt_width, OPT_LIST_SHORT,            l_opt_width, OPT_LIST_LONG,
+        s_opt_width, OPT_FLAC_SHORT,            l_opt_width, OPT_FLAC_LONG,
+        s_opt_width, OPT_RAW_SHORT,             l_opt_width, OPT_RAW_LONG,
+        s_opt_width, OPT_INDEX_SHORT,           l_opt_width, OPT_INDEX_LONG,
+        s_opt_width, OPT_VOX_SHORT" NUM",       l_opt_width, OPT_VOX_LONG"NUM",
+        s_opt_width, OPT_PREROLL_SHORT" NUM",   l_opt_width, OPT_PREROLL_LONG"NUM",
+        s_opt_width, OPT_HANGOVER_SHORT" NUM",  l_opt_width, OPT_HANGOVER_LONG"NUM",
+        s_opt_width, OPT_RETRO_SHORT" NUM",     l_opt_width, OPT_RETRO_LONG"NUM",
+        s_opt_width, OPT_PUBLISH_SHORT" NAME",  l_opt_width, OPT_PUBLISH_LONG"NAME",
+        s_opt_width, OPT_OVERWRITE_SHORT,       l_opt_width, OPT_OVERWRITE_LONG,
+        s_opt_width, OPT_STATS_SHORT" NUM",     l_opt_width, OPT_STATS_LONG"NUM",
+        s_opt_width, OPT_JSON_SHORT" FILE",     l_opt_width, OPT_JSON_LONG"FILE",
         s_opt_width, OPT_QUIET_SHORT,           l_opt_width, OPT_QUIET_LONG,
 		s_opt_width, OPT_HELP_SHORT, 			l_opt_width, OPT_HELP_LONG,
 
@@ -374,6 +1670,23 @@ void init_options(options_t *dst)
         dst->channels       = OPT_CHANNELS_DEFAULT;
         dst->help           = OPT_HELP_DEFAULT;
         dst->quiet          = OPT_QUIET_DEFAULT;
+        dst->ring_ms        = OPT_RING_DEFAULT;
+        dst->header_ms      = OPT_HEADER_DEFAULT;
+        dst->vox_db         = OPT_VOX_DEFAULT;
+        dst->preroll_ms     = OPT_PREROLL_DEFAULT;
+        dst->hangover_ms    = OPT_HANGOVER_DEFAULT;
+        dst->retro_s        = OPT_RETRO_DEFAULT;
+        dst->ndevices       = 0;
+        dst->merge          = OPT_MERGE_DEFAULT;
+        dst->fast           = OPT_FAST_DEFAULT;
+        dst->list           = OPT_LIST_DEFAULT;
+        dst->flac           = OPT_FLAC_DEFAULT;
+        dst->raw            = OPT_RAW_DEFAULT;
+        dst->index          = OPT_INDEX_DEFAULT;
+        dst->publish        = NULL;
+        dst->overwrite      = OPT_OVERWRITE_DEFAULT;
+        dst->stats_ms       = OPT_STATS_DEFAULT;
+        dst->json           = NULL;
     }
 }
 
@@ -411,12 +1724,60 @@ int parse_options(int argc, char **argv, int *current_arg_index, options_t *dst)
 			dst->help = 1;
 			argi++;
 		}
+		else if (strcmp(argv[argi], OPT_DEVICE_SHORT) == 0 || startswith(argv[argi], OPT_DEVICE_LONG))
+		{
+			if (dst->ndevices == WAVRECORDER_MAX_DEVICES ||
+			    parse_str_opt(argc, argv, &argi, &dst->devices[dst->ndevices]) != 0)
+			{
+				ret = 1;
+			}
+			else
+			{
+			    dst->ndevices++;
+			    argi++;
+			}
+		}
+		else if (strcmp(argv[argi], OPT_MERGE_SHORT) == 0 || startswith(argv[argi], OPT_MERGE_LONG))
+		{
+			dst->merge = 1;
+			argi++;
+		}
+		else if (strcmp(argv[argi], OPT_FAST_SHORT) == 0 || startswith(argv[argi], OPT_FAST_LONG))
+		{
+			dst->fast = 1;
+			argi++;
+		}
+		else if (strcmp(argv[argi], OPT_LIST_SHORT) == 0 || startswith(argv[argi], OPT_LIST_LONG))
+		{
+			dst->list = 1;
+			argi++;
+		}
+		else if (strcmp(argv[argi], OPT_FLAC_SHORT) == 0 || startswith(argv[argi], OPT_FLAC_LONG))
+		{
+			dst->flac = 1;
+			argi++;
+		}
+		else if (strcmp(argv[argi], OPT_RAW_SHORT) == 0 || startswith(argv[argi], OPT_RAW_LONG))
+		{
+			dst->raw = 1;
+			argi++;
+		}
+		else if (strcmp(argv[argi], OPT_INDEX_SHORT) == 0 || startswith(argv[argi], OPT_INDEX_LONG))
+		{
+			dst->index = 1;
+			argi++;
+		}
+		else if (strcmp(argv[argi], OPT_OVERWRITE_SHORT) == 0 || startswith(argv[argi], OPT_OVERWRITE_LONG))
+		{
+			dst->overwrite = 1;
+			argi++;
+		}
 		else if (strcmp(argv[argi], OPT_QUIET_SHORT) == 0 || startswith(argv[argi], OPT_QUIET_LONG))
 		{
 			dst->quiet = 1;
 			argi++;
 		}
-		else if (strcmp(argv[argi], OPT_RATE_SHORT) == 0 || startswith(argv[argi], OPT_RATE_LONG"="))
+		else if (strcmp(argv[argi], OPT_RATE_SHORT) == 0 || startswith(argv[argi], OPT_RATE_LONG))
 		{
 			if (parse_int32_t_opt(argc, argv, &argi, &dst->rate) != 0)
 			{
@@ -427,7 +1788,7 @@ int parse_options(int argc, char **argv, int *current_arg_index, options_t *dst)
 			    argi++;
 			}
 		}
-		else if (strcmp(argv[argi], OPT_BITS_SHORT) == 0 || startswith(argv[argi], OPT_BITS_LONG"="))
+		else if (strcmp(argv[argi], OPT_BITS_SHORT) == 0 || startswith(argv[argi], OPT_BITS_LONG))
 		{
 			if (parse_int16_t_opt(argc, argv, &argi, &dst->bitdepth) != 0)
 			{
@@ -438,7 +1799,7 @@ int parse_options(int argc, char **argv, int *current_arg_index, options_t *dst)
 			    argi++;
 			}
 		}
-		else if (strcmp(argv[argi], OPT_DURATION_SHORT) == 0 || startswith(argv[argi], OPT_DURATION_LONG"="))
+		else if (strcmp(argv[argi], OPT_DURATION_SHORT) == 0 || startswith(argv[argi], OPT_DURATION_LONG))
 		{
 			if (parse_int32_t_opt(argc, argv, &argi, &dst->duration) != 0)
 			{
@@ -449,7 +1810,106 @@ int parse_options(int argc, char **argv, int *current_arg_index, options_t *dst)
 			    argi++;
 			}
 		}
-		else if (strcmp(argv[argi], OPT_CHANNELS_SHORT) == 0 || startswith(argv[argi], OPT_CHANNELS_LONG"="))
+		else if (strcmp(argv[argi], OPT_RING_SHORT) == 0 || startswith(argv[argi], OPT_RING_LONG))
+		{
+			if (parse_int32_t_opt(argc, argv, &argi, &dst->ring_ms) != 0 || dst->ring_ms < 0)
+			{
+				ret = 1;
+			}
+			else
+			{
+			    argi++;
+			}
+		}
+		else if (strcmp(argv[argi], OPT_HEADER_SHORT) == 0 || startswith(argv[argi], OPT_HEADER_LONG))
+		{
+			if (parse_int32_t_opt(argc, argv, &argi, &dst->header_ms) != 0 || dst->header_ms < 0)
+			{
+				ret = 1;
+			}
+			else
+			{
+			    argi++;
+			}
+		}
+		else if (strcmp(argv[argi], OPT_VOX_SHORT) == 0 || startswith(argv[argi], OPT_VOX_LONG))
+		{
+			if (parse_int32_t_opt(argc, argv, &argi, &dst->vox_db) != 0 || dst->vox_db > 0)
+			{
+				ret = 1;
+			}
+			else
+			{
+			    argi++;
+			}
+		}
+		else if (strcmp(argv[argi], OPT_PREROLL_SHORT) == 0 || startswith(argv[argi], OPT_PREROLL_LONG))
+		{
+			if (parse_int32_t_opt(argc, argv, &argi, &dst->preroll_ms) != 0 || dst->preroll_ms < 0)
+			{
+				ret = 1;
+			}
+			else
+			{
+			    argi++;
+			}
+		}
+		else if (strcmp(argv[argi], OPT_HANGOVER_SHORT) == 0 || startswith(argv[argi], OPT_HANGOVER_LONG))
+		{
+			if (parse_int32_t_opt(argc, argv, &argi, &dst->hangover_ms) != 0 || dst->hangover_ms < 0)
+			{
+				ret = 1;
+			}
+			else
+			{
+			    argi++;
+			}
+		}
+		else if (strcmp(argv[argi], OPT_STATS_SHORT) == 0 || startswith(argv[argi], OPT_STATS_LONG))
+		{
+			if (parse_int32_t_opt(argc, argv, &argi, &dst->stats_ms) != 0 || dst->stats_ms < 0)
+			{
+				ret = 1;
+			}
+			else
+			{
+			    argi++;
+			}
+		}
+		else if (strcmp(argv[argi], OPT_PUBLISH_SHORT) == 0 || startswith(argv[argi], OPT_PUBLISH_LONG))
+		{
+			if (parse_str_opt(argc, argv, &argi, &dst->publish) != 0)
+			{
+				ret = 1;
+			}
+			else
+			{
+			    argi++;
+			}
+		}
+		else if (strcmp(argv[argi], OPT_JSON_SHORT) == 0 || startswith(argv[argi], OPT_JSON_LONG))
+		{
+			if (parse_str_opt(argc, argv, &argi, &dst->json) != 0)
+			{
+				ret = 1;
+			}
+			else
+			{
+			    argi++;
+			}
+		}
+		else if (strcmp(argv[argi], OPT_RETRO_SHORT) == 0 || startswith(argv[argi], OPT_RETRO_LONG))
+		{
+			if (parse_int32_t_opt(argc, argv, &argi, &dst->retro_s) != 0 || dst->retro_s < 0)
+			{
+				ret = 1;
+			}
+			else
+			{
+			    argi++;
+			}
+		}
+		else if (strcmp(argv[argi], OPT_CHANNELS_SHORT) == 0 || startswith(argv[argi], OPT_CHANNELS_LONG))
 		{
 			if (parse_int16_t_opt(argc, argv, &argi, &dst->channels) != 0)
 			{
@@ -466,6 +1926,11 @@ int parse_options(int argc, char **argv, int *current_arg_index, options_t *dst)
 		    argi++;
 		    break;
 		}
+		else if (strcmp(argv[argi], "-") == 0)
+		{
+		    // standard output, as the destination file
+		    break;
+		}
 		else if (startswith(argv[argi], "-")|| startswith(argv[argi], "--"))
 		{
 		    // we have encountered an unrecognised option
@@ -485,3 +1950,44 @@ int parse_options(int argc, char **argv, int *current_arg_index, options_t *dst)
 
 	return ret;
 }
+
+/* Waits for the other end of a ring to catch up: for as long as a device
+ * takes to capture nframes if it runs in real time, or briefly if it
+ * produces samples as fast as they are written.
+ */
+static void ring_wait(capturesched_t *sched, int realtime, int32_t nframes)
+{
+    const struct timespec brief = { 0, 200000 };
+
+    if (realtime)
+    {
+        capturesched_wait(sched, 0, nframes);
+    }
+    else
+    {
+        nanosleep(&brief, NULL);
+    }
+}
+
+/* returns the CPU time used by every thread of the process so far, in seconds */
+static double cpu_seconds(void)
+{
+    struct rusage ru;
+
+    if (getrusage(RUSAGE_SELF, &ru) != 0)
+    {
+        return 0;
+    }
+
+    return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec
+        + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+/* returns the nanoseconds since t, on the monotonic clock */
+static int64_t ns_since(const struct timespec *t)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t) (now.tv_sec - t->tv_sec) * 1000000000 + (now.tv_nsec - t->tv_nsec);
+}
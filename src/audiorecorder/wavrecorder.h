@@ -9,9 +9,22 @@
 extern "C" {
 #endif
 
+#include <pthread.h>
+#include <stdatomic.h>
+
 #include "wav.h"
+#include "ringbuf.h"
+#include "wavfile.h"
+#include "flacfile.h"
+#include "vox.h"
+#include "retrobuf.h"
+#include "onsetindex.h"
+#include "shmring.h"
+#include "capturesource.h"
+#include "histogram.h"
 
 #define WAVRECORDER_BUFSIZE     8192
+#define WAVRECORDER_MAX_DEVICES 8       // devices that can record at once
 
 #define STR(s) STR_2(s)
 #define STR_2(s) #s
@@ -38,6 +51,88 @@ extern "C" {
 #define OPT_CHANNELS_DEFAULT    1
 #define OPT_CHANNELS_EXPLAIN	"set number of audio channels (default: " STR(OPT_CHANNELS_DEFAULT) ")"
 
+#define OPT_RING_SHORT          "-B"
+#define OPT_RING_LONG           "--buffer-ms="
+#define OPT_RING_DEFAULT        2000
+#define OPT_RING_EXPLAIN        "set how much audio, in milliseconds, may wait to be written to disk (default: " STR(OPT_RING_DEFAULT) ")"
+
+#define OPT_HEADER_SHORT        "-i"
+#define OPT_HEADER_LONG         "--header-interval="
+#define OPT_HEADER_DEFAULT      1000
+#define OPT_HEADER_EXPLAIN      "update the WAV header every NUM milliseconds, or 0 only at the end (default: " STR(OPT_HEADER_DEFAULT) ")"
+
+#define OPT_FLAC_SHORT          "-f"
+#define OPT_FLAC_LONG           "--flac"
+#define OPT_FLAC_DEFAULT        0
+#define OPT_FLAC_EXPLAIN        "compress losslessly to FLAC as the audio is written, which is also done for a <FILE> ending in .flac (8 to 24 bits per sample)"
+
+#define OPT_RAW_SHORT           "-r"
+#define OPT_RAW_LONG            "--raw"
+#define OPT_RAW_DEFAULT         0
+#define OPT_RAW_EXPLAIN         "write the samples alone, with no WAV header"
+
+#define OPT_INDEX_SHORT         "-x"
+#define OPT_INDEX_LONG          "--index"
+#define OPT_INDEX_DEFAULT       0
+#define OPT_INDEX_EXPLAIN       "also write the level of every " STR(ONSETINDEX_FRAMES) " samples, and where it jumps, to <FILE>" ONSETINDEX_EXT ", which the transcriber uses to skip silence"
+
+#define OPT_VOX_SHORT           "-l"
+#define OPT_VOX_LONG            "--level="
+#define OPT_VOX_DEFAULT         0
+#define OPT_VOX_EXPLAIN         "only record while the level is above NUM dBFS (below 0), into numbered files (default: off)"
+
+#define OPT_PREROLL_SHORT       "-p"
+#define OPT_PREROLL_LONG        "--pre-roll="
+#define OPT_PREROLL_DEFAULT     500
+#define OPT_PREROLL_EXPLAIN     "with " OPT_VOX_LONG ", keep NUM milliseconds from before the level was reached (default: " STR(OPT_PREROLL_DEFAULT) ")"
+
+#define OPT_HANGOVER_SHORT      "-g"
+#define OPT_HANGOVER_LONG       "--hangover="
+#define OPT_HANGOVER_DEFAULT    2000
+#define OPT_HANGOVER_EXPLAIN    "with " OPT_VOX_LONG ", end a file after NUM milliseconds below the level (default: " STR(OPT_HANGOVER_DEFAULT) ")"
+
+#define OPT_RETRO_SHORT         "-k"
+#define OPT_RETRO_LONG          "--keep-last="
+#define OPT_RETRO_DEFAULT       0
+#define OPT_RETRO_EXPLAIN       "keep only the last NUM seconds, in memory, and write them to a numbered file each time SIGUSR1 is received, without stopping; use with " OPT_DURATION_LONG "0 to run until stopped (default: off)"
+
+#define OPT_DEVICE_SHORT        "-D"
+#define OPT_DEVICE_LONG         "--device="
+#define OPT_DEVICE_EXPLAIN      "record from the capture device NAME; give up to " STR(WAVRECORDER_MAX_DEVICES) " times to record several at once, into <FILE>-dev1, <FILE>-dev2... NAME may also be " CAPTURESOURCE_SYNTH_PREFIX "sine[:HZ], " CAPTURESOURCE_SYNTH_PREFIX "noise, " CAPTURESOURCE_SYNTH_PREFIX "silence or " CAPTURESOURCE_SYNTH_PREFIX "FILE.wav for a synthetic device (default: the default device)"
+
+#define OPT_MERGE_SHORT         "-m"
+#define OPT_MERGE_LONG          "--merge"
+#define OPT_MERGE_DEFAULT       0
+#define OPT_MERGE_EXPLAIN       "with several devices, write the channels of every device to the one file"
+
+#define OPT_FAST_SHORT          "-F"
+#define OPT_FAST_LONG           "--fast"
+#define OPT_FAST_DEFAULT        0
+#define OPT_FAST_EXPLAIN        "run synthetic devices as fast as their audio can be written, rather than in real time"
+
+#define OPT_LIST_SHORT          "-L"
+#define OPT_LIST_LONG           "--list-devices"
+#define OPT_LIST_DEFAULT        0
+#define OPT_LIST_EXPLAIN        "list the names of the capture devices, then exit"
+
+#define OPT_PUBLISH_SHORT       "-P"
+#define OPT_PUBLISH_LONG        "--publish="
+#define OPT_PUBLISH_EXPLAIN     "also publish the audio as it is recorded to the shared memory ring NAME, which transcribers read as " SHMRING_PREFIX "NAME; with /dev/null as <FILE>, nothing goes to disk (default: off)"
+
+#define OPT_OVERWRITE_SHORT     "-O"
+#define OPT_OVERWRITE_LONG      "--overwrite"
+#define OPT_OVERWRITE_DEFAULT   0
+#define OPT_OVERWRITE_EXPLAIN   "with " OPT_PUBLISH_LONG ", let a transcriber that falls behind lose audio, rather than hold up the recording"
+
+#define OPT_STATS_SHORT         "-S"
+#define OPT_STATS_LONG          "--stats-interval="
+#define OPT_STATS_DEFAULT       0
+#define OPT_STATS_EXPLAIN       "print statistics on device backlog, loop and write times, and lost samples to stderr every NUM milliseconds (default: off)"
+
+#define OPT_JSON_SHORT          "-j"
+#define OPT_JSON_LONG           "--json="
+#define OPT_JSON_EXPLAIN        "when recording ends, write the statistics as JSON to FILE, or - for stdout unless the audio goes there (default: off)"
+
 #define OPT_QUIET_SHORT		    "-q"
 #define OPT_QUIET_LONG		    "--quiet"
 #define OPT_QUIET_DEFAULT	    0
@@ -53,33 +148,129 @@ extern "C" {
 typedef struct options
 {
 	int32_t duration;   // maximum duration of recording
+	int32_t ring_ms;    // milliseconds of audio buffered for the writer thread
+	int32_t header_ms;  // milliseconds between updates of the WAV header
+
+	int32_t vox_db;     // level which triggers recording in dBFS, or 0 for always
+	int32_t preroll_ms; // milliseconds kept from before the level was reached
+	int32_t hangover_ms; // milliseconds below the level before a file ends
+	int32_t retro_s;    // seconds kept for retroactive saves, or 0 for none
 
 	int16_t channels;   // number of recording channels
     int32_t rate;       // sample rate
     int16_t bitdepth;   // resolution (number of bits) for a sample
 
+    char *devices[WAVRECORDER_MAX_DEVICES]; // names of the devices to record
+    int ndevices;       // number of names in devices, 0 for the default device
+    int merge;          // if set, all devices are recorded into one file
+    int fast;           // if set, synthetic devices are not run in real time
+    int list;           // if set, program will list capture devices and exit
+    int flac;           // if set, files are written as FLAC rather than WAV
+    int raw;            // if set, samples are written with no header
+    int index;          // if set, an onset index is written beside each file
+    char *publish;      // shared memory ring the audio is published to, or NULL
+    int overwrite;      // if set, readers of the ring that fall behind lose audio
+
+    int32_t stats_ms;   // milliseconds between statistics lines, 0 for none
+    char *json;         // file the final statistics are written to, or NULL
+
     int help;           // if set, program will show usage and exit
     int quiet;          // if set, all non-critical output will be suppressed
 
 } options_t;
 
+/* a file being recorded to, in either of the formats audio can be written in */
+typedef struct outfile
+{
+    int         is_flac;        // whether the file is FLAC rather than WAV
+    wavfile_t   wav;
+    flacfile_t  flac;
+
+    int         has_index;      // whether index is being written
+    onsetindex_writer_t index;  // levels and onset candidates of the samples
+} outfile_t;
+
+struct wavrecorder;
+
+/* one capture device, and unless devices are merged, the file it records to */
+typedef struct capturedev
+{
+    struct wavrecorder *rec;    // recording this device is part of
+    const char  *name;          // device name, or NULL for the default device
+    char        *fname;         // destination filename, if not merged
+
+    capturesource_t src;        // input device
+    int         src_open;       // whether src is open
+    unsigned char *buf;         // where samples that are dropped are captured to
+
+    ringbuf_t   ring;           // captured audio waiting to be written
+    pthread_t   capturer;       // thread which drains dev into ring
+    pthread_t   writer;         // thread which writes the ring to out
+    int         capturing;      // whether capturer was started
+    int         writing;        // whether writer was started
+
+    struct timespec started;    // when capture was started
+    uint64_t    skip;           // samples captured before the last device started
+    _Atomic uint64_t nsamples;  // samples captured since the last device started
+    _Atomic uint64_t rate_mhz;  // sample rate measured from the device, in mHz
+    _Atomic uint64_t dropped;   // samples lost because the ring was full
+    uint64_t    lost;           // samples lost because the device was not drained in time
+    _Atomic uint64_t errors;    // reads from the device which failed
+    int32_t     bufframes;      // sample frames the device can hold before losing any
+
+    /* how close the device comes to losing audio. When merging, the write
+     * times of the merged file are those of the first device.
+     */
+    histogram_t backlog;        // sample frames waiting in the device at each poll
+    histogram_t loop_ns;        // time each pass of the capture loop takes, less sleeping
+    histogram_t write_ns;       // time each write to the output file takes
+
+    outfile_t   out;            // output file
+    int         out_open;       // whether out is open
+
+    int         use_vox;        // whether recording is level-triggered
+    vox_t       vox;            // level detector and pre-roll
+    unsigned int nfiles;        // number of level-triggered or saved files started
+
+    int         use_retro;      // whether only the latest audio is kept, until saved
+    retrobuf_t  retro;          // the latest audio
+    unsigned int saves;         // number of saves asked for that were seen
+} capturedev_t;
+
 typedef struct wavrecorder
 {
     const char  *fname;         // destination filename
-    const char  *devname;       // recording device name
 
-	ALCdevice   *dev;           // input device
+    capturedev_t devs[WAVRECORDER_MAX_DEVICES];
+    unsigned int ndevs;         // number of devices recording
+    atomic_uint running;        // number of capture threads still running
+
+    int         merge;          // whether every device is written to out
+    int         flac;           // whether files are written as FLAC
+    int         raw;            // whether samples are written with no header
+    int         index;          // whether files are indexed
+    outfile_t   out;            // output file, when merging
+    int         out_open;       // whether out is open
+    int32_t     header_ms;      // milliseconds between header updates of files
 
-    unsigned char   *buf;       // input buffer
-    size_t     bufsize;         // length of input buffer
-    int32_t     bufnmemb;       // how many samples the buffer can hold
+    int         publishing;     // whether the audio written is also published
+    shmring_t   shm;            // where it is published, for transcribers
+    uint64_t    shm_waits;      // blocks that had to wait for a transcriber
+    uint64_t    shm_lost;       // blocks not published, once recording stopped
 
-    FILE        *outfp;         // output file
+    size_t     bufsize;         // length of a block of samples from one device
+    int32_t     bufnmemb;       // how many samples a block can hold
 
-    uint32_t      nsamples;     // sample count
+    atomic_int  write_err;      // set by a writer if writing fails
+
+    uint64_t    maxsamples;     // samples to record from each device, 0 for no limit
 
 	int16_t      blockalign;    // bytes per sample times number of channels
 	int16_t     bitdepth;       // bits per sample
+	int16_t     channels;       // number of audio channels of each device
+	int32_t     rate;           // sample rate
+
+    FILE        *msg;           // where messages go: stdout, unless the audio goes there
 
     int silent; // whether or not to suppress informational messages
 } wavrecorder_t;
@@ -101,14 +292,6 @@ void init_options(options_t *o);
 /* validates and retrieves program options from the command line arguments */
 int parse_options(int argc, char **argv, int *current_arg_index, options_t *dst);
 
-/* returns the appropriate OpenAL enum value for the given recording format.
- *
- * parameters:
- *    bitdepth: number of bits in each recorded sample
- *    nchannels: number of channels
- */
-ALenum get_al_format(int bitdepth, int nchannels);
-
 #if defined(__cplusplus)
 }
 #endif
@@ -0,0 +1,400 @@
+/* clipbatch.c
+ *
+ * The kernels are written once, over GCC's generic vectors of a sample
+ * from every lane, and built for each x86 level by inlining them into a
+ * function with that level's target attribute.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "clipbatch.h"
+#include "yinpitch.h"
+#include "dsp.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CLIPBATCH_X86 1
+#endif
+
+// a sample, or a sum, from every lane
+typedef float lanes_t __attribute__((vector_size(CLIPBATCH_LANES * sizeof(float))));
+typedef double dlanes_t __attribute__((vector_size(CLIPBATCH_LANES * sizeof(double))));
+
+/* the kernels which differ from level to level */
+typedef struct lane_kernels
+{
+    void (*slide)(dlanes_t *diff, const lanes_t *x, unsigned int lags, unsigned int hopsize);
+    void (*recompute)(dlanes_t *diff, const lanes_t *x, unsigned int lags);
+    void (*energy)(dlanes_t *sumsq, const lanes_t *x, size_t n);
+    void (*spectrum)(clipbatch_t *cb);
+} lane_kernels_t;
+
+static const lane_kernels_t *kernels(void);
+static void *alloc_lanes(size_t n, size_t size);
+static float lane_hfc(const clipbatch_t *cb, unsigned int lane);
+static float lane_pitch(clipbatch_t *cb, unsigned int lane, double energy);
+
+/* The window slides on a sample at a time through the hop at x, as in
+ * yinpitch.c: at each lag the newest sample enters the sum, and the oldest
+ * of the newer half of the window leaves it.
+ */
+static inline __attribute__((always_inline))
+void slide_body(dlanes_t *diff, const lanes_t *x, unsigned int lags, unsigned int hopsize)
+{
+    lanes_t newest, oldest;
+    dlanes_t in, out;
+
+    for (unsigned int k = 0; k < hopsize; k++, x++)
+    {
+        newest = x[0];
+        oldest = x[-(int) lags];
+
+        for (unsigned int tau = 0; tau < lags; tau++)
+        {
+            in = __builtin_convertvector(newest - x[-(int) tau], dlanes_t);
+            out = __builtin_convertvector(oldest - x[-(int) (lags + tau)], dlanes_t);
+            diff[tau] += in * in - out * out;
+        }
+    }
+}
+
+static inline __attribute__((always_inline))
+void recompute_body(dlanes_t *diff, const lanes_t *x, unsigned int lags)
+{
+    dlanes_t sum, d;
+
+    for (unsigned int tau = 0; tau < lags; tau++)
+    {
+        sum = (dlanes_t) { 0 };
+        for (unsigned int j = lags; j < 2 * lags; j++)
+        {
+            d = __builtin_convertvector(x[j] - x[j - tau], dlanes_t);
+            sum += d * d;
+        }
+        diff[tau] = sum;
+    }
+}
+
+static inline __attribute__((always_inline))
+void energy_body(dlanes_t *sumsq, const lanes_t *x, size_t n)
+{
+    dlanes_t sum = { 0 }, d;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        d = __builtin_convertvector(x[i], dlanes_t);
+        sum += d * d;
+    }
+
+    *sumsq = sum;
+}
+
+/* the power spectrum of the windowed frame, found as fft_real finds it */
+static inline __attribute__((always_inline))
+void spectrum_body(clipbatch_t *cb)
+{
+    const fft_t *f = &cb->fft;
+    const unsigned int half = f->size / 2;
+    const lanes_t *frame = (const lanes_t *) cb->frame;
+    const float *hann = cb->hann;
+    lanes_t *zr = (lanes_t *) cb->z_re, *zi = (lanes_t *) cb->z_im;
+    lanes_t *power = (lanes_t *) cb->power;
+    lanes_t tr, ti, cr, ci, ere, eim, ore, oim, re, im;
+    float wr, wi;
+    unsigned int stride, j;
+
+    for (unsigned int m = 0; m < half; m++)
+    {
+        zr[f->bitrev[m]] = frame[2 * m] * hann[2 * m];
+        zi[f->bitrev[m]] = frame[2 * m + 1] * hann[2 * m + 1];
+    }
+
+    for (unsigned int len = 2; len <= half; len <<= 1)
+    {
+        stride = f->size / len;
+
+        for (unsigned int i = 0; i < half; i += len)
+        {
+            for (j = 0; j < len / 2; j++)
+            {
+                wr = f->tw_re[j * stride];
+                wi = f->tw_im[j * stride];
+
+                tr = wr * zr[i + j + len / 2] - wi * zi[i + j + len / 2];
+                ti = wr * zi[i + j + len / 2] + wi * zr[i + j + len / 2];
+
+                zr[i + j + len / 2] = zr[i + j] - tr;
+                zi[i + j + len / 2] = zi[i + j] - ti;
+                zr[i + j] += tr;
+                zi[i + j] += ti;
+            }
+        }
+    }
+
+    for (unsigned int k = 0; k <= half; k++)
+    {
+        j = (half - k) % half;
+        cr = zr[j];
+        ci = -zi[j];
+
+        j = k % half;
+        ere = (zr[j] + cr) / 2;
+        eim = (zi[j] + ci) / 2;
+        ore = (zi[j] - ci) / 2;
+        oim = (cr - zr[j]) / 2;
+
+        wr = k < half ? f->tw_re[k] : -1;
+        wi = k < half ? f->tw_im[k] : 0;
+
+        re = ere + wr * ore - wi * oim;
+        im = eim + wr * oim + wi * ore;
+        power[k] = re * re + im * im;
+    }
+}
+
+/* builds every kernel for one level, given its target attribute */
+#define LANE_KERNELS(level, ...) \
+    __VA_ARGS__ static void slide_##level(dlanes_t *diff, const lanes_t *x, \
+        unsigned int lags, unsigned int hopsize) \
+    { \
+        slide_body(diff, x, lags, hopsize); \
+    } \
+    __VA_ARGS__ static void recompute_##level(dlanes_t *diff, const lanes_t *x, \
+        unsigned int lags) \
+    { \
+        recompute_body(diff, x, lags); \
+    } \
+    __VA_ARGS__ static void energy_##level(dlanes_t *sumsq, const lanes_t *x, size_t n) \
+    { \
+        energy_body(sumsq, x, n); \
+    } \
+    __VA_ARGS__ static void spectrum_##level(clipbatch_t *cb) \
+    { \
+        spectrum_body(cb); \
+    } \
+    static const lane_kernels_t level##_kernels = { \
+        slide_##level, recompute_##level, energy_##level, spectrum_##level \
+    };
+
+LANE_KERNELS(portable, )
+
+#if defined(CLIPBATCH_X86)
+LANE_KERNELS(avx2, __attribute__((target("avx2"))))
+LANE_KERNELS(avx512, __attribute__((target("avx512f"))))
+#endif
+
+int init_clipbatch(clipbatch_t *cb,
+    unsigned int lanes,
+    unsigned int winsize,
+    unsigned int hopsize,
+    unsigned int pitchsize,
+    unsigned int samplerate,
+    float silence_db,
+    float minioi_ms
+)
+{
+    if (!cb || lanes == 0 || lanes > CLIPBATCH_LANES || hopsize == 0 ||
+        hopsize > winsize || pitchsize < 8 || hopsize > pitchsize || samplerate == 0)
+    {
+        return 1;
+    }
+
+    memset(cb, 0, sizeof(*cb));
+    if (init_fft(&cb->fft, winsize) != 0)
+    {
+        return 1;
+    }
+
+    cb->lanes = lanes;
+    cb->winsize = winsize;
+    cb->hopsize = hopsize;
+    cb->pitchsize = pitchsize;
+    cb->samplerate = samplerate;
+    cb->silence_db = silence_db;
+
+    // every window and frame starts out silent
+    cb->window = alloc_lanes(pitchsize + hopsize, sizeof(lanes_t));
+    cb->diff = alloc_lanes(pitchsize / 2, sizeof(dlanes_t));
+    cb->lane_diff = malloc(pitchsize / 2 * sizeof(double));
+    cb->lane_cmnd = malloc(pitchsize / 2 * sizeof(float));
+    cb->frame = alloc_lanes(winsize + hopsize, sizeof(lanes_t));
+    cb->hann = malloc(winsize * sizeof(float));
+    cb->z_re = alloc_lanes(winsize / 2, sizeof(lanes_t));
+    cb->z_im = alloc_lanes(winsize / 2, sizeof(lanes_t));
+    cb->power = alloc_lanes(winsize / 2 + 1, sizeof(lanes_t));
+
+    if (!cb->window || !cb->diff || !cb->lane_diff || !cb->lane_cmnd || !cb->frame ||
+        !cb->hann || !cb->z_re || !cb->z_im || !cb->power)
+    {
+        free_clipbatch(cb);
+        return 1;
+    }
+
+    // as onsetdetect.c builds it, so the spectra match
+    for (unsigned int i = 0; i < winsize; i++)
+    {
+        cb->hann[i] = 0.5 - 0.5 * cos(2 * M_PI * i / winsize);
+    }
+
+    for (unsigned int l = 0; l < lanes; l++)
+    {
+        init_onsetpicker(&cb->pickers[l], hopsize, samplerate, silence_db, minioi_ms);
+    }
+
+    return 0;
+}
+
+void free_clipbatch(clipbatch_t *cb)
+{
+    if (cb != NULL)
+    {
+        free_fft(&cb->fft);
+        free(cb->window);
+        free(cb->diff);
+        free(cb->lane_diff);
+        free(cb->lane_cmnd);
+        free(cb->frame);
+        free(cb->hann);
+        free(cb->z_re);
+        free(cb->z_im);
+        free(cb->power);
+        cb->window = cb->lane_cmnd = cb->frame = cb->hann = NULL;
+        cb->z_re = cb->z_im = cb->power = NULL;
+        cb->diff = cb->lane_diff = NULL;
+    }
+}
+
+void clipbatch_do(clipbatch_t *cb, const float *const *hops, float *pitches, int *onsets,
+    double *sumsq)
+{
+    const lane_kernels_t *k = kernels();
+    const unsigned int lags = cb->pitchsize / 2;
+    lanes_t *window = (lanes_t *) cb->window;
+    lanes_t *hop = window + cb->pitchsize;
+    dlanes_t *diff = (dlanes_t *) cb->diff;
+    dlanes_t hop_sumsq, energy;
+    const float *src;
+    int slide;
+
+    // lay the hops out side by side, with silence for the clips that have ended
+    for (unsigned int l = 0; l < CLIPBATCH_LANES; l++)
+    {
+        src = l < cb->lanes ? hops[l] : NULL;
+        for (unsigned int i = 0; i < cb->hopsize; i++)
+        {
+            hop[i][l] = src ? src[i] : 0;
+        }
+    }
+    memcpy((lanes_t *) cb->frame + cb->winsize, hop, cb->hopsize * sizeof(lanes_t));
+
+    k->energy(&hop_sumsq, hop, cb->hopsize);
+
+    // of the pitch window once it has moved on
+    k->energy(&energy, window + cb->hopsize, cb->pitchsize);
+
+    /* the difference functions slide as yinpitch_do's do, unless that
+     * would not do for any clip still playing, in which case all of them
+     * are recomputed
+     */
+    slide = 2 * cb->hopsize < lags &&
+        cb->since_refresh < (unsigned long) YINPITCH_REFRESH * cb->pitchsize;
+    for (unsigned int l = 0; l < cb->lanes && slide; l++)
+    {
+        slide = !hops[l] || energy[l] >= cb->loudest[l] * YINPITCH_FADE;
+    }
+
+    if (slide)
+    {
+        k->slide(diff, hop, lags, cb->hopsize);
+        cb->since_refresh += cb->hopsize;
+    }
+    else
+    {
+        k->recompute(diff, window + cb->hopsize, lags);
+        cb->since_refresh = 0;
+    }
+    memmove(window, window + cb->hopsize, cb->pitchsize * sizeof(lanes_t));
+
+    memmove(cb->frame, (lanes_t *) cb->frame + cb->hopsize, cb->winsize * sizeof(lanes_t));
+    k->spectrum(cb);
+
+    for (unsigned int l = 0; l < cb->lanes; l++)
+    {
+        cb->loudest[l] = slide && cb->loudest[l] > energy[l] ? cb->loudest[l] : energy[l];
+
+        if (!hops[l])
+        {
+            pitches[l] = 0;
+            onsets[l] = 0;
+            sumsq[l] = 0;
+            continue;
+        }
+
+        pitches[l] = lane_pitch(cb, l, energy[l]);
+        onsets[l] = onsetpicker_do(&cb->pickers[l], lane_hfc(cb, l), hop_sumsq[l]);
+        sumsq[l] = hop_sumsq[l];
+    }
+}
+
+/* returns the pitch of lane, whose window's squares sum to energy */
+static float lane_pitch(clipbatch_t *cb, unsigned int lane, double energy)
+{
+    const dlanes_t *diff = (const dlanes_t *) cb->diff;
+    float confidence;
+
+    for (unsigned int tau = 0; tau < cb->pitchsize / 2; tau++)
+    {
+        cb->lane_diff[tau] = diff[tau][lane];
+    }
+
+    return yinpitch_pick(cb->lane_diff, cb->lane_cmnd, cb->pitchsize, cb->samplerate,
+        cb->silence_db, energy, &confidence);
+}
+
+/* returns the detection function of the latest frame of lane */
+static float lane_hfc(const clipbatch_t *cb, unsigned int lane)
+{
+    const lanes_t *power = (const lanes_t *) cb->power;
+    float hfc = 0;
+
+    for (unsigned int b = 0; b <= cb->winsize / 2; b++)
+    {
+        hfc += (b + 1) * logf(1 + sqrtf(power[b][lane]));
+    }
+
+    return hfc;
+}
+
+static const lane_kernels_t *kernels(void)
+{
+#if defined(CLIPBATCH_X86)
+    switch (dsp_isa())
+    {
+    case DSP_ISA_AVX512:
+        return &avx512_kernels;
+    case DSP_ISA_AVX2:
+        return &avx2_kernels;
+    }
+#endif
+
+    return &portable_kernels;
+}
+
+/* returns n zeroed elements of size bytes, aligned as vectors of doubles
+ * from every lane need to be, or NULL
+ */
+static void *alloc_lanes(size_t n, size_t size)
+{
+    const size_t align = sizeof(dlanes_t);
+    const size_t bytes = (n * size + align - 1) / align * align;
+    void *p;
+
+    p = aligned_alloc(align, bytes);
+    if (p)
+    {
+        memset(p, 0, bytes);
+    }
+
+    return p;
+}
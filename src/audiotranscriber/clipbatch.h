@@ -0,0 +1,89 @@
+/* clipbatch.h
+ *
+ * Analysis of several short clips at once, in lockstep, each in a lane of
+ * the vector units. A single clip leaves wide vectors mostly idle where
+ * its windows are small, but laid out side by side, a sample of every clip
+ * at each instant, up to CLIPBATCH_LANES clips share every operation of
+ * windowing, energy, YIN's difference function and the FFT, which are the
+ * same loops as for one clip with each sample widened to a vector.
+ *
+ * Each hop, every clip gets the pitch of its latest pitch window, as
+ * yinpitch_do finds it, and whether an onset was picked from the HFC of its
+ * latest frame, as onsetdetect_do finds it by FFT. Only the picking is done
+ * a clip at a time. A clip that has ended is masked: its lane is fed
+ * silence, and nothing is picked from it or waited on for it.
+ *
+ * The vector kernels are built for each x86 level, as the dsp kernels are,
+ * and follow whichever level dsp_isa() has picked.
+ */
+
+#ifndef CLIPBATCH_H
+#define CLIPBATCH_H
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include "fft.h"
+#include "onsetdetect.h"
+
+#define CLIPBATCH_LANES     16      // most clips analysed at once
+
+/* Clips analysed together. The buffers of samples hold CLIPBATCH_LANES of
+ * them for each instant, one from each lane, so that sample i of lane l is
+ * at [i * CLIPBATCH_LANES + l]; the difference function is laid out alike.
+ */
+typedef struct clipbatch
+{
+    unsigned int    lanes;          // clips analysed, up to CLIPBATCH_LANES
+    unsigned int    winsize;        // samples in an onset frame, a power of two
+    unsigned int    hopsize;
+    unsigned int    pitchsize;      // samples in a pitch window
+    unsigned int    samplerate;
+    float           silence_db;     // level below which there is no pitch or onset
+
+    float           *window;        // pitch window, then room for the next hop
+    double          *diff;          // its difference function at each lag
+    unsigned long   since_refresh;  // samples slid through since diff was computed afresh
+    double          loudest[CLIPBATCH_LANES]; // most energy in each window since then
+    double          *lane_diff;     // room for picking the pitch of one lane
+    float           *lane_cmnd;
+
+    fft_t           fft;            // twiddles and input order, for every lane
+    float           *frame;         // onset frame, then room for the next hop
+    float           *hann;          // window applied to it, one value per instant
+    float           *z_re, *z_im;   // complex signal being transformed
+    float           *power;         // squared magnitude of each bin
+    onsetpicker_t   pickers[CLIPBATCH_LANES];
+} clipbatch_t;
+
+/* Sets up the analysis of lanes clips, with onset frames of winsize samples
+ * and pitch windows of pitchsize, moved on hopsize at a time.
+ * returns 0 on success, 1 otherwise
+ */
+int init_clipbatch(clipbatch_t *cb,
+    unsigned int lanes,
+    unsigned int winsize,
+    unsigned int hopsize,
+    unsigned int pitchsize,
+    unsigned int samplerate,
+    float silence_db,
+    float minioi_ms
+);
+
+void free_clipbatch(clipbatch_t *cb);
+
+/* Moves every clip on by a hop, hops[l] holding hopsize samples of lane l,
+ * or NULL once it has ended. Sets pitches[l] to the pitch of lane l in MIDI
+ * note numbers, or 0 if none, onsets[l] to 1 if an onset was detected in
+ * it, or 0, and sumsq[l] to the sum of the squares of its hop; all are 0
+ * for lanes that have ended.
+ */
+void clipbatch_do(clipbatch_t *cb, const float *const *hops, float *pitches, int *onsets,
+    double *sumsq);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
@@ -0,0 +1,196 @@
+/* fft.c
+ */
+
+#include <stdlib.h>
+#include <math.h>
+
+#include "fft.h"
+#include "kernelsizes.h"
+
+/* the transform, of one size or of any */
+typedef struct fft_kernels
+{
+    unsigned int    size;           // what it is for, or 0 for any
+    void            (*real)(fft_t *f, const float *in, float *re, float *im);
+} fft_kernels_t;
+
+static const fft_kernels_t *find_kernels(unsigned int size);
+
+int init_fft(fft_t *f, unsigned int size)
+{
+    const unsigned int half = size / 2;
+    unsigned int bits = 0, r;
+
+    if (!f || size < 4 || (size & (size - 1)) != 0)
+    {
+        return 1;
+    }
+
+    while ((1u << bits) < half)
+    {
+        bits++;
+    }
+
+    f->size = size;
+    f->kernels = find_kernels(size);
+    f->tw_re = malloc(half * sizeof(float));
+    f->tw_im = malloc(half * sizeof(float));
+    f->bitrev = malloc(half * sizeof(unsigned int));
+    f->z_re = malloc(half * sizeof(float));
+    f->z_im = malloc(half * sizeof(float));
+
+    if (!f->tw_re || !f->tw_im || !f->bitrev || !f->z_re || !f->z_im)
+    {
+        free_fft(f);
+        return 1;
+    }
+
+    for (unsigned int k = 0; k < half; k++)
+    {
+        f->tw_re[k] = cos(2 * M_PI * k / size);
+        f->tw_im[k] = -sin(2 * M_PI * k / size);
+
+        r = 0;
+        for (unsigned int b = 0; b < bits; b++)
+        {
+            r |= ((k >> b) & 1) << (bits - 1 - b);
+        }
+        f->bitrev[k] = r;
+    }
+
+    return 0;
+}
+
+void free_fft(fft_t *f)
+{
+    if (f != NULL)
+    {
+        free(f->tw_re);
+        free(f->tw_im);
+        free(f->bitrev);
+        free(f->z_re);
+        free(f->z_im);
+        f->tw_re = f->tw_im = f->z_re = f->z_im = NULL;
+        f->bitrev = NULL;
+    }
+}
+
+/* transforms f->z in place, its samples already in bit-reversed order */
+static inline __attribute__((always_inline))
+void complex_body(fft_t *f, unsigned int size)
+{
+    const unsigned int half = size / 2;
+    float *zr = f->z_re, *zi = f->z_im;
+    float wr, wi, tr, ti;
+    unsigned int stride;
+
+    for (unsigned int len = 2; len <= half; len <<= 1)
+    {
+        // the twiddles of a transform of len are every stride'th of size
+        stride = size / len;
+
+        for (unsigned int i = 0; i < half; i += len)
+        {
+            for (unsigned int j = 0; j < len / 2; j++)
+            {
+                wr = f->tw_re[j * stride];
+                wi = f->tw_im[j * stride];
+
+                tr = wr * zr[i + j + len / 2] - wi * zi[i + j + len / 2];
+                ti = wr * zi[i + j + len / 2] + wi * zr[i + j + len / 2];
+
+                zr[i + j + len / 2] = zr[i + j] - tr;
+                zi[i + j + len / 2] = zi[i + j] - ti;
+                zr[i + j] += tr;
+                zi[i + j] += ti;
+            }
+        }
+    }
+}
+
+/* The even samples are taken as the real parts of a complex signal of half
+ * the length, and the odd ones as its imaginary parts. The transform of
+ * each is then separated out of that of the complex signal, and the two
+ * combined.
+ */
+static inline __attribute__((always_inline))
+void real_body(fft_t *f, const float *in, float *re, float *im, unsigned int size)
+{
+    const unsigned int half = size / 2;
+    float zr, zi, cr, ci, ere, eim, ore, oim, wr, wi;
+    unsigned int j;
+
+    for (unsigned int m = 0; m < half; m++)
+    {
+        f->z_re[f->bitrev[m]] = in[2 * m];
+        f->z_im[f->bitrev[m]] = in[2 * m + 1];
+    }
+
+    complex_body(f, size);
+
+    for (unsigned int k = 0; k <= half; k++)
+    {
+        j = k % half;
+        zr = f->z_re[j];
+        zi = f->z_im[j];
+
+        // the conjugate of bin half - k
+        j = (half - k) % half;
+        cr = f->z_re[j];
+        ci = -f->z_im[j];
+
+        // evens are (z + c) / 2, odds (z - c) / 2i
+        ere = (zr + cr) / 2;
+        eim = (zi + ci) / 2;
+        ore = (zi - ci) / 2;
+        oim = (cr - zr) / 2;
+
+        wr = k < half ? f->tw_re[k] : -1;
+        wi = k < half ? f->tw_im[k] : 0;
+
+        re[k] = ere + wr * ore - wi * oim;
+        im[k] = eim + wr * oim + wi * ore;
+    }
+}
+
+void fft_real(fft_t *f, const float *in, float *re, float *im)
+{
+    f->kernels->real(f, in, re, im);
+}
+
+static void real_any(fft_t *f, const float *in, float *re, float *im)
+{
+    real_body(f, in, re, im, f->size);
+}
+
+/* builds the transform of size samples */
+#define FFT_KERNELS(size, hop) \
+    static void real_##size(fft_t *f, const float *in, float *re, float *im) \
+    { \
+        real_body(f, in, re, im, size); \
+    }
+#define FFT_KERNELS_ENTRY(size, hop) { size, real_##size },
+
+KERNELSIZES(FFT_KERNELS)
+
+static const fft_kernels_t fixed_kernels[] = { KERNELSIZES(FFT_KERNELS_ENTRY) };
+static const fft_kernels_t any_kernels = { 0, real_any };
+
+/* returns the transform built for size, or if there is none, or
+ * KERNELSIZES_ENV is set, the one for any
+ */
+static const fft_kernels_t *find_kernels(unsigned int size)
+{
+    if (getenv(KERNELSIZES_ENV) == NULL)
+    {
+        for (size_t i = 0; i < sizeof(fixed_kernels) / sizeof(*fixed_kernels); i++)
+        {
+            if (fixed_kernels[i].size == size)
+            {
+                return &fixed_kernels[i];
+            }
+        }
+    }
+
+    return &any_kernels;
+}
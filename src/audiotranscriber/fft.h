@@ -0,0 +1,44 @@
+/* fft.h
+ *
+ * The discrete Fourier transform of real signals whose length is a power
+ * of two, by a radix-2 FFT of half that length over the even and odd
+ * samples taken together.
+ */
+
+#ifndef FFT_H
+#define FFT_H
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/* a transform of one length */
+typedef struct fft
+{
+    unsigned int    size;       // samples transformed
+    float           *tw_re;     // e^(-2 pi i k / size), for k up to size / 2
+    float           *tw_im;
+    unsigned int    *bitrev;    // order of the complex inputs, size / 2 of them
+    float           *z_re;      // the complex signal being transformed
+    float           *z_im;
+    const struct fft_kernels *kernels; // the transform, for this size
+} fft_t;
+
+/* Sets up transforms of size samples.
+ * returns 0 on success, 1 if size is not a power of two of at least 4, or
+ * there is no memory
+ */
+int init_fft(fft_t *f, unsigned int size);
+
+void free_fft(fft_t *f);
+
+/* puts the transform of f->size samples from in, bins 0 to f->size / 2
+ * inclusive, in re and im
+ */
+void fft_real(fft_t *f, const float *in, float *re, float *im);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
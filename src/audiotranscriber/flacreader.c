@@ -0,0 +1,659 @@
+/* flacreader.c
+ *
+ * Memory-mapped FLAC file reader.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "crc.h"
+#include "flacreader.h"
+
+#define METADATA_STREAMINFO     0
+#define STREAMINFO_LEN          34
+#define MAX_BITDEPTH            24
+#define MAX_LPC_ORDER           32
+
+// channel assignments other than independent channels
+#define CHANNELS_LEFT_SIDE      8
+#define CHANNELS_RIGHT_SIDE     9
+#define CHANNELS_MID_SIDE       10
+
+/* bits being read from a buffer, most significant first */
+typedef struct bitreader
+{
+    const unsigned char *p;     // next byte to load
+    const unsigned char *end;
+    uint64_t            acc;    // loaded bits, in the high nbits
+    unsigned int        nbits;
+    int                 err;    // set on reading past the end
+} bitreader_t;
+
+static int decode_frame(flacreader_t *r);
+static int decode_subframe(bitreader_t *br, int32_t *dst, size_t n,
+    unsigned int bitdepth);
+static int decode_residual(bitreader_t *br, int32_t *dst, size_t n,
+    unsigned int order);
+static uint32_t get_bits(bitreader_t *br, unsigned int nbits);
+static int32_t get_signed(bitreader_t *br, unsigned int nbits);
+static uint32_t get_unary(bitreader_t *br);
+static size_t bytes_read(const bitreader_t *br, const unsigned char *start);
+
+int open_flacreader(flacreader_t *r, const char *fname)
+{
+    struct stat st;
+    void *map;
+    int fd;
+
+    if (!r || !fname)
+    {
+        return 1;
+    }
+
+    fd = open(fname, O_RDONLY);
+    if (fd < 0)
+    {
+        return 1;
+    }
+
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        close(fd);
+        return 1;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        close(fd);
+        return 1;
+    }
+
+    // frames are decoded front to back, so let the kernel read ahead
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    if (init_flacreader(r, map, st.st_size) != 0)
+    {
+        munmap(map, st.st_size);
+        close(fd);
+        return 1;
+    }
+
+    r->fd = fd;
+    return 0;
+}
+
+int init_flacreader(flacreader_t *r, const unsigned char *buf, size_t size)
+{
+    const unsigned char *p, *end;
+    uint64_t packed;
+    size_t len;
+    int last = 0, have_streaminfo = 0;
+
+    if (!r || !buf)
+    {
+        return 1;
+    }
+
+    memset(r, 0, sizeof(*r));
+    r->fd = -1;
+    r->data = buf;
+    r->size = size;
+
+    if (size < 4 || memcmp(buf, "fLaC", 4) != 0)
+    {
+        return 1;
+    }
+
+    end = buf + size;
+    p = buf + 4;
+
+    // metadata blocks, of which only STREAMINFO matters
+    while (!last)
+    {
+        if (end - p < 4)
+        {
+            return 1;
+        }
+
+        last = p[0] >> 7;
+        len = (size_t) p[1] << 16 | (size_t) p[2] << 8 | p[3];
+        p += 4;
+
+        if (len > (size_t) (end - p))
+        {
+            return 1;
+        }
+
+        if ((p[-4] & 0x7f) == METADATA_STREAMINFO && len >= STREAMINFO_LEN)
+        {
+            r->max_blocksize = (uint16_t) (p[2] << 8 | p[3]);
+
+            packed = 0;
+            for (int i = 10; i < 18; i++)
+            {
+                packed = packed << 8 | p[i];
+            }
+            r->samplerate = packed >> 44;
+            r->channels = (packed >> 41 & 0x7) + 1;
+            r->bitdepth = (packed >> 36 & 0x1f) + 1;
+            r->nframes = packed & 0xfffffffffULL;
+            have_streaminfo = 1;
+        }
+
+        p += len;
+    }
+
+    if (!have_streaminfo || r->samplerate == 0 || r->max_blocksize == 0 ||
+        r->bitdepth < 4 || r->bitdepth > MAX_BITDEPTH)
+    {
+        return 1;
+    }
+
+    r->next = p;
+    r->block = malloc(sizeof(*r->block) * r->max_blocksize * r->channels);
+    if (!r->block)
+    {
+        return 1;
+    }
+
+    return 0;
+}
+
+void close_flacreader(flacreader_t *r)
+{
+    if (r == NULL)
+    {
+        return;
+    }
+
+    free(r->block);
+    r->block = NULL;
+
+    if (r->fd >= 0)
+    {
+        munmap((void *) r->data, r->size);
+        close(r->fd);
+        r->fd = -1;
+    }
+}
+
+size_t flacreader_read_mono(flacreader_t *r, float *dst, size_t nframes)
+{
+    const float scale = 1.0f / ((float) r->channels * (1 << (r->bitdepth - 1)));
+    size_t done = 0, n;
+    const int32_t *src;
+    int32_t sum;
+
+    while (done < nframes)
+    {
+        if (r->blockpos == r->blocklen && decode_frame(r) != 0)
+        {
+            break;
+        }
+
+        n = r->blocklen - r->blockpos;
+        if (n > nframes - done)
+        {
+            n = nframes - done;
+        }
+
+        src = r->block + r->blockpos;
+        for (size_t i = 0; i < n; i++)
+        {
+            sum = 0;
+            for (unsigned int c = 0; c < r->channels; c++)
+            {
+                sum += src[c * r->max_blocksize + i];
+            }
+            dst[done + i] = sum * scale;
+        }
+
+        r->blockpos += n;
+        done += n;
+    }
+
+    r->pos += done;
+
+    return done;
+}
+
+/* Decodes the frame at r->next into r->block, and moves r->next past it.
+ * returns 0 on success, 1 at the end of the file or if the frame is damaged
+ */
+static int decode_frame(flacreader_t *r)
+{
+    static const unsigned int bitdepths[8] = { 0, 8, 12, 0, 16, 20, 24, 0 };
+    const unsigned char *start = r->next;
+    bitreader_t br = { start, r->data + r->size, 0, 0, 0 };
+    unsigned int bs_code, sr_code, assignment, bitdepth, first, crc;
+    int32_t *x0, *x1, mid, side;
+    size_t n;
+
+    // sync code, a reserved bit, then the blocking strategy, which is not
+    // needed as frames are only read in order
+    if (get_bits(&br, 15) != 0x7ffc)
+    {
+        return 1;
+    }
+    get_bits(&br, 1);
+
+    bs_code = get_bits(&br, 4);
+    sr_code = get_bits(&br, 4);
+    assignment = get_bits(&br, 4);
+
+    bitdepth = bitdepths[get_bits(&br, 3)];
+    if (bitdepth == 0)
+    {
+        bitdepth = r->bitdepth;
+    }
+
+    if (get_bits(&br, 1) != 0 || bs_code == 0 || sr_code == 15 ||
+        assignment > CHANNELS_MID_SIDE || bitdepth > MAX_BITDEPTH ||
+        (assignment < CHANNELS_LEFT_SIDE ? assignment + 1 : 2) != r->channels)
+    {
+        return 1;
+    }
+
+    // frame or sample number, coded like UTF-8: skip the following bytes
+    first = get_bits(&br, 8);
+    for (unsigned int mask = 0x40; (first & mask) && mask > 1; mask >>= 1)
+    {
+        if ((get_bits(&br, 8) & 0xc0) != 0x80)
+        {
+            return 1;
+        }
+    }
+
+    if (bs_code == 1)
+    {
+        n = 192;
+    }
+    else if (bs_code <= 5)
+    {
+        n = 576 << (bs_code - 2);
+    }
+    else if (bs_code <= 7)
+    {
+        n = get_bits(&br, bs_code == 6 ? 8 : 16) + 1;
+    }
+    else
+    {
+        n = 256 << (bs_code - 8);
+    }
+
+    // the sample rate comes from STREAMINFO, but may follow here too
+    if (sr_code == 12)
+    {
+        get_bits(&br, 8);
+    }
+    else if (sr_code >= 13)
+    {
+        get_bits(&br, 16);
+    }
+
+    crc = get_bits(&br, 8);
+    if (br.err || n > r->max_blocksize ||
+        crc != crc8(0, start, bytes_read(&br, start) - 1))
+    {
+        return 1;
+    }
+
+    for (unsigned int c = 0; c < r->channels; c++)
+    {
+        // the side channel takes an extra bit
+        side = (assignment == CHANNELS_LEFT_SIDE && c == 1)
+            || (assignment == CHANNELS_RIGHT_SIDE && c == 0)
+            || (assignment == CHANNELS_MID_SIDE && c == 1);
+
+        if (decode_subframe(&br, r->block + c * r->max_blocksize, n,
+            bitdepth + side) != 0)
+        {
+            return 1;
+        }
+    }
+
+    x0 = r->block;
+    x1 = r->block + r->max_blocksize;
+
+    switch (assignment)
+    {
+        case CHANNELS_LEFT_SIDE:
+            for (size_t i = 0; i < n; i++)
+            {
+                x1[i] = x0[i] - x1[i];
+            }
+            break;
+        case CHANNELS_RIGHT_SIDE:
+            for (size_t i = 0; i < n; i++)
+            {
+                x0[i] += x1[i];
+            }
+            break;
+        case CHANNELS_MID_SIDE:
+            // the bit dropped from mid is the low bit of side
+            for (size_t i = 0; i < n; i++)
+            {
+                side = x1[i];
+                mid = (int32_t) ((uint32_t) x0[i] << 1) | (side & 1);
+                x0[i] = (mid + side) >> 1;
+                x1[i] = (mid - side) >> 1;
+            }
+            break;
+    }
+
+    // zero padding to a whole byte, then the CRC-16 of the whole frame
+    get_bits(&br, br.nbits % 8);
+    crc = get_bits(&br, 16);
+    if (br.err || crc != crc16(0, start, bytes_read(&br, start) - 2))
+    {
+        return 1;
+    }
+
+    r->next = start + bytes_read(&br, start);
+    r->blocklen = n;
+    r->blockpos = 0;
+
+    return 0;
+}
+
+/* decodes one channel of a frame, of n samples of the given bit depth */
+static int decode_subframe(bitreader_t *br, int32_t *dst, size_t n,
+    unsigned int bitdepth)
+{
+    int32_t coefs[MAX_LPC_ORDER];
+    unsigned int type, wasted = 0, order, precision;
+    int shift;
+    int64_t sum;
+    size_t i;
+
+    if (get_bits(br, 1) != 0)
+    {
+        return 1;
+    }
+
+    type = get_bits(br, 6);
+
+    // low bits that are zero in every sample are left out
+    if (get_bits(br, 1))
+    {
+        wasted = get_unary(br) + 1;
+        if (wasted >= bitdepth)
+        {
+            return 1;
+        }
+        bitdepth -= wasted;
+    }
+
+    if (type == 0)
+    {
+        // constant
+        dst[0] = get_signed(br, bitdepth);
+        for (i = 1; i < n; i++)
+        {
+            dst[i] = dst[0];
+        }
+    }
+    else if (type == 1)
+    {
+        // verbatim
+        for (i = 0; i < n; i++)
+        {
+            dst[i] = get_signed(br, bitdepth);
+        }
+    }
+    else if (type >= 8 && type <= 12)
+    {
+        // fixed polynomial predictor
+        order = type - 8;
+        if (order > n)
+        {
+            return 1;
+        }
+
+        for (i = 0; i < order; i++)
+        {
+            dst[i] = get_signed(br, bitdepth);
+        }
+
+        if (decode_residual(br, dst, n, order) != 0)
+        {
+            return 1;
+        }
+
+        switch (order)
+        {
+            case 1:
+                for (i = 1; i < n; i++)
+                {
+                    dst[i] += dst[i - 1];
+                }
+                break;
+            case 2:
+                for (i = 2; i < n; i++)
+                {
+                    dst[i] += 2 * dst[i - 1] - dst[i - 2];
+                }
+                break;
+            case 3:
+                for (i = 3; i < n; i++)
+                {
+                    dst[i] += 3 * dst[i - 1] - 3 * dst[i - 2] + dst[i - 3];
+                }
+                break;
+            case 4:
+                for (i = 4; i < n; i++)
+                {
+                    dst[i] += 4 * dst[i - 1] - 6 * dst[i - 2]
+                        + 4 * dst[i - 3] - dst[i - 4];
+                }
+                break;
+        }
+    }
+    else if (type >= 32)
+    {
+        // linear predictor with quantised coefficients
+        order = (type & 0x1f) + 1;
+        if (order > n)
+        {
+            return 1;
+        }
+
+        for (i = 0; i < order; i++)
+        {
+            dst[i] = get_signed(br, bitdepth);
+        }
+
+        precision = get_bits(br, 4) + 1;
+        shift = get_signed(br, 5);
+        if (precision > 15 || shift < 0)
+        {
+            return 1;
+        }
+
+        for (i = 0; i < order; i++)
+        {
+            coefs[i] = get_signed(br, precision);
+        }
+
+        if (decode_residual(br, dst, n, order) != 0)
+        {
+            return 1;
+        }
+
+        for (i = order; i < n; i++)
+        {
+            sum = 0;
+            for (unsigned int j = 0; j < order; j++)
+            {
+                sum += (int64_t) coefs[j] * dst[i - 1 - j];
+            }
+            dst[i] += (int32_t) (sum >> shift);
+        }
+    }
+    else
+    {
+        return 1;
+    }
+
+    if (wasted > 0)
+    {
+        for (i = 0; i < n; i++)
+        {
+            dst[i] = (int32_t) ((uint32_t) dst[i] << wasted);
+        }
+    }
+
+    return br->err;
+}
+
+/* decodes the Rice coded prediction errors of samples order to n - 1 */
+static int decode_residual(bitreader_t *br, int32_t *dst, size_t n,
+    unsigned int order)
+{
+    unsigned int method, partition_order, param_bits, escape, k, nbits;
+    size_t count, i = order;
+    uint32_t u;
+
+    method = get_bits(br, 2);
+    if (method > 1)
+    {
+        return 1;
+    }
+
+    // coding method 0 has 4 bit Rice parameters, method 1 has 5
+    param_bits = method ? 5 : 4;
+    escape = (1u << param_bits) - 1;
+
+    partition_order = get_bits(br, 4);
+    if ((n >> partition_order) << partition_order != n ||
+        (n >> partition_order) < order)
+    {
+        return 1;
+    }
+
+    for (size_t j = 0; j < (size_t) 1 << partition_order; j++)
+    {
+        count = (n >> partition_order) - (j == 0 ? order : 0);
+        k = get_bits(br, param_bits);
+
+        if (k == escape)
+        {
+            // unencoded, in a given number of bits
+            nbits = get_bits(br, 5);
+            for (size_t end = i + count; i < end; i++)
+            {
+                dst[i] = get_signed(br, nbits);
+            }
+        }
+        else
+        {
+            for (size_t end = i + count; i < end; i++)
+            {
+                u = get_unary(br) << k | get_bits(br, k);
+                dst[i] = (int32_t) (u >> 1) ^ -(int32_t) (u & 1);
+            }
+        }
+
+        if (br->err)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/* loads whole bytes until at least 57 bits are held, or the data ends */
+static inline void refill(bitreader_t *br)
+{
+    while (br->nbits <= 56 && br->p < br->end)
+    {
+        br->acc |= (uint64_t) *br->p++ << (56 - br->nbits);
+        br->nbits += 8;
+    }
+}
+
+/* returns the next nbits (up to 32) as an unsigned value */
+static uint32_t get_bits(bitreader_t *br, unsigned int nbits)
+{
+    uint32_t val;
+
+    if (nbits == 0)
+    {
+        return 0;
+    }
+
+    if (br->nbits < nbits)
+    {
+        refill(br);
+        if (br->nbits < nbits)
+        {
+            br->err = 1;
+            return 0;
+        }
+    }
+
+    val = br->acc >> (64 - nbits);
+    br->acc <<= nbits;
+    br->nbits -= nbits;
+
+    return val;
+}
+
+/* returns the next nbits (up to 32) as a two's complement value */
+static int32_t get_signed(bitreader_t *br, unsigned int nbits)
+{
+    if (nbits == 0)
+    {
+        return 0;
+    }
+
+    // shift into the top of 32 bits to sign extend
+    return (int32_t) (get_bits(br, nbits) << (32 - nbits)) >> (32 - nbits);
+}
+
+/* returns the number of zero bits before the next one, and skips them all */
+static uint32_t get_unary(bitreader_t *br)
+{
+    uint32_t q = 0;
+    unsigned int z;
+
+    for (;;)
+    {
+        // bits below the held ones are always zero
+        if (br->acc != 0)
+        {
+            z = __builtin_clzll(br->acc);
+            q += z;
+            br->acc <<= z;
+            br->acc <<= 1;
+            br->nbits -= z + 1;
+            return q;
+        }
+
+        q += br->nbits;
+        br->nbits = 0;
+
+        refill(br);
+        if (br->nbits == 0)
+        {
+            br->err = 1;
+            return 0;
+        }
+    }
+}
+
+/* returns how many bytes have been read since start, counting a partly
+ * read byte as read
+ */
+static size_t bytes_read(const bitreader_t *br, const unsigned char *start)
+{
+    return (br->p - start) - br->nbits / 8;
+}
@@ -0,0 +1,65 @@
+/* flacreader.h
+ *
+ * Read-only access to FLAC files. The file is memory-mapped and decoded a
+ * frame at a time, straight from the mapping. Every kind of subframe is
+ * understood, so files from other encoders can be read too, up to 24 bits
+ * per sample.
+ */
+
+#ifndef FLACREADER_H
+#define FLACREADER_H
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* an open FLAC file */
+typedef struct flacreader
+{
+    int                 fd;         // source file descriptor, or -1 if none
+
+    const unsigned char *data;      // start of the file contents
+    size_t              size;       // length of the file contents
+
+    uint32_t            samplerate; // sample frames per second
+    uint16_t            channels;   // number of audio channels
+    uint16_t            bitdepth;   // bits per sample
+    uint16_t            max_blocksize; // most sample frames in a FLAC frame
+    uint64_t            nframes;    // sample frames in the file, 0 if unknown
+
+    const unsigned char *next;      // next FLAC frame to decode
+    int32_t             *block;     // decoded samples of each channel in turn
+    size_t              blocklen;   // sample frames in block
+    size_t              blockpos;   // next sample frame of block to be read
+    uint64_t            pos;        // next sample frame to be read
+} flacreader_t;
+
+/* Maps the file at fname into memory and parses its header.
+ * returns 0 on success, 1 if the file could not be read or is not a FLAC
+ * file in a supported format
+ */
+int open_flacreader(flacreader_t *r, const char *fname);
+
+/* Parses the header of a FLAC file already held in memory.
+ * The buffer must remain valid until the reader is no longer used.
+ * returns 0 on success, 1 otherwise
+ */
+int init_flacreader(flacreader_t *r, const unsigned char *buf, size_t size);
+
+/* frees the reader, and unmaps and closes a file opened with open_flacreader */
+void close_flacreader(flacreader_t *r);
+
+/* Reads up to nframes sample frames, mixed down to one channel and scaled
+ * to the range [-1, 1], into dst. A damaged or cut off frame ends the file.
+ * returns the number of frames read, 0 at the end of the file
+ */
+size_t flacreader_read_mono(flacreader_t *r, float *dst, size_t nframes);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
@@ -0,0 +1,40 @@
+/* kernelsizes.h
+ *
+ * The window and hop sizes that notes are most often extracted with. The
+ * innermost loops of pitch and onset detection are built once for each of
+ * them, with their lengths fixed, so that the compiler can unroll and
+ * vectorise them with no leftover iterations to handle; any other size
+ * falls back to loops whose lengths are variables. Setting KERNELSIZES_ENV
+ * makes every size use those, to compare the two.
+ */
+
+#ifndef KERNELSIZES_H
+#define KERNELSIZES_H
+
+#define KERNELSIZES_ENV     "S2S_GENERIC_KERNELS"
+
+/* pitch window, in windows, as in aubio_notes. It is kept here, rather
+ * than in noteextractor.h, so that what needs the pitch window but not
+ * aubio, such as the benchmarks, can find it.
+ */
+#define NOTEEXTRACTOR_PITCH_SCALE   4
+
+/* applies X to each winsize and hopsize built for. No winsize is in it
+ * twice, as the FFT is built for each of them.
+ */
+#define KERNELSIZES(X) \
+    X(512, 256) \
+    X(1024, 512) \
+    X(2048, 512) \
+    X(4096, 1024)
+
+/* the same, for the pitch windows of each, NOTEEXTRACTOR_PITCH_SCALE
+ * frames long
+ */
+#define KERNELSIZES_PITCH(X) \
+    X(2048, 256) \
+    X(4096, 512) \
+    X(8192, 512) \
+    X(16384, 1024)
+
+#endif
@@ -2,19 +2,29 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <time.h>
+#include <inttypes.h>
 
+#include "parallel.h"
 #include "noteextractor.h"
 #include "midiwriter.h"
+#include "wavreader.h"
+#include "flacreader.h"
+#include "onsetindex.h"
+#include "shmring.h"
+#include "clipbatch.h"
 
 #define STR(s) STR_2(s)
 #define STR_2(s) #s
 
 #define OPT_OPTIONS_TERMINATOR  "--"
 
+#define CLIP_MIDI_EXT           ".mid"  // added to each clip's path, for its MIDI file
+
 #define OPT_OUTPUT_SHORT    "-o"
 #define OPT_OUTPUT_LONG     "--output"
 #define OPT_OUTPUT_DEFAULT  "out.mid"
-#define OPT_OUTPUT_EXPLAIN  "set output file (default: " OPT_OUTPUT_DEFAULT ")"
+#define OPT_OUTPUT_EXPLAIN  "set output file, for a single FILE (default: " OPT_OUTPUT_DEFAULT ")"
 
 #define OPT_WINSIZE_SHORT   "-w"
 #define OPT_WINSIZE_LONG    "--window-size"
@@ -26,6 +36,16 @@
 #define OPT_HOPSIZE_DEFAULT 256
 #define OPT_HOPSIZE_EXPLAIN "set hop size, in samples (default: " STR(OPT_HOPSIZE_DEFAULT) ")"
 
+#define OPT_PITCH_SHORT     "-m"
+#define OPT_PITCH_LONG      "--pitch-method"
+#define OPT_PITCH_DEFAULT   NOTEEXTRACTOR_PITCH_DEFAULT
+#define OPT_PITCH_EXPLAIN   "set pitch detection method: an aubio method, or " YINPITCH_METHOD " for YIN updated hop by hop, cheap at small hop sizes (default: " OPT_PITCH_DEFAULT ")"
+
+#define OPT_ONSET_SHORT     "-n"
+#define OPT_ONSET_LONG      "--onset-method"
+#define OPT_ONSET_DEFAULT   NOTEEXTRACTOR_ONSET_DEFAULT
+#define OPT_ONSET_EXPLAIN   "set onset detection method: an aubio method, or " ONSETDETECT_FFT " for high-frequency content by FFT (default: " OPT_ONSET_DEFAULT ")"
+
 #define OPT_BPM_SHORT       "-b"
 #define OPT_BPM_LONG        "--bpm"
 #define OPT_BPM_DEFAULT     0
@@ -36,6 +56,16 @@
 #define OPT_PPQ_DEFAULT     96
 #define OPT_PPQ_EXPLAIN     "set MIDI clock rate in PPQ (default: " STR(OPT_PPQ_DEFAULT) ")"
 
+#define OPT_TRACKS_SHORT    "-t"
+#define OPT_TRACKS_LONG     "--tracks"
+#define OPT_TRACKS_DEFAULT  1
+#define OPT_TRACKS_EXPLAIN  "split notes by pitch range into NUM MIDI tracks (default: " STR(OPT_TRACKS_DEFAULT) ")"
+
+#define OPT_JOBS_SHORT      "-j"
+#define OPT_JOBS_LONG       "--jobs"
+#define OPT_JOBS_DEFAULT    0
+#define OPT_JOBS_EXPLAIN    "set number of threads to use, and estimate pitch for batches of hops on them rather than by aubio_notes (default: number of CPUs, for writing MIDI only)"
+
 #define OPT_VERBOSE_SHORT   "-v"
 #define OPT_VERBOSE_LONG    "--verbose"
 #define OPT_VERBOSE_EXPLAIN "output extra information"
@@ -51,18 +81,58 @@ typedef struct options
 
     unsigned int winsize;
     unsigned int hopsize;
+    char *pitch_method;     // pitch detection method
+    char *onset_method;     // onset detection method
 
     unsigned int bpm;       // beats per minute
     unsigned int ppq;       // pulses per quarter note
 
+    unsigned int ntracks;   // number of MIDI tracks to write
+    unsigned int jobs;      // number of threads to use
+
     int verbose;            // print extra information to stdout
     int help;               // whether to print usage message
 } options_t;
 
+/* an audio file being read, directly or by aubio */
+typedef struct input
+{
+    aubio_source_t  *aubio;
+    wavreader_t     wav;
+    flacreader_t    flac;
+    int             is_wav, is_flac;
+} input_t;
+
+/* a clip given on the command line, and the sample rate it was found at */
+typedef struct clip
+{
+    unsigned int    samplerate;     // 0 if it could not be opened
+    unsigned int    arg;            // index of its path
+} clip_t;
+
+/* a recording still being made, published by the recorder to shared memory */
+typedef struct shmsource
+{
+    shmring_t   ring;
+    wavreader_t block;      // the block being read, in place in the ring
+    int         have_block; // whether block is in use
+} shmsource_t;
+
 
 static void usage(const char *prog_name);
 static void init_options(options_t *dst);
 static int parse_options(int argc, char **argv, options_t *dst);
+static void read_aubio(void *ctx, fvec_t *buf, uint_t *nread);
+static void read_wav(void *ctx, fvec_t *buf, uint_t *nread);
+static void read_flac(void *ctx, fvec_t *buf, uint_t *nread);
+static void read_shm(void *ctx, fvec_t *buf, uint_t *nread);
+static void seek_wav(void *ctx, uint64_t pos);
+static void seek_flac(void *ctx, uint64_t pos);
+static int open_input(input_t *in, const char *path, unsigned int hopsize,
+    notesource_t *source);
+static void close_input(input_t *in);
+static int transcribe_clips(char **paths, unsigned int npaths, options_t *opts);
+static int compare_clips(const void *a, const void *b);
 
 int main(int argc, char **argv)
 {
@@ -72,11 +142,19 @@ int main(int argc, char **argv)
 
     // audio source
     char *srcpath;
-    aubio_source_t *aubio_source;
+    input_t in = { 0 };
+    shmsource_t shm;
+    int is_shm = 0;
+    notesource_t source = { 0 };
+
+    // levels of the audio, written by the recorder alongside it
+    onsetindex_t index;
+    char *idxpath;
 
     // extracted musical notes
 	note_t *notes;
-	size_t notecount;
+	int notecount;
+    int batched;    // whether pitch is estimated for many hops at once
 
 
     /* parse command line arguments */
@@ -95,37 +173,103 @@ int main(int argc, char **argv)
         return 0;
     }
 
-    // there should be 1 more (mandatory) argument remaining (the source path)
+    // there should be at least 1 more (mandatory) argument remaining (the source path)
     if (argc - numparsed < 1)
     {
         fprintf(stderr, "Error: missing mandatory arguments\n");
         return 1;
     }
+
+    // several short clips are transcribed together, each to a file of its own
+    if (argc - numparsed > 1)
+    {
+        return transcribe_clips(argv + numparsed, argc - numparsed, &opts);
+    }
     srcpath = argv[numparsed++];
+    if (!opts.output)
+    {
+        opts.output = OPT_OUTPUT_DEFAULT;
+    }
+
+    /* open audio source. WAV files, including RF64 files too large for
+     * aubio, and FLAC recordings are read directly; anything else is left
+     * to aubio. A recording being published by the recorder is read from
+     * shared memory as it is made.
+     */
+    if (strncmp(srcpath, SHMRING_PREFIX, strlen(SHMRING_PREFIX)) == 0)
+    {
+        if (attach_shmring(&shm.ring, srcpath + strlen(SHMRING_PREFIX)) != 0)
+        {
+            fprintf(stderr, "Error: could not attach to '%s'\n", srcpath);
+            return 1;
+        }
 
-    // there should be no remaining arguments
-    if (argc - numparsed > 0)
+        is_shm = 1;
+        shm.have_block = 0;
+        source.ctx = &shm;
+        source.read = read_shm;
+        source.samplerate = shm.ring.hdr->samplerate;
+    }
+    else if (open_input(&in, srcpath, opts.hopsize, &source) != 0)
     {
-        fprintf(stderr, "Error: too many arguments\n");
+        fprintf(stderr, "Error: could not open input file '%s'\n", srcpath);
         return 1;
     }
 
-    /* open audio source */
-    aubio_source = new_aubio_source(srcpath, 0, opts.hopsize);
-    if (aubio_source == NULL)
+    /* an index of the recording lets silence be skipped without reading
+     * it. It must have been written for audio at the same rate.
+     */
+    idxpath = malloc(strlen(srcpath) + sizeof(ONSETINDEX_EXT));
+    if (idxpath && (in.is_wav || in.is_flac))
     {
-	    fprintf(stderr, "Error: could not open input file '%s'\n", srcpath);
-	    return 1;
+        sprintf(idxpath, "%s" ONSETINDEX_EXT, srcpath);
+        if (open_onsetindex(&index, idxpath) == 0)
+        {
+            if (index.samplerate == source.samplerate)
+            {
+                source.index = &index;
+            }
+            else
+            {
+                free_onsetindex(&index);
+            }
+        }
+    }
+    free(idxpath);
+
+    /* Hops are only batched, with pitch estimated for many at once, if a
+     * number of threads is given or a method other than the defaults, which
+     * are aubio_notes' own; otherwise aubio_notes analyses each hop in turn.
+     */
+    batched = opts.jobs != 0 || strcmp(opts.pitch_method, OPT_PITCH_DEFAULT) != 0 ||
+        strcmp(opts.onset_method, OPT_ONSET_DEFAULT) != 0;
+    if (opts.jobs == 0)
+    {
+        opts.jobs = parallel_ncpus();
     }
 
     /* extract notes from audio source */
-	notecount = extract_notes(aubio_source, opts.winsize, opts.hopsize, opts.bpm, &notes);
+	notecount = extract_notes(&source, opts.winsize, opts.hopsize, opts.bpm,
+	    opts.pitch_method, opts.onset_method, batched ? opts.jobs : 0, &notes);
     if (notecount < 0)
     {
         fprintf(stderr, "Error: Failed to process audio source\n");
     }
 
     /* print information about extracted notes */
+    if (opts.verbose && source.index)
+    {
+        fprintf(stderr, "index: %" PRIu64 " onset candidates, %.1f s of silence skipped\n",
+            onsetindex_count_onsets(source.index),
+            (double) source.skipped / source.samplerate);
+    }
+
+    if (opts.verbose && is_shm)
+    {
+        fprintf(stderr, "shared memory: %" PRIu64 " blocks lost to the recorder\n",
+            shmring_dropped(&shm.ring));
+    }
+
     if (opts.verbose)
     {
         for (int i = 0; i < notecount; i++)
@@ -141,10 +285,321 @@ int main(int argc, char **argv)
     }
 
     /* cleanup */
-    del_aubio_source(aubio_source);
+    close_input(&in);
+    if (is_shm)
+    {
+        detach_shmring(&shm.ring);
+    }
+    if (source.index)
+    {
+        free_onsetindex(&index);
+    }
 	aubio_cleanup();
 
-	return gen_midi_file(opts.output, notes, notecount, opts.ppq);
+    if (notecount < 0)
+    {
+        return 1;
+    }
+
+	return gen_midi_file_tracks(opts.output, notes, notecount, opts.ppq,
+	    source.samplerate, opts.ntracks, opts.jobs);
+}
+
+/* Opens the audio file at path as source. WAV files, including RF64 files
+ * too large for aubio, and FLAC recordings are read directly; anything
+ * else is left to aubio, which reads hopsize samples at a time.
+ * returns 0 on success, 1 otherwise
+ */
+static int open_input(input_t *in, const char *path, unsigned int hopsize,
+    notesource_t *source)
+{
+    memset(in, 0, sizeof(*in));
+    memset(source, 0, sizeof(*source));
+
+    if (open_wavreader(&in->wav, path) == 0)
+    {
+        in->is_wav = 1;
+        source->ctx = &in->wav;
+        source->read = read_wav;
+        source->seek = seek_wav;
+        source->samplerate = in->wav.samplerate;
+    }
+    else if (open_flacreader(&in->flac, path) == 0)
+    {
+        in->is_flac = 1;
+        source->ctx = &in->flac;
+        source->read = read_flac;
+        source->seek = seek_flac;
+        source->samplerate = in->flac.samplerate;
+    }
+    else
+    {
+        in->aubio = new_aubio_source((char *) path, 0, hopsize);
+        if (in->aubio == NULL)
+        {
+            return 1;
+        }
+
+        source->ctx = in->aubio;
+        source->read = read_aubio;
+        source->samplerate = aubio_source_get_samplerate(in->aubio);
+    }
+
+    return 0;
+}
+
+static void close_input(input_t *in)
+{
+    if (in->aubio)
+    {
+        del_aubio_source(in->aubio);
+        in->aubio = NULL;
+    }
+    if (in->is_wav)
+    {
+        close_wavreader(&in->wav);
+        in->is_wav = 0;
+    }
+    if (in->is_flac)
+    {
+        close_flacreader(&in->flac);
+        in->is_flac = 0;
+    }
+}
+
+/* Transcribes each of npaths short clips to a MIDI file of its own, at its
+ * path with CLIP_MIDI_EXT added. Clips of the same sample rate are analysed
+ * together by extract_clips, CLIPBATCH_LANES at a time, with
+ * YINPITCH_METHOD and ONSETDETECT_FFT; only that many are open at once.
+ * returns 0 on success, 1 if any clip could not be transcribed
+ */
+static int transcribe_clips(char **paths, unsigned int npaths, options_t *opts)
+{
+    input_t inputs[CLIPBATCH_LANES];
+    notesource_t sources[CLIPBATCH_LANES];
+    note_t *notes[CLIPBATCH_LANES];
+    int notecounts[CLIPBATCH_LANES];
+    unsigned int first, nclips, opened;
+    clip_t *clips;
+    char *midipath;
+    int ret = 0;
+
+    if (opts->output)
+    {
+        fprintf(stderr, "Error: %s cannot be used with more than one input file; "
+                        "each is written to its path with " CLIP_MIDI_EXT " added\n",
+            OPT_OUTPUT_LONG);
+        return 1;
+    }
+    if ((strcmp(opts->pitch_method, OPT_PITCH_DEFAULT) != 0 &&
+            strcmp(opts->pitch_method, YINPITCH_METHOD) != 0) ||
+        (strcmp(opts->onset_method, OPT_ONSET_DEFAULT) != 0 &&
+            strcmp(opts->onset_method, ONSETDETECT_FFT) != 0))
+    {
+        fprintf(stderr, "Error: several input files are analysed with pitch method "
+                        YINPITCH_METHOD " and onset method " ONSETDETECT_FFT " only\n");
+        return 1;
+    }
+    if (opts->jobs == 0)
+    {
+        opts->jobs = parallel_ncpus();
+    }
+
+    clips = malloc(npaths * sizeof(clip_t));
+    if (!clips)
+    {
+        return 1;
+    }
+
+    // the sample rate of each clip, which those analysed together must share
+    for (unsigned int i = 0; i < npaths; i++)
+    {
+        clips[i].arg = i;
+        clips[i].samplerate = 0;
+
+        if (open_input(&inputs[0], paths[i], opts->hopsize, &sources[0]) != 0)
+        {
+            fprintf(stderr, "Error: could not open input file '%s'\n", paths[i]);
+            ret = 1;
+            continue;
+        }
+        clips[i].samplerate = sources[0].samplerate;
+        close_input(&inputs[0]);
+    }
+    qsort(clips, npaths, sizeof(clip_t), compare_clips);
+
+    // those that could not be opened come first, and are passed over
+    for (first = 0; first < npaths && clips[first].samplerate == 0; first++)
+    {
+    }
+
+    for (; first < npaths; first += nclips)
+    {
+        for (nclips = 1; nclips < CLIPBATCH_LANES && first + nclips < npaths &&
+            clips[first + nclips].samplerate == clips[first].samplerate; nclips++)
+        {
+        }
+
+        for (opened = 0; opened < nclips; opened++)
+        {
+            if (open_input(&inputs[opened], paths[clips[first + opened].arg], opts->hopsize,
+                &sources[opened]) != 0)
+            {
+                fprintf(stderr, "Error: could not open input file '%s'\n",
+                    paths[clips[first + opened].arg]);
+                break;
+            }
+        }
+
+        if (opened < nclips ||
+            extract_clips(sources, nclips, opts->winsize, opts->hopsize, opts->bpm,
+                notes, notecounts) != 0)
+        {
+            if (opened == nclips)
+            {
+                fprintf(stderr, "Error: Failed to process audio source\n");
+            }
+            ret = 1;
+        }
+        else
+        {
+            for (unsigned int c = 0; c < nclips; c++)
+            {
+                const char *path = paths[clips[first + c].arg];
+
+                if (opts->verbose)
+                {
+                    fprintf(stderr, "%s: %d notes\n", path, notecounts[c]);
+                }
+
+                midipath = malloc(strlen(path) + sizeof(CLIP_MIDI_EXT));
+                if (!midipath)
+                {
+                    ret = 1;
+                }
+                else
+                {
+                    sprintf(midipath, "%s" CLIP_MIDI_EXT, path);
+                    ret |= gen_midi_file_tracks(midipath, notes[c], notecounts[c], opts->ppq,
+                        clips[first].samplerate, opts->ntracks, opts->jobs) != 0;
+                    free(midipath);
+                }
+                free(notes[c]);
+            }
+        }
+
+        for (unsigned int c = 0; c < opened; c++)
+        {
+            close_input(&inputs[c]);
+        }
+    }
+
+    free(clips);
+    aubio_cleanup();
+
+    return ret;
+}
+
+/* orders clips by sample rate, then as they were given */
+static int compare_clips(const void *a, const void *b)
+{
+    const clip_t *x = a, *y = b;
+
+    if (x->samplerate != y->samplerate)
+    {
+        return (x->samplerate > y->samplerate) - (x->samplerate < y->samplerate);
+    }
+
+    return (x->arg > y->arg) - (x->arg < y->arg);
+}
+
+/* notesource_t read functions, for each kind of input */
+
+static void read_aubio(void *ctx, fvec_t *buf, uint_t *nread)
+{
+    aubio_source_do((aubio_source_t *) ctx, buf, nread);
+}
+
+static void read_wav(void *ctx, fvec_t *buf, uint_t *nread)
+{
+    *nread = wavreader_read_mono((wavreader_t *) ctx, buf->data, buf->length);
+
+    // aubio sources pad a short final read with silence too
+    memset(buf->data + *nread, 0, (buf->length - *nread) * sizeof(*buf->data));
+}
+
+static void read_flac(void *ctx, fvec_t *buf, uint_t *nread)
+{
+    *nread = flacreader_read_mono((flacreader_t *) ctx, buf->data, buf->length);
+    memset(buf->data + *nread, 0, (buf->length - *nread) * sizeof(*buf->data));
+}
+
+/* Converts blocks straight from the ring, waiting for the recorder to
+ * publish more until it has finished. A block that the recorder overwrote
+ * while it was being read, which only happens if it was allowed to, has
+ * been read anyway; it is counted as lost.
+ */
+static void read_shm(void *ctx, fvec_t *buf, uint_t *nread)
+{
+    const struct timespec brief = { 0, 1000000 };
+    shmsource_t *s = ctx;
+    const unsigned char *block;
+    size_t len;
+    uint_t n = 0;
+
+    while (n < buf->length)
+    {
+        if (!s->have_block)
+        {
+            block = shmring_peek(&s->ring, &len);
+            if (!block)
+            {
+                if (shmring_finished(&s->ring))
+                {
+                    break;
+                }
+                nanosleep(&brief, NULL);
+                continue;
+            }
+
+            init_wavreader_raw(&s->block, block, len,
+                s->ring.hdr->channels, s->ring.hdr->bitdepth);
+            s->have_block = 1;
+        }
+
+        n += wavreader_read_mono(&s->block, buf->data + n, buf->length - n);
+
+        if (s->block.pos == s->block.nframes)
+        {
+            shmring_release(&s->ring);
+            s->have_block = 0;
+        }
+    }
+
+    *nread = n;
+    memset(buf->data + n, 0, (buf->length - n) * sizeof(*buf->data));
+}
+
+static void seek_wav(void *ctx, uint64_t pos)
+{
+    wavreader_seek((wavreader_t *) ctx, pos);
+}
+
+/* FLAC frames must be decoded in turn, so samples are read and discarded */
+static void seek_flac(void *ctx, uint64_t pos)
+{
+    flacreader_t *r = ctx;
+    float discard[4096];
+    size_t n;
+
+    while (r->pos < pos)
+    {
+        n = pos - r->pos < 4096 ? pos - r->pos : 4096;
+        if (flacreader_read_mono(r, discard, n) == 0)
+        {
+            break;
+        }
+    }
 }
 
 static void usage(const char *prog_name)
@@ -153,14 +608,21 @@ static void usage(const char *prog_name)
     const int s_opt_width = 8, l_opt_width = 24;
 
 	printf(
-	    "Usage: %s [OPTION]... <FILE>\n"
+	    "Usage: %s [OPTION]... <FILE>...\n"
 	    "Transcribes the inputted audio, storing output in a MIDI file.\n"
+	    "Given several short clips, transcribes each to <FILE>" CLIP_MIDI_EXT ", analysing up to " STR(CLIPBATCH_LANES) " of the same sample rate at once.\n"
+	    "Silence is skipped using <FILE>" ONSETINDEX_EXT ", if the recorder wrote one.\n"
+	    "<FILE> may be " SHMRING_PREFIX "NAME, to transcribe what a recorder publishes as NAME while it records.\n"
 		"Options:\n"
 		"%*s, %-*s "OPT_OUTPUT_EXPLAIN"\n"
 		"%*s, %-*s "OPT_BPM_EXPLAIN"\n"
 		"%*s, %-*s "OPT_PPQ_EXPLAIN"\n"
 		"%*s, %-*s "OPT_WINSIZE_EXPLAIN"\n"
 		"%*s, %-*s "OPT_HOPSIZE_EXPLAIN"\n"
+		"%*s, %-*s "OPT_PITCH_EXPLAIN"\n"
+		"%*s, %-*s "OPT_ONSET_EXPLAIN"\n"
+		"%*s, %-*s "OPT_TRACKS_EXPLAIN"\n"
+		"%*s, %-*s "OPT_JOBS_EXPLAIN"\n"
 		"%*s, %-*s "OPT_VERBOSE_EXPLAIN"\n"
 		"%*s, %-*s "OPT_HELP_EXPLAIN"\n"
 		"\n"
@@ -175,6 +637,10 @@ static void usage(const char *prog_name)
         s_opt_width, OPT_PPQ_SHORT,     l_opt_width, OPT_PPQ_LONG" NUM",
         s_opt_width, OPT_WINSIZE_SHORT, l_opt_width, OPT_WINSIZE_LONG" NUM",
         s_opt_width, OPT_HOPSIZE_SHORT, l_opt_width, OPT_HOPSIZE_LONG" NUM",
+        s_opt_width, OPT_PITCH_SHORT,   l_opt_width, OPT_PITCH_LONG" METHOD",
+        s_opt_width, OPT_ONSET_SHORT,   l_opt_width, OPT_ONSET_LONG" METHOD",
+        s_opt_width, OPT_TRACKS_SHORT,  l_opt_width, OPT_TRACKS_LONG" NUM",
+        s_opt_width, OPT_JOBS_SHORT,    l_opt_width, OPT_JOBS_LONG" NUM",
         s_opt_width, OPT_VERBOSE_SHORT, l_opt_width, OPT_VERBOSE_LONG,
         s_opt_width, OPT_HELP_SHORT,    l_opt_width, OPT_HELP_LONG,
 
@@ -190,14 +656,19 @@ static void init_options(options_t *dst)
 {
     if (dst)
     {
-        dst->output = OPT_OUTPUT_DEFAULT;
+        dst->output = NULL;     // OPT_OUTPUT_DEFAULT, unless there are several inputs
 
         dst->hopsize = OPT_HOPSIZE_DEFAULT;
         dst->winsize = OPT_WINSIZE_DEFAULT;
+        dst->pitch_method = OPT_PITCH_DEFAULT;
+        dst->onset_method = OPT_ONSET_DEFAULT;
 
         dst->bpm = OPT_BPM_DEFAULT;
         dst->ppq = OPT_PPQ_DEFAULT;
 
+        dst->ntracks = OPT_TRACKS_DEFAULT;
+        dst->jobs = OPT_JOBS_DEFAULT;
+
         dst->verbose = 0;
         dst->help = 0;
     }
@@ -241,6 +712,34 @@ static int parse_options(int argc, char **argv, options_t *dst)
                 return -1;
             }
         }
+        else if (strcmp(*argv, OPT_PITCH_SHORT) == 0 || strcmp(*argv, OPT_PITCH_LONG) == 0)
+        {
+            if (argc > 1)
+            {
+                argc--;
+                argv++;
+                dst->pitch_method = *argv;
+            }
+            else
+            {
+                fprintf(stderr, "%s: missing value for flag '%s'\n", prog_name, *argv);
+                return -1;
+            }
+        }
+        else if (strcmp(*argv, OPT_ONSET_SHORT) == 0 || strcmp(*argv, OPT_ONSET_LONG) == 0)
+        {
+            if (argc > 1)
+            {
+                argc--;
+                argv++;
+                dst->onset_method = *argv;
+            }
+            else
+            {
+                fprintf(stderr, "%s: missing value for flag '%s'\n", prog_name, *argv);
+                return -1;
+            }
+        }
         else if (strcmp(*argv, OPT_WINSIZE_SHORT) == 0 || strcmp(*argv, OPT_WINSIZE_LONG) == 0)
         {
             if (argc > 1)
@@ -321,6 +820,46 @@ static int parse_options(int argc, char **argv, options_t *dst)
                 return -1;
             }
         }
+        else if (strcmp(*argv, OPT_TRACKS_SHORT) == 0 || strcmp(*argv, OPT_TRACKS_LONG) == 0)
+        {
+            if (argc > 1)
+            {
+                argc--;
+                argv++;
+                dst->ntracks = strtoul(*argv, NULL, 10);
+
+                if (errno == ERANGE || errno == EINVAL)
+                {
+                    fprintf(stderr, "%s: failed to parse number after flag '%s'\n", prog_name, *(argv - 1));
+                    return -1;
+                }
+            }
+            else
+            {
+                fprintf(stderr, "%s: missing value for flag '%s'\n", prog_name, *argv);
+                return -1;
+            }
+        }
+        else if (strcmp(*argv, OPT_JOBS_SHORT) == 0 || strcmp(*argv, OPT_JOBS_LONG) == 0)
+        {
+            if (argc > 1)
+            {
+                argc--;
+                argv++;
+                dst->jobs = strtoul(*argv, NULL, 10);
+
+                if (errno == ERANGE || errno == EINVAL)
+                {
+                    fprintf(stderr, "%s: failed to parse number after flag '%s'\n", prog_name, *(argv - 1));
+                    return -1;
+                }
+            }
+            else
+            {
+                fprintf(stderr, "%s: missing value for flag '%s'\n", prog_name, *argv);
+                return -1;
+            }
+        }
         else 
 		{
 		    if (strcmp(*argv, OPT_OPTIONS_TERMINATOR) == 0)
@@ -7,10 +7,28 @@
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
+#include <limits.h>
+#include <sys/uio.h>
 
 #include "endianness.h"
+#include "parallel.h"
 #include "midi.h"
 
+// POSIX guarantees at least this many vectors per writev call
+#ifndef IOV_MAX
+#define IOV_MAX 16
+#endif
+
+/* arguments of encode_track */
+typedef struct midiencoder
+{
+    midifile_t          *midif;
+    miditrack_encoder_t encode;
+    void                *arg;
+} midiencoder_t;
+
+static int encode_track(unsigned int t, void *enc);
+
 // wrapper for the MIDI header and track chunk initialisation functions
 int init_midifile(midifile_t *midif,
     const uint16_t format,
@@ -134,7 +152,8 @@ int finalise_miditrack(miditrack_t *trk)
     }
 
     // check for prescence of End-of-track event
-    if (*(trk->eventsp - 3) != MIDIEVENT_META    ||
+    if (trk->eventsp - trk->events < 3           ||
+        *(trk->eventsp - 3) != MIDIEVENT_META    ||
         *(trk->eventsp - 2) != META_1_ENDTRACK   || 
         *(trk->eventsp - 1) != META_2_ENDTRACK)
     {
@@ -157,6 +176,47 @@ int finalise_miditrack(miditrack_t *trk)
     return 0;
 }
 
+/* Encodes every track of a MIDI file, using up to nthreads threads.
+ *
+ * Each track has its own event buffer, so tracks are encoded independently:
+ * a thread claims the next unencoded track, fills it by calling encode, then
+ * finalises it.
+ *
+ * returns 0 on success, 1 if any track could not be encoded or finalised
+ */
+int encode_midifile(midifile_t *midif,
+    miditrack_encoder_t encode,
+    void *arg,
+    unsigned int nthreads)
+{
+    midiencoder_t enc;
+
+    if (!midif || !midif->tracks || !encode)
+    {
+        return 1;
+    }
+
+    enc.midif = midif;
+    enc.encode = encode;
+    enc.arg = arg;
+
+    return parallel_for(midif->header.ntracks, nthreads, encode_track, &enc);
+}
+
+/* task routine of encode_midifile */
+static int encode_track(unsigned int t, void *p)
+{
+    midiencoder_t *enc = p;
+    miditrack_t *trk = &enc->midif->tracks[t];
+
+    if (enc->encode(trk, t, enc->arg) != 0 || finalise_miditrack(trk) != 0)
+    {
+        return 1;
+    }
+
+    return 0;
+}
+
 int write_midifile(midifile_t *midif, int fd)
 {
     if (midif == NULL || fd < 0)
@@ -169,15 +229,65 @@ int write_midifile(midifile_t *midif, int fd)
         return 1;
     }
 
-    for (int t = 0; t < midif->header.ntracks; t++)
+    const uint16_t ntracks = midif->header.ntracks;
+
+    /* gather the track chunks so that they are written in order with as few
+     * system calls as possible. Each track contributes two vectors: its
+     * chunk ID and size, then its events.
+     */
+    const size_t prefix_len = sizeof(midif->tracks->chunkid)
+        + sizeof(midif->tracks->chunksize);
+    unsigned char *prefixes = malloc(prefix_len * ntracks);
+    struct iovec *iov = malloc(sizeof(struct iovec) * 2 * ntracks);
+    int ret = 0;
+
+    if (!prefixes || !iov)
+    {
+        free(prefixes);
+        free(iov);
+        return 1;
+    }
+
+    for (int t = 0; t < ntracks; t++)
     {
-        if (write_miditrack(&midif->tracks[t], fd) != 0)
+        unsigned char *buf = prefixes + t * prefix_len;
+        uint32_t chunksize_be = be32(midif->tracks[t].chunksize);
+
+        bwrite(&buf, midif->tracks[t].chunkid, sizeof(midif->tracks[t].chunkid));
+        bwrite(&buf, &chunksize_be, sizeof(chunksize_be));
+
+        iov[2 * t].iov_base = prefixes + t * prefix_len;
+        iov[2 * t].iov_len = prefix_len;
+        iov[2 * t + 1].iov_base = midif->tracks[t].events;
+        iov[2 * t + 1].iov_len = midif->tracks[t].events_size;
+    }
+
+    for (int v = 0; v < 2 * ntracks; v += IOV_MAX)
+    {
+        int count = 2 * ntracks - v;
+        ssize_t len = 0;
+
+        if (count > IOV_MAX)
         {
-            return 1;
+            count = IOV_MAX;
+        }
+
+        for (int i = v; i < v + count; i++)
+        {
+            len += iov[i].iov_len;
+        }
+
+        if (writev(fd, &iov[v], count) != len)
+        {
+            ret = 1;
+            break;
         }
     }
 
-    return 0;
+    free(prefixes);
+    free(iov);
+
+    return ret;
 }
 
 int write_midiheader(midiheader_t *hdr, int fd)
@@ -323,10 +433,6 @@ int miditrack_noteon(miditrack_t *trk,
         velocity = MIDI_VELOCITY_MAX;
     }
 
-    fprintf(stderr, "noteon: pitch=%u, ticks=%u\n",
-        pitch, deltatime
-    );
-
     return miditrack_addevent(trk,
         deltatime,
         MIDIEVENT_NOTEON | channel,
@@ -344,10 +450,6 @@ int miditrack_noteoff(miditrack_t *trk,
     unsigned char velocity
 )
 {
-    fprintf(stderr, "noteoff: pitch=%u, ticks=%u\n",
-       pitch, deltatime
-    );
-
     if (channel > MIDI_CHANNEL_MAX || pitch > MIDI_PITCH_MAX)
     {
         return 1;
@@ -416,6 +518,21 @@ int miditrack_end(miditrack_t *trk, uint32_t deltatime)
     );
 }
 
+int miditrack_wait(miditrack_t *trk, uint64_t *deltatime)
+{
+    while (*deltatime > MIDI_DELTA_MAX)
+    {
+        if (miditrack_addevent(trk, MIDI_DELTA_MAX, MIDIEVENT_META, META_1_TEXT, 0,
+            NULL, 0) != 0)
+        {
+            return 1;
+        }
+        *deltatime -= MIDI_DELTA_MAX;
+    }
+
+    return 0;
+}
+
 int miditrack_addevent(miditrack_t *track,
     uint32_t deltatime,
     unsigned char status,
@@ -427,9 +544,11 @@ int miditrack_addevent(miditrack_t *track,
 {
     /* Check that the track and its event buffer were created.
      * Also check if the caller has indicated there are extralen bytes of
-     * data in extra, but extra is NULL
+     * data in extra, but extra is NULL, and that the deltatime fits in the
+     * 4 bytes a MIDI file allows it
      */
-    if (!track || !track->events || (!extra && extralen > 0))
+    if (!track || !track->events || (!extra && extralen > 0) ||
+        deltatime > MIDI_DELTA_MAX)
     {
         return 1;
     }
@@ -560,13 +679,15 @@ void free_midifile(midifile_t *midif)
 {
     if (midif != NULL && midif->tracks != NULL)
     {
-        while (midif->header.ntracks-- > 0)
+        while (midif->header.ntracks > 0)
         {
             // first free any track event buffers
-            free_miditrack(&midif->tracks[midif->header.ntracks]);
-            // then free the tracks themselves
-            free(midif->tracks);
+            free_miditrack(&midif->tracks[--midif->header.ntracks]);
         }
+
+        // then free the tracks themselves
+        free(midif->tracks);
+        midif->tracks = NULL;
     }
 }
 
@@ -615,8 +736,6 @@ int enc_varint32(uint32_t val, unsigned char *dst)
 
     while ((val >>= 7) > 0) // perform a right-shift of 7 bits until val == 0
     {
-        val--;
-
         /* decrement our buffer position by one byte,
          * so that the previously written byte is not overwritten.
          */
@@ -633,3 +752,44 @@ int enc_varint32(uint32_t val, unsigned char *dst)
 
     return nbytes;
 }
+
+/* Decodes a variable-length quantity, as encoded by enc_varint32.
+ *
+ * parameters:
+ *   src:    the first byte of the variable-length quantity
+ *   srclen: number of readable bytes at src
+ *   val:    receives the decoded integer
+ *
+ * returns: number of bytes consumed, or 0 if the quantity is truncated or
+ *          longer than VARINT32_MAXSIZE bytes
+ */
+int dec_varint32(const unsigned char *src, size_t srclen, uint32_t *val)
+{
+    uint32_t v = 0;
+
+    if (src == NULL || val == NULL)
+    {
+        return 0;
+    }
+
+    // deltatimes are almost always a single byte
+    if (srclen > 0 && !(src[0] & 0x80))
+    {
+        *val = src[0];
+        return 1;
+    }
+
+    for (size_t i = 0; i < srclen && i < VARINT32_MAXSIZE; i++)
+    {
+        v = (v << 7) | (src[i] & 0x7f);
+
+        // an MSB of 0 marks the last byte of the sequence
+        if (!(src[i] & 0x80))
+        {
+            *val = v;
+            return i + 1;
+        }
+    }
+
+    return 0;
+}
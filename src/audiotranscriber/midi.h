@@ -21,6 +21,7 @@ extern "C" {
 
 /* Variable-length integer encoding */
 #define VARINT32_MAXSIZE    (sizeof(int32_t) + 1) // most bytes needed by varint
+#define MIDI_DELTA_MAX      0x0fffffff  // longest deltatime, the most 4 varint bytes hold
 
 /* MIDI header value ranges */
 #define MIDI_PITCH_MAX      127
@@ -36,6 +37,10 @@ extern "C" {
 
 #define MIDIEVENT_NOTEOFF   0x80    // start of a note (note onset)
 #define MIDIEVENT_NOTEON    0x90    // end of a note (note decay)
+#define MIDIEVENT_PROGRAM   0xc0    // program change (1 data byte)
+#define MIDIEVENT_CHANPRESSURE 0xd0 // channel pressure (1 data byte)
+#define MIDIEVENT_SYSEX     0xf0    // system exclusive event
+#define MIDIEVENT_SYSEX_ESCAPE 0xf7 // system exclusive continuation/escape
 #define MIDIEVENT_META      0xff    // meta event
 
 /* Some Meta event data values */
@@ -43,6 +48,11 @@ extern "C" {
 #define META_1_ENDTRACK     0x2f    // End of track event, first byte
 #define META_2_ENDTRACK     0x00    // End of track event, second byte
 
+#define META_1_TEXT         0x01    /* Text event.
+                                     * 2nd byte is the number of bytes of text
+                                     * that follow. Empty ones fill long gaps.
+                                     */
+
 #define META_1_INSTRUMENT   0x04    /* Instrument name event.
                                      * 2nd byte is number (0-15) of bytes in the
                                      * instrument name.
@@ -103,6 +113,12 @@ typedef struct midifile
 } midifile_t;
 
 
+/* Called by encode_midifile to fill in the events of track number t.
+ * Returns 0 on success, non-zero otherwise.
+ */
+typedef int (*miditrack_encoder_t)(miditrack_t *trk, uint16_t t, void *arg);
+
+
 /* Initialisation functions */
 
 int init_midifile(midifile_t *midif,
@@ -119,6 +135,14 @@ int init_midiheader(midiheader_t *hdr,
 int init_miditrack(miditrack_t *trk, size_t bufsize);
 
 
+/* Encoding functions */
+
+int encode_midifile(midifile_t *midif,
+    miditrack_encoder_t encode,
+    void *arg,
+    unsigned int nthreads);
+
+
 /* Finalisation functions */
 
 int finalise_midifile(midifile_t *midif);
@@ -160,6 +184,13 @@ int miditrack_settempo(miditrack_t *trk,
 
 int miditrack_end(miditrack_t *trk, uint32_t deltatime);
 
+/* Fills a gap of *deltatime ticks too long for one event's deltatime with
+ * empty text events MIDI_DELTA_MAX ticks apart, and leaves in *deltatime
+ * what remains for the next event.
+ * returns 0 on success, 1 otherwise
+ */
+int miditrack_wait(miditrack_t *trk, uint64_t *deltatime);
+
 int miditrack_addevent(miditrack_t *track,
     uint32_t deltatime,
     unsigned char status,
@@ -193,6 +224,8 @@ void bwrite(unsigned char **dst, void *src, size_t nbytes);
 
 int enc_varint32(uint32_t val, unsigned char *dst);
 
+int dec_varint32(const unsigned char *src, size_t srclen, uint32_t *val);
+
 #if defined(__cplusplus)
 }
 #endif
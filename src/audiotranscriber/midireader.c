@@ -0,0 +1,289 @@
+/* midireader.c
+ *
+ * Memory-mapped Standard MIDI File reader.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "endianness.h"
+#include "midi.h"
+#include "midireader.h"
+
+// size of a chunk's ID and size fields
+#define CHUNK_PREFIX_LEN    8
+
+static uint32_t rd_be32(const unsigned char *p);
+static uint16_t rd_be16(const unsigned char *p);
+
+int open_midireader(midireader_t *r, const char *fname)
+{
+    struct stat st;
+    void *map;
+    int fd;
+
+    if (!r || !fname)
+    {
+        return 1;
+    }
+
+    fd = open(fname, O_RDONLY);
+    if (fd < 0)
+    {
+        perror(__func__);
+        return 1;
+    }
+
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        close(fd);
+        return 1;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        perror(__func__);
+        close(fd);
+        return 1;
+    }
+
+    // events are decoded front to back, so let the kernel read ahead
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    if (init_midireader(r, map, st.st_size) != 0)
+    {
+        munmap(map, st.st_size);
+        close(fd);
+        return 1;
+    }
+
+    r->fd = fd;
+    return 0;
+}
+
+int init_midireader(midireader_t *r, const unsigned char *buf, size_t size)
+{
+    uint32_t hdr_chunksize;
+
+    if (!r || !buf)
+    {
+        return 1;
+    }
+
+    r->fd = -1;
+    r->data = buf;
+    r->size = size;
+
+    if (size < midiheader_getsize() || memcmp(buf, "MThd", 4) != 0)
+    {
+        return 1;
+    }
+
+    hdr_chunksize = rd_be32(buf + 4);
+
+    // the header chunk may be longer in future versions of the spec
+    if (hdr_chunksize < midiheader_getsize() - CHUNK_PREFIX_LEN ||
+        hdr_chunksize > size - CHUNK_PREFIX_LEN)
+    {
+        return 1;
+    }
+
+    memcpy(r->header.chunkid, buf, sizeof(r->header.chunkid));
+    r->header.chunksize = hdr_chunksize;
+    r->header.format    = rd_be16(buf + 8);
+    r->header.ntracks   = rd_be16(buf + 10);
+    r->header.time_div  = rd_be16(buf + 12);
+
+    r->chunks = buf + CHUNK_PREFIX_LEN + hdr_chunksize;
+
+    return 0;
+}
+
+void close_midireader(midireader_t *r)
+{
+    if (r != NULL && r->fd >= 0)
+    {
+        munmap((void *) r->data, r->size);
+        close(r->fd);
+        r->fd = -1;
+    }
+}
+
+int midireader_next_track(const midireader_t *r,
+    const unsigned char **pos,
+    midireader_track_t *trk
+)
+{
+    const unsigned char *end;
+    const unsigned char *p;
+    uint32_t chunksize;
+
+    if (!r || !pos || !trk)
+    {
+        return -1;
+    }
+
+    end = r->data + r->size;
+    p = *pos ? *pos : r->chunks;
+
+    while (end - p >= CHUNK_PREFIX_LEN)
+    {
+        chunksize = rd_be32(p + 4);
+        if (chunksize > (size_t) (end - p) - CHUNK_PREFIX_LEN)
+        {
+            // chunk runs past the end of the file
+            return -1;
+        }
+
+        if (memcmp(p, "MTrk", 4) == 0)
+        {
+            trk->start = p + CHUNK_PREFIX_LEN;
+            trk->end = trk->start + chunksize;
+            trk->p = trk->start;
+            trk->running_status = 0;
+            trk->ticks = 0;
+
+            *pos = trk->end;
+            return 1;
+        }
+
+        // as per the spec, chunks of an unknown type are ignored
+        p += CHUNK_PREFIX_LEN + chunksize;
+    }
+
+    *pos = p;
+    return 0;
+}
+
+int midireader_next_event(midireader_track_t *trk, midievent_t *ev)
+{
+    const unsigned char *p;
+    unsigned char status;
+    int n;
+
+    if (!trk || !ev)
+    {
+        return -1;
+    }
+
+    p = trk->p;
+    if (p >= trk->end)
+    {
+        return 0;
+    }
+
+    n = dec_varint32(p, trk->end - p, &ev->deltatime);
+    if (n == 0)
+    {
+        return -1;
+    }
+    p += n;
+
+    if (p >= trk->end)
+    {
+        return -1;
+    }
+
+    if (*p & 0x80)
+    {
+        status = *(p++);
+    }
+    else
+    {
+        // data byte found where status was expected: reuse the last status
+        if (trk->running_status == 0)
+        {
+            return -1;
+        }
+        status = trk->running_status;
+    }
+
+    ev->status = status;
+    ev->meta_type = 0;
+
+    if (status == MIDIEVENT_META)
+    {
+        if (p >= trk->end)
+        {
+            return -1;
+        }
+        ev->meta_type = *(p++);
+
+        n = dec_varint32(p, trk->end - p, &ev->len);
+        if (n == 0)
+        {
+            return -1;
+        }
+        p += n;
+
+        // meta and sysex events cancel running status
+        trk->running_status = 0;
+    }
+    else if (status == MIDIEVENT_SYSEX || status == MIDIEVENT_SYSEX_ESCAPE)
+    {
+        n = dec_varint32(p, trk->end - p, &ev->len);
+        if (n == 0)
+        {
+            return -1;
+        }
+        p += n;
+
+        trk->running_status = 0;
+    }
+    else if (status < 0xf0)
+    {
+        // program change and channel pressure carry one data byte
+        switch (status & 0xf0)
+        {
+            case MIDIEVENT_PROGRAM:
+            case MIDIEVENT_CHANPRESSURE:
+                ev->len = 1;
+                break;
+            default:
+                ev->len = 2;
+                break;
+        }
+
+        trk->running_status = status;
+    }
+    else
+    {
+        // system common and real-time messages are not valid in a file
+        return -1;
+    }
+
+    if (ev->len > (size_t) (trk->end - p))
+    {
+        return -1;
+    }
+
+    ev->data = p;
+    trk->p = p + ev->len;
+
+    trk->ticks += ev->deltatime;
+    ev->ticks = trk->ticks;
+
+    return 1;
+}
+
+/* reads a big-endian integer from a possibly unaligned address */
+static uint32_t rd_be32(const unsigned char *p)
+{
+    uint32_t val;
+    memcpy(&val, p, sizeof(val));
+    return be32(val);
+}
+
+static uint16_t rd_be16(const unsigned char *p)
+{
+    uint16_t val;
+    memcpy(&val, p, sizeof(val));
+    return be16(val);
+}
@@ -0,0 +1,94 @@
+/* midireader.h
+ *
+ * Read-only access to Standard MIDI Files (MIDI specification 1.0).
+ * The file is memory-mapped and its tracks and events are decoded in place,
+ * so no memory is allocated per track or per event.
+ */
+
+#ifndef MIDIREADER_H
+#define MIDIREADER_H
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include "midi.h"
+
+/* an open MIDI file */
+typedef struct midireader
+{
+    int                 fd;         // source file descriptor, or -1 if none
+
+    const unsigned char *data;      // start of the file contents
+    size_t              size;       // length of the file contents
+
+    midiheader_t        header;     // header chunk, in host byte order
+
+    const unsigned char *chunks;    // first chunk following the header chunk
+} midireader_t;
+
+/* a cursor over the events of one track chunk */
+typedef struct midireader_track
+{
+    const unsigned char *start;     // first byte of the track's events
+    const unsigned char *end;       // one past the last byte of the events
+    const unsigned char *p;         // next event to be decoded
+
+    unsigned char       running_status; // status of the last channel event
+    uint64_t            ticks;      // absolute time of the last decoded event
+} midireader_track_t;
+
+/* a decoded MIDI event. data points into the memory-mapped file. */
+typedef struct midievent
+{
+    uint32_t            deltatime;  // ticks since the previous event
+    uint64_t            ticks;      // ticks since the start of the track
+
+    unsigned char       status;     // status byte (running status resolved)
+    unsigned char       meta_type;  // meta event type, if status is 0xff
+
+    const unsigned char *data;      // event data, after status (and meta type)
+    uint32_t            len;        // number of bytes at data
+} midievent_t;
+
+/* Maps the file at fname into memory and parses its header chunk.
+ * returns 0 on success, 1 otherwise
+ */
+int open_midireader(midireader_t *r, const char *fname);
+
+/* Parses the header chunk of a MIDI file already held in memory.
+ * The buffer must remain valid until the reader is no longer used.
+ * returns 0 on success, 1 otherwise
+ */
+int init_midireader(midireader_t *r, const unsigned char *buf, size_t size);
+
+/* unmaps and closes a file opened with open_midireader */
+void close_midireader(midireader_t *r);
+
+/* Finds the track chunk following *pos, skipping chunks of unknown type.
+ * Set *pos to NULL to start from the first chunk.
+ *
+ * returns:
+ *    1: trk was set to the next track, and *pos was advanced past it
+ *    0: there are no more tracks
+ *   -1: the file is malformed
+ */
+int midireader_next_track(const midireader_t *r,
+    const unsigned char **pos,
+    midireader_track_t *trk
+);
+
+/* Decodes the next event of a track.
+ *
+ * returns:
+ *    1: ev was set to the next event
+ *    0: there are no more events in the track
+ *   -1: the track is malformed
+ */
+int midireader_next_event(midireader_track_t *trk, midievent_t *ev);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
@@ -3,6 +3,7 @@
  */
 
 #include <stdint.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -10,18 +11,48 @@
 #include <string.h>
 #include <sys/types.h>
 
+#include "parallel.h"
 #include "midi.h"
 #include "note.h"
 #include "midiwriter.h"
 
+/* arguments of encode_chunk */
+typedef struct notechunks
+{
+    const midiwriter_t  *writer;
+    miditrack_t         *chunks;    // events of each chunk of notes
+} notechunks_t;
+
+static int encode_notes(miditrack_t *trk, uint16_t t, void *arg);
+static int encode_notes_chunked(miditrack_t *trk, uint16_t t, void *arg);
+static int encode_chunk(unsigned int c, void *arg);
+static int encode_note(miditrack_t *trk, const note_t *note,
+    const noteticks_t *ticks, unsigned int tempo_events,
+    uint64_t *prev_ticks);
+static uint64_t samples_to_ticks(uint64_t nsamples, uint64_t num, uint64_t den);
+
 // returns 0 on success, 1 if there was an error
 int gen_midi_file(
     const char *fname,
     note_t *notes,
     unsigned int notecount,
-    unsigned int ppq)
+    unsigned int ppq,
+    unsigned int samplerate)
 {
-    if (!fname || !notes)
+    return gen_midi_file_tracks(fname, notes, notecount, ppq, samplerate, 1, 1);
+}
+
+// returns 0 on success, 1 if there was an error
+int gen_midi_file_tracks(
+    const char *fname,
+    note_t *notes,
+    unsigned int notecount,
+    unsigned int ppq,
+    unsigned int samplerate,
+    unsigned int ntracks,
+    unsigned int nthreads)
+{
+    if (!fname || !notes || samplerate == 0)
     {
         return 1;
     }
@@ -32,27 +63,30 @@ int gen_midi_file(
         ppq = MIDI_PPQ_DEFAULT;
     }
 
-    int bpm;
-
-    // for converting time from seconds to ticks (MIDI sequencer clock cycles)
-    unsigned int ticks_per_sec;
-    // the shortest duration note to support (aka maximum quantisation
-    //const unsigned int shortest_note_ticks = ppq / DIV_SEMIQUAVER;
-
-    const unsigned int ntracks = 1;
-    const unsigned int channel = 0;     // MIDI track channel (0-15)
-
-    // for temporary storage of event offset times in ticks
-    unsigned long int start_delta, stop_delta;
-    // total time in ticks
-    unsigned long int total_ticks;
-    /* set to 1 if a note with a different tempo is found, thus requiring a
-     * a midi tempo event to be added */
-    int tempo_change;
+    // one track per pitch at most
+    if (ntracks == 0 || ntracks > MIDI_PITCH_MAX + 1)
+    {
+        return 1;
+    }
 
     midiwriter_t writer;    // contains data needed to generate the MIDI file
     midifile_t midif;       // the generated MIDI file
 
+    writer.notes = notes;
+    writer.notecount = notecount;
+    writer.ppq = ppq;
+    writer.samplerate = samplerate;
+    writer.ntracks = ntracks;
+    writer.nthreads = nthreads;
+
+    // convert the time of every note from samples to ticks
+    writer.ticks = malloc((notecount ? notecount : 1) * sizeof(noteticks_t));
+    if (!writer.ticks)
+    {
+        return 1;
+    }
+    get_noteticks(notes, notecount, ppq, samplerate, writer.ticks);
+
     // open output file
     writer.fname = strdup(fname);
     writer.fd = creat(writer.fname, 0664);
@@ -63,117 +97,360 @@ int gen_midi_file(
     }
 
     /* initialise a MIDI file structure.
-     * 0 indicates we want default configuration for that option
+     * 0 indicates we want default configuration for that option.
+     * Several tracks are played simultaneously, hence format 1.
      */
-    if (init_midifile(&midif, 0,  ntracks, ppq, 0) != 0)
+    if (init_midifile(&midif, ntracks > 1 ? 1 : 0, ntracks, ppq, 0) != 0)
     {
         return 1;
     }
 
-    /* Begin adding the notes as MIDI events */
+    // add the notes as MIDI events, then finalise each track
+    if (encode_midifile(&midif,
+        ntracks > 1 ? encode_notes : encode_notes_chunked,
+        &writer, nthreads) != 0)
+    {
+        fprintf(stderr, "Error encoding MIDI file\n");
+        return 1;
+    }
 
-    // Set a default tempo. To be used until a note with a known tempo is found.
-    bpm = MIDI_BPM_DEFAULT;
-    ticks_per_sec = (ppq * bpm) / 60;
-    tempo_change = 0;
-    total_ticks = 0;
-    for (int i = 0; i < notecount; i++)
+    // write MIDI file to disk
+    if (write_midifile(&midif, writer.fd) != 0)
+    {
+        fprintf(stderr, "Error writing MIDI file to disk\n");
+        return 1;
+    }
+
+    if (close(writer.fd) != 0)
+    {
+        fprintf(stderr, "Error closing MIDI file\n");
+        return 1;
+    }
+
+    print_midiheader(&midif, stderr);
+
+    // free dynamically allocated memory
+    free_midifile(&midif);
+    free(writer.ticks);
+    free(writer.fname);
+
+    return 0;
+}
+
+/* Converts the start and stop times of every note from samples to ticks.
+ *
+ * Until the first note with a known tempo, MIDI_BPM_DEFAULT is assumed. Each
+ * change of tempo starts a new segment of the timeline at that note's start,
+ * and within a segment
+ *
+ *     ticks = segment start ticks
+ *           + (samples since segment start) * ppq * bpm / (60 * samplerate)
+ *
+ * which is evaluated exactly in 64-bit integers. Every note in a segment is
+ * independent of the others, so each segment is converted in a single pass
+ * with no loop-carried state.
+ *
+ * Finally the timeline is made non-decreasing, so that overlapping input
+ * cannot produce negative deltatimes.
+ */
+void get_noteticks(const note_t *notes,
+    unsigned int notecount,
+    unsigned int ppq,
+    unsigned int samplerate,
+    noteticks_t *ticks)
+{
+    const uint64_t den = 60 * (uint64_t) samplerate;
+    unsigned int bpm = MIDI_BPM_DEFAULT;
+
+    // start of the current tempo segment
+    uint64_t seg_sample = 0, seg_ticks = 0;
+    unsigned int first = 0, last;
+    int tempo_change;
+
+    while (first < notecount)
     {
-        // update the tempo to that (if known) of the current note.
-        if (notes[i].tempo != bpm && notes[i].tempo > 0)
+        tempo_change = (notes[first].tempo != bpm && notes[first].tempo > 0);
+        if (tempo_change)
         {
-            bpm = notes[i].tempo;
-            ticks_per_sec = (ppq * bpm) / 60;
-            tempo_change = 1;
+            // end the current segment where this note begins
+            uint64_t s = notes[first].start_sample;
+            if (s < seg_sample)
+            {
+                s = seg_sample;
+            }
+
+            seg_ticks += samples_to_ticks(s - seg_sample, (uint64_t) ppq * bpm, den);
+            seg_sample = s;
+            bpm = notes[first].tempo;
         }
 
-        // convert the time from seconds to ticks offset from previous event
-        start_delta = (ticks_per_sec * notes[i].start_sec) - total_ticks;
+        // the segment runs until the next change of tempo
+        last = first + 1;
+        while (last < notecount &&
+            (notes[last].tempo == bpm || notes[last].tempo == 0))
+        {
+            last++;
+        }
 
-        // update the total time elapsed in ticks
-        total_ticks += start_delta;
+        const uint64_t num = (uint64_t) ppq * bpm;
+        for (unsigned int i = first; i < last; i++)
+        {
+            uint64_t start = notes[i].start_sample;
+            uint64_t stop = notes[i].stop_sample;
 
-        if (tempo_change)
+            start = start > seg_sample ? start - seg_sample : 0;
+            stop = stop > seg_sample ? stop - seg_sample : 0;
+
+            ticks[i].start = seg_ticks + samples_to_ticks(start, num, den);
+            ticks[i].stop = seg_ticks + samples_to_ticks(stop, num, den);
+            ticks[i].bpm = 0;
+        }
+
+        // the first note of a segment carries its tempo event
+        ticks[first].bpm = tempo_change ? bpm : 0;
+
+        first = last;
+    }
+
+    // keep time moving forwards
+    uint64_t prev = 0;
+    for (unsigned int i = 0; i < notecount; i++)
+    {
+        if (ticks[i].start < prev)
         {
-            if (miditrack_settempo(&midif.tracks[0], start_delta, bpm) != 0)
+            ticks[i].start = prev;
+        }
+        if (ticks[i].stop < ticks[i].start)
+        {
+            ticks[i].stop = ticks[i].start;
+        }
+        prev = ticks[i].stop;
+    }
+}
+
+/* returns nsamples * num / den rounded down, without overflowing:
+ * the quotient and remainder of nsamples / den are scaled separately.
+ */
+static uint64_t samples_to_ticks(uint64_t nsamples, uint64_t num, uint64_t den)
+{
+    return (nsamples / den) * num + ((nsamples % den) * num) / den;
+}
+
+/* Adds the notes of track t to trk as MIDI events.
+ *
+ * The pitch range is divided evenly between the tracks, and each track holds
+ * the notes that fall within its share. All tracks share one timeline, but
+ * tempo events are only stored in the first track.
+ *
+ * returns 0 on success, 1 if there was an error
+ */
+static int encode_notes(miditrack_t *trk, uint16_t t, void *arg)
+{
+    const midiwriter_t *writer = arg;
+    const note_t *notes = writer->notes;
+
+    // range of pitches held by this track
+    const unsigned int pitch_lo = t * (MIDI_PITCH_MAX + 1) / writer->ntracks;
+    const unsigned int pitch_hi = (t + 1) * (MIDI_PITCH_MAX + 1) / writer->ntracks - 1;
+
+    // time of the previous event in this track
+    uint64_t prev_ticks = 0;
+
+    for (unsigned int i = 0; i < writer->notecount; i++)
+    {
+        if (notes[i].pitch >= pitch_lo && notes[i].pitch <= pitch_hi)
+        {
+            if (encode_note(trk, &notes[i], &writer->ticks[i], t == 0, &prev_ticks) != 0)
             {
                 return 1;
             }
+        }
+        else if (t == 0 && writer->ticks[i].bpm)
+        {
+            uint64_t delta = writer->ticks[i].start - prev_ticks;
 
-            // unset the tempo change flag
-            tempo_change = 0;
+            // this track holds the tempo changes of every note
+            if (miditrack_wait(trk, &delta) != 0 ||
+                miditrack_settempo(trk, delta, writer->ticks[i].bpm) != 0)
+            {
+                return 1;
+            }
+            prev_ticks = writer->ticks[i].start;
+        }
+    }
 
-            /* set to zero so the offset is not doubled. (next note should
-             * occur at the same time as the tempo change)
-             */
-            start_delta = 0;
+    return 0;
+}
+
+/* Adds the notes to trk as MIDI events, encoding chunks of
+ * MIDIWRITER_CHUNK_NOTES notes in parallel. Used when there is only one track.
+ *
+ * Each chunk is encoded into its own buffer, taking its first deltatime from
+ * the last tick of the previous chunk, and the buffers are joined in order.
+ *
+ * returns 0 on success, 1 if there was an error
+ */
+static int encode_notes_chunked(miditrack_t *trk, uint16_t t, void *arg)
+{
+    const midiwriter_t *writer = arg;
+    const unsigned int nchunks =
+        (writer->notecount + MIDIWRITER_CHUNK_NOTES - 1) / MIDIWRITER_CHUNK_NOTES;
+
+    notechunks_t ctx;
+    miditrack_t *chunks;
+    size_t len, total;
+    int ret;
+
+    // too little work to be worth dividing
+    if (writer->ntracks != 1 || writer->nthreads < 2 || nchunks < 2)
+    {
+        return encode_notes(trk, t, arg);
+    }
+
+    chunks = calloc(nchunks, sizeof(miditrack_t));
+    if (!chunks)
+    {
+        return 1;
+    }
+
+    ctx.writer = writer;
+    ctx.chunks = chunks;
+
+    ret = parallel_for(nchunks, writer->nthreads, encode_chunk, &ctx);
+
+    if (ret == 0)
+    {
+        total = 0;
+        for (unsigned int c = 0; c < nchunks; c++)
+        {
+            total += chunks[c].eventsp - chunks[c].events;
         }
 
-        // add a 'note begin' event to the MIDI track
-        if (miditrack_noteon(&midif.tracks[0], start_delta, channel,
-            notes[i].pitch, notes[i].velocity) != 0)
+        if (miditrack_buffer_remaining(trk) < total &&
+            miditrack_buffer_increase(trk, total - miditrack_buffer_remaining(trk)) != 0)
         {
-            fprintf(stderr, "Error adding note begin event:\n"
-                            "  pitch: %u\n"
-                            "  start time: %f sec\n"
-                            "  start delta: %lu ticks\n"
-                            "  velocity: %u\n",
-                            notes[i].pitch,
-                            notes[i].start_sec,
-                            start_delta,
-                            notes[i].velocity
-            );
-            return 1;
+            ret = 1;
         }
+    }
 
-        // convert as before.
-        stop_delta = (ticks_per_sec * notes[i].stop_sec) - total_ticks;
+    for (unsigned int c = 0; c < nchunks; c++)
+    {
+        if (ret == 0)
+        {
+            len = chunks[c].eventsp - chunks[c].events;
+            bwrite(&trk->eventsp, chunks[c].events, len);
+        }
+        free_miditrack(&chunks[c]);
+    }
+
+    free(chunks);
+
+    return ret;
+}
+
+/* task routine of encode_notes_chunked. Encodes chunk number c. */
+static int encode_chunk(unsigned int c, void *arg)
+{
+    const notechunks_t *ctx = arg;
+    const midiwriter_t *writer = ctx->writer;
+    miditrack_t *trk = &ctx->chunks[c];
+
+    const unsigned int first = c * MIDIWRITER_CHUNK_NOTES;
+    unsigned int last = first + MIDIWRITER_CHUNK_NOTES;
+
+    // time of the event preceding this chunk
+    uint64_t prev_ticks = first > 0 ? writer->ticks[first - 1].stop : 0;
+
+    if (last > writer->notecount)
+    {
+        last = writer->notecount;
+    }
 
-        // again, update the total time elapsed
-        total_ticks += stop_delta;
+    // a note's two events rarely need more than 8 bytes each
+    if (init_miditrack(trk, (last - first) * 16) != 0)
+    {
+        return 1;
+    }
 
-        // add a 'note end' event to the MIDI track
-        if (miditrack_noteoff(&midif.tracks[0], stop_delta, channel,
-            notes[i].pitch, notes[i].velocity) != 0)
+    for (unsigned int i = first; i < last; i++)
+    {
+        if (encode_note(trk, &writer->notes[i], &writer->ticks[i], 1, &prev_ticks) != 0)
         {
-            fprintf(stderr, "Error adding note end event:\n"
-                            "  pitch: %u\n"
-                            "  stop time: %f sec\n"
-                            "  stop delta: %lu ticks\n"
-                            "  velocity: %u\n",
-                            notes[i].pitch,
-                            notes[i].stop_sec,
-                            stop_delta,
-                            notes[i].velocity
-            );
             return 1;
         }
     }
 
-    // we are finished editing our midi file structure
-    if (finalise_midifile(&midif) != 0)
+    return 0;
+}
+
+/* Adds the events of one note to trk: a tempo change if there is one and
+ * tempo_events is set, then the note's begin and end.
+ *
+ * parameters:
+ *   prev_ticks: time of the previous event in the track. Updated to the
+ *               time of the note's end.
+ *
+ * returns 0 on success, 1 if there was an error
+ */
+static int encode_note(miditrack_t *trk, const note_t *note,
+    const noteticks_t *ticks, unsigned int tempo_events,
+    uint64_t *prev_ticks)
+{
+    const unsigned int channel = 0;     // MIDI track channel (0-15)
+    uint64_t start_delta = ticks->start - *prev_ticks;
+    uint64_t length = ticks->stop - ticks->start;
+
+    // a gap or a note too long for one deltatime is filled out first
+    if (miditrack_wait(trk, &start_delta) != 0)
     {
-        fprintf(stderr, "Error finalising MIDI file\n");
         return 1;
     }
 
-    // write MIDI file to disk
-    if (write_midifile(&midif, writer.fd) != 0)
+    if (tempo_events && ticks->bpm)
     {
-        fprintf(stderr, "Error writing MIDI file to disk\n");
-        return 1;
+        if (miditrack_settempo(trk, start_delta, ticks->bpm) != 0)
+        {
+            return 1;
+        }
+
+        /* set to zero so the offset is not doubled. (the note should
+         * occur at the same time as the tempo change)
+         */
+        start_delta = 0;
     }
 
-    if (close(writer.fd) != 0)
+    // add a 'note begin' event to the MIDI track
+    if (miditrack_noteon(trk, start_delta, channel,
+        note->pitch, note->velocity) != 0)
     {
-        fprintf(stderr, "Error closing MIDI file\n");
+        fprintf(stderr, "Error adding note begin event:\n"
+                        "  pitch: %u\n"
+                        "  start time: %" PRIu64 " ticks\n"
+                        "  velocity: %u\n",
+                        note->pitch,
+                        ticks->start,
+                        note->velocity
+        );
         return 1;
     }
 
-    print_midiheader(&midif, stderr);
+    // add a 'note end' event to the MIDI track
+    if (miditrack_wait(trk, &length) != 0 ||
+        miditrack_noteoff(trk, length, channel,
+        note->pitch, note->velocity) != 0)
+    {
+        fprintf(stderr, "Error adding note end event:\n"
+                        "  pitch: %u\n"
+                        "  stop time: %" PRIu64 " ticks\n"
+                        "  velocity: %u\n",
+                        note->pitch,
+                        ticks->stop,
+                        note->velocity
+        );
+        return 1;
+    }
 
-    // free dynamically allocated memory
-    free_midifile(&midif);
+    *prev_ticks = ticks->stop;
 
     return 0;
 }
@@ -17,6 +17,17 @@ extern "C" {
 #define DIV_SEMIQUAVER      (DIV_QUAVER * 2)
 #define DIV_DEMISEMIQUAVER  (DIV_SEMIQUAVER * 2)
 
+/* number of notes per chunk when a single track is encoded by several threads */
+#define MIDIWRITER_CHUNK_NOTES  16384
+
+/* absolute times of the events of one note, in ticks */
+typedef struct noteticks
+{
+    uint64_t        start;      // note begin, and tempo change if any
+    uint64_t        stop;       // note end
+    unsigned int    bpm;        // tempo to set at start, or 0 if unchanged
+} noteticks_t;
+
 typedef struct midiwriter
 {
     char            *fname;     // destination file path
@@ -24,6 +35,13 @@ typedef struct midiwriter
 
     note_t          *notes;     // the notes that the music contains
     unsigned int    notecount;  // number of elements in notes buffer
+
+    noteticks_t     *ticks;     // times of the notes' events
+
+    unsigned int    ppq;        // pulses per quarter note
+    unsigned int    samplerate; // rate of the samples the notes are timed in
+    unsigned int    ntracks;    // number of tracks to divide the notes between
+    unsigned int    nthreads;   // maximum number of threads to encode with
 } midiwriter_t;
 
 /* method which creates a MIDI file according to the input.
@@ -31,7 +49,9 @@ typedef struct midiwriter
  * parameters:
  *   notes:     buffer of musical notes.
  *   notecount: number of notes in buffer.
- *   tempo:     tempo of the music, in crotchet beats per minute (BPM).
+ *   ppq:       MIDI clock rate, in pulses per quarter note (0 for default).
+ *   samplerate: sample rate of the audio that the notes' start_sample and
+ *              stop_sample refer to.
  *   fname:     file to write MIDI data to
  *
  * returns: 0 on success, 1 otherwise
@@ -40,7 +60,43 @@ int gen_midi_file(
     const char *fname,
     note_t *notes,
     unsigned int notecount,
-    unsigned int ppq
+    unsigned int ppq,
+    unsigned int samplerate
+);
+
+/* as above, but divides the notes between ntracks tracks by pitch range,
+ * encoding up to nthreads tracks concurrently.
+ *
+ * A single track of more than MIDIWRITER_CHUNK_NOTES notes is instead split
+ * into chunks of notes, which are encoded concurrently and then joined. The
+ * output is identical to that of encoding the track on one thread.
+ *
+ * parameters:
+ *   ntracks:   number of tracks (1-128). Each holds an equal share of the
+ *              MIDI pitch range.
+ *   nthreads:  maximum number of tracks to encode at once.
+ *
+ * returns: 0 on success, 1 otherwise
+ */
+int gen_midi_file_tracks(
+    const char *fname,
+    note_t *notes,
+    unsigned int notecount,
+    unsigned int ppq,
+    unsigned int samplerate,
+    unsigned int ntracks,
+    unsigned int nthreads
+);
+
+/* Converts the start and stop sample of each note to an absolute MIDI tick,
+ * following the tempo of the notes, and marks the notes at which the tempo
+ * changes. Conversion is exact, using 64-bit integer arithmetic.
+ */
+void get_noteticks(const note_t *notes,
+    unsigned int notecount,
+    unsigned int ppq,
+    unsigned int samplerate,
+    noteticks_t *ticks
 );
 
 /* Parser for output of aubionotes command */
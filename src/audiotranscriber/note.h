@@ -1,6 +1,8 @@
 #ifndef NOTE_H
 #define NOTE_H
 
+#include <stdint.h>
+
 #if defined(__cplusplus)
 extern "C" {
 #endif
@@ -12,6 +14,8 @@ typedef struct note
     unsigned int tempo;             // estimated tempo (in beats per minute)
     double  start_sec;    // start time, offset from beginning of entire music
     double  stop_sec;     // stop time, offset from beginning of entire music
+    uint64_t start_sample;  // start time, as an index into the source audio
+    uint64_t stop_sample;   // stop time, as an index into the source audio
 } note_t;
 
 #if defined(__cplusplus)
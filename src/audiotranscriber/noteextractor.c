@@ -10,54 +10,108 @@
 
 #include "memory.h"
 #include "noteextractor.h"
+#include "notesegmenter.h"
+#include "yinpitch.h"
+#include "clipbatch.h"
+#include "parallel.h"
 
-static unsigned int roundm(unsigned int unrounded, unsigned int multiple);
-
-/* returns the input number rounded to the nearest multiple of n */
-static unsigned int roundm(unsigned int unrounded, unsigned int multiple)
-{
-    return ((unrounded + multiple/2) / multiple) * multiple;
-}
+#define NOTEEXTRACTOR_NOTES_INCR    1000    // number of notes to add room for when full
 
-int extract_notes(
-    aubio_source_t *source,
-    unsigned int winsize,
-    unsigned int hopsize,
-    unsigned int bpm,
-    note_t **notes
-)
+/* the notes found so far, and the note being followed */
+typedef struct notelist
 {
-    if (!source || !notes)
-    {
-        return -1;
-    }
+    note_t          **notes;
+    size_t          notecount, notes_max;
 
-    // object holding context needed by aubio note functions
-    aubio_notes_t *notes_ctx;
-    smpl_t onset_minioi = 0.0;
-    smpl_t silence_threshold = -90.;
-    smpl_t release_drop = 10.;
+    unsigned int    samplerate;
+    unsigned int    bpm;            // tempo given by the caller, 0 to detect it
 
-    // object holding context needed by aubio tempo functions
-    aubio_tempo_t *tempo_ctx;
-
-    unsigned int samplerate;
-
-    fvec_t *ibuf, *obuf_notes, *obuf_tempo;
-    int blocks;
-	unsigned int nframes;
+    // for calculating average tempo across the duration of a note
+    int             note_present;   // is set upon detection of a note
+    double          tempo_sum;      // the sum of all detected tempos during a note's lifespan
+    unsigned long   tempo_count;    // number of tempos contained in sum
+} notelist_t;
 
-    size_t          notecount, notes_max; // for use with *notes
-    const size_t    notes_incr  = 1000; // number of elements to add when full
+/* silence to be jumped over, from skip_from to skip_to, if skip_to is set */
+typedef struct silenceskip
+{
+    uint64_t        margin;
+    uint64_t        skip_from, skip_to;
+} silenceskip_t;
 
-    // for calculating average tempo across the duration of a note
-    int note_present; // is set upon detection of a note
-    double tempo_thisblock;
-    double tempo_sum; // the sum of all detected tempos during a note's lifespan
-    unsigned long int tempo_count = 0; // number of tempos contained in sum
-    const unsigned int tempo_accuracy = 5;
+/* the analysers that run over a block of hops, and what they found in each */
+typedef struct analysers
+{
+    aubio_onset_t   *onset_ctx;     // onset detection by aubio, or NULL...
+    onsetdetect_t   *detect;        // ...if it is done by onsetdetect
+    aubio_tempo_t   *tempo_ctx;
+    notesegmenter_t seg;
+    fvec_t          *obuf_onset, *obuf_tempo;
+
+    int             onsets[NOTEEXTRACTOR_BLOCK_HOPS];
+    float           levels[NOTEEXTRACTOR_BLOCK_HOPS];
+    float           tempos[NOTEEXTRACTOR_BLOCK_HOPS];
+} analysers_t;
+
+/* a batch of hops whose pitches are estimated in parallel */
+typedef struct pitchbatch
+{
+    const float     *samples;   // warmup hops from before the batch, then the batch
+    float           *pitches;   // pitch of each hop of the batch
+    size_t          nhops;      // hops in the batch
+    unsigned int    warmup;     // hops that fill the pitch window
+    unsigned int    winsize, hopsize, samplerate;
+    const char      *method;    // pitch detection method
+} pitchbatch_t;
+
+static int extract_hops(
+    notesource_t *source,
+    unsigned int winsize,
+    unsigned int hopsize,
+    aubio_notes_t *notes_ctx,
+    aubio_tempo_t *tempo_ctx,
+    notelist_t *list
+);
+static int extract_batches(
+    notesource_t *source,
+    unsigned int winsize,
+    unsigned int hopsize,
+    const char *pitch_method,
+    const char *onset_method,
+    unsigned int jobs,
+    aubio_tempo_t *tempo_ctx,
+    notelist_t *list
+);
+static int segment_block(analysers_t *an, float *samples, unsigned int hopsize,
+    size_t nhops, const float *pitches, const uint64_t *positions, notelist_t *list);
+static void track_tempo(aubio_tempo_t *tempo_ctx, float *samples, unsigned int hopsize,
+    size_t nhops, fvec_t *obuf_tempo, float *tempos);
+static int estimate_pitch(unsigned int task, void *arg);
+static int estimate_yin(pitchbatch_t *pb, size_t first, size_t last);
+static int add_events(notelist_t *list, const smpl_t *events, uint64_t position,
+    float tempo);
+static uint64_t skip_silence(notesource_t *source, silenceskip_t *skip, uint64_t position,
+    unsigned int hopsize);
+static int extract_lanes(
+    notesource_t *sources,
+    unsigned int lanes,
+    unsigned int winsize,
+    unsigned int hopsize,
+    unsigned int bpm,
+    note_t **notes,
+    int *notecounts
+);
+static int check_args(unsigned int winsize, unsigned int hopsize, unsigned int bpm);
+static int init_notelist(notelist_t *list, note_t **notes, unsigned int samplerate,
+    unsigned int bpm);
+static void set_tempos(note_t *notes, size_t notecount, unsigned int bpm);
+static unsigned int roundm(unsigned int unrounded, unsigned int multiple);
 
-    // sanity check input arguments
+/* returns 0 if the window and hop sizes and tempo make sense, or 1 after
+ * saying why they do not
+ */
+static int check_args(unsigned int winsize, unsigned int hopsize, unsigned int bpm)
+{
     if (hopsize > winsize)
     {
         fprintf(stderr, "Error: hop size cannot be larger than window size\n");
@@ -84,197 +138,222 @@ int extract_notes(
         return 1;
     }
 
-    samplerate = aubio_source_get_samplerate(source);
+    return 0;
+}
 
-    /* set up notes object */
-    notes_ctx = new_aubio_notes("default", winsize, hopsize, samplerate);
-	if (notes_ctx == NULL)
-	{
-	    return 1;
+/* allocates memory for extracted musical features, in *notes.
+ * returns 0 on success, 1 otherwise
+ */
+static int init_notelist(notelist_t *list, note_t **notes, unsigned int samplerate,
+    unsigned int bpm)
+{
+    list->notes_max = 2000;
+    *notes = (note_t *) malloc(list->notes_max * sizeof(note_t));
+    if (!*notes)
+    {
+        return 1;
     }
 
-	if (onset_minioi != 0.)
-	{
-		aubio_notes_set_minioi_ms(notes_ctx, onset_minioi);
-	}
+    list->notes = notes;
+    list->notecount = 0;
+    list->samplerate = samplerate;
+    list->bpm = bpm;
+    list->note_present = 0;
+    list->tempo_sum = 0;
+    list->tempo_count = 0;
 
-	if (aubio_notes_set_silence (notes_ctx, silence_threshold) != 0)
-	{
-		fprintf(stderr, "Error: could not set silence threshold to %.2f\n",
-			silence_threshold
-		);
-	}
+    return 0;
+}
 
-	if (aubio_notes_set_release_drop (notes_ctx, release_drop) != 0)
-	{
-		fprintf(stderr, "Error: could not set release drop to %.2f\n",
-			release_drop
-		);
-	}
+/* gives every note the tempo bpm, or if it is 0, the one most of them have */
+static void set_tempos(note_t *notes, size_t notecount, unsigned int bpm)
+{
+    if (!bpm)
+    {
+        // set tempo to the most frequently occurring tempo in the music
+        bpm = get_modal_tempo(notes, notecount);
+    }
 
-    /* set up tempo object */
-    tempo_ctx = new_aubio_tempo("default", winsize, hopsize, samplerate);
-    if (tempo_ctx == NULL)
-	{
-	    del_aubio_notes(notes_ctx);
-	    return 1;
+    for (size_t i = 0; i < notecount; i++)
+    {
+        notes[i].tempo = bpm;
     }
+}
 
-    /* allocate memory for extracted musical features */
-    notes_max = 2000;
-    *notes = (note_t *) malloc(notes_max * sizeof(note_t));
-    if (!*notes)
+/* returns the input number rounded to the nearest multiple of n */
+static unsigned int roundm(unsigned int unrounded, unsigned int multiple)
+{
+    return ((unrounded + multiple/2) / multiple) * multiple;
+}
+
+int extract_notes(
+    notesource_t *source,
+    unsigned int winsize,
+    unsigned int hopsize,
+    unsigned int bpm,
+    const char *pitch_method,
+    const char *onset_method,
+    unsigned int jobs,
+    note_t **notes
+)
+{
+    if (!source || !notes || !pitch_method || !onset_method)
     {
-        del_aubio_tempo(tempo_ctx);
-        del_aubio_notes(notes_ctx);
         return -1;
     }
 
-    /* allocate buffers for input/output of aubio library functions */
-    ibuf = new_fvec(hopsize);
-    obuf_notes = new_fvec(hopsize);
-    obuf_tempo = new_fvec(1);
+    // object holding context needed by aubio note functions
+    aubio_notes_t *notes_ctx = NULL;
+    smpl_t onset_minioi = 0.0;
+    smpl_t silence_threshold = NOTEEXTRACTOR_SILENCE_DB;
+    smpl_t release_drop = NOTESEGMENTER_RELEASE_DROP;
 
-    /* process the input audio, extracting pitch, onset and tempo */
-    nframes = 0;
-	blocks = 0;
+    // object holding context needed by aubio tempo functions
+    aubio_tempo_t *tempo_ctx;
 
-	note_present = 0;
-    tempo_sum = 0;
-    tempo_count = 0;
+    unsigned int samplerate;
 
-    notecount = 0;
-	do
-	{
-	    // read in audio samples
-		aubio_source_do (source, ibuf, &nframes);
+    notelist_t      list;
+    int             err = 0;
 
-        // extract pitch and onset information from audio samples
-		aubio_notes_do (notes_ctx, ibuf, obuf_notes);
+    // sanity check input arguments
+    if (check_args(winsize, hopsize, bpm) != 0)
+    {
+        return -1;
+    }
 
-        // extract tempo information from audio samples
-		aubio_tempo_do (tempo_ctx, ibuf, obuf_tempo);
+    samplerate = source->samplerate;
 
-        // if we have detected the end of a note
-        if (obuf_notes->data[2] != 0 && note_present)
-        {
-	        (*notes)[notecount].stop_sec = (blocks * hopsize) / (float) samplerate;
+    /* aubio_notes only estimates pitch and finds onsets its own way, so
+     * other methods are used in batches, on one thread if need be
+     */
+    if ((strcmp(pitch_method, NOTEEXTRACTOR_PITCH_DEFAULT) != 0 ||
+        strcmp(onset_method, NOTEEXTRACTOR_ONSET_DEFAULT) != 0) && jobs == 0)
+    {
+        jobs = 1;
+    }
 
-            // if the caller wants us to detect tempo and we were able to do so
-            if (bpm == 0 && tempo_count > 0)
-            {
-                // store average of all detected tempos during the note lifespan
-                (*notes)[notecount].tempo = (unsigned int) round(tempo_sum / tempo_count);
-                // round tempo number to nearest multiple of 5
-                (*notes)[notecount].tempo = (unsigned int) roundm((*notes)[notecount].tempo, tempo_accuracy);
-            }
-            else
-            {
-                /* tempo could not be ascertained, or the caller has provided us
-                 * with the tempo
-                 */
-                (*notes)[notecount].tempo = bpm;
-            }
+    /* set up notes object, unless pitch is estimated separately */
+    if (jobs == 0)
+    {
+        notes_ctx = new_aubio_notes("default", winsize, hopsize, samplerate);
+	    if (notes_ctx == NULL)
+	    {
+	        return -1;
+        }
 
-            // we have completed a note, therefore increment the note index
-	        notecount++;
-	        // set to zero to indicate that the next note is as of yet undefined
-	        (*notes)[notecount].pitch = 0;
+	    if (onset_minioi != 0.)
+	    {
+		    aubio_notes_set_minioi_ms(notes_ctx, onset_minioi);
+	    }
 
-            note_present = 0;
-        }
+	    if (aubio_notes_set_silence (notes_ctx, silence_threshold) != 0)
+	    {
+		    fprintf(stderr, "Error: could not set silence threshold to %.2f\n",
+			    silence_threshold
+		    );
+	    }
+
+	    if (aubio_notes_set_release_drop (notes_ctx, release_drop) != 0)
+	    {
+		    fprintf(stderr, "Error: could not set release drop to %.2f\n",
+			    release_drop
+		    );
+	    }
+    }
 
-        // if we have detected the start of a note
-	    if (obuf_notes->data[0] != 0)
+    /* set up tempo object */
+    tempo_ctx = new_aubio_tempo("default", winsize, hopsize, samplerate);
+    if (tempo_ctx == NULL)
+	{
+	    if (notes_ctx)
 	    {
-	        // if there is already an ongoing note, end it before adding this one
-	        if (note_present)
-	        {
-	            (*notes)[notecount].stop_sec = (blocks * hopsize) / (float) samplerate;
-
-                // if the caller wants us to detect tempo and we were able to do so
-                if (bpm == 0 && tempo_count > 0)
-                {
-                    // store average of all detected tempos during the note lifespan
-                    (*notes)[notecount].tempo = (unsigned int) round(tempo_sum / tempo_count);
-                    // round tempo number to nearest multiple of 5
-                    (*notes)[notecount].tempo = (unsigned int) roundm((*notes)[notecount].tempo, tempo_accuracy);
-
-                    // we have completed a note, therefore increment the note index
-	                notecount++;
-	                // set to zero to indicate that the next note is as of yet undefined
-	                (*notes)[notecount].pitch = 0;
-                }
-                else
-                {
-                    // tempo could not be ascertained, or the caller has provided us with the tempo instead
-                    (*notes)[notecount].tempo = bpm;
-                }
-
-                // we have completed a note, therefore increment the note index
-	            notecount++;
-	        }
-
-	        (*notes)[notecount].start_sec = (blocks * hopsize) / (float) samplerate;
-
-            // reset tempo tracking variables, as a new note has begun
-            note_present = 1;
-	        tempo_sum = 0;
-	        tempo_count = 0;
-
-		    (*notes)[notecount].pitch = (unsigned int) obuf_notes->data[0];
-		    (*notes)[notecount].velocity = obuf_notes->data[1];
+	        del_aubio_notes(notes_ctx);
 	    }
+	    return -1;
+    }
 
-        /* If there is an ongoing note, and the caller wants us to detect tempo,
-         * estimate the tempo.
-         */
-        if (note_present == 1 && bpm == 0)
+    /* allocate memory for extracted musical features */
+    if (init_notelist(&list, notes, samplerate, bpm) != 0)
+    {
+        del_aubio_tempo(tempo_ctx);
+        if (notes_ctx)
         {
-            tempo_thisblock = aubio_tempo_get_bpm(tempo_ctx);
-            if ( tempo_thisblock >= 0)
-            {
-                tempo_sum += tempo_thisblock;
-                tempo_count++;
-            }
+            del_aubio_notes(notes_ctx);
         }
+        return -1;
+    }
 
-		blocks++;
+    source->skipped = 0;
 
-        // resize the notes buffer to accommodate more notes
-		if (notecount == notes_max)
-		{
-		    notes_max += notes_incr;
-            *notes = realloc_or_free(*notes, notes_max);
-		    if (*notes == NULL)
-            {
-                notecount = -1;
-                break;
-            }
-        }
-	} while (nframes == hopsize);
+    if (jobs > 0)
+    {
+        err = extract_batches(source, winsize, hopsize, pitch_method, onset_method, jobs,
+            tempo_ctx, &list);
+    }
+    else
+    {
+        err = extract_hops(source, winsize, hopsize, notes_ctx, tempo_ctx, &list);
+        del_aubio_notes(notes_ctx);
+    }
 
-    if (!bpm)
+    del_aubio_tempo(tempo_ctx);
+
+    if (err)
     {
-        // set tempo to the most frequently occurring tempo in the music
-        bpm = get_modal_tempo(*notes, notecount);
+        free(*notes);
+        *notes = NULL;
+        return -1;
     }
 
-    for (int i = 0; i < notecount; i++)
+    set_tempos(*notes, list.notecount, bpm);
+
+    return list.notecount;
+}
+
+int extract_clips(
+    notesource_t *sources,
+    unsigned int nclips,
+    unsigned int winsize,
+    unsigned int hopsize,
+    unsigned int bpm,
+    note_t **notes,
+    int *notecounts
+)
+{
+    unsigned int lanes;
+    int err = 0;
+
+    if (!sources || !notes || !notecounts || check_args(winsize, hopsize, bpm) != 0)
     {
-        (*notes)[i].tempo = bpm;
+        return -1;
     }
 
-    /* cleanup */
+    for (unsigned int i = 0; i < nclips; i++)
+    {
+        notes[i] = NULL;
+        notecounts[i] = 0;
+    }
 
-    del_fvec(ibuf);
-    del_fvec(obuf_notes);
-    del_fvec(obuf_tempo);
+    for (unsigned int first = 0; first < nclips && !err; first += lanes)
+    {
+        lanes = nclips - first < CLIPBATCH_LANES ? nclips - first : CLIPBATCH_LANES;
+        err = extract_lanes(sources + first, lanes, winsize, hopsize, bpm,
+            notes + first, notecounts + first);
+    }
 
-    del_aubio_notes(notes_ctx);
-    del_aubio_tempo(tempo_ctx);
+    if (err)
+    {
+        for (unsigned int i = 0; i < nclips; i++)
+        {
+            free(notes[i]);
+            notes[i] = NULL;
+            notecounts[i] = 0;
+        }
+        return -1;
+    }
 
-    return notecount;
+    return 0;
 }
 
 unsigned int get_modal_tempo(note_t *notes, unsigned int notecount)
@@ -306,3 +385,603 @@ unsigned int get_modal_tempo(note_t *notes, unsigned int notecount)
 
     return mode;
 }
+
+/* Analyses up to CLIPBATCH_LANES clips in lockstep, a hop of each at a
+ * time, until the last of them ends. Their pitches and onsets are found
+ * together, in the lanes of a clipbatch, and their tempo and notes a clip
+ * at a time.
+ * returns 0 on success, 1 otherwise
+ */
+static int extract_lanes(
+    notesource_t *sources,
+    unsigned int lanes,
+    unsigned int winsize,
+    unsigned int hopsize,
+    unsigned int bpm,
+    note_t **notes,
+    int *notecounts
+)
+{
+    const unsigned int samplerate = sources[0].samplerate;
+    clipbatch_t cb;
+    notelist_t lists[CLIPBATCH_LANES];
+    notesegmenter_t segs[CLIPBATCH_LANES];
+    aubio_tempo_t *tempo_ctxs[CLIPBATCH_LANES] = { NULL };
+    fvec_t *bufs[CLIPBATCH_LANES] = { NULL };
+    const float *hops[CLIPBATCH_LANES] = { NULL };
+    int ended[CLIPBATCH_LANES], onsets[CLIPBATCH_LANES];
+    float pitches[CLIPBATCH_LANES];
+    double sumsq[CLIPBATCH_LANES];
+    fvec_t *obuf_tempo;
+    smpl_t events[3];
+    uint64_t position = 0;  // index of the first sample of the current hop
+    unsigned int playing = lanes;
+    uint_t nread;
+    float level;
+    int err = 0;
+
+    for (unsigned int l = 0; l < lanes; l++)
+    {
+        if (sources[l].samplerate != samplerate)
+        {
+            fprintf(stderr, "Error: clips analysed together must have the same sample rate\n");
+            return 1;
+        }
+    }
+
+    if (init_clipbatch(&cb, lanes, winsize, hopsize, NOTEEXTRACTOR_PITCH_SCALE * winsize,
+        samplerate, NOTEEXTRACTOR_SILENCE_DB, NOTEEXTRACTOR_MINIOI_MS) != 0)
+    {
+        fprintf(stderr, "Error: clips need a window size that is a power of two\n");
+        return 1;
+    }
+
+    obuf_tempo = new_fvec(1);
+    err = !obuf_tempo;
+
+    for (unsigned int l = 0; l < lanes && !err; l++)
+    {
+        init_notesegmenter(&segs[l], NOTEEXTRACTOR_SILENCE_DB, NOTESEGMENTER_RELEASE_DROP);
+        tempo_ctxs[l] = new_aubio_tempo("default", winsize, hopsize, samplerate);
+        bufs[l] = new_fvec(hopsize);
+
+        err = !tempo_ctxs[l] || !bufs[l] || init_notelist(&lists[l], &notes[l], samplerate, bpm) != 0;
+        if (!err)
+        {
+            hops[l] = bufs[l]->data;
+            sources[l].skipped = 0;
+        }
+    }
+
+    while (!err && playing > 0)
+    {
+        for (unsigned int l = 0; l < lanes; l++)
+        {
+            if (hops[l])
+            {
+                sources[l].read(sources[l].ctx, bufs[l], &nread);
+                ended[l] = nread != hopsize;
+            }
+        }
+
+        clipbatch_do(&cb, hops, pitches, onsets, sumsq);
+
+        for (unsigned int l = 0; l < lanes && !err; l++)
+        {
+            if (!hops[l])
+            {
+                continue;
+            }
+
+            aubio_tempo_do(tempo_ctxs[l], bufs[l], obuf_tempo);
+
+            level = notesegmenter_level_of(sumsq[l], hopsize, NOTEEXTRACTOR_SILENCE_DB);
+            notesegmenter_do(&segs[l], pitches[l], onsets[l], level, events);
+
+            err = add_events(&lists[l], events, position, aubio_tempo_get_bpm(tempo_ctxs[l]));
+
+            // its last hop, short or not, has been analysed
+            if (ended[l])
+            {
+                hops[l] = NULL;
+                playing--;
+            }
+        }
+
+        position += hopsize;
+    }
+
+    for (unsigned int l = 0; l < lanes; l++)
+    {
+        if (tempo_ctxs[l])
+        {
+            del_aubio_tempo(tempo_ctxs[l]);
+        }
+        del_fvec(bufs[l]);
+
+        if (!err)
+        {
+            set_tempos(notes[l], lists[l].notecount, bpm);
+            notecounts[l] = lists[l].notecount;
+        }
+    }
+
+    del_fvec(obuf_tempo);
+    free_clipbatch(&cb);
+
+    return err;
+}
+
+/* Analyses the audio by aubio_notes, a block of NOTEEXTRACTOR_BLOCK_HOPS hops
+ * at a time: the notes of each hop of the block are found, then its tempo.
+ * returns 0 on success, 1 otherwise
+ */
+static int extract_hops(
+    notesource_t *source,
+    unsigned int winsize,
+    unsigned int hopsize,
+    aubio_notes_t *notes_ctx,
+    aubio_tempo_t *tempo_ctx,
+    notelist_t *list
+)
+{
+    silenceskip_t skip = { (uint64_t) NOTEEXTRACTOR_SKIP_MARGIN * winsize, 0, 0 };
+    uint64_t positions[NOTEEXTRACTOR_BLOCK_HOPS];
+    smpl_t events[NOTEEXTRACTOR_BLOCK_HOPS][3];
+    float tempos[NOTEEXTRACTOR_BLOCK_HOPS];
+    fvec_t hop = { .length = hopsize };
+    fvec_t obuf_notes = { .length = 3 };
+    fvec_t *obuf_tempo;
+    float *samples;
+    uint64_t blocks = 0;    // number of hops read
+    uint_t nread = hopsize;
+    size_t nhops;
+    int err;
+
+    samples = malloc((size_t) NOTEEXTRACTOR_BLOCK_HOPS * hopsize * sizeof(float));
+    obuf_tempo = new_fvec(1);
+    err = !samples || !obuf_tempo;
+
+    while (!err && nread == hopsize)
+    {
+        // read in a block of hops, one after another in memory
+        for (nhops = 0; nhops < NOTEEXTRACTOR_BLOCK_HOPS && nread == hopsize; nhops++)
+        {
+            positions[nhops] = skip_silence(source, &skip, blocks * hopsize, hopsize);
+            blocks = positions[nhops] / hopsize + 1;
+
+            hop.data = samples + nhops * hopsize;
+            source->read(source->ctx, &hop, &nread);
+        }
+
+        // extract pitch and onset information from the block
+        for (size_t i = 0; i < nhops; i++)
+        {
+            hop.data = samples + i * hopsize;
+            obuf_notes.data = events[i];
+            aubio_notes_do(notes_ctx, &hop, &obuf_notes);
+        }
+
+        // extract tempo information from the block
+        track_tempo(tempo_ctx, samples, hopsize, nhops, obuf_tempo, tempos);
+
+        for (size_t i = 0; i < nhops && !err; i++)
+        {
+            err = add_events(list, events[i], positions[i], tempos[i]);
+        }
+    }
+
+    del_fvec(obuf_tempo);
+    free(samples);
+
+    return err;
+}
+
+/* Estimates the pitch of every hop of a batch at once, on up to jobs
+ * threads, then finds onsets, tempo and notes over the batch in order.
+ * Pitch is estimated over a window NOTEEXTRACTOR_PITCH_SCALE times
+ * winsize, as aubio_notes does, and depends on nothing but the samples in
+ * the window; so each task fills it first with the hops before its own,
+ * and its results are just as if every hop had been seen in turn.
+ * Onsets are found by aubio, or by onsetdetect for ONSETDETECT_FFT. The
+ * batch is then analysed a block at a time, as extract_hops does.
+ * returns 0 on success, 1 otherwise
+ */
+static int extract_batches(
+    notesource_t *source,
+    unsigned int winsize,
+    unsigned int hopsize,
+    const char *pitch_method,
+    const char *onset_method,
+    unsigned int jobs,
+    aubio_tempo_t *tempo_ctx,
+    notelist_t *list
+)
+{
+    const size_t batch = (size_t) NOTEEXTRACTOR_TASK_HOPS * NOTEEXTRACTOR_BATCH_TASKS * jobs;
+    silenceskip_t skip = { (uint64_t) NOTEEXTRACTOR_SKIP_MARGIN * winsize, 0, 0 };
+    pitchbatch_t pb;
+    analysers_t an = { .tempo_ctx = tempo_ctx };
+    onsetdetect_t detect;
+    fvec_t hop = { .length = hopsize };
+    uint64_t *positions;
+    float *samples;
+    uint64_t blocks = 0;
+    uint_t nread = hopsize;
+    size_t nhops;
+    int err = 0;
+
+    pb.warmup = (NOTEEXTRACTOR_PITCH_SCALE * winsize + hopsize - 1) / hopsize;
+    pb.winsize = winsize;
+    pb.hopsize = hopsize;
+    pb.samplerate = source->samplerate;
+    pb.method = pitch_method;
+
+    // the window starts out silent, as aubio's does
+    samples = calloc((pb.warmup + batch) * hopsize, sizeof(float));
+    pb.samples = samples;
+    pb.pitches = malloc(batch * sizeof(float));
+    positions = malloc(batch * sizeof(uint64_t));
+    an.obuf_onset = new_fvec(1);
+    an.obuf_tempo = new_fvec(1);
+
+    if (strcmp(onset_method, ONSETDETECT_FFT) == 0)
+    {
+        if (init_onsetdetect(&detect, winsize, hopsize, source->samplerate,
+            NOTEEXTRACTOR_SILENCE_DB, NOTEEXTRACTOR_MINIOI_MS) == 0)
+        {
+            an.detect = &detect;
+        }
+        else
+        {
+            fprintf(stderr, "Error: onset method %s needs a window size that is a power of two\n",
+                onset_method
+            );
+        }
+    }
+    else
+    {
+        an.onset_ctx = new_aubio_onset(onset_method, winsize, hopsize, source->samplerate);
+        if (an.onset_ctx)
+        {
+            aubio_onset_set_silence(an.onset_ctx, NOTEEXTRACTOR_SILENCE_DB);
+            aubio_onset_set_minioi_ms(an.onset_ctx, NOTEEXTRACTOR_MINIOI_MS);
+        }
+    }
+
+    init_notesegmenter(&an.seg, NOTEEXTRACTOR_SILENCE_DB, NOTESEGMENTER_RELEASE_DROP);
+
+    err = !samples || !pb.pitches || !positions || !an.obuf_onset || !an.obuf_tempo ||
+        (!an.onset_ctx && !an.detect);
+
+    while (!err && nread == hopsize)
+    {
+        // read a batch of hops, in the order they would have been analysed
+        for (pb.nhops = 0; pb.nhops < batch && nread == hopsize; pb.nhops++)
+        {
+            positions[pb.nhops] = skip_silence(source, &skip, blocks * hopsize, hopsize);
+            blocks = positions[pb.nhops] / hopsize + 1;
+
+            hop.data = samples + (pb.warmup + pb.nhops) * hopsize;
+            source->read(source->ctx, &hop, &nread);
+        }
+
+        if (parallel_for((pb.nhops + NOTEEXTRACTOR_TASK_HOPS - 1) / NOTEEXTRACTOR_TASK_HOPS,
+            jobs, estimate_pitch, &pb) != 0)
+        {
+            err = 1;
+            break;
+        }
+
+        for (size_t i = 0; i < pb.nhops && !err; i += nhops)
+        {
+            nhops = pb.nhops - i < NOTEEXTRACTOR_BLOCK_HOPS ? pb.nhops - i : NOTEEXTRACTOR_BLOCK_HOPS;
+            err = segment_block(&an, samples + (pb.warmup + i) * hopsize, hopsize, nhops,
+                pb.pitches + i, positions + i, list);
+        }
+
+        // the last hops of this batch fill the window for the next
+        memmove(samples, samples + pb.nhops * hopsize, pb.warmup * hopsize * sizeof(float));
+    }
+
+    if (an.onset_ctx)
+    {
+        del_aubio_onset(an.onset_ctx);
+    }
+    if (an.detect)
+    {
+        free_onsetdetect(an.detect);
+    }
+    del_fvec(an.obuf_onset);
+    del_fvec(an.obuf_tempo);
+    free(positions);
+    free(pb.pitches);
+    free(samples);
+
+    return err;
+}
+
+/* Finds onsets, tempo and levels over nhops hops, laid out one after
+ * another from samples, each in a pass of its own, then segments them
+ * into notes given their pitches.
+ * returns 0 on success, 1 if the notes could not be made room for
+ */
+static int segment_block(analysers_t *an, float *samples, unsigned int hopsize,
+    size_t nhops, const float *pitches, const uint64_t *positions, notelist_t *list)
+{
+    fvec_t hop = { .length = hopsize };
+    smpl_t events[3];
+    int err = 0;
+
+    if (an->detect)
+    {
+        for (size_t i = 0; i < nhops; i++)
+        {
+            an->onsets[i] = onsetdetect_do(an->detect, samples + i * hopsize);
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < nhops; i++)
+        {
+            hop.data = samples + i * hopsize;
+            aubio_onset_do(an->onset_ctx, &hop, an->obuf_onset);
+            an->onsets[i] = an->obuf_onset->data[0] != 0;
+        }
+    }
+
+    track_tempo(an->tempo_ctx, samples, hopsize, nhops, an->obuf_tempo, an->tempos);
+
+    for (size_t i = 0; i < nhops; i++)
+    {
+        an->levels[i] = notesegmenter_level(samples + i * hopsize, hopsize,
+            NOTEEXTRACTOR_SILENCE_DB);
+    }
+
+    for (size_t i = 0; i < nhops && !err; i++)
+    {
+        notesegmenter_do(&an->seg, pitches[i], an->onsets[i], an->levels[i], events);
+        err = add_events(list, events, positions[i], an->tempos[i]);
+    }
+
+    return err;
+}
+
+/* follows the tempo over nhops hops from samples, putting the tempo found
+ * as of each in tempos
+ */
+static void track_tempo(aubio_tempo_t *tempo_ctx, float *samples, unsigned int hopsize,
+    size_t nhops, fvec_t *obuf_tempo, float *tempos)
+{
+    fvec_t hop = { .length = hopsize };
+
+    for (size_t i = 0; i < nhops; i++)
+    {
+        hop.data = samples + i * hopsize;
+        aubio_tempo_do(tempo_ctx, &hop, obuf_tempo);
+        tempos[i] = aubio_tempo_get_bpm(tempo_ctx);
+    }
+}
+
+/* estimates the pitches of hops task * NOTEEXTRACTOR_TASK_HOPS onwards */
+static int estimate_pitch(unsigned int task, void *arg)
+{
+    pitchbatch_t *pb = arg;
+    const size_t first = (size_t) task * NOTEEXTRACTOR_TASK_HOPS;
+    const size_t last = first + NOTEEXTRACTOR_TASK_HOPS < pb->nhops ?
+        first + NOTEEXTRACTOR_TASK_HOPS : pb->nhops;
+    aubio_pitch_t *pitch_ctx;
+    fvec_t hop = { .length = pb->hopsize };
+    fvec_t *obuf_pitch;
+
+    if (strcmp(pb->method, YINPITCH_METHOD) == 0)
+    {
+        return estimate_yin(pb, first, last);
+    }
+
+    pitch_ctx = new_aubio_pitch(pb->method, NOTEEXTRACTOR_PITCH_SCALE * pb->winsize,
+        pb->hopsize, pb->samplerate);
+    obuf_pitch = new_fvec(1);
+    if (!pitch_ctx || !obuf_pitch)
+    {
+        if (pitch_ctx)
+        {
+            del_aubio_pitch(pitch_ctx);
+        }
+        del_fvec(obuf_pitch);
+        return 1;
+    }
+
+    aubio_pitch_set_unit(pitch_ctx, "midi");
+    aubio_pitch_set_silence(pitch_ctx, NOTEEXTRACTOR_SILENCE_DB);
+
+    // samples holds pb->warmup hops before the first of the batch
+    for (size_t i = first; i < last + pb->warmup; i++)
+    {
+        hop.data = (smpl_t *) pb->samples + i * pb->hopsize;
+        aubio_pitch_do(pitch_ctx, &hop, obuf_pitch);
+
+        if (i >= first + pb->warmup)
+        {
+            pb->pitches[i - pb->warmup] = obuf_pitch->data[0];
+        }
+    }
+
+    del_aubio_pitch(pitch_ctx);
+    del_fvec(obuf_pitch);
+
+    return 0;
+}
+
+/* estimate_pitch for YINPITCH_METHOD, which aubio does not have */
+static int estimate_yin(pitchbatch_t *pb, size_t first, size_t last)
+{
+    yinpitch_t yin;
+    float pitch;
+
+    if (init_yinpitch(&yin, NOTEEXTRACTOR_PITCH_SCALE * pb->winsize, pb->hopsize,
+        pb->samplerate, NOTEEXTRACTOR_SILENCE_DB) != 0)
+    {
+        return 1;
+    }
+
+    for (size_t i = first; i < last + pb->warmup; i++)
+    {
+        pitch = yinpitch_do(&yin, pb->samples + i * pb->hopsize);
+
+        if (i >= first + pb->warmup)
+        {
+            pb->pitches[i - pb->warmup] = pitch;
+        }
+    }
+
+    free_yinpitch(&yin);
+
+    return 0;
+}
+
+/* Adds the notes that start or stop in the hop at position, given the
+ * events aubio_notes found in it, and follows the tempo of a note sounding,
+ * which was tempo as of the hop.
+ * returns 0 on success, 1 if the notes could not be made room for
+ */
+static int add_events(notelist_t *list, const smpl_t *events, uint64_t position,
+    float tempo)
+{
+    note_t *notes = *list->notes;
+    const unsigned int tempo_accuracy = 5;
+
+    // if we have detected the end of a note
+    if (events[2] != 0 && list->note_present)
+    {
+        notes[list->notecount].stop_sample = position;
+        notes[list->notecount].stop_sec = position / (double) list->samplerate;
+
+        // if the caller wants us to detect tempo and we were able to do so
+        if (list->bpm == 0 && list->tempo_count > 0)
+        {
+            // store average of all detected tempos during the note lifespan
+            notes[list->notecount].tempo = (unsigned int) round(list->tempo_sum / list->tempo_count);
+            // round tempo number to nearest multiple of 5
+            notes[list->notecount].tempo = (unsigned int) roundm(notes[list->notecount].tempo, tempo_accuracy);
+        }
+        else
+        {
+            /* tempo could not be ascertained, or the caller has provided us
+             * with the tempo
+             */
+            notes[list->notecount].tempo = list->bpm;
+        }
+
+        // we have completed a note, therefore increment the note index
+        list->notecount++;
+        // set to zero to indicate that the next note is as of yet undefined
+        notes[list->notecount].pitch = 0;
+
+        list->note_present = 0;
+    }
+
+    // if we have detected the start of a note
+    if (events[0] != 0)
+    {
+        // if there is already an ongoing note, end it before adding this one
+        if (list->note_present)
+        {
+            notes[list->notecount].stop_sample = position;
+            notes[list->notecount].stop_sec = position / (double) list->samplerate;
+
+            // if the caller wants us to detect tempo and we were able to do so
+            if (list->bpm == 0 && list->tempo_count > 0)
+            {
+                // store average of all detected tempos during the note lifespan
+                notes[list->notecount].tempo = (unsigned int) round(list->tempo_sum / list->tempo_count);
+                // round tempo number to nearest multiple of 5
+                notes[list->notecount].tempo = (unsigned int) roundm(notes[list->notecount].tempo, tempo_accuracy);
+            }
+            else
+            {
+                // tempo could not be ascertained, or the caller has provided us with the tempo instead
+                notes[list->notecount].tempo = list->bpm;
+            }
+
+            // we have completed a note, therefore increment the note index
+            list->notecount++;
+        }
+
+        notes[list->notecount].start_sample = position;
+        notes[list->notecount].start_sec = position / (double) list->samplerate;
+
+        // reset tempo tracking variables, as a new note has begun
+        list->note_present = 1;
+        list->tempo_sum = 0;
+        list->tempo_count = 0;
+
+        notes[list->notecount].pitch = (unsigned int) events[0];
+        notes[list->notecount].velocity = events[1];
+    }
+
+    /* If there is an ongoing note, and the caller wants us to detect tempo,
+     * estimate the tempo.
+     */
+    if (list->note_present == 1 && list->bpm == 0)
+    {
+        if (tempo >= 0)
+        {
+            list->tempo_sum += tempo;
+            list->tempo_count++;
+        }
+    }
+
+    // resize the notes buffer to accommodate more notes
+    if (list->notecount + 1 >= list->notes_max)
+    {
+        list->notes_max += NOTEEXTRACTOR_NOTES_INCR;
+        *list->notes = realloc_or_free(*list->notes, list->notes_max * sizeof(note_t));
+        if (*list->notes == NULL)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/* An index of the levels of the audio shows where it is silent without
+ * reading it. The middle of a long silence is jumped over, keeping to the
+ * grid of hops.
+ * returns the position of the hop to be read next, which is past any
+ * silence jumped over
+ */
+static uint64_t skip_silence(notesource_t *source, silenceskip_t *skip, uint64_t position,
+    unsigned int hopsize)
+{
+    uint64_t silent;
+
+    if (!source->index || !source->seek)
+    {
+        return position;
+    }
+
+    if (skip->skip_to == 0)
+    {
+        silent = onsetindex_silence(source->index, position, NOTEEXTRACTOR_SILENCE_DB);
+        if (silent > 2 * skip->margin + hopsize)
+        {
+            skip->skip_from = position + (skip->margin + hopsize - 1) / hopsize * hopsize;
+            skip->skip_to = position + (silent - skip->margin) / hopsize * hopsize;
+            if (skip->skip_to <= skip->skip_from)
+            {
+                skip->skip_to = 0;
+            }
+        }
+    }
+    else if (position == skip->skip_from)
+    {
+        source->seek(source->ctx, skip->skip_to);
+        source->skipped += skip->skip_to - skip->skip_from;
+        position = skip->skip_to;
+        skip->skip_to = 0;
+    }
+
+    return position;
+}
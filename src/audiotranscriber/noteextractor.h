@@ -12,15 +12,90 @@ extern "C" {
 #include <aubio/aubio.h>
 
 #include "note.h"
+#include "onsetindex.h"
+#include "yinpitch.h"
+#include "onsetdetect.h"
+#include "kernelsizes.h"
 
+#define NOTEEXTRACTOR_SILENCE_DB    (-90)   // level below which no note is heard
+
+/* silence is only jumped over if this many windows of it can still be
+ * analysed at either end, so notes end and the analysis settles just as if
+ * all of it had been heard
+ */
+#define NOTEEXTRACTOR_SKIP_MARGIN   4
+
+#define NOTEEXTRACTOR_PITCH_DEFAULT "default"   // aubio's own pitch detection method
+#define NOTEEXTRACTOR_ONSET_DEFAULT "default"   // aubio's own onset detection method
+#define NOTEEXTRACTOR_MINIOI_MS     30      // least time between onsets, as in aubio_notes
+
+/* hops analysed as a block, each analyser running over all of them before
+ * the next does, so that its state and the block stay in cache
+ */
+#define NOTEEXTRACTOR_BLOCK_HOPS    32
+
+/* when estimating pitch in parallel, the hops each task takes, and the
+ * tasks each thread has in a batch, which evens out when they finish
+ */
+#define NOTEEXTRACTOR_TASK_HOPS     512
+#define NOTEEXTRACTOR_BATCH_TASKS   4
+
+/* where extract_notes gets its audio from. read fills buf with up to
+ * buf->length mono samples, zeroing any it could not fill, and sets *nread
+ * to the number it filled. If the levels of the audio are known from an
+ * index, seek moves reading on to a later sample frame, to skip silence.
+ */
+typedef struct notesource
+{
+    void            *ctx;           // passed to read and seek
+    void            (*read)(void *ctx, fvec_t *buf, uint_t *nread);
+    unsigned int    samplerate;     // sample frames per second
+
+    const onsetindex_t *index;      // levels of the audio, or NULL if unknown
+    void            (*seek)(void *ctx, uint64_t pos);
+    uint64_t        skipped;        // sample frames of silence jumped over
+} notesource_t;
+
+/* Finds the notes in the audio from source, analysing winsize samples
+ * every hopsize. Pitch is detected by pitch_method, which is one of aubio's
+ * methods or YINPITCH_METHOD, and onsets by onset_method, which is one of
+ * aubio's or ONSETDETECT_FFT. If jobs is 0 and both
+ * methods are aubio's defaults, each hop is analysed in turn by
+ * aubio_notes. Otherwise the pitch
+ * of each hop in a batch of them is estimated first, on up to jobs threads,
+ * and the batch then segmented into notes.
+ * returns the number of notes put in *notes, or -1 on failure
+ */
 int extract_notes(
-    aubio_source_t *source,
+    notesource_t *source,
     unsigned int winsize,
     unsigned int hopsize,
     unsigned int bpm,
+    const char *pitch_method,
+    const char *onset_method,
+    unsigned int jobs,
     note_t **notes
 );
 
+/* Finds the notes in each of nclips short clips, as extract_notes does with
+ * YINPITCH_METHOD and ONSETDETECT_FFT, but analysing up to CLIPBATCH_LANES
+ * of them at once, in lockstep, one to a lane of the vector units. Clips
+ * analysed together must have the same sample rate. Each is read from start
+ * to end, without skipping silence. audiotranscriber uses it when given
+ * more than one input file.
+ * returns 0 on success, setting notes[i] to the notes of clip i and
+ * notecounts[i] to the number of them, or -1 on failure
+ */
+int extract_clips(
+    notesource_t *sources,
+    unsigned int nclips,
+    unsigned int winsize,
+    unsigned int hopsize,
+    unsigned int bpm,
+    note_t **notes,
+    int *notecounts
+);
+
 unsigned int get_modal_tempo(note_t *notes, unsigned int notecount);
 
 #if defined(__cplusplus)
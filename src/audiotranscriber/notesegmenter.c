@@ -0,0 +1,113 @@
+/* notesegmenter.c
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "notesegmenter.h"
+#include "dsp.h"
+
+static float median_pitch(const notesegmenter_t *s);
+static int compare_floats(const void *a, const void *b);
+
+void init_notesegmenter(notesegmenter_t *s, float silence_db, float release_drop)
+{
+    memset(s, 0, sizeof(*s));
+
+    s->silence_db = silence_db;
+    s->release_drop = release_drop;
+    s->curnote = -1;
+    s->last_onset_level = silence_db;
+}
+
+/* After an onset, a note is only started once NOTESEGMENTER_MEDIAN hops
+ * have passed, at the median of their pitches, so it is not thrown by the
+ * attack. A note stops at the next onset, or once the level has fallen far
+ * enough below what it was at its own.
+ */
+void notesegmenter_do(notesegmenter_t *s, float pitch, int onset, float level, float events[3])
+{
+    memmove(s->pitches, s->pitches + 1, sizeof(s->pitches) - sizeof(*s->pitches));
+    s->pitches[NOTESEGMENTER_MEDIAN - 1] = roundf(pitch);
+
+    events[0] = events[1] = events[2] = 0;
+
+    if (onset)
+    {
+        // an onset in silence only ends what was sounding
+        if (level == 1)
+        {
+            s->isready = 0;
+            events[2] = s->curnote;
+        }
+        else
+        {
+            s->isready = 1;
+            s->last_onset_level = level;
+        }
+    }
+    else if (level < s->last_onset_level - s->release_drop)
+    {
+        events[2] = s->curnote;
+        s->last_onset_level = s->silence_db;
+        s->curnote = 0;
+    }
+    else
+    {
+        if (s->isready > 0)
+        {
+            s->isready++;
+        }
+
+        if (s->isready == NOTESEGMENTER_MEDIAN)
+        {
+            if (s->curnote != 0)
+            {
+                events[2] = s->curnote;
+            }
+
+            s->curnote = median_pitch(s);
+            if (s->curnote > NOTESEGMENTER_MIN_PITCH)
+            {
+                events[0] = s->curnote;
+                events[1] = 127 + floorf(level);
+            }
+        }
+    }
+}
+
+float notesegmenter_level(const float *samples, size_t n, float silence_db)
+{
+    double sumsq = 0;
+    float peak = 0;
+
+    dsp_level(samples, n, &sumsq, &peak);
+
+    return notesegmenter_level_of(sumsq, n, silence_db);
+}
+
+float notesegmenter_level_of(double sumsq, size_t n, float silence_db)
+{
+    const float db = 10 * log10(sumsq / n);
+
+    return db < silence_db ? 1 : db;
+}
+
+/* returns the lower median of the latest pitches, as aubio takes it */
+static float median_pitch(const notesegmenter_t *s)
+{
+    float sorted[NOTESEGMENTER_MEDIAN];
+
+    memcpy(sorted, s->pitches, sizeof(sorted));
+    qsort(sorted, NOTESEGMENTER_MEDIAN, sizeof(*sorted), compare_floats);
+
+    return sorted[(NOTESEGMENTER_MEDIAN - 1) / 2];
+}
+
+static int compare_floats(const void *a, const void *b)
+{
+    const float x = *(const float *) a, y = *(const float *) b;
+
+    return (x > y) - (x < y);
+}
@@ -0,0 +1,59 @@
+/* notesegmenter.h
+ *
+ * Turns the pitch, onsets and level of each hop of audio into note events,
+ * the way aubio_notes does, but from pitches worked out beforehand. That
+ * lets the pitch of every hop, the expensive part, be estimated separately
+ * from this, which must see the hops in order.
+ *
+ * Pitches are in MIDI note numbers, 0 where none was heard. Events are
+ * given as aubio_notes gives them: the pitch and velocity of a note that
+ * starts, and the pitch of one that stops, each 0 if there is none.
+ */
+
+#ifndef NOTESEGMENTER_H
+#define NOTESEGMENTER_H
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+#define NOTESEGMENTER_MEDIAN        6       // hops a pitch is taken over, after an onset
+#define NOTESEGMENTER_MIN_PITCH     45      // notes at or below this are not started
+#define NOTESEGMENTER_RELEASE_DROP  10.f    // default fall in dB that ends a note
+
+/* segmentation of one stream of audio */
+typedef struct notesegmenter
+{
+    float           silence_db;     // level below which nothing is heard
+    float           release_drop;   // fall in level since the onset that ends a note
+
+    float           curnote;        // pitch sounding, 0 if none, -1 before the first
+    float           last_onset_level;
+    unsigned int    isready;        // hops since the onset, while a pitch is awaited
+
+    float           pitches[NOTESEGMENTER_MEDIAN]; // latest pitches, oldest first
+} notesegmenter_t;
+
+void init_notesegmenter(notesegmenter_t *s, float silence_db, float release_drop);
+
+/* Segments one hop, given its pitch, whether an onset was detected in it
+ * and its level from notesegmenter_level, and sets events[0] to [2]:
+ * pitch and velocity of a note starting, and pitch of a note stopping.
+ */
+void notesegmenter_do(notesegmenter_t *s, float pitch, int onset, float level, float events[3]);
+
+/* returns the level of n samples in dB as aubio measures it, or 1 if it is
+ * below silence_db
+ */
+float notesegmenter_level(const float *samples, size_t n, float silence_db);
+
+/* the same, for n samples whose squares sum to sumsq */
+float notesegmenter_level_of(double sumsq, size_t n, float silence_db);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
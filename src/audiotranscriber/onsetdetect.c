@@ -0,0 +1,315 @@
+/* onsetdetect.c
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "onsetdetect.h"
+#include "kernelsizes.h"
+#include "dsp.h"
+
+/* the loops over the frame and its bins, for one size of it or for any */
+typedef struct onsetdetect_kernels
+{
+    unsigned int    winsize;        // what they are for, or 0 for any
+    void            (*window)(float *dst, const float *frame, const float *window,
+                        unsigned int winsize);
+    float           (*hfc)(const float *re, const float *im, unsigned int winsize);
+} onsetdetect_kernels_t;
+
+// low-pass biquad the detection function is smoothed with, both ways
+static const float biquad_b[3] = { 0.1600f, 0.3200f, 0.1600f };
+static const float biquad_a[3] = { 1.0f, -0.5949f, 0.2348f };
+
+static float hfc_fft(onsetdetect_t *o);
+static int pick_peak(onsetpicker_t *p, float hfc, float *pos);
+static void filtfilt(const float *in, float *out);
+static int compare_floats(const void *a, const void *b);
+static const onsetdetect_kernels_t *find_kernels(unsigned int winsize);
+
+int init_onsetdetect(onsetdetect_t *o,
+    unsigned int winsize,
+    unsigned int hopsize,
+    unsigned int samplerate,
+    float silence_db,
+    float minioi_ms
+)
+{
+    const unsigned int nbins = winsize / 2 + 1;
+
+    if (!o || hopsize == 0 || hopsize > winsize)
+    {
+        return 1;
+    }
+
+    memset(o, 0, sizeof(*o));
+    if (init_fft(&o->fft, winsize) != 0)
+    {
+        return 1;
+    }
+
+    o->winsize = winsize;
+    o->hopsize = hopsize;
+    o->kernels = find_kernels(winsize);
+    init_onsetpicker(&o->picker, hopsize, samplerate, silence_db, minioi_ms);
+
+    // the frame starts out silent, and so its spectrum empty
+    o->frame = calloc(winsize + hopsize, sizeof(float));
+    o->window = malloc(winsize * sizeof(float));
+    o->windowed = malloc(winsize * sizeof(float));
+    o->re = calloc(nbins, sizeof(float));
+    o->im = calloc(nbins, sizeof(float));
+
+    if (!o->frame || !o->window || !o->windowed || !o->re || !o->im)
+    {
+        free_onsetdetect(o);
+        return 1;
+    }
+
+    // periodic, as aubio's "hanningz" is
+    for (unsigned int i = 0; i < winsize; i++)
+    {
+        o->window[i] = 0.5 - 0.5 * cos(2 * M_PI * i / winsize);
+    }
+
+    return 0;
+}
+
+void free_onsetdetect(onsetdetect_t *o)
+{
+    if (o != NULL)
+    {
+        free_fft(&o->fft);
+        free(o->frame);
+        free(o->window);
+        free(o->windowed);
+        free(o->re);
+        free(o->im);
+        o->frame = o->window = o->windowed = o->re = o->im = NULL;
+    }
+}
+
+int onsetdetect_do(onsetdetect_t *o, const float *hop)
+{
+    double sumsq = 0;
+    float peak = 0;
+
+    memcpy(o->frame + o->winsize, hop, o->hopsize * sizeof(float));
+    memmove(o->frame, o->frame + o->hopsize, o->winsize * sizeof(float));
+    o->hfc = hfc_fft(o);
+
+    dsp_level(hop, o->hopsize, &sumsq, &peak);
+
+    return onsetpicker_do(&o->picker, o->hfc, sumsq);
+}
+
+void init_onsetpicker(onsetpicker_t *p,
+    unsigned int hopsize,
+    unsigned int samplerate,
+    float silence_db,
+    float minioi_ms
+)
+{
+    memset(p, 0, sizeof(*p));
+    p->hopsize = hopsize;
+    p->silence_db = silence_db;
+    p->minioi = lround(minioi_ms * samplerate / 1000);
+    p->delay = 4.3 * hopsize;
+}
+
+/* An onset is put where it was picked from the detection function, which
+ * lags the audio, unless the hop it was picked in is silent or it comes too
+ * soon after the last. Sound at the very start counts as an onset too,
+ * since the detection function has nothing before it to rise from.
+ */
+int onsetpicker_do(onsetpicker_t *p, float hfc, double sumsq)
+{
+    const int silent = sumsq == 0 || 10 * log10(sumsq / p->hopsize) < p->silence_db;
+    uint64_t onset_at;
+    float pos;
+    int onset;
+
+    onset = pick_peak(p, hfc, &pos);
+
+    if (onset)
+    {
+        onset_at = p->total + lround(pos * p->hopsize);
+        if (silent || p->last_onset + p->minioi >= onset_at)
+        {
+            onset = 0;
+        }
+        else
+        {
+            p->last_onset = onset_at;
+        }
+    }
+    else if (p->total <= p->delay && !silent &&
+        (p->total == 0 || p->last_onset + p->minioi < p->total))
+    {
+        onset = 1;
+        p->last_onset = p->total + p->delay;
+    }
+
+    p->total += p->hopsize;
+
+    return onset;
+}
+
+/* returns the detection function of the frame, windowed */
+static float hfc_fft(onsetdetect_t *o)
+{
+    o->kernels->window(o->windowed, o->frame, o->window, o->winsize);
+    fft_real(&o->fft, o->windowed, o->re, o->im);
+
+    return o->kernels->hfc(o->re, o->im, o->winsize);
+}
+
+/* The latest values of the detection function are smoothed, and the one
+ * ONSETDETECT_POST from the end compared with their median and mean. Where
+ * that comparison peaks above 0, there is an onset.
+ * returns 1 if the last comparison but one is a peak, setting *pos to
+ * where it falls, in hops from 2 before the latest, or 0 otherwise
+ */
+static int pick_peak(onsetpicker_t *p, float hfc, float *pos)
+{
+    float smooth[ONSETDETECT_SPAN], sorted[ONSETDETECT_SPAN];
+    float mean = 0, p0, p1, p2;
+
+    memmove(p->recent, p->recent + 1, sizeof(p->recent) - sizeof(*p->recent));
+    p->recent[ONSETDETECT_SPAN - 1] = hfc;
+
+    filtfilt(p->recent, smooth);
+
+    for (int i = 0; i < ONSETDETECT_SPAN; i++)
+    {
+        mean += smooth[i];
+    }
+    mean /= ONSETDETECT_SPAN;
+
+    memcpy(sorted, smooth, sizeof(sorted));
+    qsort(sorted, ONSETDETECT_SPAN, sizeof(*sorted), compare_floats);
+
+    memmove(p->peek, p->peek + 1, sizeof(p->peek) - sizeof(*p->peek));
+    p->peek[2] = smooth[ONSETDETECT_POST] - sorted[(ONSETDETECT_SPAN - 1) / 2]
+        - mean * ONSETDETECT_THRESHOLD;
+
+    p0 = p->peek[0];
+    p1 = p->peek[1];
+    p2 = p->peek[2];
+    if (!(p1 > p0 && p1 > p2 && p1 > 0))
+    {
+        return 0;
+    }
+
+    // a parabola through the peak and its neighbours
+    *pos = 1 + 0.5f * (p0 - p2) / (p0 - 2 * p1 + p2);
+    return 1;
+}
+
+/* filters ONSETDETECT_SPAN values forwards, then backwards, so that they
+ * are smoothed without being delayed
+ */
+static void filtfilt(const float *in, float *out)
+{
+    float tmp[ONSETDETECT_SPAN];
+    float x1 = 0, x2 = 0, y1 = 0, y2 = 0;
+
+    for (int i = 0; i < ONSETDETECT_SPAN; i++)
+    {
+        tmp[i] = biquad_b[0] * in[i] + biquad_b[1] * x1 + biquad_b[2] * x2
+            - biquad_a[1] * y1 - biquad_a[2] * y2;
+        x2 = x1;
+        x1 = in[i];
+        y2 = y1;
+        y1 = tmp[i];
+    }
+
+    x1 = x2 = y1 = y2 = 0;
+    for (int i = ONSETDETECT_SPAN - 1; i >= 0; i--)
+    {
+        out[i] = biquad_b[0] * tmp[i] + biquad_b[1] * x1 + biquad_b[2] * x2
+            - biquad_a[1] * y1 - biquad_a[2] * y2;
+        x2 = x1;
+        x1 = tmp[i];
+        y2 = y1;
+        y1 = out[i];
+    }
+}
+
+static int compare_floats(const void *a, const void *b)
+{
+    const float x = *(const float *) a, y = *(const float *) b;
+
+    return (x > y) - (x < y);
+}
+
+static inline __attribute__((always_inline))
+void window_body(float *dst, const float *frame, const float *window, unsigned int winsize)
+{
+    for (unsigned int i = 0; i < winsize; i++)
+    {
+        dst[i] = frame[i] * window[i];
+    }
+}
+
+static inline __attribute__((always_inline))
+float hfc_body(const float *re, const float *im, unsigned int winsize)
+{
+    float hfc = 0;
+
+    for (unsigned int b = 0; b <= winsize / 2; b++)
+    {
+        hfc += (b + 1) * logf(1 + sqrtf(re[b] * re[b] + im[b] * im[b]));
+    }
+
+    return hfc;
+}
+
+static void window_any(float *dst, const float *frame, const float *window,
+    unsigned int winsize)
+{
+    window_body(dst, frame, window, winsize);
+}
+
+static float hfc_any(const float *re, const float *im, unsigned int winsize)
+{
+    return hfc_body(re, im, winsize);
+}
+
+/* builds the loops for frames of size. The hop makes no difference to them. */
+#define ONSETDETECT_KERNELS(size, hop) \
+    static void window_##size(float *dst, const float *frame, const float *window, \
+        unsigned int winsize) \
+    { \
+        window_body(dst, frame, window, size); \
+    } \
+    static float hfc_##size(const float *re, const float *im, unsigned int winsize) \
+    { \
+        return hfc_body(re, im, size); \
+    }
+#define ONSETDETECT_KERNELS_ENTRY(size, hop) { size, window_##size, hfc_##size },
+
+KERNELSIZES(ONSETDETECT_KERNELS)
+
+static const onsetdetect_kernels_t fixed_kernels[] = { KERNELSIZES(ONSETDETECT_KERNELS_ENTRY) };
+static const onsetdetect_kernels_t any_kernels = { 0, window_any, hfc_any };
+
+/* returns the loops built for frames of winsize, or if there are none, or
+ * KERNELSIZES_ENV is set, those for any
+ */
+static const onsetdetect_kernels_t *find_kernels(unsigned int winsize)
+{
+    if (getenv(KERNELSIZES_ENV) == NULL)
+    {
+        for (size_t i = 0; i < sizeof(fixed_kernels) / sizeof(*fixed_kernels); i++)
+        {
+            if (fixed_kernels[i].winsize == winsize)
+            {
+                return &fixed_kernels[i];
+            }
+        }
+    }
+
+    return &any_kernels;
+}
@@ -0,0 +1,99 @@
+/* onsetdetect.h
+ *
+ * Onset detection by high-frequency content, as aubio's default onset
+ * method does it: the spectrum of a Hann-windowed frame, its magnitudes
+ * log compressed, is weighted towards the high bins and summed, and onsets
+ * picked from the peaks of that sum over an adaptive threshold. The
+ * spectrum is found by FFT, afresh each hop.
+ */
+
+#ifndef ONSETDETECT_H
+#define ONSETDETECT_H
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#include "fft.h"
+
+#define ONSETDETECT_FFT         "fft"   // name the method is chosen by, among aubio's
+
+#define ONSETDETECT_THRESHOLD   0.058f  // of the peak picker, aubio's for HFC
+
+#define ONSETDETECT_PRE         1       // values of the detection function before...
+#define ONSETDETECT_POST        5       // ...and after the one the threshold is taken for
+#define ONSETDETECT_SPAN        (ONSETDETECT_PRE + ONSETDETECT_POST + 1)
+
+/* picks onsets from the detection function of one stream of audio */
+typedef struct onsetpicker
+{
+    unsigned int    hopsize;
+    float           silence_db;     // level of a hop below which it has no onset
+
+    float           recent[ONSETDETECT_SPAN]; // latest values of the function, oldest first
+    float           peek[3];        // latest thresholded values, oldest first
+
+    uint64_t        total;          // samples seen
+    uint64_t        last_onset;     // sample of the latest onset
+    uint64_t        minioi;         // least samples between onsets
+    uint64_t        delay;          // samples by which picking lags the audio
+} onsetpicker_t;
+
+/* a detector for one stream of audio */
+typedef struct onsetdetect
+{
+    unsigned int    winsize;        // samples in a frame, a power of two
+    unsigned int    hopsize;
+
+    fft_t           fft;
+    float           *frame;         // the frame, then room for the next hop
+    float           *window;        // Hann window
+    float           *windowed;      // the frame with the window applied
+    float           *re, *im;       // spectrum of the frame, winsize / 2 + 1 bins
+    const struct onsetdetect_kernels *kernels; // loops over the frame, for its size
+
+    float           hfc;            // detection function of the latest frame
+    onsetpicker_t   picker;
+} onsetdetect_t;
+
+/* Sets up a detector of onsets at least minioi_ms apart, over frames of
+ * winsize samples moved on hopsize at a time.
+ * returns 0 on success, 1 otherwise
+ */
+int init_onsetdetect(onsetdetect_t *o,
+    unsigned int winsize,
+    unsigned int hopsize,
+    unsigned int samplerate,
+    float silence_db,
+    float minioi_ms
+);
+
+void free_onsetdetect(onsetdetect_t *o);
+
+/* moves the frame on by the hopsize samples in hop.
+ * returns 1 if an onset was detected, 0 otherwise
+ */
+int onsetdetect_do(onsetdetect_t *o, const float *hop);
+
+/* sets up a picker of onsets at least minioi_ms apart in hops of hopsize */
+void init_onsetpicker(onsetpicker_t *p,
+    unsigned int hopsize,
+    unsigned int samplerate,
+    float silence_db,
+    float minioi_ms
+);
+
+/* Takes the detection function of the frame ending with the latest hop,
+ * whose squares sum to sumsq. This is the last step of onsetdetect_do, for
+ * callers that work out the function themselves.
+ * returns 1 if an onset was detected, 0 otherwise
+ */
+int onsetpicker_do(onsetpicker_t *p, float hfc, double sumsq);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
@@ -0,0 +1,276 @@
+/* yinpitch.c
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "yinpitch.h"
+#include "kernelsizes.h"
+#include "dsp.h"
+
+/* the loops over the window, for one size of it or for any */
+typedef struct yinpitch_kernels
+{
+    unsigned int    size, hopsize;  // what they are for, or 0 for any
+    void            (*slide)(double *diff, const float *x, unsigned int lags,
+                        unsigned int hopsize);
+    void            (*recompute)(double *diff, const float *x, unsigned int lags);
+} yinpitch_kernels_t;
+
+static void slide(yinpitch_t *y);
+static void recompute(yinpitch_t *y);
+static const yinpitch_kernels_t *find_kernels(unsigned int size, unsigned int hopsize);
+static float freq_to_midi(float freq);
+
+int init_yinpitch(yinpitch_t *y,
+    unsigned int size,
+    unsigned int hopsize,
+    unsigned int samplerate,
+    float silence_db
+)
+{
+    if (!y || size < 8 || hopsize == 0 || hopsize > size || samplerate == 0)
+    {
+        return 1;
+    }
+
+    y->size = size;
+    y->lags = size / 2;
+    y->hopsize = hopsize;
+    y->samplerate = samplerate;
+    y->silence_db = silence_db;
+    y->since_refresh = 0;
+    y->loudest = 0;
+    y->confidence = 0;
+    y->kernels = find_kernels(size, hopsize);
+
+    // a silent window differs from itself by nothing at every lag
+    y->buf = calloc(size + hopsize, sizeof(float));
+    y->diff = calloc(y->lags, sizeof(double));
+    y->cmnd = malloc(y->lags * sizeof(float));
+
+    if (!y->buf || !y->diff || !y->cmnd)
+    {
+        free_yinpitch(y);
+        return 1;
+    }
+
+    return 0;
+}
+
+void free_yinpitch(yinpitch_t *y)
+{
+    if (y != NULL)
+    {
+        free(y->buf);
+        free(y->diff);
+        free(y->cmnd);
+        y->buf = NULL;
+        y->diff = NULL;
+        y->cmnd = NULL;
+    }
+}
+
+float yinpitch_do(yinpitch_t *y, const float *hop)
+{
+    double energy = 0;
+    float peak = 0;
+
+    memcpy(y->buf + y->size, hop, y->hopsize * sizeof(float));
+
+    // of the window once it has moved on
+    dsp_level(y->buf + y->hopsize, y->size, &energy, &peak);
+
+    /* sliding costs two terms at each lag for every sample of the hop,
+     * where recomputing costs one for every sample of half the window
+     */
+    if (2 * y->hopsize < y->lags &&
+        y->since_refresh < (unsigned long) YINPITCH_REFRESH * y->size &&
+        energy >= y->loudest * YINPITCH_FADE)
+    {
+        slide(y);
+        y->since_refresh += y->hopsize;
+        y->loudest = energy > y->loudest ? energy : y->loudest;
+    }
+    else
+    {
+        memmove(y->buf, y->buf + y->hopsize, y->size * sizeof(float));
+        recompute(y);
+        y->since_refresh = 0;
+        y->loudest = energy;
+    }
+
+    return yinpitch_pick(y->diff, y->cmnd, y->size, y->samplerate, y->silence_db, energy,
+        &y->confidence);
+}
+
+/* moves the window through the hop after it */
+static void slide(yinpitch_t *y)
+{
+    y->kernels->slide(y->diff, y->buf + y->size, y->lags, y->hopsize);
+    memmove(y->buf, y->buf + y->hopsize, y->size * sizeof(float));
+}
+
+static void recompute(yinpitch_t *y)
+{
+    y->kernels->recompute(y->diff, y->buf, y->lags);
+}
+
+/* Moves the window a sample at a time through the hop at x. At each step
+ * the newest sample enters the sum, and the oldest of its newer half
+ * leaves it.
+ */
+static inline __attribute__((always_inline))
+void slide_body(double *diff, const float *x, unsigned int lags, unsigned int hopsize)
+{
+    double out, in;
+    float newest, oldest;
+
+    for (unsigned int k = 0; k < hopsize; k++, x++)
+    {
+        newest = x[0];
+        oldest = x[-(int) lags];
+
+        for (unsigned int tau = 0; tau < lags; tau++)
+        {
+            in = newest - x[-(int) tau];
+            out = oldest - x[-(int) (lags + tau)];
+            diff[tau] += in * in - out * out;
+        }
+    }
+}
+
+static inline __attribute__((always_inline))
+void recompute_body(double *diff, const float *x, unsigned int lags)
+{
+    double sum, d;
+
+    for (unsigned int tau = 0; tau < lags; tau++)
+    {
+        sum = 0;
+        for (unsigned int j = lags; j < 2 * lags; j++)
+        {
+            d = x[j] - x[j - tau];
+            sum += d * d;
+        }
+        diff[tau] = sum;
+    }
+}
+
+static void slide_any(double *diff, const float *x, unsigned int lags, unsigned int hopsize)
+{
+    slide_body(diff, x, lags, hopsize);
+}
+
+static void recompute_any(double *diff, const float *x, unsigned int lags)
+{
+    recompute_body(diff, x, lags);
+}
+
+/* builds the loops for a window of size, moved hop at a time */
+#define YINPITCH_KERNELS(size, hop) \
+    static void slide_##size##_##hop(double *diff, const float *x, unsigned int lags, \
+        unsigned int hopsize) \
+    { \
+        slide_body(diff, x, (size) / 2, hop); \
+    } \
+    static void recompute_##size##_##hop(double *diff, const float *x, unsigned int lags) \
+    { \
+        recompute_body(diff, x, (size) / 2); \
+    }
+#define YINPITCH_KERNELS_ENTRY(size, hop) \
+    { size, hop, slide_##size##_##hop, recompute_##size##_##hop },
+
+KERNELSIZES_PITCH(YINPITCH_KERNELS)
+
+static const yinpitch_kernels_t fixed_kernels[] = { KERNELSIZES_PITCH(YINPITCH_KERNELS_ENTRY) };
+static const yinpitch_kernels_t any_kernels = { 0, 0, slide_any, recompute_any };
+
+/* returns the loops built for a window of size moved hopsize at a time, or
+ * if there are none, or KERNELSIZES_ENV is set, those for any
+ */
+static const yinpitch_kernels_t *find_kernels(unsigned int size, unsigned int hopsize)
+{
+    if (getenv(KERNELSIZES_ENV) == NULL)
+    {
+        for (size_t i = 0; i < sizeof(fixed_kernels) / sizeof(*fixed_kernels); i++)
+        {
+            if (fixed_kernels[i].size == size && fixed_kernels[i].hopsize == hopsize)
+            {
+                return &fixed_kernels[i];
+            }
+        }
+    }
+
+    return &any_kernels;
+}
+
+/* The difference at each lag is normalised by its mean over the shorter
+ * lags, and the period taken as the first dip below YINPITCH_TOLERANCE,
+ * placed between samples by fitting a parabola to it.
+ */
+float yinpitch_pick(const double *diff, float *cmnd, unsigned int size,
+    unsigned int samplerate, float silence_db, double energy, float *confidence)
+{
+    const unsigned int lags = size / 2;
+    const double floor = energy * YINPITCH_FLOOR;
+    double running = 0, d;
+    float period, s0, s1, s2;
+    unsigned int tau;
+
+    *confidence = 0;
+
+    if (energy == 0 || 10 * log10(energy / size) < silence_db)
+    {
+        return 0;
+    }
+
+    // what is left of a sum that slid to nothing is rounding error
+    cmnd[0] = 1;
+    for (tau = 1; tau < lags; tau++)
+    {
+        d = diff[tau] > floor ? diff[tau] : 0;
+        running += d;
+        cmnd[tau] = running > 0 ? d * tau / running : 1;
+    }
+
+    for (tau = 2; tau < lags - 1; tau++)
+    {
+        if (cmnd[tau] < YINPITCH_TOLERANCE && cmnd[tau] < cmnd[tau + 1])
+        {
+            break;
+        }
+    }
+
+    if (tau == lags - 1)
+    {
+        return 0;
+    }
+
+    s0 = cmnd[tau - 1];
+    s1 = cmnd[tau];
+    s2 = cmnd[tau + 1];
+    period = tau;
+    if (s0 - 2 * s1 + s2 != 0)
+    {
+        period += 0.5f * (s0 - s2) / (s0 - 2 * s1 + s2);
+    }
+
+    *confidence = 1 - s1;
+
+    return freq_to_midi(samplerate / period);
+}
+
+/* returns the MIDI note number of freq, or 0 if it is out of range, as
+ * aubio_freqtomidi does
+ */
+static float freq_to_midi(float freq)
+{
+    if (freq < 2 || freq > 100000)
+    {
+        return 0;
+    }
+
+    return 12 * log2f(freq / 6.875f) - 3;
+}
@@ -0,0 +1,82 @@
+/* yinpitch.h
+ *
+ * The YIN pitch estimator, kept up to date sample by sample. YIN compares
+ * half of its window with itself at every lag up to that length, which
+ * costs the square of that length to work out afresh. As the window
+ * slides, though, only one term of the sum at each lag leaves it and one
+ * enters; so when the hop is short next to the window, as it is for fine
+ * timing, updating the sums costs a fraction of recomputing them. They are
+ * recomputed now and then all the same, so rounding errors cannot build up,
+ * and whenever the audio has grown much quieter than it was, since the
+ * errors are in proportion to the loudest it has been.
+ *
+ * Results follow aubio's "yin" method: a pitch in MIDI note numbers, or 0
+ * where the window is silent or has no clear period. Unlike aubio, though,
+ * the newer half of the window is compared with what came before it, so a
+ * note is heard as soon as it fills that half, not the whole window.
+ */
+
+#ifndef YINPITCH_H
+#define YINPITCH_H
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#define YINPITCH_METHOD     "yinslide"  // name it is chosen by, among aubio's methods
+#define YINPITCH_TOLERANCE  0.15f       // greatest normalised difference at a period
+#define YINPITCH_REFRESH    16          // windows slid through between recomputing the sums
+#define YINPITCH_FADE       1e-3        // fall in energy since then that recomputes them too
+#define YINPITCH_FLOOR      1e-9        // sums this small next to the energy are taken as 0
+
+/* an estimator for one stream of audio */
+typedef struct yinpitch
+{
+    unsigned int    size;           // samples in the window
+    unsigned int    lags;           // half of size, the longest period looked for
+    unsigned int    hopsize;
+    unsigned int    samplerate;
+    float           silence_db;     // level of the window below which there is no pitch
+
+    float           *buf;           // the window, then room for the next hop
+    double          *diff;          // difference function of the window at each lag
+    float           *cmnd;          // the same, normalised
+    unsigned long   since_refresh;  // samples slid through since diff was computed afresh
+    double          loudest;        // most energy in the window since then
+    const struct yinpitch_kernels *kernels; // loops over the window, for its size
+
+    float           confidence;     // of the last estimate, from 0 to 1
+} yinpitch_t;
+
+/* Sets up an estimator over a window of size samples, moved hopsize at a
+ * time. The window starts out silent.
+ * returns 0 on success, 1 otherwise
+ */
+int init_yinpitch(yinpitch_t *y,
+    unsigned int size,
+    unsigned int hopsize,
+    unsigned int samplerate,
+    float silence_db
+);
+
+void free_yinpitch(yinpitch_t *y);
+
+/* moves the window on by the hopsize samples in hop.
+ * returns the pitch of the window, in MIDI note numbers, or 0 if none
+ */
+float yinpitch_do(yinpitch_t *y, const float *hop);
+
+/* Finds the pitch of a window of size samples, whose squares sum to energy,
+ * from its difference function diff at lags up to size / 2, using cmnd, of
+ * as many, for room. This is the last step of yinpitch_do, for callers that
+ * work out diff themselves.
+ * returns the pitch in MIDI note numbers, or 0 if none, setting *confidence
+ */
+float yinpitch_pick(const double *diff, float *cmnd, unsigned int size,
+    unsigned int samplerate, float silence_db, double energy, float *confidence);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
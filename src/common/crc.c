@@ -0,0 +1,61 @@
+/* crc.c
+ */
+
+#include <pthread.h>
+
+#include "crc.h"
+
+#define CRC8_POLY   0x07
+#define CRC16_POLY  0x8005
+
+// one step of either CRC for every value of the next byte
+static uint8_t crc8_table[256];
+static uint16_t crc16_table[256];
+static pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+
+static void init_tables(void);
+
+uint8_t crc8(uint8_t crc, const unsigned char *buf, size_t len)
+{
+    pthread_once(&tables_once, init_tables);
+
+    for (size_t i = 0; i < len; i++)
+    {
+        crc = crc8_table[crc ^ buf[i]];
+    }
+
+    return crc;
+}
+
+uint16_t crc16(uint16_t crc, const unsigned char *buf, size_t len)
+{
+    pthread_once(&tables_once, init_tables);
+
+    for (size_t i = 0; i < len; i++)
+    {
+        crc = (uint16_t) (crc << 8) ^ crc16_table[(crc >> 8) ^ buf[i]];
+    }
+
+    return crc;
+}
+
+static void init_tables(void)
+{
+    uint8_t c8;
+    uint16_t c16;
+
+    for (unsigned int i = 0; i < 256; i++)
+    {
+        c8 = i;
+        c16 = i << 8;
+
+        for (int bit = 0; bit < 8; bit++)
+        {
+            c8 = (c8 & 0x80) ? (uint8_t) (c8 << 1) ^ CRC8_POLY : (uint8_t) (c8 << 1);
+            c16 = (c16 & 0x8000) ? (uint16_t) (c16 << 1) ^ CRC16_POLY : (uint16_t) (c16 << 1);
+        }
+
+        crc8_table[i] = c8;
+        crc16_table[i] = c16;
+    }
+}
@@ -0,0 +1,28 @@
+/* crc.h
+ *
+ * The checksums used by FLAC: CRC-8 (polynomial x^8 + x^2 + x + 1) over
+ * frame headers, and CRC-16 (polynomial x^16 + x^15 + x^2 + 1) over whole
+ * frames. Both start at 0 and are not reflected.
+ */
+
+#ifndef CRC_H
+#define CRC_H
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* returns the CRC-8 of len bytes of buf, continuing from crc (0 to start) */
+uint8_t crc8(uint8_t crc, const unsigned char *buf, size_t len);
+
+/* returns the CRC-16 of len bytes of buf, continuing from crc (0 to start) */
+uint16_t crc16(uint16_t crc, const unsigned char *buf, size_t len);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
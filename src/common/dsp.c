@@ -0,0 +1,780 @@
+/* dsp.c
+ *
+ * Each kernel has a portable version, which also finishes off whatever the
+ * vector versions leave over, then one version per x86 level, built for it
+ * with a target attribute rather than with compiler flags, so that the rest
+ * of the program still runs on any CPU.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define DSP_X86 1
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "endianness.h"
+#include "dsp.h"
+
+/* the kernels which differ from level to level */
+typedef struct dsp_kernels
+{
+    void (*byteswap16)(void *buf, size_t n);
+    void (*byteswap24)(void *buf, size_t n);
+    void (*byteswap32)(void *buf, size_t n);
+    void (*s16_to_float)(float *dst, const unsigned char *src, size_t n);
+    void (*s24_to_float)(float *dst, const unsigned char *src, size_t n);
+    void (*s32_to_float)(float *dst, const unsigned char *src, size_t n);
+    void (*downmix2)(float *dst, const float *src, size_t nframes);
+    void (*level)(const float *src, size_t n, double *sumsq, float *peak);
+} dsp_kernels_t;
+
+static const char *const isa_names[DSP_ISA_COUNT] = { "scalar", "sse2", "avx2", "avx512" };
+
+// level in use, or -1 until the first kernel is called
+static _Atomic int active_isa = -1;
+
+static const dsp_kernels_t *kernels(void);
+static int cpu_isa(void);
+
+/* portable versions */
+
+static void byteswap16_scalar(void *buf, size_t n)
+{
+    unsigned char *p = buf;
+    unsigned char tmp;
+    size_t i = 0;
+
+#if defined(__ARM_NEON)
+    for (; i + 8 <= n; i += 8, p += 16)
+    {
+        vst1q_u8(p, vrev16q_u8(vld1q_u8(p)));
+    }
+#endif
+
+    for (; i < n; i++, p += 2)
+    {
+        tmp = p[0];
+        p[0] = p[1];
+        p[1] = tmp;
+    }
+}
+
+static void byteswap24_scalar(void *buf, size_t n)
+{
+    unsigned char *p = buf;
+    unsigned char tmp;
+
+    // the middle byte stays where it is
+    for (size_t i = 0; i < n; i++, p += 3)
+    {
+        tmp = p[0];
+        p[0] = p[2];
+        p[2] = tmp;
+    }
+}
+
+static void byteswap32_scalar(void *buf, size_t n)
+{
+    unsigned char *p = buf;
+    unsigned char tmp;
+    size_t i = 0;
+
+#if defined(__ARM_NEON)
+    for (; i + 4 <= n; i += 4, p += 16)
+    {
+        vst1q_u8(p, vrev32q_u8(vld1q_u8(p)));
+    }
+#endif
+
+    for (; i < n; i++, p += 4)
+    {
+        tmp = p[0];
+        p[0] = p[3];
+        p[3] = tmp;
+        tmp = p[1];
+        p[1] = p[2];
+        p[2] = tmp;
+    }
+}
+
+static void s16_to_float_scalar(float *dst, const unsigned char *src, size_t n)
+{
+    for (size_t i = 0; i < n; i++, src += 2)
+    {
+        dst[i] = (int16_t) (src[0] | src[1] << 8) / 32768.0f;
+    }
+}
+
+static void s24_to_float_scalar(float *dst, const unsigned char *src, size_t n)
+{
+    // assembled in the top of 32 bits, to sign extend
+    for (size_t i = 0; i < n; i++, src += 3)
+    {
+        dst[i] = (int32_t) ((uint32_t) src[0] << 8 | (uint32_t) src[1] << 16
+            | (uint32_t) src[2] << 24) / 2147483648.0f;
+    }
+}
+
+static void s32_to_float_scalar(float *dst, const unsigned char *src, size_t n)
+{
+    for (size_t i = 0; i < n; i++, src += 4)
+    {
+        dst[i] = (int32_t) ((uint32_t) src[0] | (uint32_t) src[1] << 8
+            | (uint32_t) src[2] << 16 | (uint32_t) src[3] << 24) / 2147483648.0f;
+    }
+}
+
+static void downmix_scalar(float *dst, const float *src, unsigned int channels, size_t nframes)
+{
+    const float scale = 1.0f / channels;
+    float sum;
+
+    for (size_t i = 0; i < nframes; i++, src += channels)
+    {
+        sum = 0;
+        for (unsigned int c = 0; c < channels; c++)
+        {
+            sum += src[c];
+        }
+        dst[i] = sum * scale;
+    }
+}
+
+static void downmix2_scalar(float *dst, const float *src, size_t nframes)
+{
+    downmix_scalar(dst, src, 2, nframes);
+}
+
+static void level_scalar(const float *src, size_t n, double *sumsq, float *peak)
+{
+    double sum = 0;
+    float max = *peak, a;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        sum += (double) src[i] * src[i];
+        a = src[i] < 0 ? -src[i] : src[i];
+        if (a > max)
+        {
+            max = a;
+        }
+    }
+
+    *sumsq += sum;
+    *peak = max;
+}
+
+#if defined(DSP_X86)
+
+/* SSE2, which every x86-64 CPU has. It has no byte shuffle, so 24 bit
+ * samples are left to the portable versions.
+ */
+
+__attribute__((target("sse2")))
+static void byteswap16_sse2(void *buf, size_t n)
+{
+    unsigned char *p = buf;
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8, p += 16)
+    {
+        __m128i v = _mm_loadu_si128((__m128i *) p);
+        v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+        _mm_storeu_si128((__m128i *) p, v);
+    }
+
+    byteswap16_scalar(p, n - i);
+}
+
+__attribute__((target("sse2")))
+static void byteswap32_sse2(void *buf, size_t n)
+{
+    unsigned char *p = buf;
+    size_t i = 0;
+
+    for (; i + 4 <= n; i += 4, p += 16)
+    {
+        // swap the 16 bit halves of each value, then the bytes of each half
+        __m128i v = _mm_loadu_si128((__m128i *) p);
+        v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0xb1), 0xb1);
+        v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+        _mm_storeu_si128((__m128i *) p, v);
+    }
+
+    byteswap32_scalar(p, n - i);
+}
+
+__attribute__((target("sse2")))
+static void s16_to_float_sse2(float *dst, const unsigned char *src, size_t n)
+{
+    const __m128 scale = _mm_set1_ps(1.0f / 32768);
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8, src += 16)
+    {
+        // each sample paired with itself, then shifted down to sign extend
+        __m128i v = _mm_loadu_si128((__m128i *) src);
+        __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+        __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+        _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+        _mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+    }
+
+    s16_to_float_scalar(dst + i, src, n - i);
+}
+
+__attribute__((target("sse2")))
+static void s32_to_float_sse2(float *dst, const unsigned char *src, size_t n)
+{
+    const __m128 scale = _mm_set1_ps(1.0f / 2147483648.0f);
+    size_t i = 0;
+
+    for (; i + 4 <= n; i += 4, src += 16)
+    {
+        __m128i v = _mm_loadu_si128((__m128i *) src);
+        _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(v), scale));
+    }
+
+    s32_to_float_scalar(dst + i, src, n - i);
+}
+
+__attribute__((target("sse2")))
+static void downmix2_sse2(float *dst, const float *src, size_t nframes)
+{
+    const __m128 half = _mm_set1_ps(0.5f);
+    size_t i = 0;
+
+    for (; i + 4 <= nframes; i += 4, src += 8)
+    {
+        __m128 a = _mm_loadu_ps(src);
+        __m128 b = _mm_loadu_ps(src + 4);
+        __m128 l = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+        __m128 r = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+        _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_add_ps(l, r), half));
+    }
+
+    downmix_scalar(dst + i, src, 2, nframes - i);
+}
+
+__attribute__((target("sse2")))
+static void level_sse2(const float *src, size_t n, double *sumsq, float *peak)
+{
+    const __m128 magnitude = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    __m128d sum = _mm_setzero_pd();
+    __m128 max = _mm_set1_ps(*peak);
+    double lanes[2];
+    float maxes[4];
+    size_t i = 0;
+
+    // squares are summed as doubles, as the portable version does
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128 v = _mm_loadu_ps(src + i);
+        __m128d lo = _mm_cvtps_pd(v);
+        __m128d hi = _mm_cvtps_pd(_mm_movehl_ps(v, v));
+        sum = _mm_add_pd(sum, _mm_add_pd(_mm_mul_pd(lo, lo), _mm_mul_pd(hi, hi)));
+        max = _mm_max_ps(max, _mm_and_ps(v, magnitude));
+    }
+
+    _mm_storeu_pd(lanes, sum);
+    _mm_storeu_ps(maxes, max);
+    *sumsq += lanes[0] + lanes[1];
+    for (int k = 0; k < 4; k++)
+    {
+        *peak = maxes[k] > *peak ? maxes[k] : *peak;
+    }
+
+    level_scalar(src + i, n - i, sumsq, peak);
+}
+
+/* AVX2, which brings byte shuffles and twice the width */
+
+__attribute__((target("avx2")))
+static void byteswap16_avx2(void *buf, size_t n)
+{
+    const __m256i mask = _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+        1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+    unsigned char *p = buf;
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16, p += 32)
+    {
+        __m256i v = _mm256_loadu_si256((__m256i *) p);
+        _mm256_storeu_si256((__m256i *) p, _mm256_shuffle_epi8(v, mask));
+    }
+
+    byteswap16_scalar(p, n - i);
+}
+
+__attribute__((target("avx2")))
+static void byteswap24_avx2(void *buf, size_t n)
+{
+    /* swap the 4 values in the first 12 bytes of each 16 byte load. The last
+     * 4 bytes are stored back unchanged, so 16 bytes must remain.
+     */
+    const __m128i mask = _mm_setr_epi8(2, 1, 0, 5, 4, 3, 8, 7, 6,
+        11, 10, 9, 12, 13, 14, 15);
+    unsigned char *p = buf;
+    size_t i = 0;
+
+    for (; (n - i) * 3 >= 16; i += 4, p += 12)
+    {
+        __m128i v = _mm_loadu_si128((__m128i *) p);
+        _mm_storeu_si128((__m128i *) p, _mm_shuffle_epi8(v, mask));
+    }
+
+    byteswap24_scalar(p, n - i);
+}
+
+__attribute__((target("avx2")))
+static void byteswap32_avx2(void *buf, size_t n)
+{
+    const __m256i mask = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+        3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    unsigned char *p = buf;
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8, p += 32)
+    {
+        __m256i v = _mm256_loadu_si256((__m256i *) p);
+        _mm256_storeu_si256((__m256i *) p, _mm256_shuffle_epi8(v, mask));
+    }
+
+    byteswap32_scalar(p, n - i);
+}
+
+__attribute__((target("avx2")))
+static void s16_to_float_avx2(float *dst, const unsigned char *src, size_t n)
+{
+    const __m256 scale = _mm256_set1_ps(1.0f / 32768);
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8, src += 16)
+    {
+        __m256i v = _mm256_cvtepi16_epi32(_mm_loadu_si128((__m128i *) src));
+        _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+    }
+
+    s16_to_float_scalar(dst + i, src, n - i);
+}
+
+__attribute__((target("avx2")))
+static void s24_to_float_avx2(float *dst, const unsigned char *src, size_t n)
+{
+    /* 4 samples from each 12 bytes of a 16 byte load, each into the top 3
+     * bytes of 32 bits, so that it is already sign extended
+     */
+    const __m256i mask = _mm256_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11,
+        -1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11);
+    const __m256 scale = _mm256_set1_ps(1.0f / 2147483648.0f);
+    size_t i = 0;
+
+    // the second load runs 4 bytes past the 8 samples
+    for (; i + 10 <= n; i += 8, src += 24)
+    {
+        __m256i v = _mm256_inserti128_si256(
+            _mm256_castsi128_si256(_mm_loadu_si128((__m128i *) src)),
+            _mm_loadu_si128((__m128i *) (src + 12)), 1);
+        v = _mm256_shuffle_epi8(v, mask);
+        _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+    }
+
+    s24_to_float_scalar(dst + i, src, n - i);
+}
+
+__attribute__((target("avx2")))
+static void s32_to_float_avx2(float *dst, const unsigned char *src, size_t n)
+{
+    const __m256 scale = _mm256_set1_ps(1.0f / 2147483648.0f);
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8, src += 32)
+    {
+        __m256i v = _mm256_loadu_si256((__m256i *) src);
+        _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+    }
+
+    s32_to_float_sse2(dst + i, src, n - i);
+}
+
+__attribute__((target("avx2")))
+static void downmix2_avx2(float *dst, const float *src, size_t nframes)
+{
+    const __m256 half = _mm256_set1_ps(0.5f);
+    size_t i = 0;
+
+    for (; i + 8 <= nframes; i += 8, src += 16)
+    {
+        __m256 a = _mm256_loadu_ps(src);
+        __m256 b = _mm256_loadu_ps(src + 8);
+
+        // shuffles stay within 128 bit lanes, leaving frames 0 1 4 5 2 3 6 7
+        __m256 m = _mm256_mul_ps(_mm256_add_ps(_mm256_shuffle_ps(a, b, 0x88),
+            _mm256_shuffle_ps(a, b, 0xdd)), half);
+        m = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(m), 0xd8));
+        _mm256_storeu_ps(dst + i, m);
+    }
+
+    downmix_scalar(dst + i, src, 2, nframes - i);
+}
+
+__attribute__((target("avx2")))
+static void level_avx2(const float *src, size_t n, double *sumsq, float *peak)
+{
+    const __m256 magnitude = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+    __m256d sum = _mm256_setzero_pd();
+    __m256 max = _mm256_set1_ps(*peak);
+    double lanes[4];
+    float maxes[8];
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256 v = _mm256_loadu_ps(src + i);
+        __m256d lo = _mm256_cvtps_pd(_mm256_castps256_ps128(v));
+        __m256d hi = _mm256_cvtps_pd(_mm256_extractf128_ps(v, 1));
+        sum = _mm256_add_pd(sum, _mm256_add_pd(_mm256_mul_pd(lo, lo), _mm256_mul_pd(hi, hi)));
+        max = _mm256_max_ps(max, _mm256_and_ps(v, magnitude));
+    }
+
+    _mm256_storeu_pd(lanes, sum);
+    _mm256_storeu_ps(maxes, max);
+    *sumsq += (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    for (int k = 0; k < 8; k++)
+    {
+        *peak = maxes[k] > *peak ? maxes[k] : *peak;
+    }
+
+    level_scalar(src + i, n - i, sumsq, peak);
+}
+
+/* AVX-512. 24 bit byte swaps gain nothing over the AVX2 version. */
+
+__attribute__((target("avx512f,avx512bw")))
+static void byteswap16_avx512(void *buf, size_t n)
+{
+    const __m512i mask = _mm512_broadcast_i32x4(_mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6,
+        9, 8, 11, 10, 13, 12, 15, 14));
+    unsigned char *p = buf;
+    size_t i = 0;
+
+    for (; i + 32 <= n; i += 32, p += 64)
+    {
+        __m512i v = _mm512_loadu_si512(p);
+        _mm512_storeu_si512(p, _mm512_shuffle_epi8(v, mask));
+    }
+
+    byteswap16_avx2(p, n - i);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void byteswap32_avx512(void *buf, size_t n)
+{
+    const __m512i mask = _mm512_broadcast_i32x4(_mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4,
+        11, 10, 9, 8, 15, 14, 13, 12));
+    unsigned char *p = buf;
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16, p += 64)
+    {
+        __m512i v = _mm512_loadu_si512(p);
+        _mm512_storeu_si512(p, _mm512_shuffle_epi8(v, mask));
+    }
+
+    byteswap32_avx2(p, n - i);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void s16_to_float_avx512(float *dst, const unsigned char *src, size_t n)
+{
+    const __m512 scale = _mm512_set1_ps(1.0f / 32768);
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16, src += 32)
+    {
+        __m512i v = _mm512_cvtepi16_epi32(_mm256_loadu_si256((__m256i *) src));
+        _mm512_storeu_ps(dst + i, _mm512_mul_ps(_mm512_cvtepi32_ps(v), scale));
+    }
+
+    s16_to_float_avx2(dst + i, src, n - i);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void s24_to_float_avx512(float *dst, const unsigned char *src, size_t n)
+{
+    const __m512i mask = _mm512_broadcast_i32x4(_mm_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5,
+        -1, 6, 7, 8, -1, 9, 10, 11));
+    const __m512 scale = _mm512_set1_ps(1.0f / 2147483648.0f);
+    size_t i = 0;
+
+    // as for AVX2, with four 12 byte groups, the last load running 4 bytes over
+    for (; i + 18 <= n; i += 16, src += 48)
+    {
+        __m512i v = _mm512_castsi128_si512(_mm_loadu_si128((__m128i *) src));
+        v = _mm512_inserti32x4(v, _mm_loadu_si128((__m128i *) (src + 12)), 1);
+        v = _mm512_inserti32x4(v, _mm_loadu_si128((__m128i *) (src + 24)), 2);
+        v = _mm512_inserti32x4(v, _mm_loadu_si128((__m128i *) (src + 36)), 3);
+        v = _mm512_shuffle_epi8(v, mask);
+        _mm512_storeu_ps(dst + i, _mm512_mul_ps(_mm512_cvtepi32_ps(v), scale));
+    }
+
+    s24_to_float_avx2(dst + i, src, n - i);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void s32_to_float_avx512(float *dst, const unsigned char *src, size_t n)
+{
+    const __m512 scale = _mm512_set1_ps(1.0f / 2147483648.0f);
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16, src += 64)
+    {
+        __m512i v = _mm512_loadu_si512(src);
+        _mm512_storeu_ps(dst + i, _mm512_mul_ps(_mm512_cvtepi32_ps(v), scale));
+    }
+
+    s32_to_float_avx2(dst + i, src, n - i);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void downmix2_avx512(float *dst, const float *src, size_t nframes)
+{
+    const __m512i left = _mm512_setr_epi32(0, 2, 4, 6, 8, 10, 12, 14,
+        16, 18, 20, 22, 24, 26, 28, 30);
+    const __m512i right = _mm512_setr_epi32(1, 3, 5, 7, 9, 11, 13, 15,
+        17, 19, 21, 23, 25, 27, 29, 31);
+    const __m512 half = _mm512_set1_ps(0.5f);
+    size_t i = 0;
+
+    for (; i + 16 <= nframes; i += 16, src += 32)
+    {
+        __m512 a = _mm512_loadu_ps(src);
+        __m512 b = _mm512_loadu_ps(src + 16);
+        __m512 l = _mm512_permutex2var_ps(a, left, b);
+        __m512 r = _mm512_permutex2var_ps(a, right, b);
+        _mm512_storeu_ps(dst + i, _mm512_mul_ps(_mm512_add_ps(l, r), half));
+    }
+
+    downmix2_avx2(dst + i, src, nframes - i);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void level_avx512(const float *src, size_t n, double *sumsq, float *peak)
+{
+    __m512d sum = _mm512_setzero_pd();
+    __m512 max = _mm512_set1_ps(*peak);
+    size_t i = 0;
+    float m;
+
+    for (; i + 16 <= n; i += 16)
+    {
+        __m512 v = _mm512_loadu_ps(src + i);
+        __m512d lo = _mm512_cvtps_pd(_mm512_castps512_ps256(v));
+        __m512d hi = _mm512_cvtps_pd(_mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(v), 1)));
+        sum = _mm512_add_pd(sum, _mm512_add_pd(_mm512_mul_pd(lo, lo), _mm512_mul_pd(hi, hi)));
+        max = _mm512_max_ps(max, _mm512_abs_ps(v));
+    }
+
+    *sumsq += _mm512_reduce_add_pd(sum);
+    m = _mm512_reduce_max_ps(max);
+    *peak = m > *peak ? m : *peak;
+
+    level_avx2(src + i, n - i, sumsq, peak);
+}
+
+#endif
+
+static const dsp_kernels_t isa_kernels[DSP_ISA_COUNT] = {
+    {
+        byteswap16_scalar, byteswap24_scalar, byteswap32_scalar,
+        s16_to_float_scalar, s24_to_float_scalar, s32_to_float_scalar,
+        downmix2_scalar, level_scalar
+    },
+#if defined(DSP_X86)
+    {
+        byteswap16_sse2, byteswap24_scalar, byteswap32_sse2,
+        s16_to_float_sse2, s24_to_float_scalar, s32_to_float_sse2,
+        downmix2_sse2, level_sse2
+    },
+    {
+        byteswap16_avx2, byteswap24_avx2, byteswap32_avx2,
+        s16_to_float_avx2, s24_to_float_avx2, s32_to_float_avx2,
+        downmix2_avx2, level_avx2
+    },
+    {
+        byteswap16_avx512, byteswap24_avx2, byteswap32_avx512,
+        s16_to_float_avx512, s24_to_float_avx512, s32_to_float_avx512,
+        downmix2_avx512, level_avx512
+    },
+#endif
+};
+
+int dsp_isa(void)
+{
+    kernels();
+    return atomic_load_explicit(&active_isa, memory_order_relaxed);
+}
+
+const char *dsp_isa_name(int isa)
+{
+    return isa >= 0 && isa < DSP_ISA_COUNT ? isa_names[isa] : "unknown";
+}
+
+int dsp_set_isa(int isa)
+{
+    const int best = cpu_isa();
+
+    if (isa > best)
+    {
+        isa = best;
+    }
+    if (isa < DSP_ISA_SCALAR)
+    {
+        isa = DSP_ISA_SCALAR;
+    }
+
+    atomic_store_explicit(&active_isa, isa, memory_order_relaxed);
+    return isa;
+}
+
+void dsp_byteswap16(void *buf, size_t n)
+{
+    kernels()->byteswap16(buf, n);
+}
+
+void dsp_byteswap24(void *buf, size_t n)
+{
+    kernels()->byteswap24(buf, n);
+}
+
+void dsp_byteswap32(void *buf, size_t n)
+{
+    kernels()->byteswap32(buf, n);
+}
+
+void dsp_to_float(float *dst, const unsigned char *src, int format, int bitdepth, size_t n)
+{
+    // floats are only ever 32 bits, and need only be put in host order
+    if (format == DSP_FORMAT_FLOAT)
+    {
+        if (bitdepth == 32)
+        {
+            memmove(dst, src, n * sizeof(*dst));
+#if (IS_BIG_ENDIAN == 1)
+            kernels()->byteswap32(dst, n);
+#endif
+        }
+        return;
+    }
+
+    switch (bitdepth)
+    {
+        case 8:
+            // 8 bit samples alone are unsigned
+            for (size_t i = 0; i < n; i++)
+            {
+                dst[i] = (src[i] - 128) / 128.0f;
+            }
+            break;
+        case 16:
+            kernels()->s16_to_float(dst, src, n);
+            break;
+        case 24:
+            kernels()->s24_to_float(dst, src, n);
+            break;
+        case 32:
+            kernels()->s32_to_float(dst, src, n);
+            break;
+    }
+}
+
+void dsp_downmix(float *dst, const float *src, unsigned int channels, size_t nframes)
+{
+    switch (channels)
+    {
+        case 0:
+            break;
+        case 1:
+            memmove(dst, src, nframes * sizeof(*dst));
+            break;
+        case 2:
+            kernels()->downmix2(dst, src, nframes);
+            break;
+        default:
+            downmix_scalar(dst, src, channels, nframes);
+            break;
+    }
+}
+
+void dsp_level(const float *src, size_t n, double *sumsq, float *peak)
+{
+    kernels()->level(src, n, sumsq, peak);
+}
+
+size_t dsp_decimate(float *dst, const float *src, size_t n, unsigned int factor)
+{
+    if (factor == 0)
+    {
+        return 0;
+    }
+
+    // averaging runs of samples is mixing down that many channels
+    dsp_downmix(dst, src, factor, n / factor);
+    return n / factor;
+}
+
+/* returns the kernels in use, choosing them on the first call */
+static const dsp_kernels_t *kernels(void)
+{
+    int isa = atomic_load_explicit(&active_isa, memory_order_relaxed);
+    const char *env;
+
+    if (isa < 0)
+    {
+        isa = DSP_ISA_COUNT - 1;
+
+        env = getenv(DSP_ISA_ENV);
+        for (int i = 0; env && i < DSP_ISA_COUNT; i++)
+        {
+            if (strcmp(env, isa_names[i]) == 0)
+            {
+                isa = i;
+            }
+        }
+
+        // racing threads all make the same choice
+        isa = dsp_set_isa(isa);
+    }
+
+    return &isa_kernels[isa];
+}
+
+/* returns the highest level the CPU, and the operating system, support */
+static int cpu_isa(void)
+{
+#if defined(DSP_X86)
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+    {
+        return DSP_ISA_AVX512;
+    }
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return DSP_ISA_AVX2;
+    }
+    if (__builtin_cpu_supports("sse2"))
+    {
+        return DSP_ISA_SSE2;
+    }
+#endif
+
+    return DSP_ISA_SCALAR;
+}
@@ -0,0 +1,78 @@
+/* dsp.h
+ *
+ * Bulk sample kernels used by both the recorder and the transcriber. On x86
+ * each kernel is built once for each of several instruction sets, and the
+ * widest one the CPU supports is picked the first time any is called, so a
+ * single build runs as fast as it can on old and new machines alike. The
+ * choice can be capped by setting DSP_ISA_ENV to the name of a level, to
+ * compare them or to work around a faulty one. Elsewhere, the portable
+ * versions are used.
+ *
+ * Samples are little-endian, as in WAV files, and any buffer may be
+ * unaligned.
+ */
+
+#ifndef DSP_H
+#define DSP_H
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* instruction set levels, each a superset of the one before */
+#define DSP_ISA_SCALAR  0
+#define DSP_ISA_SSE2    1
+#define DSP_ISA_AVX2    2
+#define DSP_ISA_AVX512  3   // AVX-512 F and BW
+#define DSP_ISA_COUNT   4
+
+#define DSP_ISA_ENV     "S2S_DSP_ISA"   // scalar, sse2, avx2 or avx512
+
+/* returns the level of the kernels in use */
+int dsp_isa(void);
+
+/* returns the name of a level, as DSP_ISA_ENV takes it */
+const char *dsp_isa_name(int isa);
+
+/* Uses the kernels of level isa, or of the highest level below it which
+ * the CPU supports.
+ * returns the level now in use
+ */
+int dsp_set_isa(int isa);
+
+/* reverse the byte order of each of n consecutive 16, 24 or 32 bit values */
+void dsp_byteswap16(void *buf, size_t n);
+void dsp_byteswap24(void *buf, size_t n);
+void dsp_byteswap32(void *buf, size_t n);
+
+/* sample formats, as the WAVE format tags number them */
+#define DSP_FORMAT_PCM      0x0001  // integers
+#define DSP_FORMAT_FLOAT    0x0003  // IEEE floats, of 32 bits only
+
+/* Converts n samples of 8, 16, 24 or 32 bits in format to the range
+ * [-1, 1]. 8 bit integers are unsigned.
+ */
+void dsp_to_float(float *dst, const unsigned char *src, int format, int bitdepth, size_t n);
+
+/* mixes nframes interleaved frames of channels samples down to one each */
+void dsp_downmix(float *dst, const float *src, unsigned int channels, size_t nframes);
+
+/* Adds the squares of n samples to *sumsq, and raises *peak to the largest
+ * of their magnitudes if that is more.
+ */
+void dsp_level(const float *src, size_t n, double *sumsq, float *peak);
+
+/* Reduces the sample rate of n samples by factor, averaging each run of
+ * factor samples, which filters out much of what would alias.
+ * returns the number of samples written to dst, n / factor
+ */
+size_t dsp_decimate(float *dst, const float *src, size_t n, unsigned int factor);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
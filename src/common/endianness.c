@@ -5,6 +5,7 @@
 #include <stdint.h>
 
 #include "endianness.h"
+#include "dsp.h"
 
 /* Returns a 16 bit value that is the input value in reverse byte order
  *
@@ -74,3 +75,52 @@ uint32_t be32(const uint32_t val)
 #endif
     ;
 }
+
+/* the bulk conversions are the kernels of dsp.c, which choose the fastest
+ * way the CPU has to do them
+ */
+
+void byteswap16_buf(void *buf, size_t n)
+{
+    dsp_byteswap16(buf, n);
+}
+
+void byteswap24_buf(void *buf, size_t n)
+{
+    dsp_byteswap24(buf, n);
+}
+
+void byteswap32_buf(void *buf, size_t n)
+{
+    dsp_byteswap32(buf, n);
+}
+
+void le16_buf(void *buf, size_t n)
+{
+#if (IS_BIG_ENDIAN == 1)
+    byteswap16_buf(buf, n);
+#else
+    (void) buf;
+    (void) n;
+#endif
+}
+
+void le24_buf(void *buf, size_t n)
+{
+#if (IS_BIG_ENDIAN == 1)
+    byteswap24_buf(buf, n);
+#else
+    (void) buf;
+    (void) n;
+#endif
+}
+
+void le32_buf(void *buf, size_t n)
+{
+#if (IS_BIG_ENDIAN == 1)
+    byteswap32_buf(buf, n);
+#else
+    (void) buf;
+    (void) n;
+#endif
+}
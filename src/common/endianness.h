@@ -9,8 +9,12 @@
 extern "C" {
 #endif
 
+#include <stddef.h>
+#include <stdint.h>
+
 // check endianness of the target machine
 #if (defined(__BYTE_ORDER) && __BYTE_ORDER == __BIG_ENDIAN) \
+    || (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__) \
     || (defined(REG_DWORD) && REG_DWORD == REG_DWORD_BIG_ENDIAN)
 
 // any future checks for endianness can simply use the following macro
@@ -46,6 +50,21 @@ uint32_t le32(const uint32_t val);
 uint16_t be16(const uint16_t val);
 uint32_t be32(const uint32_t val);
 
+/* Reverse the byte order of each of n consecutive 16, 24 or 32 bit values
+ * in buf, in place. buf need not be aligned.
+ */
+void byteswap16_buf(void *buf, size_t n);
+void byteswap24_buf(void *buf, size_t n);
+void byteswap32_buf(void *buf, size_t n);
+
+/* Convert n consecutive 16, 24 or 32 bit values in buf, in place, from host
+ * byte order to little endian. 32 bit values may be integers or floats.
+ * If the host machine is little endian, buf is left untouched.
+ */
+void le16_buf(void *buf, size_t n);
+void le24_buf(void *buf, size_t n);
+void le32_buf(void *buf, size_t n);
+
 #if defined(__cplusplus)
 }
 #endif
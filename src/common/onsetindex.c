@@ -0,0 +1,259 @@
+/* onsetindex.c
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "onsetindex.h"
+#include "dsp.h"
+
+static int write_entry(onsetindex_writer_t *w);
+static void put_le(unsigned char *p, uint32_t val, int nbytes);
+static uint32_t get_le(const unsigned char *p, int nbytes);
+
+int open_onsetindex_writer(onsetindex_writer_t *w,
+    const char *fname,
+    uint32_t samplerate,
+    int bitdepth,
+    int channels
+)
+{
+    unsigned char hdr[ONSETINDEX_HDR_LEN];
+
+    if (!w || !fname || channels <= 0 || channels > ONSETINDEX_CHUNK ||
+        (bitdepth != 8 && bitdepth != 16 && bitdepth != 24 && bitdepth != 32))
+    {
+        return 1;
+    }
+
+    w->fp = fopen(fname, "wb");
+    if (!w->fp)
+    {
+        return 1;
+    }
+
+    w->bitdepth = bitdepth;
+    w->channels = channels;
+    w->blockalign = (size_t) channels * bitdepth / 8;
+    w->sum = 0;
+    w->nframes = 0;
+    w->last_db = ONSETINDEX_MIN_DB;
+    w->last_onset = 0;
+    w->nentries = 0;
+
+    memcpy(hdr, ONSETINDEX_MAGIC, 4);
+    put_le(hdr + 4, samplerate, 4);
+    put_le(hdr + 8, ONSETINDEX_FRAMES, 2);
+    put_le(hdr + 10, ONSETINDEX_VERSION, 2);
+
+    if (fwrite(hdr, sizeof(hdr), 1, w->fp) != 1)
+    {
+        fclose(w->fp);
+        return 1;
+    }
+
+    return 0;
+}
+
+int onsetindex_write(onsetindex_writer_t *w, const unsigned char *samples, size_t len)
+{
+    float x[ONSETINDEX_CHUNK];
+    const size_t chunk = ONSETINDEX_CHUNK / w->channels;
+    size_t nframes = len / w->blockalign, n;
+    float peak = 0;
+
+    // a chunk at a time, never running past the end of an entry
+    for (; nframes > 0; nframes -= n, samples += n * w->blockalign)
+    {
+        n = ONSETINDEX_FRAMES - w->nframes;
+        n = n < chunk ? n : chunk;
+        n = n < nframes ? n : nframes;
+
+        dsp_to_float(x, samples, w->bitdepth == 32 ? DSP_FORMAT_FLOAT : DSP_FORMAT_PCM,
+            w->bitdepth, n * w->channels);
+        dsp_level(x, n * w->channels, &w->sum, &peak);
+
+        w->nframes += n;
+        if (w->nframes == ONSETINDEX_FRAMES && write_entry(w) != 0)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+int close_onsetindex_writer(onsetindex_writer_t *w)
+{
+    int ret = 0;
+
+    if (!w || !w->fp)
+    {
+        return 1;
+    }
+
+    if (w->nframes > 0 && write_entry(w) != 0)
+    {
+        ret = 1;
+    }
+
+    if (fclose(w->fp) != 0)
+    {
+        ret = 1;
+    }
+    w->fp = NULL;
+
+    return ret;
+}
+
+int open_onsetindex(onsetindex_t *idx, const char *fname)
+{
+    unsigned char hdr[ONSETINDEX_HDR_LEN];
+    FILE *fp;
+    long size;
+
+    if (!idx || !fname)
+    {
+        return 1;
+    }
+
+    fp = fopen(fname, "rb");
+    if (!fp)
+    {
+        return 1;
+    }
+
+    if (fread(hdr, sizeof(hdr), 1, fp) != 1 || memcmp(hdr, ONSETINDEX_MAGIC, 4) != 0 ||
+        get_le(hdr + 10, 2) != ONSETINDEX_VERSION || get_le(hdr + 8, 2) == 0 ||
+        fseek(fp, 0, SEEK_END) != 0 || (size = ftell(fp)) < ONSETINDEX_HDR_LEN)
+    {
+        fclose(fp);
+        return 1;
+    }
+
+    idx->samplerate = get_le(hdr + 4, 4);
+    idx->frames = get_le(hdr + 8, 2);
+
+    // entries run to the end, so an index cut short is still usable
+    idx->nentries = size - ONSETINDEX_HDR_LEN;
+    idx->entries = malloc(idx->nentries > 0 ? idx->nentries : 1);
+
+    if (!idx->entries || fseek(fp, ONSETINDEX_HDR_LEN, SEEK_SET) != 0 ||
+        fread(idx->entries, 1, idx->nentries, fp) != idx->nentries)
+    {
+        free(idx->entries);
+        fclose(fp);
+        return 1;
+    }
+
+    fclose(fp);
+    return 0;
+}
+
+void free_onsetindex(onsetindex_t *idx)
+{
+    if (idx != NULL)
+    {
+        free(idx->entries);
+        idx->entries = NULL;
+        idx->nentries = 0;
+    }
+}
+
+int onsetindex_level(const onsetindex_t *idx, uint64_t pos)
+{
+    const uint64_t e = pos / idx->frames;
+
+    if (e >= idx->nentries)
+    {
+        return ONSETINDEX_MIN_DB;
+    }
+
+    return (idx->entries[e] & ONSETINDEX_LEVEL) + ONSETINDEX_MIN_DB;
+}
+
+uint64_t onsetindex_silence(const onsetindex_t *idx, uint64_t pos, int db)
+{
+    uint64_t e = pos / idx->frames;
+
+    while (e < idx->nentries &&
+        (idx->entries[e] & ONSETINDEX_LEVEL) + ONSETINDEX_MIN_DB < db)
+    {
+        e++;
+    }
+
+    return e * idx->frames > pos ? e * idx->frames - pos : 0;
+}
+
+uint64_t onsetindex_count_onsets(const onsetindex_t *idx)
+{
+    uint64_t n = 0;
+
+    for (uint64_t e = 0; e < idx->nentries; e++)
+    {
+        n += (idx->entries[e] & ONSETINDEX_ONSET) != 0;
+    }
+
+    return n;
+}
+
+/* writes the entry in progress, and starts the next */
+static int write_entry(onsetindex_writer_t *w)
+{
+    const double ms = w->sum / ((double) w->nframes * w->channels);
+    int db = ONSETINDEX_MIN_DB;
+    unsigned char entry;
+
+    if (ms > 0)
+    {
+        db = (int) lround(10 * log10(ms));
+        if (db < ONSETINDEX_MIN_DB)
+        {
+            db = ONSETINDEX_MIN_DB;
+        }
+        else if (db > ONSETINDEX_MIN_DB + ONSETINDEX_LEVEL)
+        {
+            db = ONSETINDEX_MIN_DB + ONSETINDEX_LEVEL;
+        }
+    }
+
+    /* a sound starting late in one entry rises again into the next, which
+     * is the same onset
+     */
+    entry = db - ONSETINDEX_MIN_DB;
+    if (db >= ONSETINDEX_FLOOR_DB && db - w->last_db >= ONSETINDEX_RISE_DB && !w->last_onset)
+    {
+        entry |= ONSETINDEX_ONSET;
+    }
+
+    w->last_onset = (entry & ONSETINDEX_ONSET) != 0;
+    w->last_db = db;
+    w->sum = 0;
+    w->nframes = 0;
+    w->nentries++;
+
+    return fputc(entry, w->fp) == EOF;
+}
+
+static void put_le(unsigned char *p, uint32_t val, int nbytes)
+{
+    for (int i = 0; i < nbytes; i++)
+    {
+        p[i] = (val >> (8 * i)) & 0xff;
+    }
+}
+
+static uint32_t get_le(const unsigned char *p, int nbytes)
+{
+    uint32_t val = 0;
+
+    for (int i = 0; i < nbytes; i++)
+    {
+        val |= (uint32_t) p[i] << (8 * i);
+    }
+
+    return val;
+}
@@ -0,0 +1,107 @@
+/* onsetindex.h
+ *
+ * A compact index of a recording, written alongside it as it is captured,
+ * so that a transcriber can find silence without scanning the audio. Each
+ * entry covers ONSETINDEX_FRAMES sample frames in one byte: the level in
+ * whole dB above -127 dBFS, and a flag set where the level jumps, which
+ * marks a candidate onset.
+ *
+ * File layout, all little-endian:
+ *   "S2SI", sample rate (32 bits), frames per entry (16 bits),
+ *   version (16 bits), then one byte per entry up to the end of the file.
+ */
+
+#ifndef ONSETINDEX_H
+#define ONSETINDEX_H
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define ONSETINDEX_EXT      ".idx"  // appended to the name of the recording
+#define ONSETINDEX_MAGIC    "S2SI"
+#define ONSETINDEX_VERSION  1
+#define ONSETINDEX_HDR_LEN  12
+#define ONSETINDEX_FRAMES   256     // sample frames per entry
+#define ONSETINDEX_CHUNK    1024    // samples measured at a time
+
+#define ONSETINDEX_LEVEL    0x7f    // bits of an entry holding its level
+#define ONSETINDEX_ONSET    0x80    // bit of an entry set for an onset candidate
+#define ONSETINDEX_MIN_DB   (-127)  // level of an entry holding 0, or less
+
+#define ONSETINDEX_RISE_DB  9       // rise over the last entry which is an onset
+#define ONSETINDEX_FLOOR_DB (-60)   // quietest level which can be an onset
+
+/* an index being written as a recording is made */
+typedef struct onsetindex_writer
+{
+    FILE        *fp;
+    int         bitdepth;       // 32 bits means floats
+    int         channels;
+    size_t      blockalign;     // bytes per sample frame
+
+    double      sum;            // sum of squares of the entry in progress
+    unsigned int nframes;       // sample frames in the entry in progress
+    int         last_db;        // level of the last entry
+    int         last_onset;     // whether the last entry was an onset candidate
+    uint64_t    nentries;       // entries written
+} onsetindex_writer_t;
+
+/* an index read back */
+typedef struct onsetindex
+{
+    unsigned char   *entries;
+    uint64_t        nentries;
+    uint32_t        samplerate;
+    unsigned int    frames;     // sample frames per entry
+} onsetindex_t;
+
+/* Creates the index at fname, for samples in the given format.
+ * returns 0 on success, 1 otherwise
+ */
+int open_onsetindex_writer(onsetindex_writer_t *w,
+    const char *fname,
+    uint32_t samplerate,
+    int bitdepth,
+    int channels
+);
+
+/* Adds len bytes of whole little-endian sample frames, as written to the
+ * recording, writing an entry for each ONSETINDEX_FRAMES of them.
+ * returns 0 on success, 1 otherwise
+ */
+int onsetindex_write(onsetindex_writer_t *w, const unsigned char *samples, size_t len);
+
+/* Writes an entry for any sample frames left over, then closes the file.
+ * returns 0 on success, 1 otherwise
+ */
+int close_onsetindex_writer(onsetindex_writer_t *w);
+
+/* Reads the whole index at fname into memory.
+ * returns 0 on success, 1 if it is missing or not an index
+ */
+int open_onsetindex(onsetindex_t *idx, const char *fname);
+
+void free_onsetindex(onsetindex_t *idx);
+
+/* returns the level of the entry holding sample frame pos, in dBFS */
+int onsetindex_level(const onsetindex_t *idx, uint64_t pos);
+
+/* Returns how many sample frames from pos on are in entries quieter than
+ * db dBFS, which is 0 if pos is not in one. Beyond the end of the index
+ * nothing is known, so nothing is silent.
+ */
+uint64_t onsetindex_silence(const onsetindex_t *idx, uint64_t pos, int db);
+
+/* returns the number of entries marked as onset candidates */
+uint64_t onsetindex_count_onsets(const onsetindex_t *idx);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
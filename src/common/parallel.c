@@ -0,0 +1,129 @@
+/* parallel.c
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "parallel.h"
+
+/* state shared by the threads of parallel_for */
+typedef struct parallel_ctx
+{
+    parallel_task_t task;
+    void            *arg;
+    unsigned int    ntasks;
+
+    pthread_mutex_t lock;       // protects the members below
+    unsigned int    next;       // next task to be claimed
+    int             err;        // set if any task failed
+} parallel_ctx_t;
+
+static void *run_tasks(void *ctx);
+
+int parallel_for(unsigned int ntasks,
+    unsigned int nthreads,
+    parallel_task_t task,
+    void *arg
+)
+{
+    parallel_ctx_t ctx;
+    pthread_t *threads = NULL;
+    unsigned int nspawned = 0;
+
+    if (!task)
+    {
+        return 1;
+    }
+
+    ctx.task = task;
+    ctx.arg = arg;
+    ctx.ntasks = ntasks;
+    ctx.next = 0;
+    ctx.err = 0;
+
+    // no point having more threads than tasks
+    if (nthreads > ntasks)
+    {
+        nthreads = ntasks;
+    }
+
+    if (pthread_mutex_init(&ctx.lock, NULL) != 0)
+    {
+        return 1;
+    }
+
+    if (nthreads > 1)
+    {
+        threads = malloc(sizeof(pthread_t) * (nthreads - 1));
+    }
+
+    if (threads != NULL)
+    {
+        while (nspawned < nthreads - 1)
+        {
+            if (pthread_create(&threads[nspawned], NULL, run_tasks, &ctx) != 0)
+            {
+                // carry on with the threads we have
+                break;
+            }
+            nspawned++;
+        }
+    }
+
+    // the calling thread takes part in the work
+    run_tasks(&ctx);
+
+    while (nspawned > 0)
+    {
+        pthread_join(threads[--nspawned], NULL);
+    }
+
+    free(threads);
+    pthread_mutex_destroy(&ctx.lock);
+
+    return ctx.err;
+}
+
+unsigned int parallel_ncpus(void)
+{
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return ncpus > 0 ? ncpus : 1;
+}
+
+/* thread routine of parallel_for */
+static void *run_tasks(void *p)
+{
+    parallel_ctx_t *ctx = p;
+    unsigned int i;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&ctx->lock);
+        i = ctx->next;
+        if (i < ctx->ntasks && !ctx->err)
+        {
+            ctx->next++;
+        }
+        else
+        {
+            i = ctx->ntasks;
+        }
+        pthread_mutex_unlock(&ctx->lock);
+
+        if (i == ctx->ntasks)
+        {
+            break;
+        }
+
+        if (ctx->task(i, ctx->arg) != 0)
+        {
+            pthread_mutex_lock(&ctx->lock);
+            ctx->err = 1;
+            pthread_mutex_unlock(&ctx->lock);
+        }
+    }
+
+    return NULL;
+}
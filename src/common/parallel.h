@@ -0,0 +1,40 @@
+/* parallel.h
+ */
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/* A unit of work run by parallel_for.
+ *
+ * parameters:
+ *   i:   index of the task, from 0 to ntasks - 1
+ *   arg: the pointer given to parallel_for
+ *
+ * returns: 0 on success, non-zero otherwise
+ */
+typedef int (*parallel_task_t)(unsigned int i, void *arg);
+
+/* Runs tasks 0 to ntasks - 1 using up to nthreads threads, including the
+ * calling thread. Tasks are claimed in index order, but may complete in any
+ * order. Once a task fails, no further tasks are started.
+ *
+ * returns: 0 if every task succeeded, 1 otherwise
+ */
+int parallel_for(unsigned int ntasks,
+    unsigned int nthreads,
+    parallel_task_t task,
+    void *arg
+);
+
+/* returns the number of online CPUs, or 1 if it cannot be determined */
+unsigned int parallel_ncpus(void);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
@@ -0,0 +1,400 @@
+/* shmring.c
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "shmring.h"
+
+#define ALIGN64(n)  (((n) + 63) & ~(size_t) 63)
+
+static int shm_name(shmring_t *r, const char *name);
+static void map_layout(shmring_t *r, unsigned char *map);
+static size_t map_size(size_t blocksize, size_t nblocks);
+static int is_abandoned(const char *name);
+static int is_dead(int32_t pid);
+
+int create_shmring(shmring_t *r,
+    const char *name,
+    size_t blocksize,
+    size_t nblocks,
+    uint32_t samplerate,
+    int bitdepth,
+    int channels,
+    int policy
+)
+{
+    shmring_header_t *hdr;
+    unsigned char *map;
+    int fd;
+
+    if (!r || blocksize == 0 || nblocks < 2 || shm_name(r, name) != 0)
+    {
+        return 1;
+    }
+
+    r->mapsize = map_size(blocksize, nblocks);
+
+    fd = shm_open(r->name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0 && errno == EEXIST && is_abandoned(r->name))
+    {
+        shm_unlink(r->name);
+        fd = shm_open(r->name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    }
+    if (fd < 0)
+    {
+        return 1;
+    }
+
+    // the new memory is zeroed, so every slot starts free
+    if (ftruncate(fd, r->mapsize) != 0)
+    {
+        close(fd);
+        shm_unlink(r->name);
+        return 1;
+    }
+
+    map = mmap(NULL, r->mapsize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        shm_unlink(r->name);
+        return 1;
+    }
+
+    hdr = (shmring_header_t *) map;
+    hdr->version = SHMRING_VERSION;
+    hdr->writer_pid = getpid();
+    hdr->policy = policy;
+    hdr->blocksize = blocksize;
+    hdr->nblocks = nblocks;
+    hdr->samplerate = samplerate;
+    hdr->bitdepth = bitdepth;
+    hdr->channels = channels;
+
+    map_layout(r, map);
+
+    atomic_init(&hdr->reserved, 0);
+    atomic_init(&hdr->head, 0);
+    atomic_init(&hdr->closed, 0);
+
+    // the magic goes in last, so a ring is never attached to half made
+    atomic_thread_fence(memory_order_release);
+    memcpy(hdr->magic, SHMRING_MAGIC, 4);
+
+    return 0;
+}
+
+void destroy_shmring(shmring_t *r)
+{
+    if (r != NULL && r->hdr != NULL)
+    {
+        shmring_close(r);
+        munmap(r->hdr, r->mapsize);
+        shm_unlink(r->name);
+        r->hdr = NULL;
+    }
+}
+
+unsigned char *shmring_acquire(shmring_t *r)
+{
+    shmring_header_t *hdr = r->hdr;
+    const uint64_t h = atomic_load_explicit(&hdr->head, memory_order_relaxed);
+    shmring_slot_t *s;
+    int32_t pid;
+
+    /* the block to be filled last held block h - nblocks, which every
+     * reader must have released. A reader which has exited never will.
+     */
+    if (hdr->policy == SHMRING_BACKPRESSURE)
+    {
+        for (int i = 0; i < SHMRING_MAX_READERS; i++)
+        {
+            s = &hdr->readers[i];
+            pid = atomic_load_explicit(&s->pid, memory_order_relaxed);
+            if (pid == 0 ||
+                h - atomic_load_explicit(&s->tail, memory_order_acquire) < hdr->nblocks)
+            {
+                continue;
+            }
+
+            if (!is_dead(pid))
+            {
+                return NULL;
+            }
+            atomic_compare_exchange_strong(&s->pid, &pid, 0);
+        }
+    }
+
+    // readers check this after using a block, to learn if it was overwritten
+    atomic_store_explicit(&hdr->reserved, h + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    return r->data + (h % hdr->nblocks) * hdr->blocksize;
+}
+
+void shmring_commit(shmring_t *r, size_t len)
+{
+    shmring_header_t *hdr = r->hdr;
+    const uint64_t h = atomic_load_explicit(&hdr->head, memory_order_relaxed);
+
+    atomic_store_explicit(&r->lens[h % hdr->nblocks], len, memory_order_relaxed);
+    atomic_store_explicit(&hdr->head, h + 1, memory_order_release);
+}
+
+int shmring_publish(shmring_t *r, const unsigned char *samples, size_t len)
+{
+    unsigned char *block;
+
+    if (len > r->hdr->blocksize)
+    {
+        return 1;
+    }
+
+    block = shmring_acquire(r);
+    if (!block)
+    {
+        return 1;
+    }
+
+    memcpy(block, samples, len);
+    shmring_commit(r, len);
+
+    return 0;
+}
+
+void shmring_close(shmring_t *r)
+{
+    atomic_store_explicit(&r->hdr->closed, 1, memory_order_release);
+}
+
+int attach_shmring(shmring_t *r, const char *name)
+{
+    shmring_header_t *hdr;
+    unsigned char *map;
+    struct stat st;
+    int32_t pid;
+    int fd;
+
+    if (!r || shm_name(r, name) != 0)
+    {
+        return 1;
+    }
+
+    fd = shm_open(r->name, O_RDWR, 0);
+    if (fd < 0)
+    {
+        return 1;
+    }
+
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(shmring_header_t))
+    {
+        close(fd);
+        return 1;
+    }
+
+    r->mapsize = st.st_size;
+    map = mmap(NULL, r->mapsize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        return 1;
+    }
+
+    hdr = (shmring_header_t *) map;
+    if (memcmp(hdr->magic, SHMRING_MAGIC, 4) != 0 || hdr->version != SHMRING_VERSION ||
+        hdr->nblocks == 0 || map_size(hdr->blocksize, hdr->nblocks) != r->mapsize)
+    {
+        munmap(map, r->mapsize);
+        return 1;
+    }
+    atomic_thread_fence(memory_order_acquire);
+
+    map_layout(r, map);
+
+    for (r->slot = 0; r->slot < SHMRING_MAX_READERS; r->slot++)
+    {
+        pid = 0;
+        if (atomic_compare_exchange_strong(&hdr->readers[r->slot].pid, &pid, getpid()))
+        {
+            break;
+        }
+    }
+
+    if (r->slot == SHMRING_MAX_READERS)
+    {
+        munmap(map, r->mapsize);
+        r->hdr = NULL;
+        return 1;
+    }
+
+    /* until the tail is stored, the writer sees where the last reader of
+     * the slot stopped, which is behind, so at worst it waits a moment
+     */
+    r->pos = atomic_load_explicit(&hdr->head, memory_order_acquire);
+    atomic_store_explicit(&hdr->readers[r->slot].dropped, 0, memory_order_relaxed);
+    atomic_store_explicit(&hdr->readers[r->slot].tail, r->pos, memory_order_release);
+
+    return 0;
+}
+
+void detach_shmring(shmring_t *r)
+{
+    if (r != NULL && r->hdr != NULL)
+    {
+        atomic_store_explicit(&r->hdr->readers[r->slot].pid, 0, memory_order_release);
+        munmap(r->hdr, r->mapsize);
+        r->hdr = NULL;
+    }
+}
+
+const unsigned char *shmring_peek(shmring_t *r, size_t *len)
+{
+    shmring_header_t *hdr = r->hdr;
+    const uint64_t h = atomic_load_explicit(&hdr->head, memory_order_acquire);
+    uint64_t oldest;
+
+    if (r->pos == h)
+    {
+        return NULL;
+    }
+
+    /* blocks from before the oldest one still whole, which the writer may
+     * already be refilling, are lost
+     */
+    if (hdr->policy == SHMRING_DROP)
+    {
+        oldest = atomic_load_explicit(&hdr->reserved, memory_order_relaxed);
+        oldest = oldest > hdr->nblocks ? oldest - hdr->nblocks : 0;
+
+        if (r->pos < oldest)
+        {
+            atomic_fetch_add_explicit(&hdr->readers[r->slot].dropped, oldest - r->pos,
+                memory_order_relaxed);
+            r->pos = oldest;
+        }
+    }
+
+    *len = atomic_load_explicit(&r->lens[r->pos % hdr->nblocks], memory_order_relaxed);
+    return r->data + (r->pos % hdr->nblocks) * hdr->blocksize;
+}
+
+int shmring_release(shmring_t *r)
+{
+    shmring_header_t *hdr = r->hdr;
+    int overwritten = 0;
+
+    // the writer begins overwriting block pos once it reserves pos + nblocks
+    if (hdr->policy == SHMRING_DROP)
+    {
+        atomic_thread_fence(memory_order_acquire);
+        overwritten = atomic_load_explicit(&hdr->reserved, memory_order_relaxed)
+            > r->pos + hdr->nblocks;
+
+        if (overwritten)
+        {
+            atomic_fetch_add_explicit(&hdr->readers[r->slot].dropped, 1,
+                memory_order_relaxed);
+        }
+    }
+
+    r->pos++;
+    atomic_store_explicit(&hdr->readers[r->slot].tail, r->pos, memory_order_release);
+
+    return overwritten;
+}
+
+int shmring_finished(shmring_t *r)
+{
+    /* closed is checked first, so no block committed before closing is
+     * missed. A writer that was killed never closes the ring.
+     */
+    return (atomic_load_explicit(&r->hdr->closed, memory_order_acquire) ||
+        is_dead(r->hdr->writer_pid)) &&
+        r->pos == atomic_load_explicit(&r->hdr->head, memory_order_acquire);
+}
+
+uint64_t shmring_dropped(shmring_t *r)
+{
+    return atomic_load_explicit(&r->hdr->readers[r->slot].dropped, memory_order_relaxed);
+}
+
+/* sets r->name to the POSIX name of the ring called name.
+ * returns 0 on success, 1 if the name is empty, too long or has a '/'
+ */
+static int shm_name(shmring_t *r, const char *name)
+{
+    if (!name || name[0] == '\0' || strlen(name) > SHMRING_NAME_MAX || strchr(name, '/'))
+    {
+        return 1;
+    }
+
+    memset(r, 0, sizeof(*r));
+    snprintf(r->name, sizeof(r->name), "/%s", name);
+
+    return 0;
+}
+
+/* points r at the parts of a mapped ring */
+static void map_layout(shmring_t *r, unsigned char *map)
+{
+    shmring_header_t *hdr = (shmring_header_t *) map;
+
+    r->hdr = hdr;
+    r->lens = (_Atomic uint64_t *) (map + ALIGN64(sizeof(*hdr)));
+    r->data = map + ALIGN64(sizeof(*hdr)) + ALIGN64(hdr->nblocks * sizeof(uint64_t));
+}
+
+/* bytes of shared memory a ring takes, which map_layout must agree with */
+static size_t map_size(size_t blocksize, size_t nblocks)
+{
+    return ALIGN64(sizeof(shmring_header_t)) + ALIGN64(nblocks * sizeof(uint64_t))
+        + blocksize * nblocks;
+}
+
+/* returns 1 if name is a ring whose writer has exited without removing it */
+static int is_abandoned(const char *name)
+{
+    shmring_header_t *hdr;
+    struct stat st;
+    int abandoned = 0;
+    int fd;
+
+    fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0)
+    {
+        return 0;
+    }
+
+    // anything too small to be a ring is not one
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(*hdr))
+    {
+        close(fd);
+        return 0;
+    }
+
+    hdr = mmap(NULL, sizeof(*hdr), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (hdr == MAP_FAILED)
+    {
+        return 0;
+    }
+
+    abandoned = memcmp(hdr->magic, SHMRING_MAGIC, 4) == 0 && is_dead(hdr->writer_pid);
+    munmap(hdr, sizeof(*hdr));
+
+    return abandoned;
+}
+
+static int is_dead(int32_t pid)
+{
+    return kill(pid, 0) != 0 && errno == ESRCH;
+}
@@ -0,0 +1,152 @@
+/* shmring.h
+ *
+ * A ring of fixed-size blocks of audio in POSIX shared memory, through
+ * which a recorder publishes what it captures to transcribers running as
+ * separate processes. A reader uses each block in place, in the mapping,
+ * so nothing is copied or written to disk on the way.
+ *
+ * There is one writer, and up to SHMRING_MAX_READERS readers, each of
+ * which sees every block from the moment it attaches. Under
+ * SHMRING_BACKPRESSURE the writer finds no room until the slowest reader
+ * has released the oldest block; under SHMRING_DROP the writer never
+ * waits, and a reader that falls a whole ring behind loses blocks instead.
+ * A reader that exits without detaching is noticed, and no longer waited
+ * for.
+ */
+
+#ifndef SHMRING_H
+#define SHMRING_H
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#define SHMRING_PREFIX      "shm:"  // names a ring where a file name is expected
+#define SHMRING_MAGIC       "S2SR"
+#define SHMRING_VERSION     1
+#define SHMRING_MAX_READERS 8
+#define SHMRING_NAME_MAX    64
+
+/* what the writer does when a reader is a whole ring behind */
+#define SHMRING_BACKPRESSURE    0   // wait for it
+#define SHMRING_DROP            1   // overwrite what it has yet to read
+
+/* a reader's place in the ring, on a cache line of its own */
+typedef struct shmring_slot
+{
+    _Alignas(64) _Atomic int32_t pid;   // process attached, or 0 if free
+    _Atomic uint64_t tail;      // number of blocks it has released
+    _Atomic uint64_t dropped;   // blocks it lost to the writer
+} shmring_slot_t;
+
+/* the start of the shared memory. The length of each block follows, then
+ * the blocks themselves.
+ */
+typedef struct shmring_header
+{
+    char            magic[4];
+    uint32_t        version;
+    int32_t         writer_pid;
+    uint32_t        policy;
+    uint64_t        blocksize;
+    uint64_t        nblocks;
+
+    // format of the samples, which are little-endian
+    uint32_t        samplerate;
+    uint16_t        bitdepth;       // 32 bits means floats
+    uint16_t        channels;
+
+    _Alignas(64) _Atomic uint64_t reserved; // number of blocks the writer has begun
+    _Atomic uint64_t head;          // number of blocks committed
+    _Atomic int     closed;         // set once the writer has finished
+
+    shmring_slot_t  readers[SHMRING_MAX_READERS];
+} shmring_header_t;
+
+/* either end of a ring, as mapped into this process */
+typedef struct shmring
+{
+    shmring_header_t *hdr;
+    _Atomic uint64_t *lens;         // bytes committed to each block
+    unsigned char   *data;          // nblocks blocks of blocksize bytes
+    size_t          mapsize;
+
+    char            name[SHMRING_NAME_MAX + 2];
+    int             slot;           // readers: index into hdr->readers
+    uint64_t        pos;            // readers: block being used
+} shmring_t;
+
+/* Writer: creates the ring called name, replacing one left behind by a
+ * writer which has since exited.
+ * returns 0 on success, 1 otherwise
+ */
+int create_shmring(shmring_t *r,
+    const char *name,
+    size_t blocksize,
+    size_t nblocks,
+    uint32_t samplerate,
+    int bitdepth,
+    int channels,
+    int policy
+);
+
+/* Writer: closes the ring to readers, then removes it. Readers still
+ * attached keep their mapping until they detach.
+ */
+void destroy_shmring(shmring_t *r);
+
+/* Writer: returns the next free block, or NULL if the ring is full of
+ * blocks some reader has yet to release.
+ */
+unsigned char *shmring_acquire(shmring_t *r);
+
+/* Writer: publishes the block returned by shmring_acquire, of which the
+ * first len bytes are valid.
+ */
+void shmring_commit(shmring_t *r, size_t len);
+
+/* Writer: copies len bytes into the next block and publishes it.
+ * returns 0 on success, 1 if the ring is full
+ */
+int shmring_publish(shmring_t *r, const unsigned char *samples, size_t len);
+
+/* Writer: marks that no more blocks will be committed. */
+void shmring_close(shmring_t *r);
+
+/* Reader: maps the ring called name and takes a free slot in it. Reading
+ * starts at the next block to be committed.
+ * returns 0 on success, 1 if there is no such ring or it has no free slot
+ */
+int attach_shmring(shmring_t *r, const char *name);
+
+/* Reader: gives up its slot and unmaps the ring. */
+void detach_shmring(shmring_t *r);
+
+/* Reader: returns the oldest block not yet released, in place, and sets
+ * *len to its length, or returns NULL if there is none yet.
+ */
+const unsigned char *shmring_peek(shmring_t *r, size_t *len);
+
+/* Reader: frees the block returned by shmring_peek.
+ * returns 0, or 1 if the writer overwrote the block while it was in use,
+ * in which case whatever was read from it is not to be trusted
+ */
+int shmring_release(shmring_t *r);
+
+/* Reader: returns 1 once the writer has closed the ring, or exited, and
+ * every block committed has been released
+ */
+int shmring_finished(shmring_t *r);
+
+/* Reader: returns the number of blocks lost to the writer so far */
+uint64_t shmring_dropped(shmring_t *r);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
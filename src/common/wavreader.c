@@ -0,0 +1,299 @@
+/* wavreader.c
+ *
+ * Memory-mapped WAV and RF64 file reader.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "wavreader.h"
+#include "dsp.h"
+
+// size of a chunk's ID and size fields
+#define CHUNK_PREFIX_LEN    8
+
+// WAVE format tags
+#define FORMAT_PCM          0x0001
+#define FORMAT_IEEE_FLOAT   0x0003
+#define FORMAT_EXTENSIBLE   0xfffe
+
+// 32 bit size field whose real value is in the ds64 chunk
+#define RF64_SIZE           0xffffffff
+
+// samples converted at a time, before being mixed down
+#define WAVREADER_CHUNK     1024
+
+static uint16_t rd_le16(const unsigned char *p);
+static uint32_t rd_le32(const unsigned char *p);
+static uint64_t rd_le64(const unsigned char *p);
+
+int open_wavreader(wavreader_t *r, const char *fname)
+{
+    struct stat st;
+    void *map;
+    int fd;
+
+    if (!r || !fname)
+    {
+        return 1;
+    }
+
+    fd = open(fname, O_RDONLY);
+    if (fd < 0)
+    {
+        return 1;
+    }
+
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        close(fd);
+        return 1;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        close(fd);
+        return 1;
+    }
+
+    // samples are read front to back, so let the kernel read ahead
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    if (init_wavreader(r, map, st.st_size) != 0)
+    {
+        munmap(map, st.st_size);
+        close(fd);
+        return 1;
+    }
+
+    r->fd = fd;
+    return 0;
+}
+
+int init_wavreader(wavreader_t *r, const unsigned char *buf, size_t size)
+{
+    const unsigned char *end, *p;
+    uint64_t ds64_datasize = 0;
+    uint64_t chunksize;
+    int have_fmt = 0;
+
+    if (!r || !buf)
+    {
+        return 1;
+    }
+
+    memset(r, 0, sizeof(*r));
+    r->fd = -1;
+    r->data = buf;
+    r->size = size;
+
+    if (size < 12 || memcmp(buf + 8, "WAVE", 4) != 0)
+    {
+        return 1;
+    }
+
+    if (memcmp(buf, "RF64", 4) == 0)
+    {
+        r->rf64 = 1;
+    }
+    else if (memcmp(buf, "RIFF", 4) != 0)
+    {
+        return 1;
+    }
+
+    end = buf + size;
+    p = buf + 12;
+
+    while (end - p >= CHUNK_PREFIX_LEN)
+    {
+        chunksize = rd_le32(p + 4);
+
+        if (memcmp(p, "ds64", 4) == 0 && r->rf64)
+        {
+            // RIFF size, then data size
+            if (chunksize < 16 || chunksize > (size_t) (end - p) - CHUNK_PREFIX_LEN)
+            {
+                return 1;
+            }
+            ds64_datasize = rd_le64(p + CHUNK_PREFIX_LEN + 8);
+        }
+        else if (memcmp(p, "fmt ", 4) == 0)
+        {
+            if (chunksize < 16 || chunksize > (size_t) (end - p) - CHUNK_PREFIX_LEN)
+            {
+                return 1;
+            }
+            r->format       = rd_le16(p + CHUNK_PREFIX_LEN);
+            r->channels     = rd_le16(p + CHUNK_PREFIX_LEN + 2);
+            r->samplerate   = rd_le32(p + CHUNK_PREFIX_LEN + 4);
+            r->blockalign   = rd_le16(p + CHUNK_PREFIX_LEN + 12);
+            r->bitdepth     = rd_le16(p + CHUNK_PREFIX_LEN + 14);
+
+            // the real format tag starts the sub format GUID
+            if (r->format == FORMAT_EXTENSIBLE && chunksize >= 40)
+            {
+                r->format = rd_le16(p + CHUNK_PREFIX_LEN + 24);
+            }
+            have_fmt = 1;
+        }
+        else if (memcmp(p, "data", 4) == 0)
+        {
+            if (!have_fmt)
+            {
+                return 1;
+            }
+
+            if (chunksize == RF64_SIZE && r->rf64)
+            {
+                chunksize = ds64_datasize;
+            }
+
+            /* a recording cut short may be longer or shorter than its
+             * header says, so only the samples actually present are used
+             */
+            if (chunksize > (size_t) (end - p) - CHUNK_PREFIX_LEN)
+            {
+                chunksize = (end - p) - CHUNK_PREFIX_LEN;
+            }
+
+            r->samples = p + CHUNK_PREFIX_LEN;
+            r->nframes = r->blockalign > 0 ? chunksize / r->blockalign : 0;
+            break;
+        }
+
+        if (chunksize > (size_t) (end - p) - CHUNK_PREFIX_LEN)
+        {
+            return 1;
+        }
+
+        // chunks are padded to an even length
+        p += CHUNK_PREFIX_LEN + chunksize + (chunksize & 1);
+    }
+
+    if (!r->samples || r->channels == 0 || r->channels > WAVREADER_CHUNK ||
+        r->samplerate == 0 || r->blockalign != r->channels * (r->bitdepth / 8))
+    {
+        return 1;
+    }
+
+    switch (r->format)
+    {
+        case FORMAT_PCM:
+            if (r->bitdepth != 8 && r->bitdepth != 16 &&
+                r->bitdepth != 24 && r->bitdepth != 32)
+            {
+                return 1;
+            }
+            break;
+        case FORMAT_IEEE_FLOAT:
+            if (r->bitdepth != 32)
+            {
+                return 1;
+            }
+            break;
+        default:
+            return 1;
+    }
+
+    return 0;
+}
+
+int init_wavreader_raw(wavreader_t *r,
+    const unsigned char *buf,
+    size_t size,
+    uint16_t channels,
+    uint16_t bitdepth
+)
+{
+    if (!r || !buf || channels == 0 || channels > WAVREADER_CHUNK ||
+        (bitdepth != 8 && bitdepth != 16 && bitdepth != 24 && bitdepth != 32))
+    {
+        return 1;
+    }
+
+    memset(r, 0, sizeof(*r));
+    r->fd = -1;
+    r->data = buf;
+    r->size = size;
+
+    r->format = bitdepth == 32 ? FORMAT_IEEE_FLOAT : FORMAT_PCM;
+    r->channels = channels;
+    r->bitdepth = bitdepth;
+    r->blockalign = channels * bitdepth / 8;
+
+    r->samples = buf;
+    r->nframes = size / r->blockalign;
+
+    return 0;
+}
+
+void close_wavreader(wavreader_t *r)
+{
+    if (r != NULL && r->fd >= 0)
+    {
+        munmap((void *) r->data, r->size);
+        close(r->fd);
+        r->fd = -1;
+    }
+}
+
+size_t wavreader_read_mono(wavreader_t *r, float *dst, size_t nframes)
+{
+    float frames[WAVREADER_CHUNK];
+    const size_t chunk = WAVREADER_CHUNK / r->channels;
+    size_t done, n;
+
+    if (nframes > r->nframes - r->pos)
+    {
+        nframes = r->nframes - r->pos;
+    }
+
+    // a mono file is converted straight into dst
+    if (r->channels == 1)
+    {
+        dsp_to_float(dst, r->samples + r->pos * r->blockalign, r->format, r->bitdepth,
+            nframes);
+        r->pos += nframes;
+        return nframes;
+    }
+
+    for (done = 0; done < nframes; done += n)
+    {
+        n = nframes - done < chunk ? nframes - done : chunk;
+        dsp_to_float(frames, r->samples + (r->pos + done) * r->blockalign, r->format,
+            r->bitdepth, n * r->channels);
+        dsp_downmix(dst + done, frames, r->channels, n);
+    }
+
+    r->pos += nframes;
+
+    return nframes;
+}
+
+void wavreader_seek(wavreader_t *r, uint64_t pos)
+{
+    r->pos = pos < r->nframes ? pos : r->nframes;
+}
+
+static uint16_t rd_le16(const unsigned char *p)
+{
+    return (uint16_t) (p[0] | p[1] << 8);
+}
+
+static uint32_t rd_le32(const unsigned char *p)
+{
+    return (uint32_t) p[0] | (uint32_t) p[1] << 8
+        | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+static uint64_t rd_le64(const unsigned char *p)
+{
+    return (uint64_t) rd_le32(p) | (uint64_t) rd_le32(p + 4) << 32;
+}
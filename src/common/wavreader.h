@@ -0,0 +1,78 @@
+/* wavreader.h
+ *
+ * Read-only access to WAV files, including RF64 files (EBU Tech 3306)
+ * larger than 4 GB. The file is memory-mapped and samples are converted
+ * straight from the mapping.
+ */
+
+#ifndef WAVREADER_H
+#define WAVREADER_H
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* an open WAV file */
+typedef struct wavreader
+{
+    int                 fd;         // source file descriptor, or -1 if none
+
+    const unsigned char *data;      // start of the file contents
+    size_t              size;       // length of the file contents
+
+    int                 rf64;       // whether sizes came from a ds64 chunk
+
+    uint16_t            format;     // WAVE format tag (1: PCM, 3: IEEE float)
+    uint16_t            channels;   // number of audio channels
+    uint32_t            samplerate; // sample frames per second
+    uint16_t            bitdepth;   // bits per sample
+    uint16_t            blockalign; // bytes per sample frame
+
+    const unsigned char *samples;   // first sample frame
+    uint64_t            nframes;    // number of sample frames in the file
+    uint64_t            pos;        // next sample frame to be read
+} wavreader_t;
+
+/* Maps the file at fname into memory and parses its header.
+ * returns 0 on success, 1 if the file could not be read or is not a WAV
+ * file in a supported format
+ */
+int open_wavreader(wavreader_t *r, const char *fname);
+
+/* Parses the header of a WAV file already held in memory.
+ * The buffer must remain valid until the reader is no longer used.
+ * returns 0 on success, 1 otherwise
+ */
+int init_wavreader(wavreader_t *r, const unsigned char *buf, size_t size);
+
+/* Reads size bytes of samples with no header, in the given format, such
+ * as a recorder writes raw. 32 bit samples are floats.
+ * returns 0 on success, 1 if the format is not supported
+ */
+int init_wavreader_raw(wavreader_t *r,
+    const unsigned char *buf,
+    size_t size,
+    uint16_t channels,
+    uint16_t bitdepth
+);
+
+/* unmaps and closes a file opened with open_wavreader */
+void close_wavreader(wavreader_t *r);
+
+/* moves reading on, or back, to sample frame pos, or the end if it is beyond */
+void wavreader_seek(wavreader_t *r, uint64_t pos);
+
+/* Reads up to nframes sample frames, mixed down to one channel and scaled
+ * to the range [-1, 1], into dst.
+ * returns the number of frames read, 0 at the end of the file
+ */
+size_t wavreader_read_mono(wavreader_t *r, float *dst, size_t nframes);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
@@ -0,0 +1,485 @@
+/* benchmarks.c
+ *
+ * Throughput benchmarks. Each prints one line per configuration to stdout.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "note.h"
+#include "midi.h"
+#include "midiwriter.h"
+#include "dsp.h"
+#include "onsetdetect.h"
+#include "yinpitch.h"
+#include "clipbatch.h"
+#include "notesegmenter.h"
+#include "kernelsizes.h"
+
+#define BENCH_FILE  "bench.mid"
+#define BENCH_RATE  44100   // sample rate that the generated notes are timed in
+#define BENCH_FRAMES 4096   // stereo frames converted at a time, as a reader would
+
+static double now_sec(void);
+static note_t *gen_notes(unsigned int notecount);
+static void bench_midi_tracks(note_t *notes, unsigned int notecount, unsigned int ntracks);
+static void bench_dsp(unsigned int seconds);
+static void bench_onsetdetect(unsigned int seconds, unsigned int winsize);
+static void bench_clipbatch(unsigned int seconds, unsigned int winsize, unsigned int hopsize);
+static void bench_blockhops(unsigned int seconds, unsigned int winsize, unsigned int hopsize);
+static void bench_kernelsizes(unsigned int seconds, unsigned int winsize, unsigned int hopsize);
+
+int main(int argc, char **argv)
+{
+    const unsigned int notecount = (argc > 1) ? strtoul(argv[1], NULL, 10) : 1000000;
+    note_t *notes;
+
+    notes = gen_notes(notecount);
+    if (!notes)
+    {
+        perror(argv[0]);
+        return 1;
+    }
+
+    // gen_midi_file prints the header of each file it writes
+    if (!freopen("/dev/null", "w", stderr))
+    {
+        return 1;
+    }
+
+    bench_midi_tracks(notes, notecount, 16);
+    bench_midi_tracks(notes, notecount, 1);
+
+    bench_dsp(600);
+
+    bench_onsetdetect(30, 512);
+    bench_onsetdetect(30, 1024);
+    bench_onsetdetect(30, 2048);
+
+    bench_clipbatch(5, 512, 256);
+    bench_clipbatch(5, 1024, 512);
+
+    bench_blockhops(10, 512, 256);
+    bench_blockhops(10, 2048, 512);
+
+#define BENCH_KERNELSIZES(size, hop) bench_kernelsizes(30, size, hop);
+    KERNELSIZES(BENCH_KERNELSIZES)
+    bench_kernelsizes(30, 1024, 384);
+
+    unlink(BENCH_FILE);
+    free(notes);
+
+    return 0;
+}
+
+/* encodes notes into ntracks tracks, doubling the thread count up to the
+ * number of CPUs, and reports the time taken for each thread count.
+ * A single track is encoded in chunks of notes instead.
+ */
+static void bench_midi_tracks(note_t *notes, unsigned int notecount, unsigned int ntracks)
+{
+    const long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    double start, elapsed, base = 0;
+
+    for (unsigned int nthreads = 1; nthreads <= ncpus; nthreads *= 2)
+    {
+        start = now_sec();
+        if (gen_midi_file_tracks(BENCH_FILE, notes, notecount, 0, BENCH_RATE, ntracks, nthreads) != 0)
+        {
+            printf("midi tracks: encoding failed\n");
+            return;
+        }
+        elapsed = now_sec() - start;
+
+        if (nthreads == 1)
+        {
+            base = elapsed;
+        }
+
+        printf("midi tracks: %u notes, %u tracks, %2u threads: %8.3f sec (%.2fx)\n",
+            notecount, ntracks, nthreads, elapsed, base / elapsed);
+    }
+}
+
+/* Reads seconds of 16 bit stereo audio the way the transcriber does:
+ * converted to floats, mixed down to mono and measured, at each level of
+ * the DSP kernels the CPU supports.
+ */
+static void bench_dsp(unsigned int seconds)
+{
+    const size_t blocks = (size_t) seconds * BENCH_RATE / BENCH_FRAMES;
+    const int saved = dsp_isa();
+    static unsigned char samples[BENCH_FRAMES * 4];
+    static float frames[BENCH_FRAMES * 2], mono[BENCH_FRAMES];
+    double start, elapsed, base = 0, sumsq;
+    float peak;
+
+    for (size_t i = 0; i < sizeof(samples); i++)
+    {
+        samples[i] = rand();
+    }
+
+    for (int isa = DSP_ISA_SCALAR; isa < DSP_ISA_COUNT && dsp_set_isa(isa) == isa; isa++)
+    {
+        sumsq = 0;
+        peak = 0;
+
+        start = now_sec();
+        for (size_t b = 0; b < blocks; b++)
+        {
+            dsp_to_float(frames, samples, DSP_FORMAT_PCM, 16, BENCH_FRAMES * 2);
+            dsp_downmix(mono, frames, 2, BENCH_FRAMES);
+            dsp_level(mono, BENCH_FRAMES, &sumsq, &peak);
+        }
+        elapsed = now_sec() - start;
+
+        if (isa == DSP_ISA_SCALAR)
+        {
+            base = elapsed;
+        }
+
+        printf("dsp kernels: %u s of 16 bit stereo, %-6s: %8.3f sec (%.2fx)\n",
+            seconds, dsp_isa_name(isa), elapsed, base / elapsed);
+    }
+
+    dsp_set_isa(saved);
+}
+
+/* times onset detection by FFT over frames of winsize, moved on by hops
+ * from half the window down to a 32nd of it, to show what short hops cost
+ */
+static void bench_onsetdetect(unsigned int seconds, unsigned int winsize)
+{
+    const size_t nsamples = (size_t) seconds * BENCH_RATE;
+    double start, elapsed;
+    onsetdetect_t o;
+    float *samples;
+
+    samples = malloc(nsamples * sizeof(float));
+    if (!samples)
+    {
+        return;
+    }
+
+    for (size_t i = 0; i < nsamples; i++)
+    {
+        samples[i] = rand() / (float) RAND_MAX - 0.5f;
+    }
+
+    for (unsigned int hopsize = winsize / 2; hopsize >= winsize / 32; hopsize /= 2)
+    {
+        if (init_onsetdetect(&o, winsize, hopsize, BENCH_RATE, -90, 30) != 0)
+        {
+            free(samples);
+            return;
+        }
+
+        start = now_sec();
+        for (size_t i = 0; i + hopsize <= nsamples; i += hopsize)
+        {
+            onsetdetect_do(&o, samples + i);
+        }
+        elapsed = now_sec() - start;
+
+        free_onsetdetect(&o);
+
+        printf("onset detection: %u s, window %4u, hop %4u, fft: %8.3f sec (%.0fx realtime)\n",
+            seconds, winsize, hopsize, elapsed, seconds / elapsed);
+    }
+
+    free(samples);
+}
+
+/* times finding the pitch and onsets of CLIPBATCH_LANES clips one at a
+ * time, then all of them at once at each instruction set level
+ */
+static void bench_clipbatch(unsigned int seconds, unsigned int winsize, unsigned int hopsize)
+{
+    const size_t nhops = (size_t) seconds * BENCH_RATE / hopsize;
+    const unsigned int pitchsize = NOTEEXTRACTOR_PITCH_SCALE * winsize;
+    const int saved = dsp_isa();
+    const float *hops[CLIPBATCH_LANES];
+    float pitches[CLIPBATCH_LANES];
+    int onsets[CLIPBATCH_LANES];
+    double sumsq[CLIPBATCH_LANES];
+    double start, elapsed, base;
+    float *samples;
+    yinpitch_t y;
+    onsetdetect_t o;
+    clipbatch_t cb;
+
+    samples = malloc(CLIPBATCH_LANES * nhops * hopsize * sizeof(float));
+    if (!samples)
+    {
+        return;
+    }
+
+    for (size_t i = 0; i < CLIPBATCH_LANES * nhops * hopsize; i++)
+    {
+        samples[i] = rand() / (float) RAND_MAX - 0.5f;
+    }
+
+    start = now_sec();
+    for (unsigned int c = 0; c < CLIPBATCH_LANES; c++)
+    {
+        if (init_yinpitch(&y, pitchsize, hopsize, BENCH_RATE, -90) != 0)
+        {
+            free(samples);
+            return;
+        }
+        if (init_onsetdetect(&o, winsize, hopsize, BENCH_RATE, -90, 30) != 0)
+        {
+            free_yinpitch(&y);
+            free(samples);
+            return;
+        }
+
+        for (size_t h = 0; h < nhops; h++)
+        {
+            yinpitch_do(&y, samples + (c * nhops + h) * hopsize);
+            onsetdetect_do(&o, samples + (c * nhops + h) * hopsize);
+        }
+
+        free_yinpitch(&y);
+        free_onsetdetect(&o);
+    }
+    base = now_sec() - start;
+
+    printf("clips: %u of %u s, window %4u, hop %4u, one at a time: %8.3f sec\n",
+        CLIPBATCH_LANES, seconds, winsize, hopsize, base);
+
+    for (int isa = DSP_ISA_SCALAR; isa < DSP_ISA_COUNT && dsp_set_isa(isa) == isa; isa++)
+    {
+        if (init_clipbatch(&cb, CLIPBATCH_LANES, winsize, hopsize, pitchsize, BENCH_RATE,
+            -90, 30) != 0)
+        {
+            break;
+        }
+
+        start = now_sec();
+        for (size_t h = 0; h < nhops; h++)
+        {
+            for (unsigned int c = 0; c < CLIPBATCH_LANES; c++)
+            {
+                hops[c] = samples + (c * nhops + h) * hopsize;
+            }
+            clipbatch_do(&cb, hops, pitches, onsets, sumsq);
+        }
+        elapsed = now_sec() - start;
+
+        printf("clips: %u of %u s, window %4u, hop %4u, in lanes, %-6s: %8.3f sec (%.2fx)\n",
+            CLIPBATCH_LANES, seconds, winsize, hopsize, dsp_isa_name(isa), elapsed,
+            base / elapsed);
+
+        free_clipbatch(&cb);
+    }
+
+    dsp_set_isa(saved);
+    free(samples);
+}
+
+/* Times analysing a tune a block of hops at a time, as the note extractor
+ * does, for blocks from 1 hop, which is every analyser taking each hop in
+ * turn, up to 256. aubio's analysers cannot be linked in here, so pitch and
+ * onsets are found by yinpitch and onsetdetect, standing in for
+ * aubio_notes, and a second onsetdetect stands in for aubio_tempo, which
+ * follows a detection function of its own.
+ */
+static void bench_blockhops(unsigned int seconds, unsigned int winsize, unsigned int hopsize)
+{
+    const size_t nhops = (size_t) seconds * BENCH_RATE / hopsize;
+    const unsigned int note = BENCH_RATE / 4;
+    double start, elapsed, single = 0;
+    yinpitch_t y;
+    onsetdetect_t o, tempo;
+    notesegmenter_t seg;
+    float *samples, *pitches, *levels, events[3];
+    int *onsets;
+
+    samples = malloc(nhops * hopsize * sizeof(float));
+    pitches = malloc(256 * sizeof(float));
+    levels = malloc(256 * sizeof(float));
+    onsets = malloc(256 * sizeof(int));
+    if (!samples || !pitches || !levels || !onsets)
+    {
+        free(samples);
+        free(pitches);
+        free(levels);
+        free(onsets);
+        return;
+    }
+
+    // notes a quarter of a second apart, each sounding for the first half
+    for (size_t t = 0; t < nhops * hopsize; t++)
+    {
+        samples[t] = t % note < note / 2 ?
+            0.5 * sin(2 * M_PI * 220 * pow(2, t / note % 12 / 12.0) * t / BENCH_RATE) : 0;
+    }
+
+    for (unsigned int block = 1; block <= 256; block *= 2)
+    {
+        if (init_yinpitch(&y, NOTEEXTRACTOR_PITCH_SCALE * winsize, hopsize, BENCH_RATE, -90) != 0)
+        {
+            break;
+        }
+        if (init_onsetdetect(&o, winsize, hopsize, BENCH_RATE, -90, 30) != 0)
+        {
+            free_yinpitch(&y);
+            break;
+        }
+        if (init_onsetdetect(&tempo, winsize, hopsize, BENCH_RATE, -90, 30) != 0)
+        {
+            free_yinpitch(&y);
+            free_onsetdetect(&o);
+            break;
+        }
+        init_notesegmenter(&seg, -90, NOTESEGMENTER_RELEASE_DROP);
+
+        start = now_sec();
+        for (size_t h = 0; h < nhops; h += block)
+        {
+            const float *b = samples + h * hopsize;
+            const size_t n = nhops - h < block ? nhops - h : block;
+
+            // each analyser takes the whole block before the next starts
+            for (size_t i = 0; i < n; i++)
+            {
+                pitches[i] = yinpitch_do(&y, b + i * hopsize);
+                onsets[i] = onsetdetect_do(&o, b + i * hopsize);
+            }
+            for (size_t i = 0; i < n; i++)
+            {
+                onsetdetect_do(&tempo, b + i * hopsize);
+            }
+            for (size_t i = 0; i < n; i++)
+            {
+                levels[i] = notesegmenter_level(b + i * hopsize, hopsize, -90);
+            }
+            for (size_t i = 0; i < n; i++)
+            {
+                notesegmenter_do(&seg, pitches[i], onsets[i], levels[i], events);
+            }
+        }
+        elapsed = now_sec() - start;
+
+        free_yinpitch(&y);
+        free_onsetdetect(&o);
+        free_onsetdetect(&tempo);
+
+        if (block == 1)
+        {
+            single = elapsed;
+        }
+        printf("block hops: %u s, window %4u, hop %4u, block %3u: %8.3f sec (%.2fx)\n",
+            seconds, winsize, hopsize, block, elapsed, single / elapsed);
+    }
+
+    free(samples);
+    free(pitches);
+    free(levels);
+    free(onsets);
+}
+
+/* returns a buffer of notecount back-to-back notes of random pitch */
+static note_t *gen_notes(unsigned int notecount)
+{
+    note_t *notes = malloc(notecount * sizeof(note_t));
+    double t = 0;
+
+    if (!notes)
+    {
+        return NULL;
+    }
+
+    srand(1);
+    for (unsigned int i = 0; i < notecount; i++)
+    {
+        notes[i].pitch = rand() % (MIDI_PITCH_MAX + 1);
+        notes[i].velocity = 64 + rand() % 64;
+        notes[i].tempo = MIDI_BPM_DEFAULT;
+        notes[i].start_sec = t;
+        notes[i].start_sample = t * BENCH_RATE;
+        t += 0.05 + (rand() % 100) / 200.0;
+        notes[i].stop_sec = t;
+        notes[i].stop_sample = t * BENCH_RATE;
+    }
+
+    return notes;
+}
+
+/* times pitch and onset detection with the loops built for winsize and
+ * hopsize, if there are any, against the generic ones
+ */
+static void bench_kernelsizes(unsigned int seconds, unsigned int winsize, unsigned int hopsize)
+{
+    const size_t nsamples = (size_t) seconds * BENCH_RATE;
+    double start, pitch[2], onset[2];
+    onsetdetect_t o;
+    yinpitch_t y;
+    float *samples;
+
+    samples = malloc(nsamples * sizeof(float));
+    if (!samples)
+    {
+        return;
+    }
+
+    for (size_t i = 0; i < nsamples; i++)
+    {
+        samples[i] = rand() / (float) RAND_MAX - 0.5f;
+    }
+
+    for (int generic = 0; generic < 2; generic++)
+    {
+        if (generic)
+        {
+            setenv(KERNELSIZES_ENV, "1", 1);
+        }
+
+        if (init_yinpitch(&y, NOTEEXTRACTOR_PITCH_SCALE * winsize, hopsize, BENCH_RATE, -90) != 0)
+        {
+            unsetenv(KERNELSIZES_ENV);
+            free(samples);
+            return;
+        }
+        start = now_sec();
+        for (size_t i = 0; i + hopsize <= nsamples; i += hopsize)
+        {
+            yinpitch_do(&y, samples + i);
+        }
+        pitch[generic] = now_sec() - start;
+        free_yinpitch(&y);
+
+        if (init_onsetdetect(&o, winsize, hopsize, BENCH_RATE, -90, 30) != 0)
+        {
+            unsetenv(KERNELSIZES_ENV);
+            free(samples);
+            return;
+        }
+        start = now_sec();
+        for (size_t i = 0; i + hopsize <= nsamples; i += hopsize)
+        {
+            onsetdetect_do(&o, samples + i);
+        }
+        onset[generic] = now_sec() - start;
+        free_onsetdetect(&o);
+    }
+    unsetenv(KERNELSIZES_ENV);
+
+    printf("kernels: %u s, window %4u, hop %4u, pitch: %8.3f sec (%.2fx), onsets: %8.3f sec (%.2fx)\n",
+        seconds, winsize, hopsize, pitch[0], pitch[1] / pitch[0], onset[0], onset[1] / onset[0]);
+
+    free(samples);
+}
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
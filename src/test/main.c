@@ -1,18 +1,80 @@
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <math.h>
+#include <signal.h>
+#include <sys/time.h>
 
 #include "noteextractor.h"
 #include "midiwriter.h"
+#include "midi.h"
+#include "midireader.h"
+#include "wavreader.h"
+#include "flacreader.h"
 #include "wav.h"
+#include "capturesched.h"
+#include "histogram.h"
+#include "ringbuf.h"
+#include "wavfile.h"
+#include "fdutils.h"
+#include "flacfile.h"
+#include "vox.h"
+#include "retrobuf.h"
+#include "capturesource.h"
 #include "stringutils.h"
+#include "endianness.h"
+#include "dsp.h"
+#include "crc.h"
+#include "onsetindex.h"
+#include "shmring.h"
+#include "kernelsizes.h"
 
 
 void test_int_equals(char *test, int result, int expected);
 void test_not_null(char *test, void *result);
 void print_test_result(char *test, int result);
 
+int varint_roundtrip(uint32_t val);
+int midi_roundtrip(const char *fname, note_t *notes, unsigned int notecount);
+int midi_tracks_roundtrip(const char *fname, note_t *notes, unsigned int notecount,
+    unsigned int ntracks, unsigned int nthreads);
+int midi_chunked_matches(unsigned int notecount, unsigned int nthreads);
+int files_equal(const char *a, const char *b);
+int midi_ticks_exact(void);
+int capturesched_paces(void);
+int ringbuf_counts(void);
+int ringbuf_ordered(unsigned int nblocks);
+int wavfile_sizes(const char *fname);
+int wavfile_interval(const char *fname);
+int byteswap_bulk(size_t n);
+int dsp_kernels_match(size_t n);
+uint32_t wav_datasize(const char *fname, long *fsize);
+int wav_rf64_promotes(void);
+int wav_32bit_roundtrip(int format);
+int wavstream_pipe(int raw);
+int write_all_interrupted(void);
+int vox_triggers(void);
+int retrobuf_saves(void);
+int flac_roundtrip(const char *fname, int bitdepth, int channels, size_t nframes);
+int flac_interval(const char *fname);
+int synthsource_signals(void);
+int synthsource_replays(const char *fname);
+int histogram_percentiles(void);
+int onsetindex_roundtrip(const char *fname);
+int shmring_transport(int policy);
+int notes_batched_match(unsigned int jobs);
+int yinpitch_tracks(unsigned int hopsize);
+int onsetdetect_finds(unsigned int hopsize);
+int clips_match_notes(unsigned int nclips);
+int kernels_match_generic(unsigned int winsize, unsigned int hopsize);
+
+#define TEST_SAMPLERATE 1000    // sample rate that the test notes are timed in
+
 int main(int argc, char **argv)
 {
     test_int_equals("get_wav_format", get_wav_format(8), WAVE_FORMAT_PCM);
@@ -25,6 +87,102 @@ int main(int argc, char **argv)
 
     test_not_null("startswith", (void *) startswith("abc", "ab"));
     test_not_null("startswith", (void *) !startswith("abc", "abcde"));
+    test_int_equals("endswith", endswith("take.flac", ".flac"), 1);
+    test_int_equals("endswith", endswith("flac", ".flac"), 0);
+
+    test_int_equals("byteswap bulk", byteswap_bulk(0), 0);
+    test_int_equals("byteswap bulk", byteswap_bulk(1), 0);
+    test_int_equals("byteswap bulk", byteswap_bulk(37), 0);
+    test_int_equals("byteswap bulk", byteswap_bulk(1024), 0);
+
+    test_int_equals("dsp kernels", dsp_kernels_match(1), 0);
+    test_int_equals("dsp kernels", dsp_kernels_match(37), 0);
+    test_int_equals("dsp kernels", dsp_kernels_match(4099), 0);
+
+    test_int_equals("varint32", varint_roundtrip(0), 0);
+    test_int_equals("varint32", varint_roundtrip(127), 0);
+    test_int_equals("varint32", varint_roundtrip(128), 0);
+    test_int_equals("varint32", varint_roundtrip(0x3fff), 0);
+    test_int_equals("varint32", varint_roundtrip(0x0fffffff), 0);
+
+    note_t notes[] = {
+        // pitch, velocity, tempo, start_sec, stop_sec, start_sample, stop_sample
+        { 60, 100, 120, 0.0,  0.5,   0,    500    },
+        { 64, 90,  120, 0.5,  2.0,   500,  2000   },  // deltatime needs 2 bytes
+        { 67, 80,  120, 2.25, 100.0, 2250, 100000 },  // deltatime needs 3 bytes
+    };
+    test_int_equals("midireader", midi_roundtrip("test_roundtrip.mid", notes, 3), 0);
+    test_int_equals("midi tracks", midi_tracks_roundtrip("test_tracks.mid", notes, 3, 4, 2), 0);
+    test_int_equals("midi tracks", midi_tracks_roundtrip("test_tracks.mid", notes, 3, 128, 8), 0);
+    test_int_equals("midi chunked", midi_chunked_matches(5 * MIDIWRITER_CHUNK_NOTES + 7, 4), 0);
+
+    note_t gaps[] = {
+        { 60, 100, 120, 0.0,       0.5,       0,           500         },
+        { 62, 90,  120, 3000000.0, 3000000.5, 3000000000,  3000000500  },  // gap > MIDI_DELTA_MAX
+        { 64, 80,  120, 3000001.0, 6000001.0, 3000001000,  6000001000  },  // so is the note
+    };
+    test_int_equals("midi long gaps", midi_roundtrip("test_roundtrip.mid", gaps, 3), 0);
+    test_int_equals("midi long gaps", midi_tracks_roundtrip("test_tracks.mid", gaps, 3, 4, 2), 0);
+
+    test_int_equals("midi ticks", midi_ticks_exact(), 0);
+
+    test_int_equals("capturesched", capturesched_paces(), 0);
+
+    test_int_equals("ringbuf", ringbuf_counts(), 0);
+    test_int_equals("ringbuf", ringbuf_ordered(100000), 0);
+
+    test_int_equals("wavfile", wavfile_sizes("test_wavfile.wav"), 0);
+    test_int_equals("wavfile", wavfile_interval("test_wavfile.wav"), 0);
+    test_int_equals("rf64", wav_rf64_promotes(), 0);
+    test_int_equals("wav 32 bit", wav_32bit_roundtrip(WAVE_FORMAT_PCM), 0);
+    test_int_equals("wav 32 bit", wav_32bit_roundtrip(WAVE_FORMAT_IEEE_FLOAT), 0);
+    test_int_equals("wavstream", wavstream_pipe(0), 0);
+    test_int_equals("wavstream", wavstream_pipe(1), 0);
+    test_int_equals("write_all", write_all_interrupted(), 0);
+
+    test_int_equals("vox", vox_triggers(), 0);
+    test_int_equals("retrobuf", retrobuf_saves(), 0);
+
+    // the standard check values of each CRC
+    test_int_equals("crc8", crc8(0, (const unsigned char *) "123456789", 9), 0xf4);
+    test_int_equals("crc16", crc16(0, (const unsigned char *) "123456789", 9), 0xfee8);
+
+    test_int_equals("flac", flac_roundtrip("test_flac.flac", 16, 1, 1), 0);
+    test_int_equals("flac", flac_roundtrip("test_flac.flac", 16, 2, 3 * FLACFILE_BLOCKSIZE + 17), 0);
+    test_int_equals("flac", flac_roundtrip("test_flac.flac", 8, 1, 2 * FLACFILE_BLOCKSIZE), 0);
+    test_int_equals("flac", flac_roundtrip("test_flac.flac", 24, 1, 100000), 0);
+    test_int_equals("flac", flac_roundtrip("test_flac.flac", 16, 3, 100000), 0);
+    test_int_equals("flac", flac_interval("test_flac.flac"), 0);
+    test_int_equals("flac", flacfile_write(NULL, NULL, 0), 1);
+
+    test_int_equals("synthsource", synthsource_signals(), 0);
+    test_int_equals("synthsource", synthsource_replays("test_synth.wav"), 0);
+
+    test_int_equals("histogram", histogram_percentiles(), 0);
+
+    test_int_equals("onsetindex", onsetindex_roundtrip("test_index.idx"), 0);
+
+    test_int_equals("shmring", shmring_transport(SHMRING_BACKPRESSURE), 0);
+    test_int_equals("shmring", shmring_transport(SHMRING_DROP), 0);
+
+    test_int_equals("notes batched", notes_batched_match(1), 0);
+    test_int_equals("notes batched", notes_batched_match(5), 0);
+
+    test_int_equals("yinpitch", yinpitch_tracks(64), 0);
+    test_int_equals("yinpitch", yinpitch_tracks(256), 0);
+    test_int_equals("yinpitch", yinpitch_tracks(1024), 0);
+
+    test_int_equals("onsetdetect", onsetdetect_finds(64), 0);
+    test_int_equals("onsetdetect", onsetdetect_finds(256), 0);
+    test_int_equals("onsetdetect", onsetdetect_finds(512), 0);
+
+    test_int_equals("clips batched", clips_match_notes(5), 0);
+    test_int_equals("clips batched", clips_match_notes(19), 0);
+
+#define TEST_KERNELSIZES(size, hop) \
+    test_int_equals("kernel sizes", kernels_match_generic(size, hop), 0);
+    KERNELSIZES(TEST_KERNELSIZES)
+
 
     printf("end of tests\n");
 }
@@ -43,3 +201,1810 @@ void print_test_result(char *test, int result)
 {
     printf("%20s: %s\n", test, result ? "OK" : "FAILED");
 }
+
+/* returns 0 if val survives encoding and decoding as a varint */
+int varint_roundtrip(uint32_t val)
+{
+    unsigned char buf[VARINT32_MAXSIZE];
+    uint32_t decoded;
+    int n;
+
+    n = enc_varint32(val, buf);
+
+    if (dec_varint32(buf, n, &decoded) != n || decoded != val)
+    {
+        return 1;
+    }
+
+    return 0;
+}
+
+/* writes notes with gen_midi_file, then reads the file back and checks each
+ * note event against the input. returns 0 if they match.
+ */
+int midi_roundtrip(const char *fname, note_t *notes, unsigned int notecount)
+{
+    midireader_t reader;
+    midireader_track_t trk;
+    midievent_t ev;
+    const unsigned char *pos = NULL;
+    const unsigned int ppq = MIDI_PPQ_DEFAULT;
+    unsigned int nevents = 0;
+    int ret = 0;
+
+    if (gen_midi_file(fname, notes, notecount, ppq, TEST_SAMPLERATE) != 0)
+    {
+        return 1;
+    }
+
+    if (open_midireader(&reader, fname) != 0)
+    {
+        unlink(fname);
+        return 1;
+    }
+
+    if (reader.header.ntracks != 1 || reader.header.time_div != ppq ||
+        midireader_next_track(&reader, &pos, &trk) != 1)
+    {
+        ret = 1;
+    }
+
+    while (ret == 0 && midireader_next_event(&trk, &ev) == 1)
+    {
+        if (ev.status == MIDIEVENT_META)
+        {
+            continue;
+        }
+
+        const note_t *n = &notes[nevents / 2];
+        const int is_on = (nevents % 2 == 0);
+        const uint64_t expected_ticks =
+            (is_on ? n->start_sample : n->stop_sample) * ppq * MIDI_BPM_DEFAULT
+            / (60 * TEST_SAMPLERATE);
+
+        if (ev.status != (is_on ? MIDIEVENT_NOTEON : MIDIEVENT_NOTEOFF) ||
+            ev.len != 2 || ev.data[0] != n->pitch || ev.ticks != expected_ticks)
+        {
+            ret = 1;
+        }
+
+        nevents++;
+    }
+
+    if (nevents != 2 * notecount || trk.p != trk.end)
+    {
+        ret = 1;
+    }
+
+    close_midireader(&reader);
+    unlink(fname);
+
+    return ret;
+}
+
+/* writes notes split across ntracks tracks, then checks that every note was
+ * written exactly once, to the track covering its pitch. returns 0 if so.
+ */
+int midi_tracks_roundtrip(const char *fname, note_t *notes, unsigned int notecount,
+    unsigned int ntracks, unsigned int nthreads)
+{
+    midireader_t reader;
+    midireader_track_t trk;
+    midievent_t ev;
+    const unsigned char *pos = NULL;
+    unsigned int t = 0, nevents = 0;
+    int ret = 0;
+
+    if (gen_midi_file_tracks(fname, notes, notecount, 0, TEST_SAMPLERATE, ntracks, nthreads) != 0)
+    {
+        return 1;
+    }
+
+    if (open_midireader(&reader, fname) != 0)
+    {
+        unlink(fname);
+        return 1;
+    }
+
+    if (reader.header.ntracks != ntracks || reader.header.format != 1)
+    {
+        ret = 1;
+    }
+
+    while (ret == 0 && midireader_next_track(&reader, &pos, &trk) == 1)
+    {
+        const unsigned int lo = t * 128 / ntracks;
+        const unsigned int hi = (t + 1) * 128 / ntracks - 1;
+
+        while (midireader_next_event(&trk, &ev) == 1)
+        {
+            if (ev.status == MIDIEVENT_META)
+            {
+                continue;
+            }
+            if (ev.data[0] < lo || ev.data[0] > hi)
+            {
+                ret = 1;
+            }
+            nevents++;
+        }
+        t++;
+    }
+
+    if (t != ntracks || nevents != 2 * notecount)
+    {
+        ret = 1;
+    }
+
+    close_midireader(&reader);
+    unlink(fname);
+
+    return ret;
+}
+
+/* encodes the same long single-track piece on one thread and on nthreads
+ * threads. returns 0 if both files are identical.
+ */
+int midi_chunked_matches(unsigned int notecount, unsigned int nthreads)
+{
+    const char *seq = "test_seq.mid", *par = "test_par.mid";
+    note_t *notes = malloc(notecount * sizeof(note_t));
+    double t = 0;
+    int ret = 1;
+
+    if (!notes)
+    {
+        return 1;
+    }
+
+    srand(1);
+    for (unsigned int i = 0; i < notecount; i++)
+    {
+        notes[i].pitch = rand() % 128;
+        notes[i].velocity = rand() % 128;
+        // change tempo part way through, so that a tempo event is encoded
+        notes[i].tempo = (i < notecount / 3) ? 120 : 95;
+        notes[i].start_sec = t;
+        notes[i].start_sample = t * TEST_SAMPLERATE;
+        t += (rand() % 1000) / 300.0;
+        notes[i].stop_sec = t;
+        notes[i].stop_sample = t * TEST_SAMPLERATE;
+    }
+
+    if (gen_midi_file_tracks(seq, notes, notecount, 0, TEST_SAMPLERATE, 1, 1) == 0 &&
+        gen_midi_file_tracks(par, notes, notecount, 0, TEST_SAMPLERATE, 1, nthreads) == 0)
+    {
+        ret = files_equal(seq, par) ? 0 : 1;
+    }
+
+    unlink(seq);
+    unlink(par);
+    free(notes);
+
+    return ret;
+}
+
+/* returns 1 if the two files have the same contents, 0 otherwise */
+int files_equal(const char *a, const char *b)
+{
+    FILE *fa = fopen(a, "rb"), *fb = fopen(b, "rb");
+    int ca, cb, equal = (fa && fb);
+
+    while (equal)
+    {
+        ca = fgetc(fa);
+        cb = fgetc(fb);
+        if (ca != cb)
+        {
+            equal = 0;
+        }
+        else if (ca == EOF)
+        {
+            break;
+        }
+    }
+
+    if (fa)
+    {
+        fclose(fa);
+    }
+    if (fb)
+    {
+        fclose(fb);
+    }
+
+    return equal;
+}
+
+/* checks sample to tick conversion across a tempo change, and far beyond the
+ * range of 32-bit sample counts. returns 0 if every tick is as expected.
+ */
+int midi_ticks_exact(void)
+{
+    const unsigned int samplerate = 44100, ppq = 96;
+    const uint64_t day = 86400ULL * samplerate;
+    note_t notes[3] = {
+        { .tempo = 0,   .start_sample = 0,       .stop_sample = 44100 },
+        { .tempo = 97,  .start_sample = 88200,   .stop_sample = 132300 },
+        { .tempo = 0,   .start_sample = 2 * day, .stop_sample = 2 * day + 1 },
+    };
+    noteticks_t ticks[3];
+
+    get_noteticks(notes, 3, ppq, samplerate, ticks);
+
+    // 120 bpm at 96 ppq is 192 ticks per second, until 2 seconds in
+    if (ticks[0].start != 0 || ticks[0].stop != 192 || ticks[0].bpm != 0)
+    {
+        return 1;
+    }
+
+    // then 97 bpm, which is 155.2 ticks per second
+    if (ticks[1].start != 384 || ticks[1].stop != 384 + 155 || ticks[1].bpm != 97)
+    {
+        return 1;
+    }
+
+    if (ticks[2].start != 384 + (2 * 86400 - 2) * 1552 / 10 || ticks[2].bpm != 0)
+    {
+        return 1;
+    }
+
+    return 0;
+}
+
+/* returns 0 if the capture scheduler sleeps for about as long as it takes to
+ * capture the missing samples, and rate-limits progress reports.
+ */
+int capturesched_paces(void)
+{
+    capturesched_t sched;
+    struct timespec t0, t1;
+    double elapsed;
+
+    init_capturesched(&sched, 44100, 1000);
+
+    // 441 samples at 44.1kHz take 10ms to capture
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    capturesched_wait(&sched, 0, 441);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    elapsed = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    if (elapsed < 0.010 || elapsed > 0.5)
+    {
+        return 1;
+    }
+
+    // enough samples are already available, so it must not sleep
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    capturesched_wait(&sched, 44100, 441);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    elapsed = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    if (elapsed > 0.005)
+    {
+        return 1;
+    }
+
+    if (capturesched_report_due(&sched) != 1 || capturesched_report_due(&sched) != 0)
+    {
+        return 1;
+    }
+
+    return 0;
+}
+
+/* returns 0 if a ring with no consumer overruns once it is full, and a ring
+ * with nothing in it counts empty polls until it is closed.
+ */
+int ringbuf_counts(void)
+{
+    ringbuf_t rb;
+    size_t len;
+    int ret = 0;
+
+    if (init_ringbuf(&rb, 16, 4) != 0)
+    {
+        return 1;
+    }
+
+    if (ringbuf_peek(&rb, &len) != NULL || rb.empty_polls != 1)
+    {
+        ret = 1;
+    }
+
+    for (int i = 0; i < 4; i++)
+    {
+        if (ringbuf_acquire(&rb) == NULL)
+        {
+            ret = 1;
+        }
+        ringbuf_commit(&rb, i);
+    }
+
+    if (ringbuf_acquire(&rb) != NULL || rb.overruns != 1 || ringbuf_used(&rb) != 4)
+    {
+        ret = 1;
+    }
+
+    // oldest block first
+    if (ringbuf_peek(&rb, &len) == NULL || len != 0)
+    {
+        ret = 1;
+    }
+    ringbuf_release(&rb);
+
+    if (ringbuf_acquire(&rb) == NULL)
+    {
+        ret = 1;
+    }
+
+    ringbuf_close(&rb);
+    while (ringbuf_peek(&rb, &len) != NULL)
+    {
+        ringbuf_release(&rb);
+    }
+
+    if (rb.empty_polls != 1)
+    {
+        ret = 1;
+    }
+
+    free_ringbuf(&rb);
+    return ret;
+}
+
+/* consumer thread of ringbuf_ordered. returns NULL if every block arrived
+ * in order.
+ */
+static void *ringbuf_consume(void *p)
+{
+    ringbuf_t *rb = p;
+    uint32_t expected = 0, val;
+    unsigned char *block;
+    size_t len;
+
+    for (;;)
+    {
+        int closed = ringbuf_closed(rb);
+
+        block = ringbuf_peek(rb, &len);
+        if (!block)
+        {
+            if (closed)
+            {
+                break;
+            }
+            sched_yield();
+            continue;
+        }
+
+        memcpy(&val, block, sizeof(val));
+        ringbuf_release(rb);
+
+        if (len != sizeof(val) || val != expected++)
+        {
+            return rb;
+        }
+    }
+
+    return NULL;
+}
+
+/* passes nblocks sequence numbers between two threads through a small ring.
+ * returns 0 if the consumer received them all, in order.
+ */
+int ringbuf_ordered(unsigned int nblocks)
+{
+    ringbuf_t rb;
+    pthread_t consumer;
+    unsigned char *block;
+    void *result;
+
+    if (init_ringbuf(&rb, sizeof(uint32_t), 8) != 0)
+    {
+        return 1;
+    }
+
+    if (pthread_create(&consumer, NULL, ringbuf_consume, &rb) != 0)
+    {
+        free_ringbuf(&rb);
+        return 1;
+    }
+
+    for (uint32_t i = 0; i < nblocks; i++)
+    {
+        while ((block = ringbuf_acquire(&rb)) == NULL)
+        {
+            sched_yield();
+        }
+
+        memcpy(block, &i, sizeof(i));
+        ringbuf_commit(&rb, sizeof(i));
+    }
+
+    ringbuf_close(&rb);
+    pthread_join(consumer, &result);
+    free_ringbuf(&rb);
+
+    return result != NULL || rb.head != nblocks;
+}
+
+/* returns 0 if the header of a file being written always describes the
+ * samples that have reached the disk, and the closed file has no slack
+ */
+int wavfile_sizes(const char *fname)
+{
+    wavfile_t wf;
+    wavheader_t hdr;
+    unsigned char samples[1000];
+    // a little over one block
+    const size_t total = (WAVFILE_BLOCKSIZE / sizeof(samples) + 3) * sizeof(samples);
+    size_t written;
+    long fsize;
+    int ret = 0;
+
+    memset(samples, 0x55, sizeof(samples));
+    init_wavheader(&hdr, 16, 2, 44100);
+
+    // reserve more space than is used, to check the file is trimmed
+    if (open_wavfile(&wf, fname, &hdr, 4 * total, 0) != 0)
+    {
+        return 1;
+    }
+
+    for (written = 0; written < total; written += sizeof(samples))
+    {
+        if (wavfile_write(&wf, samples, sizeof(samples)) != 0)
+        {
+            close_wavfile(&wf);
+            return 1;
+        }
+    }
+
+    // one whole block has been flushed, the rest is still buffered
+    if (wavfile_update_header(&wf) != 0 ||
+        wav_datasize(fname, &fsize) != WAVFILE_BLOCKSIZE)
+    {
+        ret = 1;
+    }
+
+    if (close_wavfile(&wf) != 0 ||
+        wav_datasize(fname, &fsize) != total ||
+        fsize != (long) (get_wavheader64_len() + total))
+    {
+        ret = 1;
+    }
+
+    unlink(fname);
+    return ret;
+}
+
+/* returns 0 if samples far short of a block reach the file, along with a
+ * header covering them, once the header interval has passed
+ */
+int wavfile_interval(const char *fname)
+{
+    wavfile_t wf;
+    wavheader_t hdr;
+    unsigned char samples[1000];
+    long fsize;
+    int ret = 0;
+
+    memset(samples, 0x55, sizeof(samples));
+    init_wavheader(&hdr, 16, 1, 8000);
+
+    if (open_wavfile(&wf, fname, &hdr, 0, 1) != 0)
+    {
+        return 1;
+    }
+
+    ret |= wavfile_write(&wf, samples, sizeof(samples)) != 0;
+    usleep(5000);
+    ret |= wavfile_write(&wf, samples, sizeof(samples)) != 0;
+
+    if (wav_datasize(fname, &fsize) != 2 * sizeof(samples) ||
+        fsize != (long) (get_wavheader64_len() + 2 * sizeof(samples)))
+    {
+        ret = 1;
+    }
+
+    ret |= close_wavfile(&wf) != 0;
+    unlink(fname);
+    return ret;
+}
+
+/* returns the number of bytes of samples in a WAV file, and sets fsize to
+ * its length
+ */
+uint32_t wav_datasize(const char *fname, long *fsize)
+{
+    wavreader_t r;
+    uint32_t datasize;
+
+    if (open_wavreader(&r, fname) != 0)
+    {
+        return 0;
+    }
+
+    datasize = r.nframes * r.blockalign;
+    *fsize = r.size;
+    close_wavreader(&r);
+
+    return datasize;
+}
+
+/* returns 0 if the bulk byte swaps agree with swapping one value at a time,
+ * for n values starting at an unaligned address
+ */
+int byteswap_bulk(size_t n)
+{
+    unsigned char *orig, *buf;
+    uint16_t v16;
+    uint32_t v32;
+    int ret = 0;
+
+    orig = malloc(4 * n + 1);
+    buf = malloc(4 * n + 1);
+    if (!orig || !buf)
+    {
+        free(orig);
+        free(buf);
+        return 1;
+    }
+
+    for (size_t i = 0; i < 4 * n + 1; i++)
+    {
+        orig[i] = (unsigned char) (i * 7 + 3);
+    }
+
+    memcpy(buf, orig, 4 * n + 1);
+    byteswap16_buf(buf + 1, n);
+    for (size_t i = 0; i < n; i++)
+    {
+        memcpy(&v16, orig + 1 + 2 * i, sizeof(v16));
+        v16 = byteswap16(v16);
+        ret |= memcmp(buf + 1 + 2 * i, &v16, sizeof(v16)) != 0;
+    }
+    ret |= memcmp(buf + 1 + 2 * n, orig + 1 + 2 * n, 2 * n) != 0;
+
+    memcpy(buf, orig, 4 * n + 1);
+    byteswap24_buf(buf + 1, n);
+    for (size_t i = 0; i < n; i++)
+    {
+        const unsigned char *src = orig + 1 + 3 * i;
+        const unsigned char *dst = buf + 1 + 3 * i;
+        ret |= dst[0] != src[2] || dst[1] != src[1] || dst[2] != src[0];
+    }
+    ret |= memcmp(buf + 1 + 3 * n, orig + 1 + 3 * n, n) != 0;
+
+    memcpy(buf, orig, 4 * n + 1);
+    byteswap32_buf(buf + 1, n);
+    for (size_t i = 0; i < n; i++)
+    {
+        memcpy(&v32, orig + 1 + 4 * i, sizeof(v32));
+        v32 = byteswap32(v32);
+        ret |= memcmp(buf + 1 + 4 * i, &v32, sizeof(v32)) != 0;
+    }
+    ret |= buf[0] != orig[0];
+
+    free(orig);
+    free(buf);
+
+    return ret;
+}
+
+/* Returns 0 if the kernels of every level the CPU supports agree with the
+ * portable ones over n samples, starting at an unaligned address. All but
+ * the sums of squares, which are added in a different order, must match
+ * exactly.
+ */
+int dsp_kernels_match(size_t n)
+{
+    const int saved = dsp_isa();
+    const int depths[] = { 8, 16, 24, 32, 32 };
+    const int formats[] = { DSP_FORMAT_PCM, DSP_FORMAT_PCM, DSP_FORMAT_PCM, DSP_FORMAT_PCM,
+        DSP_FORMAT_FLOAT };
+    unsigned char *raw;
+    float *ref, *out, ref_peak, peak;
+    double ref_sumsq, sumsq;
+    int ret = 0;
+
+    raw = malloc(4 * n + 1);
+    ref = malloc(4 * n * sizeof(*ref) + 1);
+    out = malloc(4 * n * sizeof(*out) + 1);
+    if (!raw || !ref || !out)
+    {
+        free(raw);
+        free(ref);
+        free(out);
+        return 1;
+    }
+
+    for (size_t i = 0; i < 4 * n + 1; i++)
+    {
+        raw[i] = (unsigned char) (i * 151 + (i >> 8) * 7 + 11);
+    }
+
+    for (int isa = DSP_ISA_SCALAR + 1; isa < DSP_ISA_COUNT && dsp_set_isa(isa) == isa; isa++)
+    {
+        ret |= byteswap_bulk(n);
+
+        for (int d = 0; d < 5; d++)
+        {
+            dsp_set_isa(DSP_ISA_SCALAR);
+            dsp_to_float(ref, raw + 1, formats[d], depths[d], n);
+            dsp_set_isa(isa);
+            dsp_to_float(out, raw + 1, formats[d], depths[d], n);
+            ret |= memcmp(ref, out, n * sizeof(*out)) != 0;
+        }
+
+        // samples which are all finite, then mixed down in threes and pairs
+        dsp_to_float(out + n, raw + 1, DSP_FORMAT_PCM, 16, 3 * n);
+        for (unsigned int c = 3; c >= 2; c--)
+        {
+            dsp_set_isa(DSP_ISA_SCALAR);
+            dsp_downmix(ref, out + n, c, n);
+            dsp_set_isa(isa);
+            dsp_downmix(out, out + n, c, n);
+            ret |= memcmp(ref, out, n * sizeof(*out)) != 0;
+        }
+
+        // halving the rate averages pairs, just as mixing down two channels
+        ret |= dsp_decimate(out, out + n, 2 * n, 2) != n;
+        ret |= memcmp(ref, out, n * sizeof(*out)) != 0;
+
+        ref_sumsq = sumsq = 0;
+        ref_peak = peak = 0;
+        dsp_set_isa(DSP_ISA_SCALAR);
+        dsp_level(out + n, 3 * n, &ref_sumsq, &ref_peak);
+        dsp_set_isa(isa);
+        dsp_level(out + n, 3 * n, &sumsq, &peak);
+        ret |= fabs(sumsq - ref_sumsq) > 1e-9 * ref_sumsq || peak != ref_peak;
+    }
+
+    dsp_set_isa(saved);
+
+    free(raw);
+    free(ref);
+    free(out);
+
+    return ret;
+}
+
+/* returns 0 if a header only becomes RF64 once the data passes 4 GB, and
+ * the samples can be read back either way
+ */
+int wav_rf64_promotes(void)
+{
+    const int16_t frames[][2] = { { 0, 0 }, { 16384, -16384 }, { 32767, 32767 } };
+    const size_t nframes = sizeof(frames) / sizeof(frames[0]);
+    unsigned char buf[128];
+    wavheader_t hdr;
+    wavreader_t r;
+    float mono[4];
+    int ret = 0;
+
+    const uint64_t lengths[] = {
+        sizeof(frames),
+        UINT32_MAX - get_wavheader64_len() + 8,         // largest RIFF file
+        UINT32_MAX - get_wavheader64_len() + 8 + 4,
+        (uint64_t) 5 << 30,
+    };
+    const int expect_rf64[] = { 0, 0, 1, 1 };
+
+    init_wavheader(&hdr, 16, 2, 8000);
+
+    for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++)
+    {
+        ret |= pack_wavheader64(&hdr, lengths[i], buf) != expect_rf64[i];
+        memcpy(buf + get_wavheader64_len(), frames, sizeof(frames));
+        le16_buf(buf + get_wavheader64_len(), 2 * nframes);
+
+        // only the frames present are read, whatever the header says
+        if (init_wavreader(&r, buf, get_wavheader64_len() + sizeof(frames)) != 0)
+        {
+            return 1;
+        }
+        ret |= r.rf64 != expect_rf64[i];
+        ret |= r.nframes != nframes || r.samplerate != 8000 || r.channels != 2;
+
+        ret |= wavreader_read_mono(&r, mono, 4) != nframes;
+        ret |= mono[0] != 0.0f || mono[1] != 0.0f || mono[2] != 32767 / 32768.0f;
+        ret |= wavreader_read_mono(&r, mono, 4) != 0;
+    }
+
+    return ret;
+}
+
+/* returns 0 if 32 bit samples in format, integers or floats, are read back
+ * from a WAV file as the values they hold
+ */
+int wav_32bit_roundtrip(int format)
+{
+    const int32_t ints[] = { 0, 0x40000000, -0x40000000, 0x7fffffff, INT32_MIN };
+    const float floats[] = { 0.0f, 0.5f, -0.5f, 1.0f, -1.0f };
+    const size_t nframes = sizeof(floats) / sizeof(floats[0]);
+    unsigned char buf[128];
+    wavheader_t hdr;
+    wavreader_t r;
+    float mono[8];
+    uint32_t bits;
+    int ret = 0;
+
+    init_wavheader(&hdr, 32, 1, 8000);
+    hdr.audioformat = format;
+    pack_wavheader64(&hdr, nframes * 4, buf);
+
+    for (size_t i = 0; i < nframes; i++)
+    {
+        if (format == WAVE_FORMAT_PCM)
+        {
+            bits = (uint32_t) ints[i];
+        }
+        else
+        {
+            memcpy(&bits, &floats[i], sizeof(bits));
+        }
+
+        for (int b = 0; b < 4; b++)
+        {
+            buf[get_wavheader64_len() + 4 * i + b] = (unsigned char) (bits >> (8 * b));
+        }
+    }
+
+    if (init_wavreader(&r, buf, get_wavheader64_len() + nframes * 4) != 0)
+    {
+        return 1;
+    }
+    ret |= r.format != format || r.bitdepth != 32;
+
+    ret |= wavreader_read_mono(&r, mono, 8) != nframes;
+    for (size_t i = 0; i < nframes; i++)
+    {
+        ret |= fabsf(mono[i] - floats[i]) > 1e-6f;
+    }
+
+    return ret;
+}
+
+/* collects what vox_preroll_flush passes on, for vox_triggers */
+typedef struct collected
+{
+    int16_t samples[64];
+    size_t  n;
+} collected_t;
+
+static int collect_samples(void *ctx, unsigned char *samples, size_t len)
+{
+    collected_t *c = ctx;
+
+    memcpy(c->samples + c->n, samples, len);
+    c->n += len / sizeof(int16_t);
+    return 0;
+}
+
+/* returns 0 if level-triggered recording starts on the first loud block with
+ * the right pre-roll, and stops once the hangover time has passed
+ */
+int vox_triggers(void)
+{
+    // 1000 Hz mono, so each block of 5 samples lasts 5 ms
+    const int rate = 1000;
+    int16_t quiet[5], loud[5] = { 16000, -16000, 16000, -16000, 16000 };
+    collected_t c = { .n = 0 };
+    vox_t v;
+    int16_t next = 1;
+    int ret = 0;
+
+    // -20 dBFS, 10 ms pre-roll, 20 ms hangover
+    if (init_vox(&v, -20, 10, 20, rate, 16, 1) != 0)
+    {
+        return 1;
+    }
+
+    // numbered quiet blocks, of which only the last 10 samples are kept
+    for (int b = 0; b < 4; b++)
+    {
+        for (int i = 0; i < 5; i++)
+        {
+            quiet[i] = next++;
+        }
+        ret |= vox_update(&v, (unsigned char *) quiet, sizeof(quiet)) != VOX_IDLE;
+        vox_preroll_push(&v, (unsigned char *) quiet, sizeof(quiet));
+    }
+
+    ret |= vox_update(&v, (unsigned char *) loud, sizeof(loud)) != VOX_START;
+    ret |= vox_preroll_flush(&v, collect_samples, &c) != 0;
+    ret |= c.n != 10;
+    for (size_t i = 0; i < c.n; i++)
+    {
+        ret |= c.samples[i] != (int16_t) (11 + i);
+    }
+
+    // three quiet blocks are within the hangover, the fourth reaches it
+    for (int b = 0; b < 3; b++)
+    {
+        ret |= vox_update(&v, (unsigned char *) quiet, sizeof(quiet)) != VOX_CONTINUE;
+    }
+    ret |= vox_update(&v, (unsigned char *) loud, sizeof(loud)) != VOX_CONTINUE;
+    for (int b = 0; b < 3; b++)
+    {
+        ret |= vox_update(&v, (unsigned char *) quiet, sizeof(quiet)) != VOX_CONTINUE;
+    }
+    ret |= vox_update(&v, (unsigned char *) quiet, sizeof(quiet)) != VOX_STOP;
+    ret |= vox_update(&v, (unsigned char *) quiet, sizeof(quiet)) != VOX_IDLE;
+    ret |= vox_update(&v, (unsigned char *) loud, sizeof(loud)) != VOX_START;
+
+    free_vox(&v);
+
+    return ret;
+}
+
+/* returns 0 if nframes of a mix of tones, steps, silence and noise are
+ * encoded to a FLAC file and decoded back exactly
+ */
+int flac_roundtrip(const char *fname, int bitdepth, int channels, size_t nframes)
+{
+    const int bytes = bitdepth / 8;
+    const int32_t full = 1 << (bitdepth - 1);
+    flacfile_t ff;
+    flacreader_t r;
+    wavheader_t hdr;
+    unsigned char *samples;
+    int32_t *expected;
+    float *decoded;
+    uint32_t seed = 1;
+    size_t off, n, got = 0;
+    int32_t x;
+    int ret = 0;
+
+    samples = malloc(nframes * channels * bytes);
+    expected = malloc(nframes * sizeof(*expected));
+    decoded = malloc(nframes * sizeof(*decoded));
+    if (!samples || !expected || !decoded)
+    {
+        free(samples);
+        free(expected);
+        free(decoded);
+        return 1;
+    }
+
+    for (size_t i = 0; i < nframes; i++)
+    {
+        expected[i] = 0;
+        for (int c = 0; c < channels; c++)
+        {
+            seed = seed * 1103515245 + 12345;
+
+            // each channel a different kind of block, in turn
+            switch ((i / FLACFILE_BLOCKSIZE + c) % 4)
+            {
+                case 0:
+                    x = (int32_t) (0.5 * full * sin(i * 0.01 * (c + 1)))
+                        + (int32_t) (seed >> 16) % 64 - 32;
+                    break;
+                case 1:
+                    x = (i / 100) % 2 ? full / 4 : -full;
+                    break;
+                case 2:
+                    x = 0;
+                    break;
+                default:
+                    // full scale noise, which cannot be compressed
+                    x = (int32_t) (seed >> (32 - bitdepth)) - full;
+                    break;
+            }
+
+            expected[i] += x;
+
+            // little-endian, with 8 bit samples unsigned, as in WAV files
+            for (int b = 0; b < bytes; b++)
+            {
+                samples[(i * channels + c) * bytes + b] =
+                    bitdepth == 8 ? x + 128 : (uint32_t) x >> (8 * b);
+            }
+        }
+    }
+
+    init_wavheader(&hdr, bitdepth, channels, 44100);
+    if (open_flacfile(&ff, fname, &hdr, 0) != 0)
+    {
+        ret = 1;
+    }
+
+    // written in pieces that do not line up with the FLAC blocks
+    for (off = 0; ret == 0 && off < nframes; off += n)
+    {
+        n = nframes - off < 1000 ? nframes - off : 1000;
+        ret = flacfile_write(&ff, samples + off * channels * bytes,
+            n * channels * bytes);
+    }
+
+    if (close_flacfile(&ff) != 0 || ret != 0 || open_flacreader(&r, fname) != 0)
+    {
+        ret = 1;
+    }
+    else
+    {
+        ret = r.nframes != nframes || r.channels != channels ||
+            r.bitdepth != bitdepth || r.samplerate != 44100;
+
+        while ((n = flacreader_read_mono(&r, decoded + got, 4000)) > 0)
+        {
+            got += n;
+        }
+        ret |= got != nframes;
+
+        // well within one step of the quietest sample
+        for (size_t i = 0; i < got && ret == 0; i++)
+        {
+            ret = fabs(decoded[i] - (double) expected[i] / channels / full) > 1e-7;
+        }
+
+        close_flacreader(&r);
+    }
+
+    unlink(fname);
+    free(samples);
+    free(expected);
+    free(decoded);
+
+    return ret;
+}
+
+/* returns 0 if an encoded frame, far short of a write, reaches the file,
+ * along with a header counting it, once the header interval has passed
+ */
+int flac_interval(const char *fname)
+{
+    unsigned char samples[2 * (FLACFILE_BLOCKSIZE + 1)];
+    flacfile_t ff;
+    flacreader_t r;
+    wavheader_t hdr;
+    float mono[FLACFILE_BLOCKSIZE];
+    int ret = 0;
+
+    for (size_t i = 0; i < sizeof(samples); i++)
+    {
+        samples[i] = (unsigned char) (i * 37);
+    }
+    init_wavheader(&hdr, 16, 1, 8000);
+
+    if (open_flacfile(&ff, fname, &hdr, 1) != 0)
+    {
+        return 1;
+    }
+
+    // a frame and a half is refused, and nothing of it kept
+    ret |= flacfile_write(&ff, samples, 3) != 1;
+
+    // a whole block, then once the interval has passed, one frame more
+    ret |= flacfile_write(&ff, samples, 2 * FLACFILE_BLOCKSIZE) != 0;
+    usleep(5000);
+    ret |= flacfile_write(&ff, samples + 2 * FLACFILE_BLOCKSIZE, 2) != 0;
+
+    if (open_flacreader(&r, fname) != 0)
+    {
+        ret = 1;
+    }
+    else
+    {
+        ret |= r.nframes != FLACFILE_BLOCKSIZE;
+        ret |= flacreader_read_mono(&r, mono, FLACFILE_BLOCKSIZE) != FLACFILE_BLOCKSIZE;
+        close_flacreader(&r);
+    }
+
+    ret |= close_flacfile(&ff) != 0;
+    unlink(fname);
+    return ret;
+}
+
+/* returns 0 if a synthetic sine is produced on demand when not real time,
+ * and in real time loses what is not read before the device fills
+ */
+int synthsource_signals(void)
+{
+    capturesource_t src;
+    int16_t frames[100][2];
+    const struct timespec wait = { 0, 50000000 };
+    int ret = 0;
+
+    // 1000 Hz at 8000 Hz: an eighth of a cycle per sample
+    if (open_synthsource(&src, "sine:1000", 8000, 16, 2, 100, 0) != 0)
+    {
+        return 1;
+    }
+
+    ret |= src.start(src.ctx) != 0;
+    ret |= src.available(src.ctx) != 100 || src.finished(src.ctx);
+    ret |= src.read(src.ctx, frames, 100) != 0;
+    ret |= frames[0][0] != 0 || frames[1][0] != 11585 || frames[1][1] != 11585;
+    ret |= frames[4][0] != 0 || frames[5][1] != -11585 || frames[9][0] != 11585;
+    src.close(src.ctx);
+
+    // 50 ms is 400 samples, of which a device holding 80 loses the rest
+    if (open_synthsource(&src, "noise", 8000, 16, 1, 80, 1) != 0)
+    {
+        return 1;
+    }
+
+    ret |= src.start(src.ctx) != 0;
+    nanosleep(&wait, NULL);
+    ret |= src.available(src.ctx) != 80 || src.lost(src.ctx) < 320;
+    src.close(src.ctx);
+
+    return ret;
+}
+
+/* returns 0 if a WAV file is replayed exactly by a synthetic device, which
+ * then reports that it has finished
+ */
+int synthsource_replays(const char *fname)
+{
+    wavfile_t wf;
+    wavheader_t hdr;
+    capturesource_t src;
+    int16_t samples[250], replayed[250];
+    int32_t n, total = 0;
+    int ret = 0;
+
+    for (int i = 0; i < 250; i++)
+    {
+        samples[i] = i * 100 - 12500;
+    }
+
+    init_wavheader(&hdr, 16, 1, 8000);
+    le16_buf(samples, 250);
+    if (open_wavfile(&wf, fname, &hdr, 0, 0) != 0 ||
+        wavfile_write(&wf, (unsigned char *) samples, sizeof(samples)) != 0 ||
+        close_wavfile(&wf) != 0)
+    {
+        unlink(fname);
+        return 1;
+    }
+    le16_buf(samples, 250);
+
+    // a file in another format is refused
+    if (open_synthsource(&src, fname, 8000, 16, 2, 100, 0) == 0)
+    {
+        src.close(src.ctx);
+        ret = 1;
+    }
+
+    if (open_synthsource(&src, fname, 8000, 16, 1, 100, 0) != 0)
+    {
+        unlink(fname);
+        return 1;
+    }
+
+    // a block at a time, the last one short
+    while (ret == 0 && total < 250)
+    {
+        ret |= src.finished(src.ctx) != (total >= 200);
+        n = src.available(src.ctx);
+        ret |= n != (total < 200 ? 100 : 50);
+        ret |= src.read(src.ctx, replayed + total, n) != 0;
+        total += n;
+    }
+
+    ret |= src.available(src.ctx) != 0 || !src.finished(src.ctx);
+    ret |= memcmp(samples, replayed, sizeof(samples)) != 0;
+
+    src.close(src.ctx);
+    unlink(fname);
+
+    return ret;
+}
+
+/* returns 0 if percentiles are the tops of the right buckets, with the
+ * highest no more than the largest value
+ */
+int histogram_percentiles(void)
+{
+    histogram_t h;
+    int ret = 0;
+
+    init_histogram(&h);
+    ret |= histogram_percentile(&h, 0.5) != 0 || histogram_mean(&h) != 0;
+
+    for (int i = 0; i < 90; i++)
+    {
+        histogram_add(&h, 5);
+    }
+    for (int i = 0; i < 9; i++)
+    {
+        histogram_add(&h, 100);
+    }
+    histogram_add(&h, 3000);
+
+    ret |= atomic_load(&h.count) != 100 || histogram_mean(&h) != 43.5;
+    ret |= histogram_percentile(&h, 0.5) != 5 || histogram_percentile(&h, 0.9) != 5;
+
+    // 100 falls in the eighth of 64 to 127 that runs from 96 to 103
+    ret |= histogram_percentile(&h, 0.99) != 103 || histogram_percentile(&h, 1) != 3000;
+
+    // the largest values stay in range
+    histogram_add(&h, UINT64_MAX);
+    ret |= histogram_percentile(&h, 1) != UINT64_MAX;
+
+    return ret;
+}
+
+/* returns 0 if samples streamed through a pipe arrive whole, after a header
+ * of unknown length which a reader takes to run to the end, or no header
+ */
+int wavstream_pipe(int raw)
+{
+    wavfile_t wf;
+    wavheader_t hdr;
+    wavreader_t r;
+    unsigned char samples[1000], got[2 * sizeof(samples)];
+    const size_t hdr_len = raw ? 0 : get_wavheader_len();
+    size_t len = 0;
+    ssize_t n;
+    int fds[2], ret = 0;
+
+    for (size_t i = 0; i < sizeof(samples); i++)
+    {
+        samples[i] = i * 7;
+    }
+
+    if (pipe(fds) != 0)
+    {
+        return 1;
+    }
+
+    init_wavheader(&hdr, 16, 1, 8000);
+    if (open_wavstream(&wf, fds[1], &hdr, raw) != 0)
+    {
+        close(fds[0]);
+        close(fds[1]);
+        return 1;
+    }
+
+    // in two pieces, neither of them held back
+    ret |= wavfile_write(&wf, samples, 600) != 0;
+    ret |= wavfile_write(&wf, samples + 600, sizeof(samples) - 600) != 0;
+    ret |= wavfile_update_header(&wf) != 0;
+    ret |= close_wavfile(&wf) != 0;
+
+    while ((n = read(fds[0], got + len, sizeof(got) - len)) > 0)
+    {
+        len += n;
+    }
+    close(fds[0]);
+
+    ret |= len != hdr_len + sizeof(samples);
+    ret |= memcmp(got + hdr_len, samples, sizeof(samples)) != 0;
+
+    if (!raw)
+    {
+        ret |= init_wavreader(&r, got, len) != 0 || r.nframes != sizeof(samples) / 2;
+    }
+
+    return ret;
+}
+
+static volatile sig_atomic_t alarms;
+
+static void count_alarm(int sig)
+{
+    alarms++;
+}
+
+/* what drain_pipe reads, and from where */
+typedef struct drain
+{
+    int             fd;
+    unsigned char   *buf;
+    size_t          len;
+    size_t          size;
+} drain_t;
+
+/* reads a pipe to its end, once the writer has had time to fill it */
+static void *drain_pipe(void *arg)
+{
+    drain_t *d = arg;
+    ssize_t n;
+
+    usleep(100000);
+    while ((n = read(d->fd, d->buf + d->len, d->size - d->len)) > 0)
+    {
+        d->len += n;
+    }
+
+    return NULL;
+}
+
+/* returns 0 if write_all gets all of a write through a full pipe while a
+ * signal, installed without SA_RESTART as wavrecorder's SIGINT is,
+ * interrupts it every few milliseconds
+ */
+int write_all_interrupted(void)
+{
+    const size_t size = 1024 * 1024;
+    struct sigaction sa, old_sa;
+    struct itimerval timer = { { 0, 5000 }, { 0, 5000 } }, stop = { { 0, 0 }, { 0, 0 } };
+    sigset_t mask, old_mask;
+    unsigned char *buf;
+    drain_t d;
+    pthread_t reader;
+    int fds[2], ret = 0;
+
+    buf = malloc(size);
+    d.buf = malloc(size);
+    if (!buf || !d.buf || pipe(fds) != 0)
+    {
+        free(buf);
+        free(d.buf);
+        return 1;
+    }
+    for (size_t i = 0; i < size; i++)
+    {
+        buf[i] = i * 13 + (i >> 12);
+    }
+    d.fd = fds[0];
+    d.len = 0;
+    d.size = size;
+
+    sa.sa_handler = count_alarm;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;
+    sigaction(SIGALRM, &sa, &old_sa);
+
+    // only the writer takes the signal
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGALRM);
+    pthread_sigmask(SIG_BLOCK, &mask, &old_mask);
+    if (pthread_create(&reader, NULL, drain_pipe, &d) != 0)
+    {
+        ret = 1;
+    }
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+
+    if (ret == 0)
+    {
+        alarms = 0;
+        setitimer(ITIMER_REAL, &timer, NULL);
+        ret |= write_all(fds[1], buf, size) != 0;
+        setitimer(ITIMER_REAL, &stop, NULL);
+        ret |= alarms == 0;
+
+        close(fds[1]);
+        pthread_join(reader, NULL);
+        ret |= d.len != size || memcmp(d.buf, buf, size) != 0;
+    }
+    else
+    {
+        close(fds[1]);
+    }
+
+    sigaction(SIGALRM, &old_sa, NULL);
+    close(fds[0]);
+    free(buf);
+    free(d.buf);
+
+    return ret;
+}
+
+/* a place for retrobuf_saves to collect what is saved */
+typedef struct saved
+{
+    char    buf[64];
+    size_t  len;
+} saved_t;
+
+static int collect_saved(void *ctx, unsigned char *samples, size_t len)
+{
+    saved_t *c = ctx;
+
+    if (c->len + len > sizeof(c->buf))
+    {
+        return 1;
+    }
+
+    memcpy(c->buf + c->len, samples, len);
+    c->len += len;
+    return 0;
+}
+
+/* returns 0 if a save is of the latest bytes, oldest first, less any that
+ * were overwritten before the save reached them
+ */
+int retrobuf_saves(void)
+{
+    retrobuf_t rb;
+    saved_t c = { .len = 0 };
+    int ret = 0;
+
+    if (init_retrobuf(&rb, 10) != 0)
+    {
+        return 1;
+    }
+
+    retrobuf_push(&rb, (const unsigned char *) "0123456", 7);
+    retrobuf_push(&rb, (const unsigned char *) "789AB", 5);
+
+    retrobuf_save_start(&rb);
+    ret |= retrobuf_save_step(&rb, 4, collect_saved, &c) != 0 || !rb.saving;
+
+    // "67" are overwritten before they are saved
+    retrobuf_push(&rb, (const unsigned char *) "CDEFGH", 6);
+    ret |= retrobuf_save_step(&rb, 100, collect_saved, &c) != 0 || rb.saving;
+    ret |= c.len != 8 || memcmp(c.buf, "234589AB", 8) != 0;
+
+    // a second save has everything, across the wrap
+    c.len = 0;
+    retrobuf_save_start(&rb);
+    ret |= retrobuf_save_step(&rb, 100, collect_saved, &c) != 0 || rb.saving;
+    ret |= c.len != 10 || memcmp(c.buf, "89ABCDEFGH", 10) != 0;
+
+    free_retrobuf(&rb);
+    return ret;
+}
+
+/* returns 0 if the index of silence, a loud tone, then silence again reads
+ * back as silent around an onset candidate where the tone starts
+ */
+int onsetindex_roundtrip(const char *fname)
+{
+    onsetindex_writer_t w;
+    onsetindex_t idx;
+    unsigned char frame[2][2];   // 16 bit stereo
+    int16_t s;
+    int ret = 0;
+
+    if (open_onsetindex_writer(&w, fname, 8000, 16, 2) != 0)
+    {
+        return 1;
+    }
+
+    // 1000 frames of silence, 1000 of a half scale square wave, 1100 of silence
+    for (int i = 0; i < 3100; i++)
+    {
+        s = (i >= 1000 && i < 2000) ? ((i & 1) ? 16384 : -16384) : 0;
+        frame[0][0] = frame[1][0] = s & 0xff;
+        frame[0][1] = frame[1][1] = (s >> 8) & 0xff;
+        ret |= onsetindex_write(&w, (unsigned char *) frame, sizeof(frame)) != 0;
+    }
+    ret |= close_onsetindex_writer(&w) != 0;
+
+    if (open_onsetindex(&idx, fname) != 0)
+    {
+        return 1;
+    }
+
+    // 12 whole entries, then a short one
+    ret |= idx.samplerate != 8000 || idx.frames != ONSETINDEX_FRAMES || idx.nentries != 13;
+
+    // the entries from 768 to 1023 and from 1792 to 2047 are partly loud
+    ret |= onsetindex_silence(&idx, 0, -90) != 768;
+    ret |= onsetindex_silence(&idx, 100, -90) != 668;
+    ret |= onsetindex_silence(&idx, 1000, -90) != 0;
+    ret |= onsetindex_silence(&idx, 2048, -90) != 3328 - 2048;
+    ret |= onsetindex_level(&idx, 1500) != -6 || onsetindex_level(&idx, 0) != ONSETINDEX_MIN_DB;
+
+    // one onset, where the tone starts
+    ret |= onsetindex_count_onsets(&idx) != 1 || !(idx.entries[3] & ONSETINDEX_ONSET);
+
+    free_onsetindex(&idx);
+    return ret;
+}
+
+/* Returns 0 if two readers of a ring of 4 blocks each see 10 blocks
+ * published in order, in place. Under back-pressure the writer waits for the
+ * slower reader; otherwise that reader loses the 6 oldest blocks.
+ */
+int shmring_transport(int policy)
+{
+    shmring_t w, r[2];
+    const unsigned char *block;
+    unsigned char samples[16];
+    char name[32];
+    size_t len;
+    int ret = 0, published = 0, expect;
+
+    snprintf(name, sizeof(name), "s2s-test-%d", (int) getpid());
+    if (create_shmring(&w, name, sizeof(samples), 4, 8000, 16, 1, policy) != 0)
+    {
+        return 1;
+    }
+
+    if (attach_shmring(&r[0], name) != 0 || attach_shmring(&r[1], name) != 0)
+    {
+        destroy_shmring(&w);
+        return 1;
+    }
+
+    // the first reader keeps up, block by block
+    for (int i = 0; i < 10; i++)
+    {
+        memset(samples, i, sizeof(samples));
+        if (shmring_publish(&w, samples, i + 1) != 0)
+        {
+            break;
+        }
+        published++;
+
+        block = shmring_peek(&r[0], &len);
+        ret |= !block || len != (size_t) i + 1 || block[i] != i;
+        ret |= shmring_release(&r[0]) != 0;
+    }
+    ret |= published != (policy == SHMRING_DROP ? 10 : 4);
+
+    // the second reads what it can, freeing room for the rest, if that was needed
+    for (expect = policy == SHMRING_DROP ? 6 : 0; expect < 10; expect++)
+    {
+        if (published < 10)
+        {
+            memset(samples, published, sizeof(samples));
+            if (shmring_publish(&w, samples, published + 1) == 0)
+            {
+                published++;
+                block = shmring_peek(&r[0], &len);
+                ret |= !block || block[0] != published - 1 || shmring_release(&r[0]) != 0;
+            }
+        }
+
+        block = shmring_peek(&r[1], &len);
+        ret |= !block || block[0] != expect || shmring_release(&r[1]) != 0;
+    }
+    ret |= shmring_dropped(&r[0]) != 0;
+    ret |= shmring_dropped(&r[1]) != (policy == SHMRING_DROP ? 6 : 0);
+
+    // finished once closed, and not before
+    ret |= shmring_finished(&r[1]);
+    shmring_close(&w);
+    ret |= !shmring_finished(&r[0]) || !shmring_finished(&r[1]);
+
+    detach_shmring(&r[0]);
+    detach_shmring(&r[1]);
+    destroy_shmring(&w);
+
+    // nothing is left behind
+    ret |= attach_shmring(&r[0], name) == 0;
+
+    return ret;
+}
+
+/* audio held in memory, read by extract_notes */
+typedef struct tune
+{
+    float   *samples;
+    size_t  n, pos;
+} tune_t;
+
+static void read_tune(void *ctx, fvec_t *buf, uint_t *nread)
+{
+    tune_t *t = ctx;
+
+    *nread = t->n - t->pos < buf->length ? t->n - t->pos : buf->length;
+    memcpy(buf->data, t->samples + t->pos, *nread * sizeof(float));
+    memset(buf->data + *nread, 0, (buf->length - *nread) * sizeof(float));
+    t->pos += *nread;
+}
+
+/* returns 0 if estimating pitch for batches of hops on jobs threads finds
+ * the notes that aubio_notes does, hop by hop, in a tune long enough to
+ * need several batches: the same pitches, to within a semitone, starting
+ * and stopping within two hops of them
+ */
+int notes_batched_match(unsigned int jobs)
+{
+    const unsigned int rate = 44100, hopsize = 256;
+    const int64_t slack = 2 * hopsize;
+    tune_t tune = { NULL, 15 * rate, 0 };
+    notesource_t source = { &tune, read_tune, rate };
+    note_t *one, *many;
+    int n1, n2, ret;
+
+    tune.samples = malloc(tune.n * sizeof(float));
+    if (!tune.samples)
+    {
+        return 1;
+    }
+
+    // a rising scale of half second notes, each with a gap after it
+    for (size_t i = 0; i < tune.n; i++)
+    {
+        tune.samples[i] = i % (rate / 2) < rate * 2 / 5 ?
+            0.5 * sin(2 * M_PI * 220 * pow(2, i / (rate / 2) % 12 / 12.0) * i / rate) : 0;
+    }
+
+    n1 = extract_notes(&source, 512, hopsize, 120, NOTEEXTRACTOR_PITCH_DEFAULT,
+        NOTEEXTRACTOR_ONSET_DEFAULT, 0, &one);
+    tune.pos = 0;
+    n2 = extract_notes(&source, 512, hopsize, 120, NOTEEXTRACTOR_PITCH_DEFAULT,
+        NOTEEXTRACTOR_ONSET_DEFAULT, jobs, &many);
+
+    ret = n1 <= 0 || n2 != n1;
+    for (int i = 0; !ret && i < n1; i++)
+    {
+        ret = abs((int) one[i].pitch - (int) many[i].pitch) > 1 ||
+            llabs((int64_t) one[i].start_sample - (int64_t) many[i].start_sample) > slack ||
+            llabs((int64_t) one[i].stop_sample - (int64_t) many[i].stop_sample) > slack;
+    }
+
+    if (n1 > 0)
+    {
+        free(one);
+    }
+    if (n2 > 0)
+    {
+        free(many);
+    }
+    free(tune.samples);
+
+    return ret;
+}
+
+/* returns 0 if YIN, moved on hopsize samples at a time, finds the pitch of
+ * steady tones and none in silence, and its sums still match ones worked
+ * out afresh at the end
+ */
+int yinpitch_tracks(unsigned int hopsize)
+{
+    const unsigned int rate = 44100, size = 2048, hops = rate / 2 / hopsize;
+    const float tones[] = { 57, 69, 0, 64, 45 };    // MIDI note numbers, 0 for silence
+    yinpitch_t y;
+    float *hop, pitch, freq;
+    double ref, d;
+    uint64_t t = 0;
+    int ret = 0;
+
+    hop = malloc(hopsize * sizeof(float));
+    if (!hop || init_yinpitch(&y, size, hopsize, rate, -90) != 0)
+    {
+        free(hop);
+        return 1;
+    }
+
+    for (int n = 0; n < sizeof(tones) / sizeof(*tones); n++)
+    {
+        freq = 440 * pow(2, (tones[n] - 69) / 12);
+
+        for (unsigned int h = 0; h < hops; h++)
+        {
+            for (unsigned int i = 0; i < hopsize; i++, t++)
+            {
+                hop[i] = tones[n] ? 0.5 * sin(2 * M_PI * freq * t / rate) : 0;
+            }
+            pitch = yinpitch_do(&y, hop);
+
+            // once the window is all one tone
+            if ((h + 1) * hopsize >= size)
+            {
+                ret |= tones[n] ? fabs(pitch - tones[n]) > 0.05 : pitch != 0;
+            }
+        }
+    }
+
+    for (unsigned int tau = 0; tau < y.lags; tau++)
+    {
+        ref = 0;
+        for (unsigned int j = 0; j < y.lags; j++)
+        {
+            d = y.buf[y.lags + j] - y.buf[y.lags + j - tau];
+            ref += d * d;
+        }
+        ret |= fabs(y.diff[tau] - ref) > 1e-6 * (ref + 1);
+    }
+
+    free_yinpitch(&y);
+    free(hop);
+
+    return ret;
+}
+
+/* returns 0 if onset detection, moved on hopsize samples at a time, finds
+ * an onset at the start of each note of a tune and nowhere else
+ */
+int onsetdetect_finds(unsigned int hopsize)
+{
+    const unsigned int rate = 44100, winsize = 1024, note = rate / 4;
+    const uint64_t total = 4 * rate;
+    onsetdetect_t detect;
+    float *hop;
+    uint64_t t = 0, onsets = 0;
+    int ret = 0;
+
+    hop = malloc(hopsize * sizeof(float));
+    if (!hop)
+    {
+        return 1;
+    }
+    if (init_onsetdetect(&detect, winsize, hopsize, rate, -90, 30) != 0)
+    {
+        free(hop);
+        return 1;
+    }
+
+    while (t < total)
+    {
+        // notes a quarter of a second apart, each sounding for the first half
+        for (unsigned int i = 0; i < hopsize; i++, t++)
+        {
+            hop[i] = t % note < note / 2 ?
+                0.5 * sin(2 * M_PI * 220 * pow(2, t / note % 12 / 12.0) * t / rate) : 0;
+        }
+
+        // picking lags the audio, by at most a window and a few hops
+        if (onsetdetect_do(&detect, hop))
+        {
+            onsets++;
+            ret |= (t - hopsize) % note > winsize + 8 * hopsize;
+        }
+    }
+
+    ret |= onsets != total / note;
+
+    free_onsetdetect(&detect);
+    free(hop);
+
+    return ret;
+}
+
+/* Returns 0 if the loops built for frames of winsize, moved on hopsize at a
+ * time, find the same pitches, onsets and spectra of a tune as those for any
+ * size, which KERNELSIZES_ENV selects. The sums may be added in a different
+ * order, so the results need only agree to within rounding.
+ */
+int kernels_match_generic(unsigned int winsize, unsigned int hopsize)
+{
+    const unsigned int rate = 44100, note = rate / 4;
+    const size_t nsamples = 2 * rate;
+    // cleared, so that all of them can be freed whichever fails to start
+    yinpitch_t y_fixed = { 0 }, y_any = { 0 };
+    onsetdetect_t o_fixed = { 0 }, o_any = { 0 };
+    fft_t f_fixed = { 0 }, f_any = { 0 };
+    float *samples, *re[2], *im[2];
+    float loudest = 0, pitch_fixed, pitch_any;
+    uint32_t noise = 1;
+    int ret = 0;
+
+    samples = malloc(nsamples * sizeof(float));
+    re[0] = malloc((winsize / 2 + 1) * sizeof(float));
+    re[1] = malloc((winsize / 2 + 1) * sizeof(float));
+    im[0] = malloc((winsize / 2 + 1) * sizeof(float));
+    im[1] = malloc((winsize / 2 + 1) * sizeof(float));
+    if (!samples || !re[0] || !re[1] || !im[0] || !im[1])
+    {
+        free(samples);
+        free(re[0]);
+        free(re[1]);
+        free(im[0]);
+        free(im[1]);
+        return 1;
+    }
+
+    // notes a quarter of a second apart, each sounding for the first half, over faint noise
+    for (size_t t = 0; t < nsamples; t++)
+    {
+        noise = noise * 1664525 + 1013904223;
+        samples[t] = (t % note < note / 2 ?
+            0.5 * sin(2 * M_PI * 220 * pow(2, t / note % 12 / 12.0) * t / rate) : 0)
+            + (noise >> 8) / (float) (1 << 24) * 1e-3f;
+    }
+
+    unsetenv(KERNELSIZES_ENV);
+    ret |= init_yinpitch(&y_fixed, NOTEEXTRACTOR_PITCH_SCALE * winsize, hopsize, rate, -90);
+    ret |= init_onsetdetect(&o_fixed, winsize, hopsize, rate, -90, 30);
+    ret |= init_fft(&f_fixed, winsize);
+    setenv(KERNELSIZES_ENV, "1", 1);
+    ret |= init_yinpitch(&y_any, NOTEEXTRACTOR_PITCH_SCALE * winsize, hopsize, rate, -90);
+    ret |= init_onsetdetect(&o_any, winsize, hopsize, rate, -90, 30);
+    ret |= init_fft(&f_any, winsize);
+    unsetenv(KERNELSIZES_ENV);
+
+    // each size in KERNELSIZES has loops of its own
+    ret |= y_fixed.kernels == y_any.kernels;
+    ret |= o_fixed.kernels == o_any.kernels;
+    ret |= f_fixed.kernels == f_any.kernels;
+
+    for (size_t t = 0; ret == 0 && t + hopsize <= nsamples; t += hopsize)
+    {
+        pitch_fixed = yinpitch_do(&y_fixed, samples + t);
+        pitch_any = yinpitch_do(&y_any, samples + t);
+        ret |= fabsf(pitch_fixed - pitch_any) > 1e-3f;
+
+        ret |= onsetdetect_do(&o_fixed, samples + t) != onsetdetect_do(&o_any, samples + t);
+        loudest = o_any.hfc > loudest ? o_any.hfc : loudest;
+        ret |= fabsf(o_fixed.hfc - o_any.hfc) > 1e-5f * loudest;
+
+        // the frame ending with the hop
+        if (t + hopsize >= winsize)
+        {
+            fft_real(&f_fixed, samples + t + hopsize - winsize, re[0], im[0]);
+            fft_real(&f_any, samples + t + hopsize - winsize, re[1], im[1]);
+            for (unsigned int b = 0; b <= winsize / 2; b++)
+            {
+                ret |= fabsf(re[0][b] - re[1][b]) > 1e-5f * winsize;
+                ret |= fabsf(im[0][b] - im[1][b]) > 1e-5f * winsize;
+            }
+        }
+    }
+
+    free_yinpitch(&y_fixed);
+    free_yinpitch(&y_any);
+    free_onsetdetect(&o_fixed);
+    free_onsetdetect(&o_any);
+    free_fft(&f_fixed);
+    free_fft(&f_any);
+    free(samples);
+    free(re[0]);
+    free(re[1]);
+    free(im[0]);
+    free(im[1]);
+
+    return ret;
+}
+
+/* returns 0 if analysing clips of different lengths together, nclips of
+ * them, finds the same notes in each as analysing it alone does
+ */
+int clips_match_notes(unsigned int nclips)
+{
+    const unsigned int rate = 44100, note = rate / 4;
+    tune_t *tunes;
+    notesource_t *sources;
+    note_t **notes, *alone;
+    int *counts, n, ret = 0;
+
+    tunes = calloc(nclips, sizeof(tune_t));
+    sources = calloc(nclips, sizeof(notesource_t));
+    notes = calloc(nclips, sizeof(note_t *));
+    counts = calloc(nclips, sizeof(int));
+    ret = !tunes || !sources || !notes || !counts;
+
+    // scales of different lengths, from different notes
+    for (unsigned int c = 0; c < nclips && !ret; c++)
+    {
+        tunes[c].n = (2 + c % 5) * rate + c * 1000;
+        tunes[c].samples = malloc(tunes[c].n * sizeof(float));
+        sources[c] = (notesource_t) { &tunes[c], read_tune, rate };
+        ret = !tunes[c].samples;
+
+        for (size_t i = 0; i < tunes[c].n && !ret; i++)
+        {
+            tunes[c].samples[i] = i % note < note * 4 / 5 ?
+                0.5 * sin(2 * M_PI * 220 * pow(2, (i / note + c) % 12 / 12.0) * i / rate) : 0;
+        }
+    }
+
+    ret = ret || extract_clips(sources, nclips, 1024, 256, 120, notes, counts) != 0;
+
+    for (unsigned int c = 0; c < nclips && !ret; c++)
+    {
+        tunes[c].pos = 0;
+        n = extract_notes(&sources[c], 1024, 256, 120, YINPITCH_METHOD, ONSETDETECT_FFT, 1,
+            &alone);
+
+        ret = n <= 0 || n != counts[c];
+        for (int i = 0; !ret && i < n; i++)
+        {
+            ret = alone[i].pitch != notes[c][i].pitch ||
+                alone[i].start_sample != notes[c][i].start_sample ||
+                alone[i].stop_sample != notes[c][i].stop_sample;
+        }
+
+        if (n > 0)
+        {
+            free(alone);
+        }
+    }
+
+    for (unsigned int c = 0; tunes && c < nclips; c++)
+    {
+        free(tunes[c].samples);
+        if (notes)
+        {
+            free(notes[c]);
+        }
+    }
+    free(tunes);
+    free(sources);
+    free(notes);
+    free(counts);
+
+    return ret;
+}